@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "cpu_triangulate_arena.hpp"
+
+// Runs random allocations and releases on a MeshArena and checks that blocks are aligned, do not overlap, keep
+// their contents and never take the used bytes over the budget, and that the chunks go back to the heap once
+// everything is released.
+//
+// Usage: arena_check [operations] [seed]
+
+namespace
+{
+	using cputri::MeshArena;
+
+	const uint64_t budget = 8 * MeshArena::chunk_size;
+
+	struct Block
+	{
+		uint64_t size;
+		uint8_t fill;
+	};
+
+	// Block start to size and fill byte of every block handed out
+	typedef std::map<char*, Block> Blocks;
+
+	bool holds_fill(char* block, const Block& info)
+	{
+		for (uint64_t i = 0; i < info.size; ++i)
+		{
+			if ((uint8_t)block[i] != info.fill)
+				return false;
+		}
+
+		return true;
+	}
+
+	// True if [block, block + size) overlaps a block in blocks
+	bool overlaps(const Blocks& blocks, char* block, uint64_t size)
+	{
+		auto next = blocks.lower_bound(block);
+		if (next != blocks.end() && next->first < block + size)
+			return true;
+		if (next != blocks.begin())
+		{
+			--next;
+			if (next->first + MeshArena::get_block_size(next->second.size) > block)
+				return true;
+		}
+
+		return false;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t operations = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+	const uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1305;
+	if (operations == 0)
+	{
+		printf("Usage: arena_check [operations] [seed]\n");
+		return 1;
+	}
+
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<uint32_t> operation(0, 99);
+	std::uniform_int_distribution<uint32_t> size_shift(0, 13);
+
+	MeshArena arena(budget);
+	Blocks blocks;
+	std::vector<char*> block_list;
+	uint64_t used = 0;
+	uint64_t most_reserved = 0;
+	uint32_t refused = 0;
+	uint32_t failures = 0;
+
+	auto fail = [&](const char* what)
+	{
+		if (failures++ < 5)
+			printf("%s\n", what);
+	};
+
+	for (uint32_t i = 0; i < operations; ++i)
+	{
+		// Phases of mostly allocating and mostly releasing, so the budget is reached and the arena empties again
+		const uint32_t allocate_share = (i / 1000) % 2 == 0 ? 65 : 35;
+
+		if (operation(rng) < allocate_share)
+		{
+			// Sizes from a few bytes to more than a chunk, most of them not powers of two
+			const uint64_t size = (MeshArena::min_block_size << size_shift(rng)) / 4 * 3 + operation(rng);
+			const uint64_t block_size = MeshArena::get_block_size(size);
+
+			char* block = (char*)arena.allocate(size);
+			if (!block)
+			{
+				++refused;
+				if (used + block_size <= budget)
+					fail("allocate refused a block that fits in the budget");
+				continue;
+			}
+
+			if (used + block_size > budget)
+				fail("allocate went over the budget");
+			if ((uintptr_t)block % 64 != 0)
+				fail("block is not aligned to 64 bytes");
+			if (overlaps(blocks, block, block_size))
+				fail("block overlaps another");
+
+			const uint8_t fill = (uint8_t)(block_list.size() * 31 + 7);
+			memset(block, fill, size);
+			blocks[block] = Block{ size, fill };
+			block_list.push_back(block);
+			used += block_size;
+		}
+		else if (!block_list.empty())
+		{
+			const uint32_t index = std::uniform_int_distribution<uint32_t>(0, (uint32_t)block_list.size() - 1)(rng);
+			char* block = block_list[index];
+			block_list[index] = block_list.back();
+			block_list.pop_back();
+
+			const Block info = blocks[block];
+			if (!holds_fill(block, info))
+				fail("block lost its contents");
+
+			arena.release(block, info.size);
+			blocks.erase(block);
+			used -= MeshArena::get_block_size(info.size);
+		}
+
+		if (arena.get_used() != used)
+			fail("used bytes differ");
+		if (arena.get_reserved() < used)
+			fail("fewer bytes reserved than used");
+
+		most_reserved = std::max(most_reserved, arena.get_reserved());
+	}
+
+	for (char* block : block_list)
+	{
+		if (!holds_fill(block, blocks[block]))
+			fail("block lost its contents");
+		arena.release(block, blocks[block].size);
+	}
+
+	// Everything merges back into whole chunks, all but the spare go back to the heap
+	const uint64_t reserved_after = arena.get_reserved();
+	if (arena.get_used() != 0)
+		fail("bytes still used after releasing everything");
+	if (reserved_after > MeshArena::chunk_size)
+		fail("chunks kept after releasing everything");
+
+	// The spare chunk is used again instead of taking another
+	void* whole_chunk = arena.allocate(MeshArena::chunk_size);
+	if (!whole_chunk || arena.get_reserved() != MeshArena::chunk_size)
+		fail("a whole chunk did not reuse the spare");
+	arena.release(whole_chunk, MeshArena::chunk_size);
+
+	printf("operations:       %u, %u refused by the budget\n", operations, refused);
+	printf("most reserved:    %.2f MiB for a budget of %.2f MiB\n", most_reserved / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
+	printf("reserved after:   %.2f MiB\n", reserved_after / (1024.0 * 1024.0));
+	printf("failures:         %u\n", failures);
+	printf("%s\n", failures == 0 ? "passed" : "FAILED");
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cpu_triangulate_simd.hpp"
+
+// Times the circumcircle containment kernels used by the border scans in cputri::Terrain::triangulate_shader
+// against the scalar loop, and checks that every kernel finds the same triangles.
+//
+// Usage: circumcircle_benchmark [border triangles] [iterations]
+
+namespace
+{
+	// Same size as the triangle array of a node
+	const uint32_t triangle_count = 1000;
+
+	struct Result
+	{
+		double ns_per_test;
+		uint64_t hits;
+	};
+
+	Result run(cputri::CircumcircleKernel kernel, const cputri::CircumcircleArrays& circles, const std::vector<uint32_t>& border,
+		const std::vector<glm::vec2>& points, uint32_t iterations, std::vector<uint32_t>& hits)
+	{
+		uint64_t hit_total = 0;
+
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t it = 0; it < iterations; ++it)
+		{
+			for (const glm::vec2& point : points)
+			{
+				hit_total += kernel(circles, border.data(), (uint32_t)border.size(), point, hits.data());
+			}
+		}
+		const auto end = std::chrono::high_resolution_clock::now();
+
+		const double tests = (double)iterations * points.size() * border.size();
+		return Result{ std::chrono::duration<double, std::nano>(end - start).count() / tests, hit_total };
+	}
+
+	// Returns false if kernel and reference disagree for any point
+	bool matches(cputri::CircumcircleKernel kernel, cputri::CircumcircleKernel reference, const cputri::CircumcircleArrays& circles,
+		const std::vector<uint32_t>& border, const std::vector<glm::vec2>& points)
+	{
+		std::vector<uint32_t> hits(border.size());
+		std::vector<uint32_t> reference_hits(border.size());
+
+		for (const glm::vec2& point : points)
+		{
+			const uint32_t count = kernel(circles, border.data(), (uint32_t)border.size(), point, hits.data());
+			const uint32_t reference_count = reference(circles, border.data(), (uint32_t)border.size(), point, reference_hits.data());
+			if (count != reference_count)
+				return false;
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (hits[i] != reference_hits[i])
+					return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	const uint32_t border_count = argc > 1 ? (uint32_t)atoi(argv[1]) : 500;
+	const uint32_t iterations = argc > 2 ? (uint32_t)atoi(argv[2]) : 2000;
+
+	if (border_count == 0 || border_count > triangle_count || iterations == 0)
+	{
+		printf("Usage: circumcircle_benchmark [border triangles (1-%u)] [iterations]\n", triangle_count);
+		return 1;
+	}
+
+	std::mt19937 rng(1305);
+	std::uniform_real_distribution<float> position(0.0f, 250.0f);
+	std::uniform_real_distribution<float> radius(1.0f, 20.0f);
+
+	// Circumcircles in both node layouts, vec4-sized triangles and one array per component
+	std::vector<float> aos(triangle_count * 4);
+	std::vector<float> soa(triangle_count * 3);
+	for (uint32_t t = 0; t < triangle_count; ++t)
+	{
+		const float x = position(rng);
+		const float y = position(rng);
+		const float r = radius(rng);
+
+		aos[t * 4 + 0] = x;
+		aos[t * 4 + 1] = y;
+		aos[t * 4 + 2] = r * r;
+		aos[t * 4 + 3] = 0.0f;
+
+		soa[t] = x;
+		soa[triangle_count + t] = y;
+		soa[triangle_count * 2 + t] = r * r;
+	}
+
+	const cputri::CircumcircleArrays layouts[2] = {
+		{ &aos[0], &aos[1], &aos[2], 4 },
+		{ &soa[0], &soa[triangle_count], &soa[triangle_count * 2], 1 } };
+	const char* layout_names[2] = { "aos", "soa" };
+
+	// Border triangles are scattered through the node
+	std::vector<uint32_t> border(triangle_count);
+	for (uint32_t t = 0; t < triangle_count; ++t)
+	{
+		border[t] = t;
+	}
+	std::shuffle(border.begin(), border.end(), rng);
+	border.resize(border_count);
+
+	std::vector<glm::vec2> points(64);
+	for (glm::vec2& point : points)
+	{
+		point = glm::vec2(position(rng), position(rng));
+	}
+
+	std::vector<uint32_t> hits(border_count);
+
+	const cputri::SIMD_LEVEL detected = cputri::detect_simd_level();
+	printf("detected:        %s\n", cputri::get_simd_level_name(detected));
+	printf("border size:     %u\n", border_count);
+
+	const cputri::CircumcircleKernel scalar = cputri::get_circumcircle_kernel(cputri::SIMD_LEVEL::SCALAR);
+
+	for (int layout = 0; layout < 2; ++layout)
+	{
+		const Result reference = run(scalar, layouts[layout], border, points, iterations, hits);
+
+		for (int level = (int)cputri::SIMD_LEVEL::SCALAR; level <= (int)detected; ++level)
+		{
+			const cputri::CircumcircleKernel kernel = cputri::get_circumcircle_kernel((cputri::SIMD_LEVEL)level);
+			if (!matches(kernel, scalar, layouts[layout], border, points))
+			{
+				printf("%s %s: results differ from scalar\n", layout_names[layout], cputri::get_simd_level_name((cputri::SIMD_LEVEL)level));
+				return 1;
+			}
+
+			const Result result = run(kernel, layouts[layout], border, points, iterations, hits);
+			printf("%s %-8s %6.3f ns/test  %5.2fx  (%llu hits)\n", layout_names[layout], cputri::get_simd_level_name((cputri::SIMD_LEVEL)level),
+				result.ns_per_test, reference.ns_per_test / result.ns_per_test, (unsigned long long)result.hits);
+		}
+	}
+
+	return 0;
+}
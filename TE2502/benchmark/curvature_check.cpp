@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cpu_triangulate.hpp"
+#include "cpu_triangulate_simd.hpp"
+
+// Compares the curvatures of DERIVATIVE_MODE::ANALYTIC with the filtered ones of DERIVATIVE_MODE::FILTERED at
+// random positions, and fails if they drift further apart than the tolerances below. Also checks that the
+// height terrain_with_derivatives gives is the one the height kernels give.
+//
+// Usage: curvature_check [positions] [seed]
+
+namespace
+{
+	// The analytic curvature is the Laplacian of a smoothed terrain, the filter one of the terrain sampled at
+	// whole steps, so they only agree on average. When this was written the correlation was 0.81 and the means
+	// were 1.30 and 1.25 over the area the camera paths cover
+	const double min_correlation = 0.75;
+	const double max_mean_ratio = 1.10;
+
+	// Area the camera paths in camera_paths.txt fly over
+	const float area_min = -500.0f;
+	const float area_max = 500.0f;
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+	const uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1;
+	if (count < 2)
+	{
+		printf("Usage: curvature_check [positions] [seed]\n");
+		return 1;
+	}
+
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> position(area_min, area_max);
+
+	std::vector<float> x(count);
+	std::vector<float> z(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		x[i] = position(generator);
+		z[i] = position(generator);
+	}
+
+	std::vector<float> filtered(count);
+	std::vector<float> analytic(count);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	cputri::curvatures(x.data(), z.data(), count, filtered.data());
+	const double filtered_ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / count;
+
+	start = std::chrono::high_resolution_clock::now();
+	cputri::analytic_curvatures(x.data(), z.data(), count, analytic.data());
+	const double analytic_ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / count;
+
+	std::vector<float> heights(count);
+	cputri::evaluate_terrain(x.data(), z.data(), count, heights.data());
+
+	uint32_t height_mismatches = 0;
+	double filtered_sum = 0.0;
+	double analytic_sum = 0.0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (cputri::terrain_with_derivatives<0>(x[i], z[i], 0.0f).height != heights[i])
+			++height_mismatches;
+
+		filtered_sum += filtered[i];
+		analytic_sum += analytic[i];
+	}
+
+	const double filtered_mean = filtered_sum / count;
+	const double analytic_mean = analytic_sum / count;
+
+	double covariance = 0.0;
+	double filtered_variance = 0.0;
+	double analytic_variance = 0.0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const double df = filtered[i] - filtered_mean;
+		const double da = analytic[i] - analytic_mean;
+		covariance += df * da;
+		filtered_variance += df * df;
+		analytic_variance += da * da;
+	}
+
+	const double correlation = covariance / std::sqrt(filtered_variance * analytic_variance);
+	const double mean_ratio = std::max(filtered_mean, analytic_mean) / std::min(filtered_mean, analytic_mean);
+
+	printf("positions:             %u\n", count);
+	printf("mean curvature:        %.3f filtered, %.3f analytic\n", filtered_mean, analytic_mean);
+	printf("correlation:           %.3f (at least %.2f)\n", correlation, min_correlation);
+	printf("ratio of means:        %.3f (at most %.2f)\n", mean_ratio, max_mean_ratio);
+	printf("height mismatches:     %u\n", height_mismatches);
+	printf("time per position:     %.1f ns filtered, %.1f ns analytic\n", filtered_ns, analytic_ns);
+
+	const bool passed = correlation >= min_correlation && mean_ratio <= max_mean_ratio && height_mismatches == 0;
+	printf("%s\n", passed ? "passed" : "FAILED");
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cpu_triangulate_node_cache.hpp"
+
+// Runs random inserts, takes and pops on NodeCaches of several capacities next to a plain list of cached nodes, and
+// checks that the least recently cached node is dropped first, that a node is only taken back while its neighbours
+// fit and that every slot handed to the cache comes back exactly once.
+//
+// Usage: node_cache_check [operations] [seed]
+
+namespace
+{
+	using cputri::NodeCache;
+
+	const uint32_t capacities[] = { 0, 1, 4, 64 };
+
+	// Positions on both sides of the origin, so keys of negative coordinates are tested too
+	const int position_range = 6;
+
+	struct Cached
+	{
+		glm::ivec2 position;
+		uint32_t slot;
+		NodeCache::NeighbourSerials neighbours;
+	};
+
+	// Returns the number of mismatches, printing the first
+	uint32_t check(uint32_t capacity, uint32_t operations, std::mt19937& rng)
+	{
+		NodeCache cache;
+		cache.set_capacity(capacity);
+
+		// Most recently cached first, like the cache
+		std::vector<Cached> cached;
+
+		// Times every slot was handed to the cache and came back from it
+		std::vector<uint32_t> given;
+		std::vector<uint32_t> returned;
+
+		std::uniform_int_distribution<uint32_t> operation(0, 99);
+		std::uniform_int_distribution<int> coordinate(-position_range, position_range);
+		std::uniform_int_distribution<uint64_t> serial(0, 3);
+
+		uint32_t failures = 0;
+		auto fail = [&](const char* what, uint32_t found, uint32_t expected)
+		{
+			if (failures++ == 0)
+				printf("capacity %u: %s gave %u, expected %u\n", capacity, what, found, expected);
+		};
+
+		auto give_back = [&](uint32_t slot)
+		{
+			if (slot == NodeCache::INVALID)
+				return;
+			if (slot >= given.size() || returned[slot] >= given[slot])
+				fail("slot returned more often than given", slot, 0);
+			else
+				++returned[slot];
+		};
+
+		auto find = [&](glm::ivec2 position)
+		{
+			return std::find_if(cached.begin(), cached.end(), [&](const Cached& c) { return c.position == position; });
+		};
+
+		for (uint32_t i = 0; i < operations; ++i)
+		{
+			const uint32_t op = operation(rng);
+			const glm::ivec2 position(coordinate(rng), coordinate(rng));
+
+			// Few serials, so neighbours often still fit, are often gone (0) and now and then were replaced
+			NodeCache::NeighbourSerials neighbours;
+			for (uint64_t& neighbour : neighbours)
+			{
+				neighbour = serial(rng);
+			}
+
+			if (op < 50)
+			{
+				// Positions that are already cached are taken out first, like when a node leaves the quadtree
+				if (find(position) != cached.end())
+					continue;
+
+				const uint32_t slot = (uint32_t)given.size();
+				given.push_back(1);
+				returned.push_back(0);
+
+				uint32_t expected = NodeCache::INVALID;
+				if (capacity == 0)
+				{
+					expected = slot;
+				}
+				else
+				{
+					if (cached.size() >= capacity)
+					{
+						expected = cached.back().slot;
+						cached.pop_back();
+					}
+					cached.insert(cached.begin(), Cached{ position, slot, neighbours });
+				}
+
+				const uint32_t freed = cache.insert(position, slot, neighbours);
+				if (freed != expected)
+					fail("insert", freed, expected);
+				give_back(freed);
+			}
+			else if (op < 90)
+			{
+				uint32_t expected = NodeCache::INVALID;
+				uint32_t expected_stale = NodeCache::INVALID;
+				auto entry = find(position);
+				if (entry != cached.end())
+				{
+					bool fits = true;
+					for (uint32_t nn = 0; nn < neighbours.size(); ++nn)
+					{
+						fits = fits && (neighbours[nn] == 0 || neighbours[nn] == entry->neighbours[nn]);
+					}
+					(fits ? expected : expected_stale) = entry->slot;
+					cached.erase(entry);
+				}
+
+				uint32_t stale;
+				const uint32_t taken = cache.take(position, neighbours, stale);
+				if (taken != expected)
+					fail("take", taken, expected);
+				if (stale != expected_stale)
+					fail("take stale slot", stale, expected_stale);
+				give_back(taken);
+				give_back(stale);
+			}
+			else if (op < 95)
+			{
+				const uint32_t expected = cached.empty() ? NodeCache::INVALID : cached.back().slot;
+				if (!cached.empty())
+					cached.pop_back();
+
+				const uint32_t popped = cache.pop_oldest();
+				if (popped != expected)
+					fail("pop_oldest", popped, expected);
+				give_back(popped);
+			}
+			else
+			{
+				auto entry = find(position);
+				const uint32_t expected = entry != cached.end() ? entry->slot : NodeCache::INVALID;
+				const uint32_t found = cache.find(position);
+				if (found != expected)
+					fail("find", found, expected);
+			}
+
+			if (cache.get_count() != cached.size())
+				fail("count", cache.get_count(), (uint32_t)cached.size());
+		}
+
+		// Emptying the cache gives back every slot still in it, oldest first
+		while (!cached.empty())
+		{
+			const uint32_t popped = cache.pop_oldest();
+			if (popped != cached.back().slot)
+				fail("pop_oldest at the end", popped, cached.back().slot);
+			give_back(popped);
+			cached.pop_back();
+		}
+		if (cache.pop_oldest() != NodeCache::INVALID)
+			fail("pop_oldest of an empty cache", 0, NodeCache::INVALID);
+
+		for (uint32_t slot = 0; slot < given.size(); ++slot)
+		{
+			if (returned[slot] != given[slot])
+				fail("slot never returned", slot, 0);
+		}
+
+		return failures;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t operations = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+	const uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1305;
+	if (operations == 0)
+	{
+		printf("Usage: node_cache_check [operations] [seed]\n");
+		return 1;
+	}
+
+	std::mt19937 rng(seed);
+
+	uint32_t failures = 0;
+	for (const uint32_t capacity : capacities)
+	{
+		const uint32_t found = check(capacity, operations, rng);
+		printf("capacity %2u:  %u operations, %u mismatches\n", capacity, operations, found);
+		failures += found;
+	}
+
+	printf("%s\n", failures == 0 ? "passed" : "FAILED");
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cpu_triangulate_order.hpp"
+
+// Sorts random points with cputri::InsertionOrder and checks that the result is a permutation of the input, that the
+// same points always come out in the same order, that points inserted one after another are much closer than in a
+// random order and that the first points inserted spread out over the whole node.
+//
+// Usage: order_check [points] [seed]
+
+namespace
+{
+	const glm::vec2 node_min = glm::vec2(-250.0f, 500.0f);
+	const glm::vec2 node_max = glm::vec2(0.0f, 750.0f);
+
+	// Points in insertion order, triangulate_shader inserts from the back
+	std::vector<glm::vec4> insertion_order(const std::vector<glm::vec4>& points)
+	{
+		return std::vector<glm::vec4>(points.rbegin(), points.rend());
+	}
+
+	double mean_step(const std::vector<glm::vec4>& points)
+	{
+		double total = 0.0;
+		for (size_t pp = 1; pp < points.size(); ++pp)
+		{
+			total += glm::distance(glm::vec2(points[pp].x, points[pp].z), glm::vec2(points[pp - 1].x, points[pp - 1].z));
+		}
+
+		return total / (points.size() - 1);
+	}
+
+	bool same(const std::vector<glm::vec4>& a, const std::vector<glm::vec4>& b)
+	{
+		return std::equal(a.begin(), a.end(), b.begin(), b.end());
+	}
+
+	// True if every point of points comes out of sorted once and unchanged, found through its number in w
+	bool is_permutation(const std::vector<glm::vec4>& sorted, const std::vector<glm::vec4>& points)
+	{
+		std::vector<bool> seen(points.size(), false);
+		for (const glm::vec4& point : sorted)
+		{
+			const size_t pp = (size_t)point.w;
+			if (pp >= points.size() || seen[pp] || point != points[pp])
+				return false;
+			seen[pp] = true;
+		}
+
+		return sorted.size() == points.size();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : 4096;
+	const uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1305;
+
+	// Fewer points are too few to tell a curve from chance
+	if (count < 1024)
+	{
+		printf("Usage: order_check [points (at least 1024)] [seed]\n");
+		return 1;
+	}
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> x(node_min.x, node_max.x);
+	std::uniform_real_distribution<float> z(node_min.y, node_max.y);
+
+	// The point's number goes in w so the permutation can be followed
+	std::vector<glm::vec4> points(count);
+	for (uint32_t pp = 0; pp < count; ++pp)
+	{
+		points[pp] = glm::vec4(x(rng), 0.0f, z(rng), float(pp));
+	}
+
+	uint32_t failures = 0;
+	auto expect = [&](bool passed, const char* what)
+	{
+		printf("%-46s %s\n", what, passed ? "ok" : "FAILED");
+		failures += passed ? 0 : 1;
+	};
+
+	cputri::InsertionOrder order;
+	std::vector<glm::vec4> sorted = points;
+	order.sort(sorted.data(), count, node_min, node_max);
+
+	expect(is_permutation(sorted, points), "every point comes out once, unchanged");
+
+	// A used InsertionOrder and a new one give the same order
+	std::vector<glm::vec4> again = points;
+	order.sort(again.data(), count, node_min, node_max);
+	std::vector<glm::vec4> fresh = points;
+	cputri::InsertionOrder().sort(fresh.data(), count, node_min, node_max);
+	expect(same(sorted, again) && same(sorted, fresh), "the same points give the same order");
+
+	std::vector<glm::vec4> one = { points[0] };
+	order.sort(one.data(), 1, node_min, node_max);
+	expect(one[0] == points[0], "a single point is left alone");
+
+	// Points outside the node are clamped onto its side but still sorted with the rest
+	std::vector<glm::vec4> outside = points;
+	outside[0].x = node_min.x - 1000.0f;
+	outside[1].z = node_max.y + 1000.0f;
+	std::vector<glm::vec4> outside_sorted = outside;
+	order.sort(outside_sorted.data(), count, node_min, node_max);
+	expect(is_permutation(outside_sorted, outside), "points outside the node are kept");
+
+	const std::vector<glm::vec4> inserted = insertion_order(sorted);
+	std::vector<glm::vec4> shuffled = points;
+	std::shuffle(shuffled.begin(), shuffled.end(), rng);
+	const double sorted_step = mean_step(inserted);
+	const double random_step = mean_step(shuffled);
+	expect(sorted_step < random_step * 0.25, "consecutive points are close together");
+
+	// The first rounds are small but spread over the node, so the mesh grows evenly
+	const uint32_t first = count / 16;
+	glm::vec2 first_min = node_max;
+	glm::vec2 first_max = node_min;
+	for (uint32_t pp = 0; pp < first; ++pp)
+	{
+		first_min = glm::min(first_min, glm::vec2(inserted[pp].x, inserted[pp].z));
+		first_max = glm::max(first_max, glm::vec2(inserted[pp].x, inserted[pp].z));
+	}
+	const glm::vec2 spread = (first_max - first_min) / (node_max - node_min);
+	expect(spread.x > 0.75f && spread.y > 0.75f, "the first points spread over the node");
+
+	printf("mean step:        %.3f sorted, %.3f random (%.3f)\n", sorted_step, random_step, sorted_step / random_step);
+	printf("first %5u:      cover %.2f x %.2f of the node\n", first, spread.x, spread.y);
+	printf("%s\n", failures == 0 ? "passed" : "FAILED");
+
+	return failures == 0 ? 0 : 1;
+}
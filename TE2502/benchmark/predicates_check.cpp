@@ -0,0 +1,179 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "cpu_triangulate_predicates.hpp"
+
+// Checks the signs of cputri::orient2d and cputri::incircle against determinants found exactly in 128 bit integers,
+// on random, collinear, cocircular and barely perturbed points placed where doubles cannot tell them apart.
+//
+// Usage: predicates_check [cases] [seed]
+
+namespace
+{
+	// Points are whole numbers up to 2^25 scaled by 2^-40 and moved to around 1000, so every coordinate is exact in a
+	// double but the differences between them are close to its last bits. The scale and offset do not change the
+	// signs, so the reference works on the whole numbers
+	const double offset = 1000.0;
+	const double scale = 1.0 / (1ull << 40);
+	const int64_t max_coordinate = 1 << 25;
+
+	struct Point
+	{
+		int64_t x;
+		int64_t y;
+	};
+
+	glm::dvec2 to_double(Point p)
+	{
+		return glm::dvec2(offset + p.x * scale, offset + p.y * scale);
+	}
+
+	int sign(__int128 value)
+	{
+		return (value > 0) - (value < 0);
+	}
+
+	int sign(double value)
+	{
+		return (value > 0.0) - (value < 0.0);
+	}
+
+	int exact_orient2d(Point a, Point b, Point c)
+	{
+		const __int128 left = (__int128)(a.x - c.x) * (b.y - c.y);
+		const __int128 right = (__int128)(a.y - c.y) * (b.x - c.x);
+		return sign(left - right);
+	}
+
+	int exact_incircle(Point a, Point b, Point c, Point d)
+	{
+		const __int128 adx = a.x - d.x, ady = a.y - d.y;
+		const __int128 bdx = b.x - d.x, bdy = b.y - d.y;
+		const __int128 cdx = c.x - d.x, cdy = c.y - d.y;
+
+		const __int128 alift = adx * adx + ady * ady;
+		const __int128 blift = bdx * bdx + bdy * bdy;
+		const __int128 clift = cdx * cdx + cdy * cdy;
+
+		return sign(alift * (bdx * cdy - cdx * bdy) + blift * (cdx * ady - adx * cdy) + clift * (adx * bdy - bdx * ady));
+	}
+
+	struct Counts
+	{
+		uint32_t tests = 0;
+		uint32_t failures = 0;
+		uint32_t zeros = 0;
+		uint64_t exact = 0;
+	};
+
+	void check_orient2d(Point a, Point b, Point c, Counts& counts)
+	{
+		const int expected = exact_orient2d(a, b, c);
+		const int found = sign(cputri::orient2d(to_double(a), to_double(b), to_double(c), &counts.exact));
+
+		++counts.tests;
+		counts.zeros += expected == 0;
+		if (found != expected)
+		{
+			++counts.failures;
+			if (counts.failures <= 5)
+				printf("orient2d (%lld %lld) (%lld %lld) (%lld %lld): %d, expected %d\n", (long long)a.x, (long long)a.y,
+					(long long)b.x, (long long)b.y, (long long)c.x, (long long)c.y, found, expected);
+		}
+	}
+
+	void check_incircle(Point a, Point b, Point c, Point d, Counts& counts)
+	{
+		const int expected = exact_incircle(a, b, c, d);
+		const int found = sign(cputri::incircle(to_double(a), to_double(b), to_double(c), to_double(d), &counts.exact));
+
+		++counts.tests;
+		counts.zeros += expected == 0;
+		if (found != expected)
+		{
+			++counts.failures;
+			if (counts.failures <= 5)
+				printf("incircle (%lld %lld) (%lld %lld) (%lld %lld) (%lld %lld): %d, expected %d\n", (long long)a.x, (long long)a.y,
+					(long long)b.x, (long long)b.y, (long long)c.x, (long long)c.y, (long long)d.x, (long long)d.y, found, expected);
+		}
+	}
+
+	void print(const char* name, const Counts& counts)
+	{
+		printf("%-10s %u tests, %u exactly 0, %llu exact fallbacks, %u wrong signs\n", name, counts.tests, counts.zeros,
+			(unsigned long long)counts.exact, counts.failures);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t cases = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+	const uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1305;
+	if (cases == 0)
+	{
+		printf("Usage: predicates_check [cases] [seed]\n");
+		return 1;
+	}
+
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int64_t> coordinate(-max_coordinate / 2, max_coordinate / 2);
+	std::uniform_int_distribution<int64_t> step(-64, 64);
+	std::uniform_int_distribution<int64_t> radius(1, max_coordinate / 16);
+	std::uniform_int_distribution<int64_t> nudge(-1, 1);
+
+	// Well separated points never need the exact fallback
+	Counts simple;
+	{
+		const double orientation = cputri::orient2d(glm::dvec2(0.0, 0.0), glm::dvec2(1.0, 0.0), glm::dvec2(0.0, 1.0), &simple.exact);
+		const double inside = cputri::incircle(glm::dvec2(0.0, 0.0), glm::dvec2(1.0, 0.0), glm::dvec2(0.0, 1.0), glm::dvec2(0.25, 0.25), &simple.exact);
+		const double outside = cputri::incircle(glm::dvec2(0.0, 0.0), glm::dvec2(1.0, 0.0), glm::dvec2(0.0, 1.0), glm::dvec2(2.0, 2.0), &simple.exact);
+		const double clockwise = cputri::incircle(glm::dvec2(0.0, 0.0), glm::dvec2(0.0, 1.0), glm::dvec2(1.0, 0.0), glm::dvec2(0.25, 0.25), &simple.exact);
+
+		simple.tests = 4;
+		simple.failures = (orientation > 0.0 ? 0 : 1) + (inside > 0.0 ? 0 : 1) + (outside < 0.0 ? 0 : 1) + (clockwise < 0.0 ? 0 : 1);
+		if (simple.exact != 0)
+			++simple.failures;
+	}
+
+	Counts orientations;
+	Counts circles;
+	for (uint32_t i = 0; i < cases; ++i)
+	{
+		const Point a = { coordinate(rng), coordinate(rng) };
+		const Point b = { coordinate(rng), coordinate(rng) };
+		const Point c = { coordinate(rng), coordinate(rng) };
+		const Point d = { coordinate(rng), coordinate(rng) };
+
+		check_orient2d(a, b, c, orientations);
+		check_incircle(a, b, c, d, circles);
+
+		// On the line through a and b, and one unit off it
+		const Point direction = { step(rng), step(rng) };
+		const int64_t k = step(rng);
+		const Point on_line = { a.x + k * direction.x, a.y + k * direction.y };
+		const Point past = { a.x + 2 * k * direction.x, a.y + 2 * k * direction.y };
+		check_orient2d(a, on_line, past, orientations);
+		check_orient2d(a, on_line, { past.x + nudge(rng), past.y + nudge(rng) }, orientations);
+
+		// On a circle of radius 5r around c, from the 3-4-5 triangle, and one unit off it
+		const int64_t r = radius(rng);
+		const Point p0 = { c.x + 5 * r, c.y };
+		const Point p1 = { c.x + 3 * r, c.y + 4 * r };
+		const Point p2 = { c.x - 4 * r, c.y + 3 * r };
+		const Point p3 = { c.x, c.y - 5 * r };
+		check_incircle(p0, p1, p2, p3, circles);
+		check_incircle(p0, p1, p2, { p3.x + nudge(rng), p3.y + nudge(rng) }, circles);
+		check_incircle(p2, p1, p0, { p3.x + nudge(rng), p3.y + nudge(rng) }, circles);
+	}
+
+	print("simple:", simple);
+	print("orient2d:", orientations);
+	print("incircle:", circles);
+
+	const bool passed = simple.failures == 0 && orientations.failures == 0 && circles.failures == 0;
+	printf("%s\n", passed ? "passed" : "FAILED");
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "cpu_triangulate.hpp"
+
+// Replays a camera path from camera_paths.txt through the CPU triangulator at a fixed timestep.
+// Needs no window or GPU, so terrain throughput can be measured on headless build machines.
+//
+// Usage: replay_benchmark <path name> [--paths file] [--dt seconds] [--width pixels] [--height pixels]
+//                         [--threshold t] [--area-mult a] [--curv-mult c] [--vertices-per-refine n] [--threads n]
+//                         [--batched 0|1] [--spatial-order 0|1] [--memory-budget megabytes]
+//                         [--node-cache n] [--tile-cache directory]
+//                         [--derivatives filtered|analytic] [--error-cache 0|1] [--error-tolerance t]
+//                         [--point-budget n] [--time-budget milliseconds] [--decimation 0|1]
+//                         [--decimation-hysteresis h] [--decimation-interval n] [--check 0|1]
+
+namespace
+{
+	struct PathPart
+	{
+		glm::vec3 pos;
+		float yaw;
+		float pitch;
+	};
+	typedef std::vector<PathPart> Path;
+
+	struct Options
+	{
+		std::string path_name;
+		std::string paths_file = "camera_paths.txt";
+		float dt = 1.0f / 60.0f;
+		float width = 1080.0f;
+		float height = 720.0f;
+		float threshold = 0.0f;
+		float area_multiplier = 1.0f;
+		float curvature_multiplier = 1.0f;
+		int vertices_per_refine = 1;
+		int threads = 0;
+		bool batched = false;
+		bool spatial_order = true;
+		float memory_budget = 0.0f;
+		int node_cache = -1;
+		std::string tile_cache;
+		cputri::DERIVATIVE_MODE derivative_mode = cputri::DERIVATIVE_MODE::FILTERED;
+		bool error_cache = true;
+		float error_tolerance = 0.0f;
+		int point_budget = 0;
+		float time_budget = 0.0f;
+		bool decimation = false;
+		float decimation_hysteresis = 0.5f;
+		int decimation_interval = 8;
+		bool check = false;
+	};
+
+	// Time between saved path parts, same as PathHandler::m_max_countdown
+	const float path_part_time = 0.1f;
+
+	// Camera settings, same as Camera
+	const float fov = 90.0f;
+	const float camera_near = 0.05f;
+	const float camera_far = 1400.0f;
+
+	// Reads the path with the given name from a file in the format written by PathHandler
+	bool load_path(const std::string& file_path, const std::string& path_name, Path& path)
+	{
+		std::ifstream in(file_path);
+		if (!in.is_open())
+		{
+			printf("Could not open file for loading: %s\n", file_path.c_str());
+			return false;
+		}
+
+		int path_count;
+		in >> path_count;
+		for (int pp = 0; pp < path_count; ++pp)
+		{
+			std::string name;
+			int pos_count;
+			in >> name >> pos_count;
+
+			Path current;
+			current.reserve(pos_count);
+			for (int cc = 0; cc < pos_count; ++cc)
+			{
+				PathPart part;
+				in >> part.pos.x >> part.pos.y >> part.pos.z >> part.yaw >> part.pitch;
+				current.push_back(part);
+			}
+
+			if (name == path_name)
+			{
+				path = current;
+				return path.size() >= 2;
+			}
+		}
+
+		printf("Could not find path: %s\n", path_name.c_str());
+		return false;
+	}
+
+	// Interpolates a path part the same way as PathHandler::update
+	PathPart interpolate(const PathPart& current, const PathPart& next, float percent)
+	{
+		PathPart part;
+		part.pos = (1.f - percent) * current.pos + percent * next.pos;
+
+		float current_yaw = current.yaw;
+		float next_yaw = next.yaw;
+		if (next_yaw - current_yaw > 3.141592f)
+			current_yaw += 6.283184f;
+		else if (current_yaw - next_yaw > 3.141592f)
+			next_yaw += 6.283184f;
+		part.yaw = (1.f - percent) * current_yaw + percent * next_yaw;
+
+		part.pitch = (1.f - percent) * current.pitch + percent * next.pitch;
+
+		return part;
+	}
+
+	// Same projection as Camera::calculate_perspective
+	glm::mat4 calculate_perspective(float horiz_fov_degrees, float n, float f, float window_width, float window_height)
+	{
+		float fov = glm::radians(horiz_fov_degrees);
+		float a = window_width / window_height;
+		float vert_fov = 2.0f * atanf(tanf(fov * 0.5f) / a);
+		float c = 1.0f / tanf(vert_fov * 0.5f);
+
+		glm::mat4 persp;
+		persp[0] = { c / a, 0, 0, 0 };
+		persp[1] = { 0, c, 0, 0 };
+		persp[2] = { 0, 0, (f + n) / (f - n), 1 };
+		persp[3] = { 0, 0, -(2 * f * n) / (f - n), 0 };
+
+		return persp;
+	}
+
+	// Same view matrix as Camera::update
+	glm::mat4 calculate_view(const PathPart& part)
+	{
+		glm::mat4 camera_rotation = glm::rotate(glm::rotate(glm::mat4(1.0f), -part.pitch, { 1, 0, 0 }), part.yaw, { 0, 1, 0 });
+		return glm::translate(camera_rotation, glm::vec3{ -part.pos });
+	}
+
+	// Same planes and corners as Camera::get_camera_planes
+	Frustum calculate_frustum(const glm::mat4& vp)
+	{
+		Frustum frustum;
+
+		// Left, right, top, bottom, near, far
+		for (int i = 0; i < 6; ++i)
+		{
+			const int row = i / 2;
+			const float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+			frustum.m_planes[i].m_plane.x = vp[0][3] + sign * vp[0][row];
+			frustum.m_planes[i].m_plane.y = vp[1][3] + sign * vp[1][row];
+			frustum.m_planes[i].m_plane.z = vp[2][3] + sign * vp[2][row];
+			frustum.m_planes[i].m_plane.w = vp[3][3] + sign * vp[3][row];
+			frustum.m_planes[i].normalize();
+		}
+
+		const glm::mat4 inv_vp = glm::inverse(vp);
+		const glm::vec4 corners[8] = {
+			{ 1,  1, 0, 1 }, { -1,  1, 0, 1 }, { 1, -1, 0, 1 }, { -1, -1, 0, 1 },
+			{ 1,  1, 1, 1 }, { -1,  1, 1, 1 }, { 1, -1, 1, 1 }, { -1, -1, 1, 1 } };
+		for (int i = 0; i < 8; ++i)
+		{
+			glm::vec4 point = inv_vp * corners[i];
+			frustum.m_corners[i] = point / point.w;
+		}
+
+		return frustum;
+	}
+
+	bool parse_options(int argc, const char** argv, Options& options)
+	{
+		if (argc < 2)
+			return false;
+
+		options.path_name = argv[1];
+		for (int i = 2; i + 1 < argc; i += 2)
+		{
+			const char* key = argv[i];
+			const char* value = argv[i + 1];
+
+			if (strcmp(key, "--paths") == 0)
+				options.paths_file = value;
+			else if (strcmp(key, "--dt") == 0)
+				options.dt = (float)atof(value);
+			else if (strcmp(key, "--width") == 0)
+				options.width = (float)atof(value);
+			else if (strcmp(key, "--height") == 0)
+				options.height = (float)atof(value);
+			else if (strcmp(key, "--threshold") == 0)
+				options.threshold = (float)atof(value);
+			else if (strcmp(key, "--area-mult") == 0)
+				options.area_multiplier = (float)atof(value);
+			else if (strcmp(key, "--curv-mult") == 0)
+				options.curvature_multiplier = (float)atof(value);
+			else if (strcmp(key, "--vertices-per-refine") == 0)
+				options.vertices_per_refine = atoi(value);
+			else if (strcmp(key, "--threads") == 0)
+				options.threads = atoi(value);
+			else if (strcmp(key, "--batched") == 0)
+				options.batched = atoi(value) != 0;
+			else if (strcmp(key, "--spatial-order") == 0)
+				options.spatial_order = atoi(value) != 0;
+			else if (strcmp(key, "--memory-budget") == 0)
+				options.memory_budget = (float)atof(value);
+			else if (strcmp(key, "--node-cache") == 0)
+				options.node_cache = atoi(value);
+			else if (strcmp(key, "--tile-cache") == 0)
+				options.tile_cache = value;
+			else if (strcmp(key, "--derivatives") == 0 && strcmp(value, "filtered") == 0)
+				options.derivative_mode = cputri::DERIVATIVE_MODE::FILTERED;
+			else if (strcmp(key, "--derivatives") == 0 && strcmp(value, "analytic") == 0)
+				options.derivative_mode = cputri::DERIVATIVE_MODE::ANALYTIC;
+			else if (strcmp(key, "--error-cache") == 0)
+				options.error_cache = atoi(value) != 0;
+			else if (strcmp(key, "--error-tolerance") == 0)
+				options.error_tolerance = (float)atof(value);
+			else if (strcmp(key, "--point-budget") == 0)
+				options.point_budget = atoi(value);
+			else if (strcmp(key, "--time-budget") == 0)
+				options.time_budget = (float)atof(value);
+			else if (strcmp(key, "--decimation") == 0)
+				options.decimation = atoi(value) != 0;
+			else if (strcmp(key, "--decimation-hysteresis") == 0)
+				options.decimation_hysteresis = (float)atof(value);
+			else if (strcmp(key, "--decimation-interval") == 0)
+				options.decimation_interval = atoi(value);
+			else if (strcmp(key, "--check") == 0)
+				options.check = atoi(value) != 0;
+			else
+			{
+				printf("Unknown option: %s\n", key);
+				return false;
+			}
+		}
+
+		return options.dt > 0.0f && options.width > 0.0f && options.height > 0.0f;
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	Options options;
+	if (!parse_options(argc, argv, options))
+	{
+		printf("Usage: replay_benchmark <path name> [--paths file] [--dt seconds] [--width pixels] [--height pixels]\n"
+			"                        [--threshold t] [--area-mult a] [--curv-mult c] [--vertices-per-refine n] [--threads n]\n"
+			"                        [--batched 0|1] [--spatial-order 0|1] [--memory-budget megabytes]\n"
+			"                        [--node-cache n] [--tile-cache directory]\n"
+			"                        [--derivatives filtered|analytic] [--error-cache 0|1] [--error-tolerance t]\n"
+			"                        [--point-budget n] [--time-budget milliseconds] [--decimation 0|1]\n"
+			"                        [--decimation-hysteresis h] [--decimation-interval n] [--check 0|1]\n");
+		return 1;
+	}
+
+	Path path;
+	if (!load_path(options.paths_file, options.path_name, path))
+		return 1;
+
+	cputri::Terrain terrain(options.threads);
+	terrain.vertices_per_refine = options.vertices_per_refine;
+	terrain.batched_insertion = options.batched;
+	terrain.spatial_insertion_order = options.spatial_order;
+	terrain.derivative_mode = options.derivative_mode;
+	terrain.error_cache = options.error_cache;
+	terrain.error_cache_tolerance = options.error_tolerance;
+	terrain.refine_point_budget = (uint32_t)std::max(options.point_budget, 0);
+	terrain.refine_time_budget = options.time_budget;
+	terrain.decimation = options.decimation;
+	terrain.decimation_hysteresis = options.decimation_hysteresis;
+	terrain.decimation_interval = (uint32_t)std::max(options.decimation_interval, 1);
+	if (options.memory_budget > 0.0f)
+		terrain.set_memory_budget((uint64_t)(options.memory_budget * 1024.0f * 1024.0f));
+	if (options.node_cache >= 0)
+		terrain.set_node_cache_size((uint32_t)options.node_cache);
+	if (!options.tile_cache.empty())
+		terrain.set_tile_cache(options.tile_cache, options.threshold, options.area_multiplier, options.curvature_multiplier);
+
+	const glm::mat4 perspective = calculate_perspective(fov, camera_near, camera_far, options.width, options.height);
+
+	uint64_t frames = 0;
+	std::vector<double> frame_times;
+	std::vector<double> refine_times;
+	size_t part_index = 0;
+	float percent = 0.0f;
+
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	while (part_index + 1 < path.size())
+	{
+		const PathPart part = interpolate(path[part_index], path[part_index + 1], percent);
+		const glm::mat4 vp = perspective * calculate_view(part);
+		Frustum frustum = calculate_frustum(vp);
+
+		const auto frame_start = std::chrono::high_resolution_clock::now();
+		terrain.intersect(frustum, part.pos);
+		terrain.process_triangles(vp, options.threshold, options.area_multiplier, options.curvature_multiplier);
+
+		// The time budget only covers triangulate(), so it is timed on its own too
+		const auto refine_start = std::chrono::high_resolution_clock::now();
+		terrain.triangulate();
+		const auto frame_end = std::chrono::high_resolution_clock::now();
+		frame_times.push_back(std::chrono::duration<double, std::milli>(frame_end - frame_start).count());
+		refine_times.push_back(std::chrono::duration<double, std::milli>(frame_end - refine_start).count());
+		++frames;
+
+		// Outside the frame time, the check goes over every triangle
+		std::string error;
+		if (options.check && !terrain.check_mesh(error))
+		{
+			printf("Invalid mesh after frame %llu: %s\n", (unsigned long long)frames, error.c_str());
+			return 1;
+		}
+
+		percent += 1.f / path_part_time * options.dt;
+		if (percent > 0.99f)
+		{
+			++part_index;
+			percent = 0.f;
+		}
+	}
+
+	const auto end = std::chrono::high_resolution_clock::now();
+	const double seconds = std::chrono::duration<double>(end - start).count();
+
+	const cputri::Statistics statistics = terrain.get_statistics();
+
+	std::sort(frame_times.begin(), frame_times.end());
+	const double frame_p99 = frame_times.empty() ? 0.0 : frame_times[(frame_times.size() - 1) * 99 / 100];
+	const double frame_max = frame_times.empty() ? 0.0 : frame_times.back();
+
+	std::sort(refine_times.begin(), refine_times.end());
+	const double refine_p99 = refine_times.empty() ? 0.0 : refine_times[(refine_times.size() - 1) * 99 / 100];
+	const double refine_max = refine_times.empty() ? 0.0 : refine_times.back();
+
+	printf("path:                  %s (%zu parts, dt %.4f s)\n", options.path_name.c_str(), path.size(), options.dt);
+	printf("threads:               %u\n", terrain.get_thread_count());
+	printf("batched insertion:     %s\n", options.batched ? "on" : "off");
+	printf("spatial order:         %s\n", options.spatial_order ? "on" : "off");
+	printf("derivatives:           %s\n", options.derivative_mode == cputri::DERIVATIVE_MODE::ANALYTIC ? "analytic" : "filtered");
+	if (options.error_cache)
+		printf("error cache:           on, tolerance %g\n", options.error_tolerance);
+	else
+		printf("error cache:           off\n");
+	if (options.time_budget > 0.0f)
+		printf("time budget:           %.2f ms per frame\n", options.time_budget);
+	else
+		printf("time budget:           off\n");
+	if (options.point_budget > 0)
+		printf("point budget:          %d per frame\n", options.point_budget);
+	else
+		printf("point budget:          off\n");
+	if (options.decimation)
+		printf("decimation:            on, hysteresis %g, every %d views\n", options.decimation_hysteresis, options.decimation_interval);
+	else
+		printf("decimation:            off\n");
+	printf("frames:                %llu\n", (unsigned long long)frames);
+	printf("time:                  %.3f s\n", seconds);
+	printf("frames/sec:            %.1f\n", frames / seconds);
+	printf("frame time:            %.3f ms 99th percentile, %.3f ms worst\n", frame_p99, frame_max);
+	printf("triangulate time:      %.3f ms 99th percentile, %.3f ms worst\n", refine_p99, refine_max);
+	printf("out of refine time:    %llu frames\n", (unsigned long long)statistics.refine_time_exhausted);
+	printf("points inserted:       %llu\n", (unsigned long long)statistics.points_inserted);
+	printf("points inserted/sec:   %.1f\n", statistics.points_inserted / seconds);
+	printf("triangles produced:    %llu\n", (unsigned long long)statistics.triangles_created);
+	printf("triangles in mesh:     %llu\n", (unsigned long long)terrain.get_triangle_count());
+	printf("vertices removed:      %llu\n", (unsigned long long)statistics.vertices_removed);
+	printf("insertions discarded:  %llu\n", (unsigned long long)statistics.insertions_discarded);
+	printf("points over budget:    %llu\n", (unsigned long long)statistics.points_over_budget);
+	printf("mean cavity:           %.2f triangles\n", statistics.points_inserted ? (double)statistics.cavity_triangles / statistics.points_inserted : 0.0);
+	printf("largest cavity:        %llu triangles\n", (unsigned long long)statistics.largest_cavity);
+	printf("exact predicates:      %llu\n", (unsigned long long)statistics.exact_predicates);
+	printf("mesh memory:           %.2f MiB, %.2f MiB reserved\n", terrain.get_memory_used() / (1024.0 * 1024.0),
+		terrain.get_memory_reserved() / (1024.0 * 1024.0));
+	printf("node cache:            %llu hits, %llu misses\n", (unsigned long long)statistics.node_cache_hits, (unsigned long long)statistics.node_cache_misses);
+	printf("tiles loaded:          %llu\n", (unsigned long long)statistics.tiles_loaded);
+	const uint64_t errors_tested = statistics.error_cache_hits + statistics.error_cache_misses;
+	printf("error cache:           %llu hits, %llu misses (%.1f%% hit rate)\n", (unsigned long long)statistics.error_cache_hits,
+		(unsigned long long)statistics.error_cache_misses, errors_tested ? 100.0 * statistics.error_cache_hits / errors_tested : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "slot_allocator.hpp"
+
+// Runs random acquires and releases on SlotAllocators of several sizes next to a plain array of used flags, and
+// checks that every acquire returns the lowest free slot, that full allocators return INVALID and that the counts agree.
+//
+// Usage: slot_allocator_check [operations] [seed]
+
+namespace
+{
+	// Sizes around the 64 slot words and the 64 word summary words
+	const uint32_t slot_counts[] = { 1, 63, 64, 65, 200, 4095, 4096, 4097, 10000 };
+
+	uint32_t lowest_free(const std::vector<bool>& used)
+	{
+		for (uint32_t slot = 0; slot < used.size(); ++slot)
+		{
+			if (!used[slot])
+				return slot;
+		}
+
+		return SlotAllocator::INVALID;
+	}
+
+	// Returns the number of mismatches, printing the first
+	uint32_t check(uint32_t slot_count, uint32_t operations, std::mt19937& rng)
+	{
+		SlotAllocator allocator(slot_count);
+		std::vector<bool> used(slot_count, false);
+		std::vector<uint32_t> used_slots;
+
+		std::uniform_int_distribution<uint32_t> operation(0, 99);
+		std::uniform_int_distribution<uint32_t> bulk_count(1, 80);
+		std::vector<uint32_t> slots(80);
+
+		uint32_t failures = 0;
+		auto fail = [&](const char* what, uint32_t found, uint32_t expected)
+		{
+			if (failures++ == 0)
+				printf("%u slots: %s gave %u, expected %u\n", slot_count, what, found, expected);
+		};
+
+		for (uint32_t i = 0; i < operations; ++i)
+		{
+			// Mostly fills the allocator up, then mostly empties it, so it is full and empty now and then
+			const uint32_t acquire_share = (i / 500) % 2 == 0 ? 70 : 30;
+			const uint32_t op = operation(rng);
+
+			if (op == 0)
+			{
+				allocator.clear();
+				used.assign(slot_count, false);
+				used_slots.clear();
+			}
+			else if (op < acquire_share - 10)
+			{
+				const uint32_t expected = lowest_free(used);
+				const uint32_t slot = allocator.acquire();
+				if (slot != expected)
+					fail("acquire", slot, expected);
+				if (slot != SlotAllocator::INVALID && slot < slot_count)
+				{
+					used[slot] = true;
+					used_slots.push_back(slot);
+				}
+			}
+			else if (op < acquire_share)
+			{
+				const uint32_t count = bulk_count(rng);
+				const uint32_t acquired = allocator.acquire(count, slots.data());
+				for (uint32_t ss = 0; ss < acquired; ++ss)
+				{
+					const uint32_t expected = lowest_free(used);
+					if (slots[ss] != expected)
+						fail("bulk acquire", slots[ss], expected);
+					if (slots[ss] < slot_count)
+					{
+						used[slots[ss]] = true;
+						used_slots.push_back(slots[ss]);
+					}
+				}
+				if (acquired < count && lowest_free(used) != SlotAllocator::INVALID)
+					fail("bulk acquire count", acquired, count);
+			}
+			else if (!used_slots.empty())
+			{
+				const uint32_t index = std::uniform_int_distribution<uint32_t>(0, (uint32_t)used_slots.size() - 1)(rng);
+				const uint32_t slot = used_slots[index];
+				used_slots[index] = used_slots.back();
+				used_slots.pop_back();
+
+				allocator.release(slot);
+				used[slot] = false;
+			}
+
+			if (allocator.get_used_count() != used_slots.size())
+				fail("used count", allocator.get_used_count(), (uint32_t)used_slots.size());
+
+			// Every flag now and then, it is slow for the large allocators
+			if (i % 97 == 0)
+			{
+				for (uint32_t slot = 0; slot < slot_count; ++slot)
+				{
+					if (allocator.is_used(slot) != used[slot])
+						fail("is_used", allocator.is_used(slot), used[slot]);
+				}
+			}
+		}
+
+		return failures;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t operations = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+	const uint32_t seed = argc > 2 ? (uint32_t)atoi(argv[2]) : 1305;
+	if (operations == 0)
+	{
+		printf("Usage: slot_allocator_check [operations] [seed]\n");
+		return 1;
+	}
+
+	std::mt19937 rng(seed);
+
+	uint32_t failures = 0;
+	for (const uint32_t slot_count : slot_counts)
+	{
+		const uint32_t found = check(slot_count, operations, rng);
+		printf("%5u slots:  %u operations, %u mismatches\n", slot_count, operations, found);
+		failures += found;
+	}
+
+	printf("%s\n", failures == 0 ? "passed" : "FAILED");
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+// Runs parallel_for on ThreadPools of several sizes with task counts around the thread count and uneven task
+// lengths, and checks that every task runs exactly once, that thread indices are below the thread count, that no
+// thread index runs two tasks at once and that every task has finished when parallel_for returns.
+//
+// Usage: thread_pool_check [rounds]
+
+namespace
+{
+	const uint32_t thread_counts[] = { 1, 2, 3, 8, 0 };
+	const uint32_t task_counts[] = { 0, 1, 2, 7, 8, 9, 100, 1000 };
+
+	// Returns the number of failed rounds, printing the first
+	uint32_t check(uint32_t thread_count, uint32_t rounds)
+	{
+		ThreadPool pool(thread_count);
+		const uint32_t threads = pool.get_thread_count();
+		if (threads == 0 || (thread_count != 0 && threads != thread_count))
+		{
+			printf("%u threads: pool has %u threads\n", thread_count, threads);
+			return 1;
+		}
+
+		std::unique_ptr<std::atomic<uint32_t>[]> busy(new std::atomic<uint32_t>[threads]);
+		std::vector<std::atomic<uint32_t>> runs(task_counts[sizeof(task_counts) / sizeof(task_counts[0]) - 1]);
+
+		uint32_t failures = 0;
+		auto fail = [&](const char* what, uint32_t task_count, uint32_t round)
+		{
+			if (failures++ == 0)
+				printf("%u threads, %u tasks, round %u: %s\n", threads, task_count, round, what);
+		};
+
+		for (uint32_t round = 0; round < rounds; ++round)
+		{
+			for (const uint32_t task_count : task_counts)
+			{
+				for (uint32_t tt = 0; tt < task_count; ++tt)
+				{
+					runs[tt] = 0;
+				}
+				for (uint32_t ii = 0; ii < threads; ++ii)
+				{
+					busy[ii] = 0;
+				}
+				std::atomic<uint32_t> bad_thread(0);
+				std::atomic<uint32_t> overlapping(0);
+
+				pool.parallel_for(task_count, [&](uint32_t task, uint32_t thread)
+				{
+					if (thread >= threads || task >= task_count)
+					{
+						++bad_thread;
+						return;
+					}
+					if (busy[thread].exchange(1) != 0)
+						++overlapping;
+
+					// Every seventh task is much longer, so the other threads run out of work and steal
+					if (task % 7 == round % 7)
+						std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+					++runs[task];
+					busy[thread] = 0;
+				});
+
+				bool once = true;
+				for (uint32_t tt = 0; tt < task_count; ++tt)
+				{
+					once = once && runs[tt] == 1;
+				}
+
+				if (bad_thread != 0)
+					fail("task or thread index out of range", task_count, round);
+				if (overlapping != 0)
+					fail("one thread index ran two tasks at once", task_count, round);
+				if (!once)
+					fail("a task did not run exactly once before parallel_for returned", task_count, round);
+			}
+		}
+
+		return failures;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t rounds = argc > 1 ? (uint32_t)atoi(argv[1]) : 50;
+	if (rounds == 0)
+	{
+		printf("Usage: thread_pool_check [rounds]\n");
+		return 1;
+	}
+
+	uint32_t failures = 0;
+	for (const uint32_t thread_count : thread_counts)
+	{
+		const uint32_t found = check(thread_count, rounds);
+		printf("%2u threads:  %u rounds, %u failed\n", thread_count, rounds, found);
+		failures += found;
+	}
+
+	printf("%s\n", failures == 0 ? "passed" : "FAILED");
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "cpu_triangulate_data.hpp"
+#include "cpu_triangulate_tile_cache.hpp"
+
+// Writes a node to a TileCache and reads it back, checking that every array comes back as it was written, and that
+// tiles with other neighbours, other parameters, a wrong size, corrupt counts or indices outside their arrays are
+// not read.
+//
+// Usage: tile_cache_check [grid side]
+
+namespace
+{
+	using namespace cputri;
+
+	const uint64_t parameters = 0x1305;
+	const uint64_t serial = 42;
+	const glm::ivec2 position = glm::ivec2(3, -2);
+	const uint64_t max_bytes = 16ull << 20;
+
+	// Arrays a node points into, so a TerrainData can be put together without a Terrain
+	struct NodeStorage
+	{
+		std::vector<uint> indices;
+		std::vector<uint> connections;
+		std::vector<uint> border;
+		std::vector<glm::vec4> positions;
+		std::vector<Triangle> triangles;
+		std::vector<float> soa[7];
+	};
+
+	// Side * side vertices on a unit grid, two triangles per square. Neighbours are found through their shared edges,
+	// edges on the left side of the grid are connected to the node to the left and the rest of the outside is left
+	// INVALID, like edges of the quadtree
+	TerrainData make_grid(uint side, NodeStorage& storage)
+	{
+		std::map<std::pair<uint, uint>, uint> edge_triangles;
+
+		for (uint y = 0; y + 1 < side; ++y)
+		{
+			for (uint x = 0; x + 1 < side; ++x)
+			{
+				const uint v = y * side + x;
+				const uint corners[2][3] = { { v, v + 1, v + side }, { v + 1, v + side + 1, v + side } };
+				for (const auto& triangle : corners)
+				{
+					const uint t = (uint)storage.indices.size() / 3;
+					for (uint ss = 0; ss < 3; ++ss)
+					{
+						storage.indices.push_back(triangle[ss]);
+						edge_triangles[{ triangle[ss], triangle[(ss + 1) % 3] }] = t;
+					}
+				}
+			}
+		}
+
+		const uint triangle_count = (uint)storage.indices.size() / 3;
+		const uint vertex_count = side * side;
+
+		storage.connections.assign(storage.indices.size(), INVALID);
+		for (uint t = 0; t < triangle_count; ++t)
+		{
+			for (uint ss = 0; ss < 3; ++ss)
+			{
+				const uint from = storage.indices[t * 3 + ss];
+				const uint to = storage.indices[t * 3 + (ss + 1) % 3];
+				const auto neighbour = edge_triangles.find({ to, from });
+				if (neighbour != edge_triangles.end())
+				{
+					storage.connections[t * 3 + ss] = neighbour->second;
+				}
+				else if (from % side == 0 && to % side == 0)
+				{
+					storage.connections[t * 3 + ss] = INVALID - 4 - 1;
+					storage.border.push_back(t);
+				}
+			}
+		}
+
+		storage.positions.resize(vertex_count);
+		storage.triangles.resize(triangle_count);
+		for (std::vector<float>& array : storage.soa)
+		{
+			array.resize(std::max(vertex_count, triangle_count));
+		}
+
+		TerrainData node{};
+		node.index_count = (uint)storage.indices.size();
+		node.vertex_count = vertex_count;
+		node.border_count = (uint)storage.border.size();
+		node.indices.elements = storage.indices.data();
+		node.triangle_connections.elements = storage.connections.data();
+		node.border_triangle_indices.elements = storage.border.data();
+#if TERRAIN_SOA_LAYOUT
+		node.position_x.elements = storage.soa[0].data();
+		node.position_y.elements = storage.soa[1].data();
+		node.position_z.elements = storage.soa[2].data();
+		node.curvature.elements = storage.soa[3].data();
+		node.circumcentre_x.elements = storage.soa[4].data();
+		node.circumcentre_y.elements = storage.soa[5].data();
+		node.circumradius2.elements = storage.soa[6].data();
+#else
+		node.positions.elements = storage.positions.data();
+		node.triangles.elements = storage.triangles.data();
+#endif
+
+		// Heights and curvatures that are not whole numbers, so any byte out of place shows
+		for (uint v = 0; v < vertex_count; ++v)
+		{
+			node.set_position(v, glm::vec4(float(v % side), v * 0.37f - 5.0f, float(v / side), v * 0.013f));
+		}
+		for (uint t = 0; t < triangle_count; ++t)
+		{
+			node.set_circumcircle(t, glm::vec2(t * 0.5f + 0.25f, t * 0.125f), 0.5f + t * 0.001f);
+		}
+
+		return node;
+	}
+
+	// True if the tile holds exactly what the node does
+	bool matches(const Tile& tile, const TerrainData& node)
+	{
+		if (tile.serial != serial || tile.indices.size() != node.index_count || tile.positions.size() != node.vertex_count
+			|| tile.border_triangle_indices.size() != node.border_count || tile.triangle_connections.size() != node.index_count
+			|| tile.circumcircles.size() != node.index_count / 3)
+			return false;
+
+		for (uint ii = 0; ii < node.index_count; ++ii)
+		{
+			if (tile.indices[ii] != node.indices[ii] || tile.triangle_connections[ii] != node.triangle_connections[ii])
+				return false;
+		}
+		for (uint v = 0; v < node.vertex_count; ++v)
+		{
+			if (tile.positions[v] != node.get_position(v))
+				return false;
+		}
+		for (uint t = 0; t < node.index_count / 3; ++t)
+		{
+			if (tile.circumcircles[t] != glm::vec3(node.get_circumcentre(t), node.get_circumradius2(t)))
+				return false;
+		}
+		for (uint bb = 0; bb < node.border_count; ++bb)
+		{
+			if (tile.border_triangle_indices[bb] != node.border_triangle_indices[bb])
+				return false;
+		}
+
+		return true;
+	}
+
+	std::vector<char> read_file(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	void write_file(const std::filesystem::path& path, const std::vector<char>& bytes)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(bytes.data(), bytes.size());
+	}
+
+	void set_uint(std::vector<char>& bytes, uint64_t offset, uint32_t value)
+	{
+		memcpy(&bytes[offset], &value, sizeof(value));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint side = argc > 1 ? (uint)atoi(argv[1]) : 12;
+	if (side < 2)
+	{
+		printf("Usage: tile_cache_check [grid side (at least 2)]\n");
+		return 1;
+	}
+
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "tile_cache_check";
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directory(directory);
+
+	NodeStorage storage;
+	const TerrainData node = make_grid(side, storage);
+
+	NodeCache::NeighbourSerials neighbours;
+	for (uint nn = 0; nn < neighbours.size(); ++nn)
+	{
+		neighbours[nn] = nn == 3 ? 0 : 100 + nn;
+	}
+
+	const TileCache cache(directory.string(), parameters);
+	uint failures = 0;
+	auto expect = [&](bool passed, const char* what)
+	{
+		printf("%-46s %s\n", what, passed ? "ok" : "FAILED");
+		failures += passed ? 0 : 1;
+	};
+
+	Tile tile;
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile before it is written");
+	expect(cache.save(position, serial, neighbours, node), "tile written");
+
+	tile = Tile();
+	expect(cache.load(position, neighbours, max_bytes, tile) && matches(tile, node), "tile read back as written");
+
+	NodeCache::NeighbourSerials gone = neighbours;
+	gone[5] = 0;
+	expect(cache.load(position, gone, max_bytes, tile) && matches(tile, node), "tile read with a neighbour gone");
+
+	NodeCache::NeighbourSerials replaced = neighbours;
+	replaced[5] = 999;
+	expect(!cache.load(position, replaced, max_bytes, tile), "no tile with a neighbour replaced");
+
+	expect(!cache.load(position + glm::ivec2(1, 0), neighbours, max_bytes, tile), "no tile at another position");
+	expect(!TileCache(directory.string(), parameters + 1).load(position, neighbours, max_bytes, tile), "no tile with other parameters");
+	const uint64_t array_size = node.index_count * sizeof(uint32_t) * 2 + node.vertex_count * sizeof(glm::vec4)
+		+ node.index_count / 3 * sizeof(glm::vec3) + node.border_count * sizeof(uint32_t);
+	expect(!cache.load(position, neighbours, array_size - 1, tile), "no tile larger than max_bytes");
+
+	// The counts end the header, before the arrays
+	const std::filesystem::path path = std::filesystem::directory_iterator(directory)->path();
+	const std::vector<char> original = read_file(path);
+	const uint64_t header_size = original.size() - array_size;
+	const uint64_t index_count_offset = header_size - 4 * sizeof(uint32_t);
+
+	std::vector<char> bytes = original;
+	bytes.resize(bytes.size() - 4);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile cut short");
+
+	bytes = original;
+	bytes.push_back(0);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile with bytes after it");
+
+	bytes = original;
+	set_uint(bytes, 0, 0x5454494c);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile in the other byte order");
+
+	bytes = original;
+	set_uint(bytes, index_count_offset, 0x7ffffffe);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile with a huge index count");
+
+	bytes = original;
+	set_uint(bytes, index_count_offset + 4, 0xffffffff);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile with a huge vertex count");
+
+	bytes = original;
+	set_uint(bytes, header_size, node.vertex_count);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile with an index past its vertices");
+
+	bytes = original;
+	set_uint(bytes, header_size + node.index_count * sizeof(uint32_t) + node.vertex_count * sizeof(glm::vec4)
+		+ node.index_count / 3 * sizeof(glm::vec3), node.index_count / 3);
+	write_file(path, bytes);
+	expect(!cache.load(position, neighbours, max_bytes, tile), "no tile with a connection past its triangles");
+
+	write_file(path, original);
+	expect(cache.load(position, neighbours, max_bytes, tile) && matches(tile, node), "tile read again once restored");
+
+	std::filesystem::remove_all(directory);
+
+	printf("%s\n", failures == 0 ? "passed" : "FAILED");
+
+	return failures == 0 ? 0 : 1;
+}
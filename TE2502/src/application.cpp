@@ -9,6 +9,7 @@
 #include "quadtree.hpp"
 
 #include "cpu_triangulate.hpp"
+#include "cpu_triangulate_debug.hpp"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -264,7 +265,7 @@ Application::Application() :
 #endif
 
 #ifdef CPUTRI
-	cputri::setup(m_tfile);
+	m_cpu_terrain = new cputri::Terrain();
 #endif
 }
 
@@ -290,7 +291,7 @@ Application::~Application()
 	glfwTerminate();
 
 #ifdef CPUTRI
-	cputri::destroy();
+	delete m_cpu_terrain;
 #endif
 }
 
@@ -405,7 +406,7 @@ void Application::run(bool auto_triangulate)
 		update(delta_time.count());
 
 #ifdef CPUTRI
-		cputri::run(m_debug_drawer, *m_main_camera, *m_current_camera, *m_window, m_show_imgui);
+		cputri::run(*m_cpu_terrain, m_debug_drawer, *m_main_camera, *m_current_camera, *m_window, m_show_imgui);
 #endif
 
 		draw(auto_triangulate);
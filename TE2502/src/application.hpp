@@ -20,6 +20,11 @@
 
 #include <GLFW/glfw3.h>
 
+namespace cputri
+{
+	class Terrain;
+}
+
 // Main class for the program
 class Application
 {
@@ -121,6 +126,9 @@ private:
 	// Terrain generation/drawing
 	Quadtree m_quadtree;
 
+	// CPU terrain generation, only used if CPUTRI is defined
+	cputri::Terrain* m_cpu_terrain = nullptr;
+
 	// Debug drawing
 	PipelineLayout m_debug_pipeline_layout;
 	std::unique_ptr<Pipeline> m_debug_pipeline;
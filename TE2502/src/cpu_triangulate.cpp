@@ -1,15 +1,19 @@
 #include <algorithm>
 #include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <array>
+#include <limits>
+#include <random>
+#include <vector>
 #include <glm/gtc/constants.hpp>
 
-#include "vulkan/vulkan.h"
 #include "glm/glm.hpp"
 #include "cpu_triangulate.hpp"
-#include "graphics/window.hpp"
-#include "utilities.hpp"
-
-#include "imgui/imgui.h"
+#include "cpu_triangulate_data.hpp"
+#include "cpu_triangulate_predicates.hpp"
+#include "thread_pool.hpp"
 
 // Fritjof when coding in this file:
 //    ,,,,,
@@ -30,143 +34,15 @@
 namespace cputri
 {
 	using namespace glm;
-	typedef uint32_t uint;
-
-	#define TERRAIN_GENERATE_TOTAL_SIDE_LENGTH 1000
-	#define TERRAIN_GENERATE_NUM_INDICES 3000
-	#define TERRAIN_GENERATE_NUM_VERTICES 1000
-	#define TERRAIN_GENERATE_NUM_NODES 16
-	#define TERRAIN_GENERATE_GRID_SIDE 3
-	#define TRIANGULATE_MAX_NEW_POINTS 1024
-	#define QUADTREE_LEVELS 2
-	#define MAX_BORDER_TRIANGLE_COUNT 2000
-	#define ADJUST_PERCENTAGE 0.35f
-	
-	#define WORK_GROUP_SIZE 1
 
 	const uvec3 gl_GlobalInvocationID{ 0, 0, 0 };
 
-	uint num_indices;
-	uint num_vertices;
-	uint num_nodes;
-	uint num_new_points;
-	uint quadtree_levels;
-	uint max_border_triangle_count;
-
-	int max_points_per_refine = 9999999;
-	int vistris_start = 0;
-	int vistris_end = 99999999;
-	bool show_cc = false;
-	bool show = false;
-
-	struct Triangle
-	{
-		vec2 circumcentre;
-		float circumradius2;
-		uint pad;
-	};
-
-	struct BufferNodeHeader
-	{
-		uint vertex_count;
-		uint new_points_count;
-		uint pad;
-
-		vec2 min;
-		vec2 max;
-
-		uint border_count;
-		std::array<uint, MAX_BORDER_TRIANGLE_COUNT> border_triangle_indices;
-	};
-
-	struct TerrainData
-	{
-		uint index_count;
-		uint instance_count;
-		uint first_index;
-		int  vertex_offset;
-		uint first_instance;
-
-		// struct BufferNodeHeader {
-		uint vertex_count;
-		uint new_points_count;
-		uint pad;
-
-		vec2 min;
-		vec2 max;
-
-		uint border_count;
-		std::array<uint, MAX_BORDER_TRIANGLE_COUNT> border_triangle_indices;
-		// }
-
-		std::array<uint, TERRAIN_GENERATE_NUM_INDICES> indices;
-		std::array<vec4, TERRAIN_GENERATE_NUM_VERTICES> positions;
-		std::array<Triangle, TERRAIN_GENERATE_NUM_INDICES / 3> triangles;
-		std::array<uint, TERRAIN_GENERATE_NUM_INDICES> triangle_connections;
-		std::array<vec4, TRIANGULATE_MAX_NEW_POINTS> new_points;
-		std::array<uint, TRIANGULATE_MAX_NEW_POINTS> new_points_triangles;
-	};
-
-	const uint quadtree_data_size = (1 << QUADTREE_LEVELS) * (1 << QUADTREE_LEVELS) + 4;
-	const uint pad_size = 16 - (quadtree_data_size % 16);
-
-	struct TerrainBuffer
-	{
-		std::array<uint, (1 << QUADTREE_LEVELS) * (1 << QUADTREE_LEVELS)> quadtree_index_map;
-		vec2 quadtree_min;
-		vec2 quadtree_max;
-		std::array<uint, pad_size> pad;
-		std::array<TerrainData, TERRAIN_GENERATE_NUM_NODES> data;
-	};
-
-
-	struct GenerateInfo
-	{
-		vec2 min;
-		vec2 max;
-		uint index;
-	};
-	struct Quadtree {
-		// Number and array of indices to nodes that needs to generate terrain
-		uint num_generate_nodes;
-		GenerateInfo* generate_nodes;
-
-		// Number and array of indices to nodes that needs to draw terrain
-		uint num_draw_nodes;
-		uint* draw_nodes;
-
-		float total_side_length;
-
-		// Max number of active nodes
-		uint64_t max_nodes;
-
-		// For chunk i of m_buffer, quadtree.buffer_index_filled[i] is true if that chunk is used by a node
-		bool* buffer_index_filled;
-
-		uint* node_index_to_buffer_index;
-
-		uint64_t node_memory_size;
-		vec2* quadtree_minmax;
-
-		vec2 node_size;
-
-		const float quadtree_shift_distance = 100.0f;
-	};
-	Quadtree quadtree;
-
-	const uint INVALID = ~0u;
-
-	TerrainBuffer* terrain_buffer;
-	uint cpu_index_buffer_size;
-
 	const float gaussian_width = 1.0f;
 	const int filter_radius = 2;	// Side length of grid is filter_radius * 2 + 1
 	const int filter_side = filter_radius * 2 + 1;
-	float log_filter[filter_side * filter_side];
 
 
 #pragma region TERRAINSTUFF
-	float dump;
 	vec2 addxy = vec2(1.0f, 0.0f);
 	vec2 addyy = vec2(0.0f, 0.0f);
 	vec2 addxx = vec2(1.0f, 1.0f);
@@ -188,14 +64,13 @@ namespace cputri
 		return a;
 	}
 
-	const mat2 rotate2D = mat2(1.3623f, 1.7531f, -1.7131f, 1.4623f);
-
 	//// Low-res stuff
 
 	float hash12(vec2 p)
 	{
 		vec3 p3 = fract(vec3(p.x, p.y, p.x) * HASHSCALE1);
 		p3 += dot(p3, vec3(p3.y, p3.z, p3.x) + 19.19f);
+		float dump;
 		return modff((p3.x + p3.y) * p3.z, &dump);
 	}
 
@@ -210,23 +85,13 @@ namespace cputri
 		return res;
 	}
 
+	// Evaluated by the kernels in cpu_triangulate_simd.cpp, which do the same as the shader's terrain().
+	// Use evaluate_terrain directly to get many heights at once
 	float terrain(vec2 p)
 	{
-		vec2 pos = p * 0.05f;
-		float w = (noise(pos * 0.25f) * 0.75f + 0.15f);
-		w = 66.0f * w * w;
-		vec2 dxy = vec2(0.0, 0.0);
-		float f = .0;
-		for (int i = 0; i < 5; i++)
-		{
-			f += w * noise(pos);
-			w = -w * 0.4f;
-			pos = rotate2D * pos;
-		}
-		float ff = noise(pos * 0.002f);
-
-		f += pow(abs(ff), 5.0f) * 275.0f - 5.0f;
-		return f;
+		float height;
+		evaluate_terrain(&p.x, &p.y, 1, &height);
+		return height;
 	}
 
 	float height_to_surface(vec3 p)
@@ -262,35 +127,12 @@ namespace cputri
 	}
 
 	//--------------------------------------------------------------------------
-	// High def version only used for grabbing normal information.
+	// High def version only used for grabbing normal information. The same as terrain() with six more octaves
 	float terrain2(vec2 p)
 	{
-		// There's some real magic numbers in here! 
-		// The noise calls add large mountain ranges for more variation over distances...
-		vec2 pos = p * 0.05f;
-		float w = (noise(pos * 0.25f) * 0.75f + 0.15f);
-		w = 66.0f * w * w;
-		vec2 dxy = vec2(0.0f, 0.0f);
-		float f = 0.0f;
-		for (int i = 0; i < 5; i++)
-		{
-			f += w * noise(pos);
-			w = -w * 0.4f;	//...Flip negative and positive for varition	   
-			pos = rotate2D * pos;
-		}
-		float ff = noise(pos * 0.002f);
-		f += powf(abs(ff), 5.0f) * 275.0f - 5.0f;
-
-
-		// That's the last of the low resolution, now go down further for the Normal data...
-		for (int i = 0; i < 6; i++)
-		{
-			f += w * noise(pos);
-			w = -w * 0.4f;
-			pos = rotate2D * pos;
-		}
-
-		return f;
+		float height;
+		evaluate_terrain2(&p.x, &p.y, 1, &height);
+		return height;
 	}
 
 	///////
@@ -457,42 +299,150 @@ namespace cputri
 			abs(p.z) <= p.w);
 	}
 
-	float curvature(vec3 p)
+	// Laplacian of Gaussian kernel used by curvature()
+	std::array<float, filter_side * filter_side> create_log_filter()
 	{
-		const float pi = 3.1415f;
+		std::array<float, filter_side * filter_side> filter;
 
-		float sample_step = 1.0f;
+		float sum = 0.0f;
 
-		float curvature = 0.0f;
+		for (int64_t x = -filter_radius; x <= filter_radius; x++)
+		{
+			for (int64_t y = -filter_radius; y <= filter_radius; y++)
+			{
+				// https://homepages.inf.ed.ac.uk/rbf/HIPR2/log.htm
+				float t = -((x * x + y * y) / (2.0f * gaussian_width * gaussian_width));
+				float log = -(1.0f / (pi<float>() * powf(gaussian_width, 4.0f))) * (1.0f + t) * exp(t);
+
+				filter[(y + filter_radius) * filter_side + (x + filter_radius)] = log;
+				sum += log;
+			}
+		}
+
+		// Normalize filter
+		float correction = 1.0f / sum;
+		for (uint64_t i = 0; i < filter_side * filter_side; i++)
+		{
+			filter[i] *= correction;
+		}
+
+		return filter;
+	}
 
+	// Only read after static initialization, so all terrains and threads can share it
+	const std::array<float, filter_side * filter_side> log_filter = create_log_filter();
+
+	const uint curvature_samples = filter_side * filter_side;
+
+	// Sum of filter weight times squared offset along one axis. The filter is symmetric, so for a smooth terrain
+	// curvatures() gives about abs(0.5 * log_second_moment * laplacian), with the laplacian of the terrain blurred
+	// by the filter's Gaussian
+	float find_log_second_moment()
+	{
+		float moment = 0.0f;
+		for (int x = -filter_radius; x <= filter_radius; x++)
+		{
+			for (int y = -filter_radius; y <= filter_radius; y++)
+			{
+				moment += log_filter[(y + filter_radius) * filter_side + (x + filter_radius)] * float(x * x);
+			}
+		}
+
+		return moment;
+	}
+
+	const float log_second_moment = find_log_second_moment();
+
+	// Curvature from the heights of the filter samples around a point, in the order curvatures() evaluates them
+	float filter_heights(const float* heights)
+	{
+		float curvature = 0.0f;
 		for (int x = -filter_radius; x <= filter_radius; x++)
 		{
 			for (int y = -filter_radius; y <= filter_radius; y++)
 			{
-				curvature += terrain(vec2(p.x, p.z) + vec2(sample_step * x, sample_step * y)) * log_filter[(y + filter_radius) * filter_side + (x + filter_radius)];
+				curvature += heights[(x + filter_radius) * filter_side + (y + filter_radius)] * log_filter[(y + filter_radius) * filter_side + (x + filter_radius)];
 			}
 		}
 
-		// Normalize for height
-		curvature -= terrain(vec2(p.x, p.z));
+		// Normalize for height, the middle sample is the height at the point
+		curvature -= heights[filter_radius * filter_side + filter_radius];
 
 		return abs(curvature);
 	}
 
+	// Number of points whose filter samples are evaluated in one batch by curvatures()
+	const uint curvature_batch_size = 16;
+
+	// Curvature of the terrain at each of the count positions (x[i], z[i]), found by filtering the heights around them.
+	// The heights of the filter samples of several positions are evaluated at once
+	void curvatures(const float* x, const float* z, uint count, float* results)
+	{
+		const float sample_step = 1.0f;
+
+		float sample_x[curvature_batch_size * curvature_samples];
+		float sample_z[curvature_batch_size * curvature_samples];
+		float heights[curvature_batch_size * curvature_samples];
+
+		for (uint first = 0; first < count; first += curvature_batch_size)
+		{
+			const uint batch_size = std::min(count - first, curvature_batch_size);
+
+			uint ss = 0;
+			for (uint pp = 0; pp < batch_size; ++pp)
+			{
+				for (int sx = -filter_radius; sx <= filter_radius; sx++)
+				{
+					for (int sy = -filter_radius; sy <= filter_radius; sy++)
+					{
+						sample_x[ss] = x[first + pp] + sample_step * sx;
+						sample_z[ss] = z[first + pp] + sample_step * sy;
+						++ss;
+					}
+				}
+			}
+
+			evaluate_terrain(sample_x, sample_z, ss, heights);
+
+			for (uint pp = 0; pp < batch_size; ++pp)
+			{
+				results[first + pp] = filter_heights(heights + pp * curvature_samples);
+			}
+		}
+	}
+
+	// Same as curvatures(), but from the second derivatives of the terrain found in closed form, in one evaluation
+	// per position instead of one per filter sample
+	void analytic_curvatures(const float* x, const float* z, uint count, float* results)
+	{
+		for (uint pp = 0; pp < count; ++pp)
+		{
+			const TerrainDerivatives derivatives = terrain_with_derivatives<0>(x[pp], z[pp], gaussian_width);
+			results[pp] = abs(0.5f * log_second_moment * (derivatives.hessian.x + derivatives.hessian.z));
+		}
+	}
 
-	void setup(TFile& tfile)
+	float curvature(vec3 p)
 	{
-		num_indices = TERRAIN_GENERATE_NUM_INDICES;
-		num_vertices = TERRAIN_GENERATE_NUM_VERTICES;
-		num_nodes = TERRAIN_GENERATE_NUM_NODES;
-		num_new_points = TRIANGULATE_MAX_NEW_POINTS;
-		quadtree_levels = QUADTREE_LEVELS;
-		max_border_triangle_count = MAX_BORDER_TRIANGLE_COUNT;
+		float result;
+		curvatures(&p.x, &p.z, 1, &result);
+		return result;
+	}
 
+
+	Terrain::Terrain(uint thread_count)
+	{
 		assert(quadtree_levels > 0);
 
-		quadtree.buffer_index_filled = new bool[num_nodes];
-		memset(quadtree.buffer_index_filled, 0, num_nodes * sizeof(bool));
+		thread_pool = new ThreadPool(thread_count);
+		contexts = new TriangulationContext[thread_pool->get_thread_count()];
+		border_grids = new BorderGrid[num_nodes];
+		error_caches = new ErrorCache[num_nodes];
+		batch = new InsertionBatch();
+		processing = new TriangleProcessing();
+		reset_statistics();
+
+		quadtree.node_slots = SlotAllocator(num_nodes);
 
 		quadtree.num_generate_nodes = 0;
 		quadtree.generate_nodes = new GenerateInfo[num_nodes];
@@ -500,26 +450,22 @@ namespace cputri
 		quadtree.num_draw_nodes = 0;
 		quadtree.draw_nodes = new uint[num_nodes];
 
-		quadtree.node_memory_size =
-			sizeof(VkDrawIndexedIndirectCommand) +
-			sizeof(BufferNodeHeader) +
-			num_indices * sizeof(uint) + // Indices
-			num_vertices * sizeof(vec4) + // Vertices
-			(num_indices / 3) * sizeof(Triangle) + // Circumcentre and circumradius
-			num_indices * sizeof(uint) + // Triangle connectivity
-			num_new_points * sizeof(vec4) + // New points
-			num_new_points * sizeof(uint); // New point triangle index
+		// Nodes have no arrays until they are generated
+		mesh_arena = new MeshArena(TERRAIN_MEMORY_BUDGET);
+		terrain_buffer = new TerrainBuffer();
 
-		// Add space for an additional two vec2's to store the quadtree min and max
-		cpu_index_buffer_size = (1 << quadtree_levels) * (1 << quadtree_levels) * sizeof(uint) + sizeof(vec2) * 2;
-		cpu_index_buffer_size += 64 - (cpu_index_buffer_size % 64);
+		node_cache = new NodeCache();
+		node_cache->set_capacity(TERRAIN_NODE_CACHE_SIZE);
+		node_serials = new uint64_t[num_nodes]();
 
-		terrain_buffer = (TerrainBuffer*) new char[cpu_index_buffer_size + quadtree.node_memory_size * num_nodes + 1000];
+		// No tile cache until set_tile_cache is called
+		tile_cache = nullptr;
+		tile = new Tile();
 
-		quadtree.node_index_to_buffer_index = (uint*)terrain_buffer;
+		quadtree.node_index_to_buffer_index = terrain_buffer->quadtree_index_map.data();
 
-		// Point to the end of cpu index buffer
-		quadtree.quadtree_minmax = (vec2*) (((char*)quadtree.node_index_to_buffer_index) + (1 << quadtree_levels) * (1 << quadtree_levels) * sizeof(uint));
+		// Quadtree min and max follow the index map
+		quadtree.quadtree_minmax = &terrain_buffer->quadtree_min;
 
 		quadtree.total_side_length = TERRAIN_GENERATE_TOTAL_SIDE_LENGTH;
 		float half_length = quadtree.total_side_length * 0.5f;
@@ -528,853 +474,1333 @@ namespace cputri
 
 		// (1 << levels) is number of nodes per axis
 		memset(quadtree.node_index_to_buffer_index, INVALID, (1 << quadtree_levels) * (1 << quadtree_levels) * sizeof(uint));
+		quadtree.map_origin = uvec2(0);
 
 		quadtree.node_size = vec2(quadtree.total_side_length / (1 << quadtree_levels), quadtree.total_side_length / (1 << quadtree_levels));
-
-		// Create filter kernel
-		const float gaussian_width = 1.0f;
-
-		float sum = 0.0f;
-
-		for (int64_t x = -filter_radius; x <= filter_radius; x++)
-		{
-			for (int64_t y = -filter_radius; y <= filter_radius; y++)
-			{
-				// https://homepages.inf.ed.ac.uk/rbf/HIPR2/log.htm
-				float t = -((x * x + y * y) / (2.0f * gaussian_width * gaussian_width));
-				float log = -(1.0f / (pi<float>() * powf(gaussian_width, 4.0f))) * (1.0f + t) * exp(t);
-
-				log_filter[(y + filter_radius) * filter_side + (x + filter_radius)] = log;
-				sum += log;
-			}
-		}
-
-		// Normalize filter
-		float correction = 1.0f / sum;
-		for (uint64_t i = 0; i < filter_side * filter_side; i++)
-		{
-			log_filter[i] *= correction;
-		}
 	}
 
-	void destroy()
+	Terrain::~Terrain()
 	{
-		delete[] terrain_buffer;
+		save_tiles();
+
+		delete tile;
+		delete tile_cache;
+		delete[] node_serials;
+		delete node_cache;
+		delete terrain_buffer;
+		delete mesh_arena;
 		delete[] quadtree.draw_nodes;
 		delete[] quadtree.generate_nodes;
-		delete[] quadtree.buffer_index_filled;
+		delete processing;
+		delete batch;
+		delete[] error_caches;
+		delete[] border_grids;
+		delete[] contexts;
+		delete thread_pool;
 	}
 
-	int temp = 0;
-	int vertices_per_refine = 1;
-	int show_connections = -1;
-	int refine_node = -1;
-	int sideshow_bob = 0;
+	uint Terrain::get_thread_count() const
+	{
+		return thread_pool->get_thread_count();
+	}
 
-	bool do_triangulation = false;
+	TriangulationContext& Terrain::caller_context()
+	{
+		// parallel_for runs the calling thread as the last thread
+		return contexts[thread_pool->get_thread_count() - 1];
+	}
 
-	void run(DebugDrawer& dd, Camera& main_camera, Camera& current_camera, Window& window, bool show_imgui)
+	uint Terrain::get_offset(uint node_x, uint node_z)
 	{
-		Frustum fr = main_camera.get_frustum();
-		do_triangulation = false;
-		cputri::intersect(fr, dd, main_camera.get_pos());
+		assert(node_x >= 0u && node_x < (1u << quadtree_levels));
+		assert(node_z >= 0u && node_z < (1u << quadtree_levels));
+
+		return quadtree.node_index_to_buffer_index[get_map_index(node_x, node_z)];
+	}
 
-		cputri::draw_terrain(fr, dd, current_camera, window);
+	uint Terrain::get_map_index(uint x, uint y) const
+	{
+		const uint mask = (1u << quadtree_levels) - 1;
+		return ((y + quadtree.map_origin.y) & mask) * (1u << quadtree_levels) + ((x + quadtree.map_origin.x) & mask);
+	}
 
-		static float threshold = 0.0f;
-		static float area_mult = 1.0f;
-		static float curv_mult = 1.0f;
+	void Terrain::shift_quadtree(glm::vec3 camera_pos)
+	{
+		const int nodes_per_side = 1 << quadtree_levels;
+		const float shift_distance = quadtree.quadtree_shift_distance;
 
-		if (show_imgui)
+		// Whole nodes to move along x and z until the camera is further than the shift distance from every side,
+		// found at once instead of moving one node and checking again
+		ivec2 steps(0);
+		for (uint axis = 0; axis < 2; ++axis)
 		{
-			ImGui::Begin("Lol");
-			ImGui::SliderInt("Index", &temp, -1, 15);
-			ImGui::SliderInt("Vertices per refine", &vertices_per_refine, 1, 10);
-			ImGui::SliderInt("Show Connections", &show_connections, -1, 200);
-			ImGui::SliderInt("Refine Node", &refine_node, -1, TERRAIN_GENERATE_NUM_NODES - 1);
-			ImGui::SliderInt("Sideshow", &sideshow_bob, -1, 8);
+			const float camera = axis == 0 ? camera_pos.x : camera_pos.z;
+			const float min = quadtree.quadtree_minmax[0][axis];
+			const float max = quadtree.quadtree_minmax[1][axis];
+			const float size = quadtree.node_size[axis];
+
+			if (camera + shift_distance >= max)
+				steps[axis] = int((camera + shift_distance - max) / size) + 1;
+			else if (camera - shift_distance <= min)
+				steps[axis] = -(int((min - camera + shift_distance) / size) + 1);
+		}
 
-			ImGui::End();
+		for (uint axis = 0; axis < 2; ++axis)
+		{
+			const int direction = steps[axis] > 0 ? 1 : -1;
+			const int count = std::abs(steps[axis]);
 
-			ImGui::Begin("cputri");
-			if (ImGui::Button("Refine"))
-			{
-				cputri::process_triangles(main_camera, window, threshold, area_mult, curv_mult);
-				triangulate();
-			}
-			else if (do_triangulation)
+			// After a whole quadtree of steps every node has left, so a teleport only moves the empty quadtree the rest of the way
+			for (int ss = 0; ss < std::min(count, nodes_per_side); ++ss)
 			{
-				triangulate();
+				shift_quadtree(axis, direction);
 			}
-			if (ImGui::Button("Clear Terrain"))
+
+			if (count > nodes_per_side)
 			{
-				clear_terrain();
+				const float distance = (count - nodes_per_side) * direction * quadtree.node_size[axis];
+				quadtree.quadtree_minmax[0][axis] += distance;
+				quadtree.quadtree_minmax[1][axis] += distance;
 			}
-
-			ImGui::DragFloat("Area mult", &area_mult, 0.01f, 0.0f, 50.0f);
-			ImGui::DragFloat("Curv mult", &curv_mult, 0.01f, 0.0f, 50.0f);
-			ImGui::DragFloat("Threshold", &threshold, 0.01f, 0.0f, 50.0f);
-
-			ImGui::Checkbox("Show", &show);
-			ImGui::Checkbox("Show CC", &show_cc);
-
-			ImGui::DragInt("Max Points", &max_points_per_refine);
-			ImGui::DragInt("Vistris Start", &vistris_start, 0.1f);
-			ImGui::DragInt("Vistris End", &vistris_end, 0.1f);
-			ImGui::End();
 		}
 	}
 
-	uint find_chunk()
+	void Terrain::shift_quadtree(uint axis, int direction)
 	{
-		for (uint i = 0; i < num_nodes; i++)
+		const uint nodes_per_side = 1 << quadtree_levels;
+
+		// The row or column on the side moved away from leaves the quadtree
+		const uint leaving = direction > 0 ? 0 : nodes_per_side - 1;
+		for (uint ii = 0; ii < nodes_per_side; ++ii)
 		{
-			if (!quadtree.buffer_index_filled[i])
-				return i;
+			if (axis == 0)
+				cache_node(leaving, ii);
+			else
+				cache_node(ii, leaving);
 		}
 
-		return INVALID;
-	}
+		quadtree.quadtree_minmax[0][axis] += direction * quadtree.node_size[axis];
+		quadtree.quadtree_minmax[1][axis] += direction * quadtree.node_size[axis];
 
-	uint get_offset(uint node_x, uint node_z)
-	{
-		assert(node_x >= 0u && node_x < (1u << quadtree_levels));
-		assert(node_z >= 0u && node_z < (1u << quadtree_levels));
+		// Moving the origin turns its entries into the row or column coming in on the other side, nothing else moves
+		quadtree.map_origin[axis] = (quadtree.map_origin[axis] + direction) & (nodes_per_side - 1);
 
-		return quadtree.node_index_to_buffer_index[node_x + (1u << quadtree_levels) * node_z];
+		const uint entering = nodes_per_side - 1 - leaving;
+		for (uint ii = 0; ii < nodes_per_side; ++ii)
+		{
+			quadtree.node_index_to_buffer_index[axis == 0 ? get_map_index(entering, ii) : get_map_index(ii, entering)] = INVALID;
+		}
 	}
 
-	uint64_t get_index_offset_of_node(uint i)
+	void Terrain::clear_terrain()
 	{
-		return get_offset_of_node(i) + sizeof(VkDrawIndexedIndirectCommand) + sizeof(BufferNodeHeader);
+		save_tiles();
+
+		memset(quadtree.node_index_to_buffer_index, INVALID, (1 << quadtree_levels) * (1 << quadtree_levels) * sizeof(uint));
+		quadtree.map_origin = uvec2(0);
+		quadtree.node_slots.clear();
+		node_cache->clear();
+
+		for (uint ii = 0; ii < (1 << quadtree_levels) * (1 << quadtree_levels); ii++)
+		{
+			terrain_buffer->data[ii].instance_count = 0;
+		}
+
+		for (uint ii = 0; ii < num_nodes; ii++)
+		{
+			release_node(ii);
+		}
 	}
 
-	uint64_t get_vertex_offset_of_node(uint i)
+	uint64_t Terrain::get_triangle_count()
 	{
-		return get_index_offset_of_node(i) + num_indices * sizeof(uint);
+		uint64_t triangle_count = 0;
+		for (uint i = 0; i < (1 << quadtree_levels) * (1 << quadtree_levels); i++)
+		{
+			if (quadtree.node_index_to_buffer_index[i] != INVALID)
+				triangle_count += terrain_buffer->data[quadtree.node_index_to_buffer_index[i]].index_count / 3;
+		}
 
+		return triangle_count;
 	}
 
-	uint64_t get_offset_of_node(uint i)
+	bool Terrain::is_node_active(uint node_index) const
 	{
-		return cpu_index_buffer_size + i * quadtree.node_memory_size;
+		for (uint i = 0; i < (1 << quadtree_levels) * (1 << quadtree_levels); i++)
+		{
+			if (quadtree.node_index_to_buffer_index[i] == node_index)
+				return true;
+		}
+
+		return false;
 	}
 
-	void shift_quadtree(glm::vec3 camera_pos)
+	bool Terrain::check_mesh(std::string& error) const
 	{
-		size_t nodes_per_side = (1ull << quadtree_levels);
-
-		bool shifted = false;
+		char message[256];
 
-		do
+		for (uint i = 0; i < (1 << quadtree_levels) * (1 << quadtree_levels); i++)
 		{
-			shifted = false;
+			const uint node_index = quadtree.node_index_to_buffer_index[i];
+			if (node_index == INVALID)
+				continue;
 
-			if (camera_pos.x + quadtree.quadtree_shift_distance >= quadtree.quadtree_minmax[1].x)
-			{
-				shifted = true;
+			const TerrainData& node = terrain_buffer->data[node_index];
+			const uint triangle_count = node.index_count / 3;
 
-				quadtree.quadtree_minmax[0].x += quadtree.node_size.x;
-				quadtree.quadtree_minmax[1].x += quadtree.node_size.x;
+			if (node.index_count % 3 != 0 || node.index_count > node.triangle_capacity * 3 || node.vertex_count > node.vertex_capacity)
+			{
+				snprintf(message, sizeof(message), "node %u: %u indices and %u vertices do not fit its arrays", node_index, node.index_count, node.vertex_count);
+				error = message;
+				return false;
+			}
 
-				for (size_t y = 0; y < nodes_per_side; ++y)
+			for (uint ii = 0; ii < node.index_count; ++ii)
+			{
+				if (node.indices[ii] >= node.vertex_count)
 				{
-					for (size_t x = 0; x < nodes_per_side; ++x)
-					{
-						size_t index = y * nodes_per_side + x;
-
-						if (x == nodes_per_side - 1)
-						{
-							quadtree.node_index_to_buffer_index[index] = INVALID;
-						}
-						else
-						{
-							if (x == 0 && quadtree.node_index_to_buffer_index[index] != INVALID)
-							{
-								quadtree.buffer_index_filled[quadtree.node_index_to_buffer_index[index]] = false;
-							}
-
-							quadtree.node_index_to_buffer_index[index] = quadtree.node_index_to_buffer_index[index + 1];
-						}
-					}
+					snprintf(message, sizeof(message), "node %u: index %u is %u, past its %u vertices", node_index, ii, node.indices[ii], node.vertex_count);
+					error = message;
+					return false;
 				}
 			}
-			else if (camera_pos.x - quadtree.quadtree_shift_distance <= quadtree.quadtree_minmax[0].x)
-			{
-				shifted = true;
-
-				quadtree.quadtree_minmax[0].x -= quadtree.node_size.x;
-				quadtree.quadtree_minmax[1].x -= quadtree.node_size.x;
 
-				for (size_t y = 0; y < nodes_per_side; ++y)
+			// Connection ss is the edge from corner ss to corner ss + 1, which the neighbour has the other way around
+			for (uint tt = 0; tt < triangle_count; ++tt)
+			{
+				for (uint ss = 0; ss < 3; ++ss)
 				{
-					for (int64_t x = nodes_per_side - 1; x >= 0; --x)
-					{
-						size_t index = y * nodes_per_side + x;
+					const uint neighbour = node.triangle_connections[tt * 3 + ss];
+					if (neighbour >= INVALID - 9)
+						continue;
 
-						if (x == 0)
+					bool mutual = false;
+					if (neighbour < triangle_count)
+					{
+						const uint from = node.indices[tt * 3 + ss];
+						const uint to = node.indices[tt * 3 + (ss + 1) % 3];
+						for (uint ns = 0; ns < 3; ++ns)
 						{
-							quadtree.node_index_to_buffer_index[index] = INVALID;
+							mutual = mutual || (node.triangle_connections[neighbour * 3 + ns] == tt
+								&& node.indices[neighbour * 3 + ns] == to && node.indices[neighbour * 3 + (ns + 1) % 3] == from);
 						}
-						else
-						{
-							if (x == nodes_per_side - 1 && quadtree.node_index_to_buffer_index[index] != INVALID)
-							{
-								quadtree.buffer_index_filled[quadtree.node_index_to_buffer_index[index]] = false;
-							}
+					}
 
-							quadtree.node_index_to_buffer_index[index] = quadtree.node_index_to_buffer_index[index - 1];
-						}
+					if (!mutual)
+					{
+						snprintf(message, sizeof(message), "node %u: triangle %u side %u connects to %u, which does not share the edge back", node_index, tt, ss, neighbour);
+						error = message;
+						return false;
 					}
 				}
 			}
-			else if (camera_pos.z + quadtree.quadtree_shift_distance >= quadtree.quadtree_minmax[1].y)
-			{
-				shifted = true;
-
-				quadtree.quadtree_minmax[0].y += quadtree.node_size.y;
-				quadtree.quadtree_minmax[1].y += quadtree.node_size.y;
 
-				for (size_t y = 0; y < nodes_per_side; ++y)
+			for (uint bb = 0; bb < node.border_count; ++bb)
+			{
+				if (node.border_triangle_indices[bb] >= triangle_count)
 				{
-					for (size_t x = 0; x < nodes_per_side; ++x)
-					{
-						size_t index = y * nodes_per_side + x;
-
-						if (y == nodes_per_side - 1)
-						{
-							quadtree.node_index_to_buffer_index[index] = INVALID;
-						}
-						else
-						{
-							if (y == 0 && quadtree.node_index_to_buffer_index[index] != INVALID)
-							{
-								quadtree.buffer_index_filled[quadtree.node_index_to_buffer_index[index]] = false;
-							}
-
-							quadtree.node_index_to_buffer_index[index] = quadtree.node_index_to_buffer_index[index + nodes_per_side];
-						}
-					}
+					snprintf(message, sizeof(message), "node %u: border triangle %u is %u, past its %u triangles", node_index, bb, node.border_triangle_indices[bb], triangle_count);
+					error = message;
+					return false;
 				}
 			}
-			else if (camera_pos.z - quadtree.quadtree_shift_distance <= quadtree.quadtree_minmax[0].y)
-			{
-				shifted = true;
+		}
 
-				quadtree.quadtree_minmax[0].y -= quadtree.node_size.y;
-				quadtree.quadtree_minmax[1].y -= quadtree.node_size.y;
+		// The ring map has to put every node where the quadtree is now, and no node in two places
+		const uint nodes_per_side = 1 << quadtree_levels;
+		std::vector<bool> mapped(num_nodes, false);
+		for (uint y = 0; y < nodes_per_side; ++y)
+		{
+			for (uint x = 0; x < nodes_per_side; ++x)
+			{
+				const uint node_index = quadtree.node_index_to_buffer_index[get_map_index(x, y)];
+				if (node_index == INVALID)
+					continue;
 
-				for (int64_t y = nodes_per_side - 1; y >= 0; --y)
+				if (node_index >= num_nodes || mapped[node_index])
 				{
-					for (size_t x = 0; x < nodes_per_side; ++x)
-					{
-						size_t index = y * nodes_per_side + x;
-
-						if (y == 0)
-						{
-							quadtree.node_index_to_buffer_index[index] = INVALID;
-						}
-						else
-						{
-							if (y == nodes_per_side - 1 && quadtree.node_index_to_buffer_index[index] != INVALID)
-							{
-								quadtree.buffer_index_filled[quadtree.node_index_to_buffer_index[index]] = false;
-							}
+					snprintf(message, sizeof(message), "node %u: at quadtree position %u %u and somewhere else", node_index, x, y);
+					error = message;
+					return false;
+				}
+				mapped[node_index] = true;
 
-							quadtree.node_index_to_buffer_index[index] = quadtree.node_index_to_buffer_index[index - nodes_per_side];
-						}
-					}
+				const vec2 expected = quadtree.quadtree_minmax[0] + vec2(x, y) * quadtree.node_size;
+				const vec2 min = terrain_buffer->data[node_index].min;
+				if (any(greaterThan(abs(min - expected), quadtree.node_size * 0.01f)))
+				{
+					snprintf(message, sizeof(message), "node %u: at quadtree position %u %u starts at %f %f instead of %f %f", node_index, x, y,
+						min.x, min.y, expected.x, expected.y);
+					error = message;
+					return false;
 				}
 			}
-		} while (shifted);
+		}
+
+		return true;
 	}
 
-	void clear_terrain()
+	Statistics Terrain::get_statistics() const
 	{
-		memset(quadtree.node_index_to_buffer_index, INVALID, (1 << quadtree_levels) * (1 << quadtree_levels) * sizeof(uint));
-		memset(quadtree.buffer_index_filled, 0, num_nodes * sizeof(bool));
+		Statistics statistics{};
+		for (uint i = 0; i < thread_pool->get_thread_count(); i++)
+		{
+			statistics.points_inserted += contexts[i].statistics.points_inserted;
+			statistics.triangles_created += contexts[i].statistics.triangles_created;
+			statistics.insertions_discarded += contexts[i].statistics.insertions_discarded;
+			statistics.cavity_triangles += contexts[i].statistics.cavity_triangles;
+			statistics.largest_cavity = std::max(statistics.largest_cavity, contexts[i].statistics.largest_cavity);
+			statistics.exact_predicates += contexts[i].statistics.exact_predicates;
+			statistics.node_cache_hits += contexts[i].statistics.node_cache_hits;
+			statistics.node_cache_misses += contexts[i].statistics.node_cache_misses;
+			statistics.tiles_loaded += contexts[i].statistics.tiles_loaded;
+			statistics.error_cache_hits += contexts[i].statistics.error_cache_hits;
+			statistics.error_cache_misses += contexts[i].statistics.error_cache_misses;
+			statistics.points_over_budget += contexts[i].statistics.points_over_budget;
+			statistics.refine_time_exhausted += contexts[i].statistics.refine_time_exhausted;
+			statistics.vertices_removed += contexts[i].statistics.vertices_removed;
+		}
 
-		for (uint ii = 0; ii < (1 << quadtree_levels) * (1 << quadtree_levels); ii++)
+		return statistics;
+	}
+
+	void Terrain::reset_statistics()
+	{
+		for (uint i = 0; i < thread_pool->get_thread_count(); i++)
 		{
-			terrain_buffer->data[ii].instance_count = 0;
+			contexts[i].statistics = Statistics{};
 		}
 	}
 
-	void triangulate()
+	vec3 Terrain::get_normal(vec2 position, float step) const
 	{
-		const int nodes_per_side = 1 << quadtree_levels;
-		for (int yy = 0; yy < 3; ++yy)
+		if (derivative_mode == DERIVATIVE_MODE::ANALYTIC)
 		{
-			for (int xx = 0; xx < 3; ++xx)
-			{
-				for (int ty = yy; ty < nodes_per_side; ty += 3)
-				{
-					for (int tx = xx; tx < nodes_per_side; tx += 3)
-					{
-						bool all_valid = true;
-						// Check self and neighbour nodes
-						for (int y = -1; y <= 1; ++y)
-						{
-							for (int x = -1; x <= 1; ++x)
-							{
-								const int nx = tx + x;
-								const int ny = ty + y;
-								if (nx >= 0 && nx < nodes_per_side && ny >= 0 && ny < nodes_per_side)
-								{
-									const uint neighbour_index = quadtree.node_index_to_buffer_index[ny * nodes_per_side + nx];
-									if (neighbour_index == INVALID)
-									{
-										all_valid = false;
-									}
-								}
-								else
-								{
-									all_valid = false;
-								}
-							}
-						}
-
-						if (all_valid)
-						{
-							uint index = quadtree.node_index_to_buffer_index[ty * nodes_per_side + tx];
-							triangulate_shader(index);
-						}
-					}
-				}
-			}
+			const TerrainDerivatives derivatives = terrain_with_derivatives<6>(position.x, position.y, 0.0f);
+			return normalize(vec3(-derivatives.gradient.x, 1.0f, -derivatives.gradient.y));
 		}
+
+		// Same as terrain_draw.frag
+		const vec3 nor = vec3(0.0f, terrain2(position), 0.0f);
+		const vec3 v2 = nor - vec3(step, terrain2(position + vec2(step, 0.0f)), 0.0f);
+		const vec3 v3 = nor - vec3(0.0f, terrain2(position + vec2(0.0f, -step)), -step);
+		return normalize(cross(v2, v3));
 	}
 
-	void process_triangles(Camera& camera, Window& window, float em_threshold, float area_multiplier, float curvature_multiplier)
+	void Terrain::set_memory_budget(uint64_t bytes)
 	{
-		// Nonupdated terrain
-		for (uint i = 0; i < quadtree.num_draw_nodes; i++)
-		{
-			triangle_process_shader(
-				camera.get_vp(),
-				vec4(camera.get_pos(), 0),
-				window.get_size(),
-				em_threshold,
-				area_multiplier,
-				curvature_multiplier,
-				quadtree.draw_nodes[i]);
-		}
-
-		// Newly generated terrain
-		for (uint i = 0; i < quadtree.num_generate_nodes; i++)
-		{
-			triangle_process_shader(
-				camera.get_vp(),
-				vec4(camera.get_pos(), 0),
-				window.get_size(),
-				em_threshold,
-				area_multiplier,
-				curvature_multiplier,
-				quadtree.generate_nodes[i].index);
-		}
+		mesh_arena->set_budget(bytes);
 	}
 
-	void intersect(Frustum& frustum, DebugDrawer& dd, vec3 camera_pos)
+	uint64_t Terrain::get_memory_used() const
 	{
-		shift_quadtree(camera_pos);
-
-		quadtree.num_generate_nodes = 0;
-		quadtree.num_draw_nodes = 0;
+		return mesh_arena->get_used();
+	}
 
-		float half_length = quadtree.total_side_length * 0.5f;
-		
-		// Gather status of nodes
-		intersect(frustum, dd, AabbXZ{ quadtree.quadtree_minmax[0],
-			quadtree.quadtree_minmax[1] }, 0, 0, 0);
+	uint64_t Terrain::get_memory_reserved() const
+	{
+		return mesh_arena->get_reserved();
+	}
 
-		for (uint i = 0; i < quadtree.num_generate_nodes; i++)
+	void Terrain::set_node_cache_size(uint count)
+	{
+		node_cache->set_capacity(std::min(count, (uint)TERRAIN_NODE_CACHE_SIZE));
+		while (node_cache->get_count() > node_cache->get_capacity())
 		{
-			generate_shader(quadtree.generate_nodes[i].index, quadtree.generate_nodes[i].min, quadtree.generate_nodes[i].max);
-			do_triangulation = true;
+			free_node(node_cache->pop_oldest());
 		}
 	}
 
-	const float EPSILON = 1e-5f;
-	int intersect_triangle(glm::vec3 r_o, glm::vec3 r_d, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, float * t)
+	uint Terrain::get_node_cache_size() const
 	{
-		vec3 edge1, edge2, tvec, pvec, qvec;
-		float det, inv_det, u, v;
-
-		//find vecotrs fo two edges sharing vert0
-		edge1 = p1 - p0;
-		edge2 = p2 - p0;
-
-		//begin calculationg determinant
-		pvec = cross(r_d, edge2);
+		return node_cache->get_capacity();
+	}
 
-		//if determinant is near zero, ray lies in plane of triangle
-		det = dot(edge1, pvec);
+	void Terrain::set_tile_cache(const std::string& directory, float em_threshold, float area_multiplier, float curvature_multiplier)
+	{
+		delete tile_cache;
+		tile_cache = nullptr;
 
-		if (det > -EPSILON && det < EPSILON)
-			return 0;
-		inv_det = 1.0f / det;
+		if (directory.empty())
+			return;
 
-		//calculate distance from vert0 to ray origin
-		tvec = r_o - p0;
+		// FNV-1a of everything a refined node depends on besides the camera
+		const float parameters[] = { quadtree.node_size.x, (float)TERRAIN_GENERATE_GRID_SIDE, em_threshold, area_multiplier, curvature_multiplier };
+		uint64_t key = 0xcbf29ce484222325ull;
+		for (uint ii = 0; ii < sizeof(parameters); ++ii)
+		{
+			key = (key ^ ((const uint8_t*)parameters)[ii]) * 0x100000001b3ull;
+		}
 
-		u = dot(tvec, pvec) * inv_det;
-		if (u < 0.0f || u > 1.0f)
-			return 0;
+		tile_cache = new TileCache(directory, key);
 
-		//prepare to test V parameter
-		qvec = cross(tvec, edge1);
+		// Serials of nodes read from tiles come from earlier runs, so the serials of this run start at a random
+		// offset to not match them by chance
+		next_node_serial += (uint64_t)std::random_device()() << 32;
+	}
 
-		//calculate V parameter and test bounds
-		v = dot(r_d, qvec) * inv_det;
-		if (v < 0.0f || u + v > 1.0f)
-			return 0;
+	// Bytes per element of the capacity of each block of a node
+#if TERRAIN_SOA_LAYOUT
+	const uint64_t triangle_element_size = 3 * sizeof(float) + 6 * sizeof(uint);
+	const uint64_t vertex_element_size = 4 * sizeof(float);
+#else
+	const uint64_t triangle_element_size = sizeof(Triangle) + 6 * sizeof(uint);
+	const uint64_t vertex_element_size = sizeof(vec4);
+#endif
+	const uint64_t border_element_size = sizeof(uint);
+	const uint64_t new_points_element_size = sizeof(vec4);
+
+	// Start of the block of each capacity, the first array in it
+#if TERRAIN_SOA_LAYOUT
+	void* get_triangle_block(TerrainData& node) { return node.circumcentre_x.data(); }
+	void* get_vertex_block(TerrainData& node) { return node.position_x.data(); }
+#else
+	void* get_triangle_block(TerrainData& node) { return node.triangles.data(); }
+	void* get_vertex_block(TerrainData& node) { return node.positions.data(); }
+#endif
+
+	// Finds a block with room for count elements if capacity is smaller than that. Tries twice the capacity first
+	// so a growing node does not have to be copied for every insertion. The capacity is rounded up to fill the block.
+	// Returns false if not even count elements fit in the budget
+	bool grow_block(MeshArena& arena, uint capacity, uint count, uint initial_capacity, uint64_t element_size, uint& new_capacity, char*& block)
+	{
+		new_capacity = capacity;
+		block = nullptr;
+		if (count <= capacity)
+			return true;
 
-		//calculate t, ray intersection triangle
-		*t = dot(edge2, qvec) * inv_det;
+		const uint wanted[2] = { std::max(count, capacity == 0 ? initial_capacity : capacity * 2), count };
+		for (uint ww = 0; ww < 2 && !block; ++ww)
+		{
+			block = (char*)arena.allocate(wanted[ww] * element_size);
+			new_capacity = (uint)(MeshArena::get_block_size(wanted[ww] * element_size) / element_size);
+		}
 
-		return 1;
+		return block != nullptr;
 	}
 
-	void intersect(Frustum& frustum, DebugDrawer& dd, AabbXZ aabb, uint level, uint x, uint y)
+	// Points array into block after the arrays before it, copying the old_count elements it had
+	template<typename T>
+	void move_array(NodeArray<T>& array, char*& block, uint old_count, uint count)
 	{
-		if (level == quadtree_levels)
-		{
-			//float minx = aabb.m_min.x + (aabb.m_max.x - aabb.m_min.x) * 0.05f;
-			//float maxx = aabb.m_min.x + (aabb.m_max.x - aabb.m_min.x) * 0.95f;
+		T* elements = (T*)block;
+		if (array.elements)
+			memcpy(elements, array.elements, old_count * sizeof(T));
 
-			//float minz = aabb.m_min.y + (aabb.m_max.y - aabb.m_min.y) * 0.05f;
-			//float maxz = aabb.m_min.y + (aabb.m_max.y - aabb.m_min.y) * 0.95f;
-
-			//dd.draw_line({ minx, 0, minz }, { minx, 0, maxz }, { 1, 1, 0 });
-			//dd.draw_line({ minx, 0, minz }, { maxx, 0, minz }, { 1, 1, 0 });
+		array.elements = elements;
+		block += count * sizeof(T);
+	}
 
-			//dd.draw_line({ maxx, 0, maxz }, { maxx, 0, minz }, { 1, 1, 0 });
-			//dd.draw_line({ maxx, 0, maxz }, { minx, 0, maxz }, { 1, 1, 0 });
+	bool Terrain::reserve_node(uint node_index, uint triangle_count, uint vertex_count, uint border_count)
+	{
+		TerrainData& node = terrain_buffer->data[node_index];
 
-			// Index into m_node_index_to_buffer_index
-			uint index = (1 << quadtree_levels) * y + x;
-			if (quadtree.node_index_to_buffer_index[index] == INVALID)
-			{
-				// Visible node does not have data
+		uint triangle_capacity = 0;
+		uint vertex_capacity = 0;
+		uint border_capacity = 0;
+		char* triangle_block = nullptr;
+		char* vertex_block = nullptr;
+		char* border_block = nullptr;
 
-				uint new_index = find_chunk();
-				if (new_index != INVALID)
-				{
-					quadtree.buffer_index_filled[new_index] = true;
-					quadtree.node_index_to_buffer_index[index] = new_index;
+		// Every block is found before anything is moved, so the node stays as it is if one does not fit
+		const bool fits = grow_block(*mesh_arena, node.triangle_capacity, triangle_count, NODE_INITIAL_TRIANGLE_CAPACITY, triangle_element_size, triangle_capacity, triangle_block)
+			&& grow_block(*mesh_arena, node.vertex_capacity, vertex_count, NODE_INITIAL_VERTEX_CAPACITY, vertex_element_size, vertex_capacity, vertex_block)
+			&& grow_block(*mesh_arena, node.border_capacity, border_count, NODE_INITIAL_BORDER_CAPACITY, border_element_size, border_capacity, border_block);
 
-					// m_buffer[new_index] needs to be filled with data
-					quadtree.generate_nodes[quadtree.num_generate_nodes].index = new_index;
-					quadtree.generate_nodes[quadtree.num_generate_nodes].min = aabb.m_min;
-					quadtree.generate_nodes[quadtree.num_generate_nodes].max = aabb.m_max;
-					quadtree.num_generate_nodes++;
-				}
-				else
-				{
-					// No space left! Ignore for now...
-				}
-			}
-			else
-			{
-				// Visible node has data, draw it
+		if (!fits)
+		{
+			mesh_arena->release(triangle_block, triangle_capacity * triangle_element_size);
+			mesh_arena->release(vertex_block, vertex_capacity * vertex_element_size);
+			return false;
+		}
 
-				// m_buffer[m_node_index_to_buffer_index[index]] needs to be drawn
-				quadtree.draw_nodes[quadtree.num_draw_nodes] = quadtree.node_index_to_buffer_index[index];
-				quadtree.num_draw_nodes++;
-			}
+		if (triangle_block)
+		{
+			char* old_block = (char*)get_triangle_block(node);
+			char* next = triangle_block;
+#if TERRAIN_SOA_LAYOUT
+			move_array(node.circumcentre_x, next, node.triangle_capacity, triangle_capacity);
+			move_array(node.circumcentre_y, next, node.triangle_capacity, triangle_capacity);
+			move_array(node.circumradius2, next, node.triangle_capacity, triangle_capacity);
+#else
+			move_array(node.triangles, next, node.triangle_capacity, triangle_capacity);
+#endif
+			move_array(node.indices, next, node.triangle_capacity * 3, triangle_capacity * 3);
+			move_array(node.triangle_connections, next, node.triangle_capacity * 3, triangle_capacity * 3);
+
+			mesh_arena->release(old_block, node.triangle_capacity * triangle_element_size);
+			node.triangle_capacity = triangle_capacity;
+		}
 
-			return;
+		if (vertex_block)
+		{
+			char* old_block = (char*)get_vertex_block(node);
+			char* next = vertex_block;
+#if TERRAIN_SOA_LAYOUT
+			move_array(node.position_x, next, node.vertex_capacity, vertex_capacity);
+			move_array(node.position_y, next, node.vertex_capacity, vertex_capacity);
+			move_array(node.position_z, next, node.vertex_capacity, vertex_capacity);
+			move_array(node.curvature, next, node.vertex_capacity, vertex_capacity);
+#else
+			move_array(node.positions, next, node.vertex_capacity, vertex_capacity);
+#endif
+
+			mesh_arena->release(old_block, node.vertex_capacity * vertex_element_size);
+			node.vertex_capacity = vertex_capacity;
 		}
 
-		// This node is visible, check children
-		if (frustum_aabbxz_intersection(frustum, aabb))
+		if (border_block)
 		{
-			vec2 mid = (aabb.m_min + aabb.m_max) * 0.5f;
-			float mid_x = (aabb.m_min.x + aabb.m_max.x) * 0.5f;
-			float mid_z = (aabb.m_min.y + aabb.m_max.y) * 0.5f;
+			char* old_block = (char*)node.border_triangle_indices.data();
+			char* next = border_block;
+			move_array(node.border_triangle_indices, next, node.border_capacity, border_capacity);
 
-			intersect(frustum, dd, { {aabb.m_min.x, aabb.m_min.y}, {mid.x, mid.y} }, level + 1, (x << 1), (y << 1));
-			intersect(frustum, dd, { {aabb.m_min.x, mid_z}, {mid.x, aabb.m_max.y} }, level + 1, (x << 1), (y << 1) + 1);
-			intersect(frustum, dd, { {mid_x, aabb.m_min.y}, {aabb.m_max.x, mid_z} }, level + 1, (x << 1) + 1, (y << 1));
-			intersect(frustum, dd, { {mid.x, mid.y}, {aabb.m_max.x, aabb.m_max.y} }, level + 1, (x << 1) + 1, (y << 1) + 1);
+			mesh_arena->release(old_block, node.border_capacity * border_element_size);
+			node.border_capacity = border_capacity;
 		}
+
+		return true;
 	}
 
-	void draw_terrain(Frustum& frustum, DebugDrawer& dd, Camera& camera, Window& window)
+	bool Terrain::reserve_new_points(uint node_index, uint count)
 	{
-		static vec3 ori;
-		static vec3 dir;
-		if (show)
-		{
-			for (size_t ii = 0; ii < num_nodes; ii++)
-			{
-				if (quadtree.buffer_index_filled[ii] && (ii == temp || temp == -1))
-				{
-					int hovered_triangle = -1;
-					const float height = -100.0f;
+		TerrainData& node = terrain_buffer->data[node_index];
 
+		uint new_points_capacity;
+		char* new_points_block;
+		if (!grow_block(*mesh_arena, node.new_points_capacity, count, NODE_INITIAL_NEW_POINTS_CAPACITY, new_points_element_size, new_points_capacity, new_points_block))
+			return false;
 
-					// If C is pressed, do ray-triangle intersection and show connection of hovered triangle
-					if (glfwGetKey(window.get_glfw_window(), GLFW_KEY_C) == GLFW_PRESS
-						&& !ImGui::GetIO().WantCaptureMouse)
-					{
-						vec3 ray_o = camera.get_pos();
-						vec3 ray_dir;
+		if (new_points_block)
+		{
+			char* old_block = (char*)node.new_points.data();
+			char* next = new_points_block;
+			move_array(node.new_points, next, node.new_points_capacity, new_points_capacity);
 
-						ori = ray_o;
-						
+			mesh_arena->release(old_block, node.new_points_capacity * new_points_element_size);
+			node.new_points_capacity = new_points_capacity;
+		}
 
-						vec2 mouse_pos;
-						// Get mouse pos
-						const bool focused = glfwGetWindowAttrib(window.get_glfw_window(), GLFW_FOCUSED) != 0;
-						if (focused)
-						{
-							double mouse_x, mouse_y;
-							glfwGetCursorPos(window.get_glfw_window(), &mouse_x, &mouse_y);
-							mouse_pos = vec2((float)mouse_x, (float)mouse_y);
-						}
+		return true;
+	}
 
-						int w, h;
-						glfwGetWindowSize(window.get_glfw_window(), &w, &h);
-						vec2 window_size = vec2(w, h);
-						const float deg_to_rad = 3.1415f / 180.0f;
-						const float fov = camera.get_fov();	// In degrees
-						float px = 2.0f * (mouse_pos.x + 0.5f - window_size.x / 2) / window_size.x * tan(fov / 2.0f * deg_to_rad);
-						float py = 2.0f * (mouse_pos.y + 0.5f - window_size.y / 2) / window_size.y * tan(fov / 2.0f * deg_to_rad) * window_size.y / window_size.x;
-						ray_dir = vec3(px, py, 1);
-						ray_dir = normalize(vec3(inverse(camera.get_view()) * vec4(normalize(ray_dir), 0.0f)));
+	void Terrain::release_node(uint node_index)
+	{
+		TerrainData& node = terrain_buffer->data[node_index];
 
-						dir = ray_dir;
+		mesh_arena->release(get_triangle_block(node), node.triangle_capacity * triangle_element_size);
+		mesh_arena->release(get_vertex_block(node), node.vertex_capacity * vertex_element_size);
+		mesh_arena->release(node.border_triangle_indices.data(), node.border_capacity * border_element_size);
+		mesh_arena->release(node.new_points.data(), node.new_points_capacity * new_points_element_size);
 
-						float d = 9999999999.0f;
-						float max_d = 9999999999.0f;
+		// Everything else is set when the node is generated again
+		node = TerrainData();
+	}
 
-						// Perform ray-triangle intersection
-						for (uint ind = 0; ind < terrain_buffer->data[ii].index_count; ind += 3)
-						{
-							vec3 p0 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 0]]) + vec3(0.0f, height, 0.0f);
-							vec3 p1 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 1]]) + vec3(0.0f, height, 0.0f);
-							vec3 p2 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 2]]) + vec3(0.0f, height, 0.0f);
+	void Terrain::free_node(uint node_index)
+	{
+		release_node(node_index);
+		quadtree.node_slots.release(node_index);
+	}
 
-							if (intersect_triangle(ray_o, ray_dir, p0, p1, p2, &d) && d < max_d && d >= 0.0f)
-							{
-								hovered_triangle = ind / 3;
-							}
-						}
-					}
+	ivec2 Terrain::get_node_position(uint x, uint y) const
+	{
+		return ivec2(glm::round(quadtree.quadtree_minmax[0] / quadtree.node_size)) + ivec2(x, y);
+	}
 
-					for (uint ind = vistris_start * 3; ind < terrain_buffer->data[ii].index_count && ind < (uint)vistris_end * 3; ind += 3)
-					{
-						vec3 p0 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 0]]) + vec3(0.0f, height, 0.0f);
-						vec3 p1 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 1]]) + vec3(0.0f, height, 0.0f);
-						vec3 p2 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 2]]) + vec3(0.0f, height, 0.0f);
+	void Terrain::get_neighbour_serials(ivec2 position, uint64_t* serials) const
+	{
+		const int nodes_per_side = 1 << quadtree_levels;
+		const ivec2 quadtree_position = get_node_position(0, 0);
 
-						vec3 mid = (p0 + p1 + p2) / 3.0f;
+		uint nn = 0;
+		for (int y = -1; y <= 1; ++y)
+		{
+			for (int x = -1; x <= 1; ++x)
+			{
+				if (x == 0 && y == 0)
+					continue;
 
-						dd.draw_line(p0, p1, { 1, 0, 0 });
-						dd.draw_line(p1, p2, { 1, 0, 0 });
-						dd.draw_line(p2, p0, { 1, 0, 0 });
+				const ivec2 neighbour = position + ivec2(x, y);
+				const ivec2 local = neighbour - quadtree_position;
 
-						//dd.draw_line(mid, p0, { 0, 1, 0 });
-						//dd.draw_line(mid, p1, { 0, 1, 0 });
-						//dd.draw_line(mid, p2, { 0, 1, 0 });
+				// A cached node might be inside the quadtree again, but not put back yet because it is not visible
+				uint neighbour_index = INVALID;
+				if (local.x >= 0 && local.x < nodes_per_side && local.y >= 0 && local.y < nodes_per_side)
+					neighbour_index = quadtree.node_index_to_buffer_index[get_map_index(local.x, local.y)];
+				if (neighbour_index == INVALID)
+					neighbour_index = node_cache->find(neighbour);
 
-						if (show_cc || hovered_triangle == ind / 3)
-						{
-							const uint tri_index = ind / 3;
-							const uint steps = 20;
-							const float angle = 3.14159265f * 2.0f / steps;
-							for (uint jj = 0; jj < steps + 1; ++jj)
-							{
-								float cc_radius = sqrt(terrain_buffer->data[ii].triangles[tri_index].circumradius2);
-								vec3 cc_mid = { terrain_buffer->data[ii].triangles[tri_index].circumcentre.x, mid.y, terrain_buffer->data[ii].triangles[tri_index].circumcentre.y };
+				serials[nn++] = neighbour_index != INVALID ? node_serials[neighbour_index] : 0;
+			}
+		}
+	}
 
-								dd.draw_line(cc_mid + vec3(sinf(angle * jj) * cc_radius, 0.0f, cosf(angle * jj) * cc_radius),
-									cc_mid + vec3(sinf(angle * (jj + 1)) * cc_radius, 0.0f, cosf(angle * (jj + 1)) * cc_radius),
-									{ 0, 0, 1 });
-							}
-						}
+	void Terrain::cache_node(uint x, uint y)
+	{
+		const uint node_index = quadtree.node_index_to_buffer_index[get_map_index(x, y)];
+		if (node_index == INVALID)
+			return;
 
-						if (show_connections == ind / 3 || hovered_triangle == ind / 3)
-						{
-							glm::vec3 h = { 0, -20, 0 };
+		const ivec2 position = get_node_position(x, y);
 
-							dd.draw_line(p0 + h, p1 + h, { 1, 0, 0 });
-							dd.draw_line(p1 + h, p2 + h, { 0, 1, 0 });
-							dd.draw_line(p2 + h, p0 + h, { 0, 0, 1 });
+		NodeCache::NeighbourSerials neighbours;
+		get_neighbour_serials(position, neighbours.data());
 
-							glm::vec3 n0 = mid + h;
-							glm::vec3 n1 = mid + h;
-							glm::vec3 n2 = mid + h;
+		// Cached nodes do not change, so the tile written now is the one the node would have when it is freed
+		if (tile_cache)
+			tile_cache->save(position, node_serials[node_index], neighbours, terrain_buffer->data[node_index]);
 
-							if (terrain_buffer->data[ii].triangle_connections[ind + 0] < INVALID - 10)
-							{
-								uint neighbour_ind = terrain_buffer->data[ii].triangle_connections[ind + 0];
-								n0 = (terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 0]] + 
-									  terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 1]] + 
-									  terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 2]]) / 3.0f;
-								n0 += glm::vec3(0, height, 0) + h;
-							}
-							if (terrain_buffer->data[ii].triangle_connections[ind + 1] < INVALID - 10)
-							{
-								uint neighbour_ind = terrain_buffer->data[ii].triangle_connections[ind + 1];
-								n1 = (terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 0]] +
-									terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 1]] +
-									terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 2]]) / 3.0f;
-								n1 += glm::vec3(0, height, 0) + h;
-							}
-							if (terrain_buffer->data[ii].triangle_connections[ind + 2] < INVALID - 10)
-							{
-								uint neighbour_ind = terrain_buffer->data[ii].triangle_connections[ind + 2];
-								n2 = (terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 0]] +
-									terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 1]] +
-									terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[neighbour_ind * 3 + 2]]) / 3.0f;
-								n2 += glm::vec3(0, height, 0) + h;
-							}
+		const uint freed = node_cache->insert(position, node_index, neighbours);
+		if (freed != INVALID)
+			free_node(freed);
+	}
 
+	void Terrain::save_tiles()
+	{
+		if (!tile_cache)
+			return;
 
-							dd.draw_line(mid + h, n0, { 1, 0, 0 });
-							dd.draw_line(mid + h, n1, { 0, 1, 0 });
-							dd.draw_line(mid + h, n2, { 0, 0, 1 });
-						}
-					}
-					//for (int tt = 0; tt < terrain_buffer->data[ii].vertex_count; ++tt)
-					//{
-					//	vec3 p = terrain_buffer->data[ii].positions[tt] + vec4(0, -100, 0, 0);
-					//	dd.draw_line(p, p + vec3(0, -50, 0), vec3(1, 0, 1));
-					//}
-
-					//vec2 min = terrain_buffer->data[ii].min;
-					//vec2 max = terrain_buffer->data[ii].max;
-					//dd.draw_line({ min.x - terrain_buffer->data[ii].border_max[3], -150, min.y }, { min.x - terrain_buffer->data[ii].border_max[3], -150, max.y }, { 1, 1, 1 });
-					//dd.draw_line({ max.x + terrain_buffer->data[ii].border_max[1], -150, min.y }, { max.x + terrain_buffer->data[ii].border_max[1], -150, max.y }, { 1, 1, 1 });
-					//dd.draw_line({ min.x, -150, max.y + terrain_buffer->data[ii].border_max[0] }, { max.x, -150, max.y + terrain_buffer->data[ii].border_max[0] }, { 1, 1, 1 });
-					//dd.draw_line({ min.x, -150, min.y - terrain_buffer->data[ii].border_max[2] }, { max.x, -150, min.y - terrain_buffer->data[ii].border_max[2] }, { 1, 1, 1 });
-
-					for (uint bt = 0; bt < terrain_buffer->data[ii].border_count; ++bt)
-					{
-						const float height = -102.0f;
-						uint ind = terrain_buffer->data[ii].border_triangle_indices[bt] * 3;
-						vec3 p0 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 0]]) + vec3(0.0f, height, 0.0f);
-						vec3 p1 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 1]]) + vec3(0.0f, height, 0.0f);
-						vec3 p2 = vec3(terrain_buffer->data[ii].positions[terrain_buffer->data[ii].indices[ind + 2]]) + vec3(0.0f, height, 0.0f);
+		const uint nodes_per_side = 1 << quadtree_levels;
+		for (uint y = 0; y < nodes_per_side; ++y)
+		{
+			for (uint x = 0; x < nodes_per_side; ++x)
+			{
+				const uint node_index = quadtree.node_index_to_buffer_index[get_map_index(x, y)];
+				if (node_index == INVALID)
+					continue;
 
-						if (sideshow_bob != -1 && terrain_buffer->data[ii].triangle_connections[ind + 0] == INVALID - sideshow_bob)
-						{
-							dd.draw_line(p0 - vec3{0, 2, 0}, p1 - vec3{0, 2, 0}, { 0.0f, 1.0f, 0.0f });
-						}
-						if (sideshow_bob != -1 && terrain_buffer->data[ii].triangle_connections[ind + 1] == INVALID - sideshow_bob)
-						{
-							dd.draw_line(p1 - vec3{ 0, 2, 0 }, p2 - vec3{ 0, 2, 0 }, { 0.0f, 1.0f, 0.0f });
-						}
-						if (sideshow_bob != -1 && terrain_buffer->data[ii].triangle_connections[ind + 2] == INVALID - sideshow_bob)
-						{
-							dd.draw_line(p2 - vec3{ 0, 2, 0 }, p0 - vec3{ 0, 2, 0 }, { 0.0f, 1.0f, 0.0f });
-						}
+				const ivec2 position = get_node_position(x, y);
+				NodeCache::NeighbourSerials neighbours;
+				get_neighbour_serials(position, neighbours.data());
 
-						dd.draw_line(p0, p1, { 0, 0, 1 });
-						dd.draw_line(p1, p2, { 0, 0, 1 });
-						dd.draw_line(p2, p0, { 0, 0, 1 });
-					}
-				}
+				tile_cache->save(position, node_serials[node_index], neighbours, terrain_buffer->data[node_index]);
 			}
 		}
 	}
 
-	uint atomicAdd(uint& var, int addition)
-	{
-		uint ret = var;
-		var += addition;
-		return ret;
-	}
-
-#pragma region GENERATE
-
-	struct GenerateEdge
+	void Terrain::load_tile(uint node_index, vec2 min, vec2 max)
 	{
-		vec4 p1;
-		vec4 p2;
-		uint p1_index;
-		uint p2_index;
-		uint connection;
-		uint old_triangle_index;
-		uint future_index;
-		uint pad[3];
-	};
-	const uint max_border_edges = 100;
-	/*shared*/ std::array<GenerateEdge, max_border_edges * 3> s_generate_edges;
+		TerrainData& node = terrain_buffer->data[node_index];
+		const uint triangle_count = tile->get_triangle_count();
 
-	const uint max_triangles_to_remove = 100;
+		node.index_count = (uint)tile->indices.size();
+		node.instance_count = 1;
+		node.first_index = 0;
+		node.vertex_offset = 0;
+		node.first_instance = 0;
 
-	/*shared*/ std::array<uint, max_triangles_to_remove> s_triangles_to_remove;
-	/*shared*/ uint s_triangles_removed;
-	/*shared*/ uint s_new_triangle_count;
+		node.vertex_count = (uint)tile->positions.size();
+		node.new_points_count = 0;
 
-	/*shared*/ uint s_triangle_count;
-	/*shared*/ uint s_vertex_count;
+		// The same as the neighbours' even if the quadtree's position drifted since the tile was written
+		node.min = min;
+		node.max = max;
 
-	/*shared*/ uint s_valid_indices[max_triangles_to_remove];
+		node.border_count = (uint)tile->border_triangle_indices.size();
 
-#define NUM_NEW_TRIANGLE_INDICES 30
-	uint g_new_triangle_indices[NUM_NEW_TRIANGLE_INDICES];
-	uint g_new_triangle_index_count;
+		// TileCache::load checked that these only point into the tile's own arrays
+		memcpy(node.indices.data(), tile->indices.data(), node.index_count * sizeof(uint));
+		memcpy(node.triangle_connections.data(), tile->triangle_connections.data(), node.index_count * sizeof(uint));
+		memcpy(node.border_triangle_indices.data(), tile->border_triangle_indices.data(), node.border_count * sizeof(uint));
 
+		for (uint vv = 0; vv < node.vertex_count; ++vv)
+		{
+			node.set_position(vv, tile->positions[vv]);
+		}
 
-#define TEST_TRIANGLE_BUFFER_SIZE 50
-	uint seen_triangles[TEST_TRIANGLE_BUFFER_SIZE];
-	uint seen_triangle_count;
-	uint triangles_to_test[TEST_TRIANGLE_BUFFER_SIZE];
-	uint test_count;
+		for (uint tt = 0; tt < triangle_count; ++tt)
+		{
+			node.set_circumcircle(tt, vec2(tile->circumcircles[tt]), tile->circumcircles[tt].z);
+		}
 
-	bool is_internal(uint node_index, uint connection_index)
-	{
-		uint index = terrain_buffer->data[node_index].triangle_connections[connection_index];
-		return index < INVALID - 10;
+		rebuild_border_grid(node_index);
+		reset_error_cache(node_index);
 	}
 
-	void g_remove_old_triangles(uint node_index)
+	void Terrain::triangulate()
 	{
-		// Remove old triangles
-		for (int j = int(s_triangles_removed) - 1; j >= 0; --j)
+		const int nodes_per_side = 1 << quadtree_levels;
+
+		// Nodes to triangulate in the current colour class
+		std::vector<uint> nodes;
+		nodes.reserve(num_nodes);
+
+		refine_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<float, std::milli>(refine_time_budget));
+		for (uint i = 0; i < thread_pool->get_thread_count(); i++)
 		{
-			const uint index = s_triangles_to_remove[j];
+			contexts[i].out_of_time = false;
+		}
 
-			const uint last_triangle = terrain_buffer->data[node_index].index_count / 3 - 1;
+		// Nodes three steps apart never touch each other's 3x3 neighbourhood,
+		// so all nodes in one colour class can be triangulated at the same time.
+		// A call that runs out of time picks up where the last one stopped
+		for (uint cc = 0; cc < 9; ++cc)
+		{
+			const uint colour_class = (next_colour_class + cc) % 9;
+			const int yy = colour_class / 3;
+			const int xx = colour_class % 3;
+			first_colour_class = cc == 0;
 
-			for (uint ii = 0; ii < 3; ++ii)
+			if (cc != 0 && out_of_refine_time(caller_context()))
 			{
-				replace_connection_index(node_index, terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + ii], last_triangle, index);
+				++caller_context().statistics.refine_time_exhausted;
+				next_colour_class = colour_class;
+				return;
 			}
 
-			// Remove triangle
-			if (index < last_triangle)
-			{
-				terrain_buffer->data[node_index].indices[index * 3 + 0] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 0];
-				terrain_buffer->data[node_index].indices[index * 3 + 1] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 1];
-				terrain_buffer->data[node_index].indices[index * 3 + 2] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 2];
-				terrain_buffer->data[node_index].triangles[index].circumcentre = terrain_buffer->data[node_index].triangles[last_triangle].circumcentre;
-				terrain_buffer->data[node_index].triangles[index].circumradius2 = terrain_buffer->data[node_index].triangles[last_triangle].circumradius2;
-				terrain_buffer->data[node_index].triangle_connections[index * 3 + 0] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 0];
-				terrain_buffer->data[node_index].triangle_connections[index * 3 + 1] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 1];
-				terrain_buffer->data[node_index].triangle_connections[index * 3 + 2] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 2];
+			nodes.clear();
 
-				for (uint tt = 0; tt < g_new_triangle_index_count; ++tt)
+			for (int ty = yy; ty < nodes_per_side; ty += 3)
+			{
+				for (int tx = xx; tx < nodes_per_side; tx += 3)
 				{
-					const uint triangle_index = g_new_triangle_indices[tt];
-					if (triangle_index == last_triangle)
-						g_new_triangle_indices[tt] = index;
+					bool all_valid = true;
+					// Check self and neighbour nodes
+					for (int y = -1; y <= 1; ++y)
+					{
+						for (int x = -1; x <= 1; ++x)
+						{
+							const int nx = tx + x;
+							const int ny = ty + y;
+							if (nx >= 0 && nx < nodes_per_side && ny >= 0 && ny < nodes_per_side)
+							{
+								const uint neighbour_index = quadtree.node_index_to_buffer_index[get_map_index(nx, ny)];
+								if (neighbour_index == INVALID)
+								{
+									all_valid = false;
+								}
+							}
+							else
+							{
+								all_valid = false;
+							}
+						}
+					}
+
+					if (all_valid)
+					{
+						nodes.push_back(quadtree.node_index_to_buffer_index[get_map_index(tx, ty)]);
+					}
 				}
 			}
 
-			terrain_buffer->data[node_index].index_count -= 3;
-
-			// Update the rest of the new points' triangle index after updating triangles in node
-			for (uint ii = 0; ii < terrain_buffer->data[node_index].new_points_count; ++ii)
+			if (batched_insertion && nodes.size() < thread_pool->get_thread_count())
 			{
-				if (terrain_buffer->data[node_index].new_points_triangles[ii] == index)
+				// Too few nodes to keep every thread busy, so the threads share the points of one node at a time
+				for (uint nn = 0; nn < (uint)nodes.size(); ++nn)
 				{
-					// Look through all newly added triangles only
-					for (uint tt = 0; tt < g_new_triangle_index_count; ++tt)
+					if (nn != 0 && out_of_refine_time(caller_context()))
 					{
-						const uint triangle_index = g_new_triangle_indices[tt];
-						const vec4 new_point = terrain_buffer->data[node_index].new_points[ii];
-						const vec2 circumcentre = terrain_buffer->data[node_index].triangles[triangle_index].circumcentre;
-						const float circumradius2 = terrain_buffer->data[node_index].triangles[triangle_index].circumradius2;
-
-						const float dx = new_point.x - circumcentre.x;
-						const float dy = new_point.z - circumcentre.y;
-
-						// Find the first triangle whose cc contains the point
-						if (dx * dx + dy * dy < circumradius2)
-						{
-							terrain_buffer->data[node_index].new_points_triangles[ii] = triangle_index;
-							break;
-						}
+						caller_context().out_of_time = true;
+						break;
 					}
+
+					triangulate_batched(nodes[nn]);
 				}
-				else if (terrain_buffer->data[node_index].new_points_triangles[ii] == last_triangle)
+			}
+			else
+			{
+				// Returns when the whole colour class is done
+				thread_pool->parallel_for((uint)nodes.size(), [&](uint task, uint thread)
+				{
+					triangulate_shader(contexts[thread], nodes[task]);
+				});
+			}
+
+			// The rest of the colour class is done first next time
+			for (uint i = 0; i < thread_pool->get_thread_count(); i++)
+			{
+				if (contexts[i].out_of_time)
 				{
-					terrain_buffer->data[node_index].new_points_triangles[ii] = index;
+					++caller_context().statistics.refine_time_exhausted;
+					next_colour_class = colour_class;
+					return;
 				}
 			}
 		}
 	}
 
-	void g_add_connection(uint connection_index)
+	bool Terrain::out_of_refine_time(const TriangulationContext& ctx) const
 	{
-		// Check if it has already been seen
-		for (uint ii = 0; ii < seen_triangle_count; ++ii)
+		return refine_time_budget > 0.0f && std::chrono::steady_clock::now() + ctx.insertion_time >= refine_deadline;
+	}
+
+	// True if errors measured with the cached view parameters are still good for these
+	bool same_view(const ErrorCache& cache, const mat4& vp, float area_multiplier, float curvature_multiplier, float tolerance)
+	{
+		if (!cache.valid || cache.area_multiplier != area_multiplier || cache.curvature_multiplier != curvature_multiplier)
+			return false;
+
+		for (uint cc = 0; cc < 4; ++cc)
 		{
-			if (connection_index == seen_triangles[ii])
+			for (uint rr = 0; rr < 4; ++rr)
 			{
-				return;
+				if (!(abs(cache.vp[cc][rr] - vp[cc][rr]) <= tolerance))
+					return false;
 			}
 		}
 
-		seen_triangles[seen_triangle_count] = connection_index;
-		++seen_triangle_count;
-		triangles_to_test[test_count] = connection_index;
-		++test_count;
+		return true;
 	}
 
-	void generate_triangulate_shader(const uint node_index)
+	void Terrain::process_triangles(const mat4& vp, float em_threshold, float area_multiplier, float curvature_multiplier)
 	{
-		const uint thid = gl_GlobalInvocationID.x;
-
-		const vec2 node_min = terrain_buffer->data[node_index].min;
-		const vec2 node_max = terrain_buffer->data[node_index].max;
-		const float side = node_max.x - node_min.x;
-
-		const int nodes_per_side = 1 << quadtree_levels;
-
-		const int cx = int((node_min.x - terrain_buffer->quadtree_min.x + 1) / side);  // current node x
-		const int cy = int((node_min.y - terrain_buffer->quadtree_min.y + 1) / side);  // current node z/y
+		processing->node_count = 0;
+		processing->range_count = 0;
+		processing->pending_insertions = 0;
 
-		// Set shared variables
-		if (thid == 0)
+		// Nonupdated terrain
+		for (uint i = 0; i < quadtree.num_draw_nodes; i++)
 		{
-			s_triangles_removed = 0;
+			add_process_node(quadtree.draw_nodes[i]);
 		}
 
-		//barrier();
-		//memoryBarrierShared();
-
-		const uint new_points_count = terrain_buffer->data[node_index].new_points_count;
-
-		for (uint n = 0; n < new_points_count && n < TERRAIN_GENERATE_NUM_VERTICES; ++n)
+		// Newly generated terrain
+		for (uint i = 0; i < quadtree.num_generate_nodes; i++)
 		{
-			const vec4 current_point = terrain_buffer->data[node_index].new_points[n];
+			add_process_node(quadtree.generate_nodes[i].index);
+		}
 
-			seen_triangle_count = 1;
-			test_count = 1;
+		// Clip space positions of every vertex, found once since each is shared by several triangles
+		thread_pool->parallel_for(processing->node_count, [&](uint task, uint thread)
+		{
+			const uint node_index = processing->nodes[task].node_index;
+			const TerrainData& node = terrain_buffer->data[node_index];
+			ErrorCache& cache = error_caches[node_index];
 
-			const uint start_index = terrain_buffer->data[node_index].new_points_triangles[n];
-			seen_triangles[0] = start_index;
-			triangles_to_test[0] = start_index;
-			g_new_triangle_index_count = 0;
+			// A new view makes every error dirty
+			const bool new_view = !error_cache || !same_view(cache, vp, area_multiplier, curvature_multiplier, error_cache_tolerance);
+			if (new_view)
+			{
+				cache.valid = true;
+				cache.vp = vp;
+				cache.area_multiplier = area_multiplier;
+				cache.curvature_multiplier = curvature_multiplier;
+				++cache.new_views;
+				cache.clip_positions.clear();
+				cache.triangles.clear();
+			}
 
-			bool finish = false;
-			while (test_count != 0 && !finish)
+			// Vertices are only added, and decimate_node moves the positions along when it compacts them, so the ones
+			// from earlier calls keep their positions
+			for (uint v = (uint)cache.clip_positions.size(); v < node.vertex_count; ++v)
 			{
-				const uint triangle_index = triangles_to_test[--test_count];
-				const vec2 circumcentre = terrain_buffer->data[node_index].triangles[triangle_index].circumcentre;
-				const float circumradius2 = terrain_buffer->data[node_index].triangles[triangle_index].circumradius2;
+				cache.clip_positions.push_back(cache.vp * glm::vec4(glm::vec3(node.get_position(v)), 1.0f));
+			}
 
-				const float dx = current_point.x - circumcentre.x;
-				const float dy = current_point.z - circumcentre.y;
+			if (decimation && new_view && (cache.new_views + node_index) % std::max(decimation_interval, 1u) == 0)
+				decimate_node(contexts[thread], node_index, em_threshold);
 
-				if (dx * dx + dy * dy < circumradius2)
+			cache.triangles.resize(node.index_count / 3);
+		});
+
+		for (uint nn = 0; nn < processing->node_count; ++nn)
+		{
+			add_triangle_ranges(nn);
+		}
+
+		thread_pool->parallel_for(processing->range_count, [&](uint task, uint thread)
+		{
+			triangle_process_shader(contexts[thread], em_threshold, processing->ranges[task]);
+		});
+
+		if (refine_point_budget != 0)
+			spend_point_budget();
+
+		// An exclusive scan over the point counts of each node's ranges gives where their points go. A node gets the
+		// first max_new_normal_points points in triangle order, the same as if it was one range.
+		// Processed nodes have no points left from earlier calls, see add_process_node
+		for (uint nn = 0; nn < processing->node_count; ++nn)
+		{
+			const ProcessNode& process_node = processing->nodes[nn];
+			TerrainData& node = terrain_buffer->data[process_node.node_index];
+
+			uint total = 0;
+			for (uint rr = process_node.first_range; rr < process_node.first_range + process_node.range_count; ++rr)
+			{
+				TriangleRange& range = processing->ranges[rr];
+				range.offset = total;
+				range.kept_count = std::min(range.point_count, max_new_normal_points - total);
+				total += range.kept_count;
+			}
+
+			node.new_points_count = std::min(total, num_new_points);
+
+			// Points that do not fit in the memory budget are dropped, like the ones over num_new_points
+			if (!reserve_new_points(process_node.node_index, node.new_points_count))
+				node.new_points_count = std::min(node.new_points_count, node.new_points_capacity);
+		}
+
+		thread_pool->parallel_for(processing->range_count, [&](uint task, uint)
+		{
+			write_range_points(processing->ranges[task]);
+		});
+
+		// Consecutive insertions then work on nearby triangles, which are still in cache
+		if (spatial_insertion_order)
+		{
+			thread_pool->parallel_for(processing->node_count, [&](uint task, uint thread)
+			{
+				TerrainData& node = terrain_buffer->data[processing->nodes[task].node_index];
+				contexts[thread].insertion_order.sort(node.new_points.data(), node.new_points_count, node.min, node.max);
+			});
+		}
+	}
+
+	bool Terrain::intersect(Frustum& frustum, vec3 camera_pos)
+	{
+		shift_quadtree(camera_pos);
+
+		quadtree.num_generate_nodes = 0;
+		quadtree.num_draw_nodes = 0;
+
+		float half_length = quadtree.total_side_length * 0.5f;
+		
+		// Gather status of nodes
+		intersect(frustum, AabbXZ{ quadtree.quadtree_minmax[0],
+			quadtree.quadtree_minmax[1] }, 0, 0, 0);
+
+		TriangulationContext& ctx = caller_context();
+		for (uint i = 0; i < quadtree.num_generate_nodes; i++)
+		{
+			generate_shader(ctx, quadtree.generate_nodes[i].index, quadtree.generate_nodes[i].min, quadtree.generate_nodes[i].max);
+		}
+
+		return quadtree.num_generate_nodes > 0;
+	}
+
+	void Terrain::intersect(Frustum& frustum, AabbXZ aabb, uint level, uint x, uint y)
+	{
+		if (level == quadtree_levels)
+		{
+			//float minx = aabb.m_min.x + (aabb.m_max.x - aabb.m_min.x) * 0.05f;
+			//float maxx = aabb.m_min.x + (aabb.m_max.x - aabb.m_min.x) * 0.95f;
+
+			//float minz = aabb.m_min.y + (aabb.m_max.y - aabb.m_min.y) * 0.05f;
+			//float maxz = aabb.m_min.y + (aabb.m_max.y - aabb.m_min.y) * 0.95f;
+
+			//dd.draw_line({ minx, 0, minz }, { minx, 0, maxz }, { 1, 1, 0 });
+			//dd.draw_line({ minx, 0, minz }, { maxx, 0, minz }, { 1, 1, 0 });
+
+			//dd.draw_line({ maxx, 0, maxz }, { maxx, 0, minz }, { 1, 1, 0 });
+			//dd.draw_line({ maxx, 0, maxz }, { minx, 0, maxz }, { 1, 1, 0 });
+
+			// Index into m_node_index_to_buffer_index
+			uint index = get_map_index(x, y);
+			if (quadtree.node_index_to_buffer_index[index] == INVALID)
+			{
+				// Visible node does not have data
+
+				TriangulationContext& ctx = caller_context();
+
+				// Put the node back as it was if it is cached and none of its neighbours are new
+				const ivec2 position = get_node_position(x, y);
+				NodeCache::NeighbourSerials neighbours;
+				get_neighbour_serials(position, neighbours.data());
+
+				uint stale_index;
+				const uint cached_index = node_cache->take(position, neighbours, stale_index);
+				if (stale_index != INVALID)
+					free_node(stale_index);
+
+				if (cached_index != INVALID)
+				{
+					++ctx.statistics.node_cache_hits;
+
+					quadtree.node_index_to_buffer_index[index] = cached_index;
+					quadtree.draw_nodes[quadtree.num_draw_nodes] = cached_index;
+					quadtree.num_draw_nodes++;
+					return;
+				}
+
+				// A node refined before, in this run or an earlier one, is read from its tile instead of being generated.
+				// A tile larger than the whole memory budget could never be reserved
+				const bool from_tile = tile_cache && tile_cache->load(position, neighbours, mesh_arena->get_budget(), *tile);
+
+				const uint triangle_count = from_tile ? tile->get_triangle_count() : NODE_INITIAL_TRIANGLE_CAPACITY;
+				const uint vertex_count = from_tile ? (uint)tile->positions.size() : NODE_INITIAL_VERTEX_CAPACITY;
+				const uint border_count = from_tile ? (uint)tile->border_triangle_indices.size() : NODE_INITIAL_BORDER_CAPACITY;
+
+				uint new_index = quadtree.node_slots.acquire();
+
+				// The node's first triangles and points might not fit in the memory budget. Cached nodes make room,
+				// least recently used first
+				bool reserved = false;
+				while (new_index != INVALID && !reserved)
+				{
+					reserved = reserve_node(new_index, triangle_count, vertex_count, border_count) &&
+						reserve_new_points(new_index, NODE_INITIAL_NEW_POINTS_CAPACITY);
+
+					if (!reserved && node_cache->get_count() == 0)
+					{
+						free_node(new_index);
+						new_index = INVALID;
+					}
+					else if (!reserved)
+					{
+						free_node(node_cache->pop_oldest());
+					}
+				}
+
+				if (new_index != INVALID && from_tile)
+				{
+					++ctx.statistics.tiles_loaded;
+
+					quadtree.node_index_to_buffer_index[index] = new_index;
+					node_serials[new_index] = tile->serial;
+					load_tile(new_index, aabb.m_min, aabb.m_max);
+
+					quadtree.draw_nodes[quadtree.num_draw_nodes] = new_index;
+					quadtree.num_draw_nodes++;
+				}
+				else if (new_index != INVALID)
+				{
+					++ctx.statistics.node_cache_misses;
+
+					quadtree.node_index_to_buffer_index[index] = new_index;
+					node_serials[new_index] = next_node_serial++;
+
+					// m_buffer[new_index] needs to be filled with data
+					quadtree.generate_nodes[quadtree.num_generate_nodes].index = new_index;
+					quadtree.generate_nodes[quadtree.num_generate_nodes].min = aabb.m_min;
+					quadtree.generate_nodes[quadtree.num_generate_nodes].max = aabb.m_max;
+					quadtree.num_generate_nodes++;
+				}
+				else
+				{
+					// No space left! Ignore for now...
+				}
+			}
+			else
+			{
+				// Visible node has data, draw it
+
+				// m_buffer[m_node_index_to_buffer_index[index]] needs to be drawn
+				quadtree.draw_nodes[quadtree.num_draw_nodes] = quadtree.node_index_to_buffer_index[index];
+				quadtree.num_draw_nodes++;
+			}
+
+			return;
+		}
+
+		// This node is visible, check children
+		if (frustum_aabbxz_intersection(frustum, aabb))
+		{
+			vec2 mid = (aabb.m_min + aabb.m_max) * 0.5f;
+			float mid_x = (aabb.m_min.x + aabb.m_max.x) * 0.5f;
+			float mid_z = (aabb.m_min.y + aabb.m_max.y) * 0.5f;
+
+			intersect(frustum, { {aabb.m_min.x, aabb.m_min.y}, {mid.x, mid.y} }, level + 1, (x << 1), (y << 1));
+			intersect(frustum, { {aabb.m_min.x, mid_z}, {mid.x, aabb.m_max.y} }, level + 1, (x << 1), (y << 1) + 1);
+			intersect(frustum, { {mid_x, aabb.m_min.y}, {aabb.m_max.x, mid_z} }, level + 1, (x << 1) + 1, (y << 1));
+			intersect(frustum, { {mid.x, mid.y}, {aabb.m_max.x, aabb.m_max.y} }, level + 1, (x << 1) + 1, (y << 1) + 1);
+		}
+	}
+
+	uint atomicAdd(uint& var, int addition)
+	{
+		uint ret = var;
+		var += addition;
+		return ret;
+	}
+
+	uint hash_edge_component(float v)
+	{
+		// Adding zero turns -0 into 0, which compares equal to it
+		v += 0.0f;
+		uint bits;
+		memcpy(&bits, &v, sizeof(bits));
+		return bits;
+	}
+
+	// Counts how often each of edges[0, count) appears, comparing end points like the old pairwise loop did.
+	// Afterwards is_shared_edge() tells if an edge is inside the cavity
+	template<typename Edge>
+	void count_cavity_edges(CavityEdgeTable& table, const Edge* edges, uint count)
+	{
+		if (++table.stamp == 0)
+		{
+			memset(table.slot_stamps, 0, sizeof(table.slot_stamps));
+			table.stamp = 1;
+		}
+
+		for (uint i = 0; i < count; ++i)
+		{
+			const vec4& p1 = edges[i].p1;
+			const vec4& p2 = edges[i].p2;
+
+			uint hash = hash_edge_component(p1.x);
+			hash = hash * 0x9E3779B1u ^ hash_edge_component(p1.z);
+			hash = hash * 0x9E3779B1u ^ hash_edge_component(p2.x);
+			hash = hash * 0x9E3779B1u ^ hash_edge_component(p2.z);
+			hash ^= hash >> 15;
+			hash *= 0x2C1B3C6Du;
+			hash ^= hash >> 12;
+
+			uint slot = hash & (CavityEdgeTable::size - 1);
+			while (true)
+			{
+				if (table.slot_stamps[slot] != table.stamp)
+				{
+					table.slot_stamps[slot] = table.stamp;
+					table.slot_edges[slot] = i;
+					table.slot_counts[slot] = 1;
+					break;
+				}
+
+				const Edge& other = edges[table.slot_edges[slot]];
+				if (other.p1 == p1 && other.p2 == p2)
+				{
+					++table.slot_counts[slot];
+					break;
+				}
+
+				slot = (slot + 1) & (CavityEdgeTable::size - 1);
+			}
+
+			table.edge_slots[i] = slot;
+		}
+	}
+
+	bool is_shared_edge(const CavityEdgeTable& table, uint edge)
+	{
+		return table.slot_counts[table.edge_slots[edge]] > 1;
+	}
+
+	// True if point is strictly inside the circumcircle of triangle. Decided with robust predicates on the triangle's corners,
+	// since the stored circumcircle can put nearly cocircular points on the wrong side and make the cavity inconsistent
+	bool circumcircle_contains(const TerrainData& node, uint triangle, vec4 point, Statistics& statistics)
+	{
+		const vec4 p0 = node.get_position(node.indices[triangle * 3 + 0]);
+		const vec4 p1 = node.get_position(node.indices[triangle * 3 + 1]);
+		const vec4 p2 = node.get_position(node.indices[triangle * 3 + 2]);
+
+		const dvec2 a = dvec2(p0.x, p0.z);
+		const dvec2 b = dvec2(p1.x, p1.z);
+		const dvec2 c = dvec2(p2.x, p2.z);
+
+		// A flat triangle has no circumcircle
+		const double orientation = orient2d(a, b, c, &statistics.exact_predicates);
+		if (orientation == 0.0)
+			return false;
+
+		const double side = incircle(a, b, c, dvec2(point.x, point.z), &statistics.exact_predicates);
+		return orientation > 0.0 ? side > 0.0 : side < 0.0;
+	}
+
+	// Twice the signed area of a, b, p in the xz plane
+	float edge_side(vec4 a, vec4 b, vec2 p)
+	{
+		return (b.x - a.x) * (p.y - a.z) - (b.z - a.z) * (p.x - a.x);
+	}
+
+	// Remembering stochastic walk from triangle start to the triangle of the node that contains point. Crosses the first
+	// edge that has point on its far side, trying the edges from a random one and never going back over the edge it came in by.
+	// Returns INVALID if the only way on is over the node's border, which happens when the point is outside the node
+	// or behind a bend in the border
+	uint walk_to_point(const TerrainData& node, vec2 point, uint start)
+	{
+		const uint triangle_count = node.index_count / 3;
+		if (triangle_count == 0)
+			return INVALID;
+
+		uint triangle = start < triangle_count ? start : triangle_count - 1;
+		uint previous = INVALID;
+		uint random = triangle * 0x9E3779B1u + 1;
+
+		// More steps than triangles means the walk is going in circles on a mesh that is not Delaunay
+		for (uint steps = 0; steps < triangle_count; ++steps)
+		{
+			random = random * 1664525u + 1013904223u;
+			const uint first_side = (random >> 16) % 3;
+
+			const vec4 p[3] = {
+				node.get_position(node.indices[triangle * 3 + 0]),
+				node.get_position(node.indices[triangle * 3 + 1]),
+				node.get_position(node.indices[triangle * 3 + 2]) };
+
+			uint next = INVALID;
+			bool blocked = false;
+			for (uint ii = 0; ii < 3; ++ii)
+			{
+				const uint ss = (first_side + ii) % 3;
+				const uint neighbour = node.triangle_connections[triangle * 3 + ss];
+				if (neighbour == previous)
+					continue;
+
+				// Connection ss is the edge from vertex ss to vertex ss + 1
+				const float point_side = edge_side(p[ss], p[(ss + 1) % 3], point);
+				const float triangle_side = edge_side(p[ss], p[(ss + 1) % 3], vec2(p[(ss + 2) % 3].x, p[(ss + 2) % 3].z));
+				if (point_side * triangle_side < 0.0f)
+				{
+					// Keep looking for an edge that stays inside the node
+					if (neighbour >= INVALID - 9)
+					{
+						blocked = true;
+						continue;
+					}
+
+					next = neighbour;
+					break;
+				}
+			}
+
+			if (next == INVALID)
+				return blocked ? INVALID : triangle;
+
+			previous = triangle;
+			triangle = next;
+		}
+
+		return INVALID;
+	}
+
+	// Returns the triangle of the node that contains point, or INVALID if no triangle of the node does.
+	// Walks from the newest triangle. The border between nodes bends and can block a walk, from a pocket of the
+	// border that the start is in or into one that the point is in. So then it walks from triangles spread over
+	// the node, and last from the border triangles listed in the point's cell of border_grid
+	uint locate_point(const TerrainData& node, const BorderGrid& border_grid, vec2 point)
+	{
+		const uint triangle_count = node.index_count / 3;
+
+		uint triangle = walk_to_point(node, point, triangle_count - 1);
+		for (uint ii = 1; ii <= LOCATE_EXTRA_WALKS && triangle == INVALID; ++ii)
+		{
+			triangle = walk_to_point(node, point, triangle_count * ii / (LOCATE_EXTRA_WALKS + 1));
+		}
+		if (triangle != INVALID)
+			return triangle;
+
+		for (const uint candidate : border_grid.get_candidates(point))
+		{
+			triangle = walk_to_point(node, point, candidate);
+			if (triangle != INVALID)
+				return triangle;
+		}
+
+		return INVALID;
+	}
+
+#pragma region GENERATE
+
+	bool Terrain::is_internal(uint node_index, uint connection_index)
+	{
+		uint index = terrain_buffer->data[node_index].triangle_connections[connection_index];
+		return index < INVALID - 10;
+	}
+
+	void Terrain::g_remove_old_triangles(TriangulationContext& ctx, uint node_index)
+	{
+		// Remove old triangles
+		for (int j = int(ctx.s_triangles_removed) - 1; j >= 0; --j)
+		{
+			const uint index = ctx.s_triangles_to_remove[j];
+
+			const uint last_triangle = terrain_buffer->data[node_index].index_count / 3 - 1;
+
+			for (uint ii = 0; ii < 3; ++ii)
+			{
+				replace_connection_index(node_index, terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + ii], last_triangle, index);
+			}
+
+			// Remove triangle
+			if (index < last_triangle)
+			{
+				terrain_buffer->data[node_index].indices[index * 3 + 0] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 0];
+				terrain_buffer->data[node_index].indices[index * 3 + 1] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 1];
+				terrain_buffer->data[node_index].indices[index * 3 + 2] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 2];
+				terrain_buffer->data[node_index].set_circumcircle(index, terrain_buffer->data[node_index].get_circumcentre(last_triangle), terrain_buffer->data[node_index].get_circumradius2(last_triangle));
+				terrain_buffer->data[node_index].triangle_connections[index * 3 + 0] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 0];
+				terrain_buffer->data[node_index].triangle_connections[index * 3 + 1] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 1];
+				terrain_buffer->data[node_index].triangle_connections[index * 3 + 2] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 2];
+
+				for (uint tt = 0; tt < ctx.g_new_triangle_index_count; ++tt)
+				{
+					const uint triangle_index = ctx.g_new_triangle_indices[tt];
+					if (triangle_index == last_triangle)
+						ctx.g_new_triangle_indices[tt] = index;
+				}
+			}
+
+			terrain_buffer->data[node_index].index_count -= 3;
+		}
+	}
+
+	void g_add_connection(TriangulationContext& ctx, uint connection_index)
+	{
+		// Check if it has already been seen
+		for (uint ii = 0; ii < ctx.seen_triangle_count; ++ii)
+		{
+			if (connection_index == ctx.seen_triangles[ii])
+			{
+				return;
+			}
+		}
+
+		ctx.seen_triangles[ctx.seen_triangle_count] = connection_index;
+		++ctx.seen_triangle_count;
+		ctx.triangles_to_test[ctx.test_count] = connection_index;
+		++ctx.test_count;
+	}
+
+	void Terrain::generate_triangulate_shader(TriangulationContext& ctx, const uint node_index)
+	{
+		const uint thid = gl_GlobalInvocationID.x;
+
+		const vec2 node_min = terrain_buffer->data[node_index].min;
+		const vec2 node_max = terrain_buffer->data[node_index].max;
+		const float side = node_max.x - node_min.x;
+
+		const int nodes_per_side = 1 << quadtree_levels;
+
+		const int cx = int((node_min.x - terrain_buffer->quadtree_min.x + 1) / side);  // current node x
+		const int cy = int((node_min.y - terrain_buffer->quadtree_min.y + 1) / side);  // current node z/y
+
+		// Set shared variables
+		if (thid == 0)
+		{
+			ctx.s_triangles_removed = 0;
+		}
+
+		//barrier();
+		//memoryBarrierShared();
+
+		const uint new_points_count = terrain_buffer->data[node_index].new_points_count;
+
+		for (uint n = 0; n < new_points_count; ++n)
+		{
+			const vec4 current_point = terrain_buffer->data[node_index].new_points[n];
+
+			ctx.seen_triangle_count = 1;
+			ctx.test_count = 1;
+
+			const uint start_index = locate_point(terrain_buffer->data[node_index], border_grids[node_index], vec2(current_point.x, current_point.z));
+			if (start_index == INVALID)
+				continue;
+
+			ctx.seen_triangles[0] = start_index;
+			ctx.triangles_to_test[0] = start_index;
+			ctx.g_new_triangle_index_count = 0;
+
+			bool finish = false;
+			while (ctx.test_count != 0 && !finish)
+			{
+				const uint triangle_index = ctx.triangles_to_test[--ctx.test_count];
+
+				if (circumcircle_contains(terrain_buffer->data[node_index], triangle_index, current_point, ctx.statistics))
 				{
 					// Add triangle edges to edge buffer
 					const uint index0 = terrain_buffer->data[node_index].indices[triangle_index * 3 + 0];
 					const uint index1 = terrain_buffer->data[node_index].indices[triangle_index * 3 + 1];
 					const uint index2 = terrain_buffer->data[node_index].indices[triangle_index * 3 + 2];
-					const vec4 p0 = vec4(vec3(terrain_buffer->data[node_index].positions[index0]), 1.0f);
-					const vec4 p1 = vec4(vec3(terrain_buffer->data[node_index].positions[index1]), 1.0f);
-					const vec4 p2 = vec4(vec3(terrain_buffer->data[node_index].positions[index2]), 1.0f);
+					const vec4 p0 = vec4(vec3(terrain_buffer->data[node_index].get_position(index0)), 1.0f);
+					const vec4 p1 = vec4(vec3(terrain_buffer->data[node_index].get_position(index1)), 1.0f);
+					const vec4 p2 = vec4(vec3(terrain_buffer->data[node_index].get_position(index2)), 1.0f);
 
 					// Store edges to be removed
-					uint tr = atomicAdd(s_triangles_removed, 1);
+					uint tr = atomicAdd(ctx.s_triangles_removed, 1);
 					if (tr >= max_triangles_to_remove || tr >= max_border_edges)
 					{
 						finish = true;
@@ -1384,31 +1810,31 @@ namespace cputri
 					uint ec = tr * 3;
 					// Edge 0
 					bool biggest_point = p0.y < p1.y;
-					s_generate_edges[ec + 0].p1 = biggest_point ? p0 : p1;
-					s_generate_edges[ec + 0].p2 = !biggest_point ? p0 : p1;
-					s_generate_edges[ec + 0].p1_index = biggest_point ? index0 : index1;
-					s_generate_edges[ec + 0].p2_index = !biggest_point ? index0 : index1;
-					s_generate_edges[ec + 0].connection = terrain_buffer->data[node_index].triangle_connections[triangle_index * 3 + 0];
-					s_generate_edges[ec + 0].old_triangle_index = triangle_index;
+					ctx.s_generate_edges[ec + 0].p1 = biggest_point ? p0 : p1;
+					ctx.s_generate_edges[ec + 0].p2 = !biggest_point ? p0 : p1;
+					ctx.s_generate_edges[ec + 0].p1_index = biggest_point ? index0 : index1;
+					ctx.s_generate_edges[ec + 0].p2_index = !biggest_point ? index0 : index1;
+					ctx.s_generate_edges[ec + 0].connection = terrain_buffer->data[node_index].triangle_connections[triangle_index * 3 + 0];
+					ctx.s_generate_edges[ec + 0].old_triangle_index = triangle_index;
 					// Edge 1
 					biggest_point = p1.y < p2.y;
-					s_generate_edges[ec + 1].p1 = biggest_point ? p1 : p2;
-					s_generate_edges[ec + 1].p2 = !biggest_point ? p1 : p2;
-					s_generate_edges[ec + 1].p1_index = biggest_point ? index1 : index2;
-					s_generate_edges[ec + 1].p2_index = !biggest_point ? index1 : index2;
-					s_generate_edges[ec + 1].connection = terrain_buffer->data[node_index].triangle_connections[triangle_index * 3 + 1];
-					s_generate_edges[ec + 1].old_triangle_index = triangle_index;
+					ctx.s_generate_edges[ec + 1].p1 = biggest_point ? p1 : p2;
+					ctx.s_generate_edges[ec + 1].p2 = !biggest_point ? p1 : p2;
+					ctx.s_generate_edges[ec + 1].p1_index = biggest_point ? index1 : index2;
+					ctx.s_generate_edges[ec + 1].p2_index = !biggest_point ? index1 : index2;
+					ctx.s_generate_edges[ec + 1].connection = terrain_buffer->data[node_index].triangle_connections[triangle_index * 3 + 1];
+					ctx.s_generate_edges[ec + 1].old_triangle_index = triangle_index;
 					// Edge 2
 					biggest_point = p2.y < p0.y;
-					s_generate_edges[ec + 2].p1 = biggest_point ? p2 : p0;
-					s_generate_edges[ec + 2].p2 = !biggest_point ? p2 : p0;
-					s_generate_edges[ec + 2].p1_index = biggest_point ? index2 : index0;
-					s_generate_edges[ec + 2].p2_index = !biggest_point ? index2 : index0;
-					s_generate_edges[ec + 2].connection = terrain_buffer->data[node_index].triangle_connections[triangle_index * 3 + 2];
-					s_generate_edges[ec + 2].old_triangle_index = triangle_index;
+					ctx.s_generate_edges[ec + 2].p1 = biggest_point ? p2 : p0;
+					ctx.s_generate_edges[ec + 2].p2 = !biggest_point ? p2 : p0;
+					ctx.s_generate_edges[ec + 2].p1_index = biggest_point ? index2 : index0;
+					ctx.s_generate_edges[ec + 2].p2_index = !biggest_point ? index2 : index0;
+					ctx.s_generate_edges[ec + 2].connection = terrain_buffer->data[node_index].triangle_connections[triangle_index * 3 + 2];
+					ctx.s_generate_edges[ec + 2].old_triangle_index = triangle_index;
 
 					// Mark the triangle to be removed later
-					s_triangles_to_remove[tr] = triangle_index;
+					ctx.s_triangles_to_remove[tr] = triangle_index;
 
 					// Add neighbour triangles to be tested
 					for (uint ss = 0; ss < 3 && !finish; ++ss)
@@ -1417,13 +1843,13 @@ namespace cputri
 
 						if (index <= INVALID - 9)
 						{
-							if (seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || test_count >= TEST_TRIANGLE_BUFFER_SIZE)
+							if (ctx.seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || ctx.test_count >= TEST_TRIANGLE_BUFFER_SIZE)
 							{
 								finish = true;
 								break;
 							}
 
-							g_add_connection(index);
+							g_add_connection(ctx, index);
 						}
 					}
 				}
@@ -1431,7 +1857,7 @@ namespace cputri
 
 			if (finish)
 			{
-				s_triangles_removed = 0;
+				ctx.s_triangles_removed = 0;
 				continue;
 			}
 
@@ -1439,25 +1865,12 @@ namespace cputri
 			//memoryBarrierShared();
 
 			// Delete all doubly specified edges from edge buffer (this leaves the edges of the enclosing polygon only)
-			const uint edge_count = s_triangles_removed * 3;
-			uint i = thid;
-			while (i < edge_count)
+			const uint edge_count = ctx.s_triangles_removed * 3;
+			count_cavity_edges(ctx.cavity_edges, ctx.s_generate_edges.data(), edge_count);
+			for (uint i = thid; i < edge_count; i += WORK_GROUP_SIZE)
 			{
-				bool found = false;
-				for (uint j = 0; j < edge_count; ++j)
-				{
-					if (i != j &&
-						s_generate_edges[i].p1 == s_generate_edges[j].p1 &&
-						s_generate_edges[i].p2 == s_generate_edges[j].p2)
-					{
-						// Mark as invalid
-						s_generate_edges[j].p1.w = -1;
-						found = true;
-					}
-				}
-				if (found)
-					s_generate_edges[i].p1.w = -1;
-				i += WORK_GROUP_SIZE;
+				if (is_shared_edge(ctx.cavity_edges, i))
+					ctx.s_generate_edges[i].p1.w = -1;
 			}
 
 			//barrier();
@@ -1466,51 +1879,61 @@ namespace cputri
 			// Count the number of new triangles to create
 			if (thid == 0)
 			{
-				s_new_triangle_count = 0;
+				ctx.s_new_triangle_count = 0;
 
 				for (uint j = 0; j < edge_count && j < max_triangles_to_remove * 3; ++j)
 				{
-					if (s_generate_edges[j].p1.w > -0.5)
+					if (ctx.s_generate_edges[j].p1.w > -0.5)
 					{
-						s_generate_edges[j].future_index = terrain_buffer->data[node_index].index_count / 3 + s_new_triangle_count;
-						s_valid_indices[s_new_triangle_count++] = j;
+						ctx.s_generate_edges[j].future_index = terrain_buffer->data[node_index].index_count / 3 + ctx.s_new_triangle_count;
+						ctx.s_valid_indices[ctx.s_new_triangle_count++] = j;
 					}
 				}
 			}
 
+			// The new triangles are added before the old ones are removed
+			if (!reserve_node(node_index,
+				terrain_buffer->data[node_index].index_count / 3 + ctx.s_new_triangle_count,
+				terrain_buffer->data[node_index].vertex_count + 1,
+				terrain_buffer->data[node_index].border_count + ctx.s_new_triangle_count))
+			{
+				ctx.s_triangles_removed = 0;
+				continue;
+			}
+
 			//barrier();
 			//memoryBarrierShared();
 
 			if (thid == 0)
 			{
 				// Add to the triangle list all triangles formed between the point and the edges of the enclosing polygon
-				for (uint ii = 0; ii < s_new_triangle_count; ++ii)
+				for (uint ii = 0; ii < ctx.s_new_triangle_count; ++ii)
 				{
-					uint i = s_valid_indices[ii];
-					vec3 P = vec3(s_generate_edges[i].p1);
-					vec3 Q = vec3(s_generate_edges[i].p2);
+					uint i = ctx.s_valid_indices[ii];
+					vec3 P = vec3(ctx.s_generate_edges[i].p1);
+					vec3 Q = vec3(ctx.s_generate_edges[i].p2);
 					vec3 R = vec3(current_point);
 
 					// Make sure winding order is correct
 					const vec3 nor = cross(R - P, Q - P);
 					if (nor.y > 0)
 					{
-						vec4 temp = s_generate_edges[i].p1;
-						s_generate_edges[i].p1 = s_generate_edges[i].p2;
-						s_generate_edges[i].p2 = temp;
-						uint temp2 = s_generate_edges[i].p1_index;
-						s_generate_edges[i].p1_index = s_generate_edges[i].p2_index;
-						s_generate_edges[i].p2_index = temp2;
+						vec4 temp = ctx.s_generate_edges[i].p1;
+						ctx.s_generate_edges[i].p1 = ctx.s_generate_edges[i].p2;
+						ctx.s_generate_edges[i].p2 = temp;
+						uint temp2 = ctx.s_generate_edges[i].p1_index;
+						ctx.s_generate_edges[i].p1_index = ctx.s_generate_edges[i].p2_index;
+						ctx.s_generate_edges[i].p2_index = temp2;
 					}
 
 					// Set indices for the new triangle
 					const uint index_count = terrain_buffer->data[node_index].index_count;
-					terrain_buffer->data[node_index].indices[index_count + 0] = s_generate_edges[i].p1_index;
-					terrain_buffer->data[node_index].indices[index_count + 1] = s_generate_edges[i].p2_index;
+					terrain_buffer->data[node_index].indices[index_count + 0] = ctx.s_generate_edges[i].p1_index;
+					terrain_buffer->data[node_index].indices[index_count + 1] = ctx.s_generate_edges[i].p2_index;
 					terrain_buffer->data[node_index].indices[index_count + 2] = terrain_buffer->data[node_index].vertex_count;
 
 					const uint triangle_count = index_count / 3;
-					g_new_triangle_indices[g_new_triangle_index_count++] = triangle_count;
+					ctx.g_new_triangle_indices[ctx.g_new_triangle_index_count++] = triangle_count;
 
 					// Set circumcircles for the new triangle
 					float a = distance(vec2(P.x, P.z), vec2(Q.x, Q.z));
@@ -1519,58 +1942,56 @@ namespace cputri
 
 					const vec2 cc_center = find_circum_center(vec2(P.x, P.z), vec2(Q.x, Q.z), vec2(R.x, R.z));
 					const float cc_radius2 = find_circum_radius_squared(a, b, c);
-					const float cc_radius = sqrt(cc_radius2);
 
-					terrain_buffer->data[node_index].triangles[triangle_count].circumcentre = cc_center;
-					terrain_buffer->data[node_index].triangles[triangle_count].circumradius2 = cc_radius2;
+					terrain_buffer->data[node_index].set_circumcircle(triangle_count, cc_center, cc_radius2);
 
 					// Connections
-					terrain_buffer->data[node_index].triangle_connections[index_count + 0] = s_generate_edges[i].connection;
-					const vec4 edges[2] = { s_generate_edges[i].p1, s_generate_edges[i].p2 };
+					terrain_buffer->data[node_index].triangle_connections[index_count + 0] = ctx.s_generate_edges[i].connection;
+					const vec4 edges[2] = { ctx.s_generate_edges[i].p1, ctx.s_generate_edges[i].p2 };
 					bool already_added = false;
 					for (uint ss = 0; ss < 2; ++ss)  // The two other sides
 					{
 						bool found = false;
 						// Search through all other new triangles that have been added to find possible neighbours/connections
-						for (uint ee = 0; ee < s_new_triangle_count && !found; ++ee)
+						for (uint ee = 0; ee < ctx.s_new_triangle_count && !found; ++ee)
 						{
-							uint test_index = s_valid_indices[ee];
+							uint test_index = ctx.s_valid_indices[ee];
 							if (test_index == i)
 								continue;
 							// Check each pair of points in the triangle if they match
-							if (edges[ss] == s_generate_edges[test_index].p1)
+							if (edges[ss] == ctx.s_generate_edges[test_index].p1)
 							{
-								terrain_buffer->data[node_index].triangle_connections[index_count + 2 - ss] = s_generate_edges[test_index].future_index;
+								terrain_buffer->data[node_index].triangle_connections[index_count + 2 - ss] = ctx.s_generate_edges[test_index].future_index;
 								found = true;
 							}
-							else if (edges[ss] == s_generate_edges[test_index].p2)
+							else if (edges[ss] == ctx.s_generate_edges[test_index].p2)
 							{
-								terrain_buffer->data[node_index].triangle_connections[index_count + 2 - ss] = s_generate_edges[test_index].future_index;
+								terrain_buffer->data[node_index].triangle_connections[index_count + 2 - ss] = ctx.s_generate_edges[test_index].future_index;
 								found = true;
 							}
 						}
 						if (!found)
 						{
 							terrain_buffer->data[node_index].triangle_connections[index_count + 2 - ss] = INVALID;
-							if (!already_added && terrain_buffer->data[node_index].border_count < MAX_BORDER_TRIANGLE_COUNT)
+							if (!already_added)
 							{
 								already_added = true;
-								terrain_buffer->data[node_index].border_triangle_indices[terrain_buffer->data[node_index].border_count++] = s_generate_edges[i].future_index;
+								terrain_buffer->data[node_index].border_triangle_indices[terrain_buffer->data[node_index].border_count++] = ctx.s_generate_edges[i].future_index;
 							}
 						}
 					}
 
-					replace_connection_index(node_index, s_generate_edges[i].connection, s_generate_edges[i].old_triangle_index, s_generate_edges[i].future_index);
+					replace_connection_index(node_index, ctx.s_generate_edges[i].connection, ctx.s_generate_edges[i].old_triangle_index, ctx.s_generate_edges[i].future_index);
 
 					terrain_buffer->data[node_index].index_count += 3;
 				}
 
-				g_remove_old_triangles(node_index);
+				g_remove_old_triangles(ctx, node_index);
 
 				// Insert new point
-				terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].vertex_count++] = current_point;
+				terrain_buffer->data[node_index].set_position(terrain_buffer->data[node_index].vertex_count++, current_point);
 
-				s_triangles_removed = 0;
+				ctx.s_triangles_removed = 0;
 			}
 
 			//barrier();
@@ -1581,7 +2002,7 @@ namespace cputri
 		terrain_buffer->data[node_index].new_points_count = 0;
 	}
 
-	void add_border_point(uint self_node_index, uint other_node_index, vec4 point)
+	void Terrain::add_border_point(uint self_node_index, vec4 point)
 	{
 		uint count = terrain_buffer->data[self_node_index].new_points_count;
 		for (uint np = 0; np < count; ++np)
@@ -1603,28 +2024,27 @@ namespace cputri
 			//const vec2 circumcentre = terrain_buffer->data[self_node_index].triangles[triangle_index].circumcentre;
 			//const float circumradius2 = terrain_buffer->data[self_node_index].triangles[triangle_index].circumradius2;
 
-			const vec2 circumcentre = terrain_buffer->data[self_node_index].triangles[tt].circumcentre;
-			const float circumradius2 = terrain_buffer->data[self_node_index].triangles[tt].circumradius2;
+			const vec2 circumcentre = terrain_buffer->data[self_node_index].get_circumcentre(tt);
+			const float circumradius2 = terrain_buffer->data[self_node_index].get_circumradius2(tt);
 
 			const float dx = point.x - circumcentre.x;
 			const float dy = point.z - circumcentre.y;
 
 			// Find the first triangle whose cc contains the point
-			if (dx * dx + dy * dy < circumradius2)
+			if (dx * dx + dy * dy < circumradius2 && reserve_new_points(self_node_index, terrain_buffer->data[self_node_index].new_points_count + 1))
 			{
-				terrain_buffer->data[self_node_index].new_points[terrain_buffer->data[self_node_index].new_points_count] = point;
-				terrain_buffer->data[self_node_index].new_points_triangles[terrain_buffer->data[self_node_index].new_points_count++] = tt;
+				terrain_buffer->data[self_node_index].new_points[terrain_buffer->data[self_node_index].new_points_count++] = point;
 				return;
 			}
 		}
 	}
 
-	void g_remove_marked_triangles(uint node_index)
+	void Terrain::g_remove_marked_triangles(TriangulationContext& ctx, uint node_index)
 	{
 		// Remove the outer triangles/supertriangles
-		for (int j = int(s_triangles_removed) - 1; j >= 0; --j)
+		for (int j = int(ctx.s_triangles_removed) - 1; j >= 0; --j)
 		{
-			const uint index = s_triangles_to_remove[j];
+			const uint index = ctx.s_triangles_to_remove[j];
 
 			const uint last_triangle = terrain_buffer->data[node_index].index_count / 3 - 1;
 
@@ -1657,16 +2077,15 @@ namespace cputri
 				terrain_buffer->data[node_index].indices[index * 3 + 0] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 0];
 				terrain_buffer->data[node_index].indices[index * 3 + 1] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 1];
 				terrain_buffer->data[node_index].indices[index * 3 + 2] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 2];
-				terrain_buffer->data[node_index].triangles[index].circumcentre = terrain_buffer->data[node_index].triangles[last_triangle].circumcentre;
-				terrain_buffer->data[node_index].triangles[index].circumradius2 = terrain_buffer->data[node_index].triangles[last_triangle].circumradius2;
+				terrain_buffer->data[node_index].set_circumcircle(index, terrain_buffer->data[node_index].get_circumcentre(last_triangle), terrain_buffer->data[node_index].get_circumradius2(last_triangle));
 				terrain_buffer->data[node_index].triangle_connections[index * 3 + 0] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 0];
 				terrain_buffer->data[node_index].triangle_connections[index * 3 + 1] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 1];
 				terrain_buffer->data[node_index].triangle_connections[index * 3 + 2] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 2];
 
-				for (uint ii = 0; ii < j; ++ii)
+				for (uint ii = 0; ii < (uint)j; ++ii)
 				{
-					if (s_triangles_to_remove[ii] == last_triangle)
-						s_triangles_to_remove[ii] = index;
+					if (ctx.s_triangles_to_remove[ii] == last_triangle)
+						ctx.s_triangles_to_remove[ii] = index;
 				}
 			}
 
@@ -1674,12 +2093,12 @@ namespace cputri
 		}
 	}
 
-	void g_remove_marked_triangles2(uint node_index)
+	void Terrain::g_remove_marked_triangles2(TriangulationContext& ctx, uint node_index)
 	{
 		// Remove the outer triangles/supertriangles
-		for (int j = int(s_triangles_removed) - 1; j >= 0; --j)
+		for (int j = int(ctx.s_triangles_removed) - 1; j >= 0; --j)
 		{
-			const uint index = s_triangles_to_remove[j];
+			const uint index = ctx.s_triangles_to_remove[j];
 
 			const uint last_triangle = terrain_buffer->data[node_index].index_count / 3 - 1;
 
@@ -1694,16 +2113,15 @@ namespace cputri
 				terrain_buffer->data[node_index].indices[index * 3 + 0] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 0];
 				terrain_buffer->data[node_index].indices[index * 3 + 1] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 1];
 				terrain_buffer->data[node_index].indices[index * 3 + 2] = terrain_buffer->data[node_index].indices[last_triangle * 3 + 2];
-				terrain_buffer->data[node_index].triangles[index].circumcentre = terrain_buffer->data[node_index].triangles[last_triangle].circumcentre;
-				terrain_buffer->data[node_index].triangles[index].circumradius2 = terrain_buffer->data[node_index].triangles[last_triangle].circumradius2;
+				terrain_buffer->data[node_index].set_circumcircle(index, terrain_buffer->data[node_index].get_circumcentre(last_triangle), terrain_buffer->data[node_index].get_circumradius2(last_triangle));
 				terrain_buffer->data[node_index].triangle_connections[index * 3 + 0] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 0];
 				terrain_buffer->data[node_index].triangle_connections[index * 3 + 1] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 1];
 				terrain_buffer->data[node_index].triangle_connections[index * 3 + 2] = terrain_buffer->data[node_index].triangle_connections[last_triangle * 3 + 2];
 
-				for (uint ii = 0; ii < j; ++ii)
+				for (uint ii = 0; ii < (uint)j; ++ii)
 				{
-					if (s_triangles_to_remove[ii] == last_triangle)
-						s_triangles_to_remove[ii] = index;
+					if (ctx.s_triangles_to_remove[ii] == last_triangle)
+						ctx.s_triangles_to_remove[ii] = index;
 				}
 			}
 
@@ -1725,7 +2143,7 @@ namespace cputri
 		c = -0.5f*(a*(v0.x + v1.x) + b * (v0.z + v1.z));
 	}
 
-	bool is_same_edge(vec4 e1p1, vec4 e1p2, vec3 test_middle, vec4 e2p1, vec4 e2p2, vec3 neighbour_middle, uint neighbour_node_index, uint neighbour_border_index, bool& found_matching_edge)
+	bool Terrain::is_same_edge(vec4 e1p1, vec4 e1p2, vec3 test_middle, vec4 e2p1, vec4 e2p2, vec3 neighbour_middle, uint neighbour_node_index, uint neighbour_border_index, bool& found_matching_edge)
 	{
 		if (((e1p1 == e2p1 && e1p2 == e2p2) ||
 			(e1p2 == e2p1 && e1p1 == e2p2)) && 
@@ -1743,7 +2161,7 @@ namespace cputri
 	}
 
 
-	void generate_shader(uint node_index, vec2 min, vec2 max)
+	void Terrain::generate_shader(TriangulationContext& ctx, uint node_index, vec2 min, vec2 max)
 	{
 		const uint GRID_SIDE = TERRAIN_GENERATE_GRID_SIDE;
 
@@ -1773,10 +2191,10 @@ namespace cputri
 			vec4 p2 = vec4(node_max.x + temp, 3, node_max.y + temp, 1);
 			vec4 p3 = vec4(node_min.x - temp, 4, node_max.y + temp, 1);
 
-			terrain_buffer->data[node_index].positions[0] = p0;
-			terrain_buffer->data[node_index].positions[1] = p1;
-			terrain_buffer->data[node_index].positions[2] = p2;
-			terrain_buffer->data[node_index].positions[3] = p3;
+			terrain_buffer->data[node_index].set_position(0, p0);
+			terrain_buffer->data[node_index].set_position(1, p1);
+			terrain_buffer->data[node_index].set_position(2, p2);
+			terrain_buffer->data[node_index].set_position(3, p3);
 
 			terrain_buffer->data[node_index].indices[0] = 0;
 			terrain_buffer->data[node_index].indices[1] = 1;
@@ -1789,10 +2207,8 @@ namespace cputri
 			const vec2 Q = vec2(p1.x, p1.z);
 			const vec2 R = vec2(p2.x, p2.z);
 			const vec2 S = vec2(p3.x, p3.z);
-			terrain_buffer->data[node_index].triangles[0].circumcentre = find_circum_center(P, Q, R);
-			terrain_buffer->data[node_index].triangles[0].circumradius2 = find_circum_radius_squared(P, Q, R);
-			terrain_buffer->data[node_index].triangles[1].circumcentre = find_circum_center(R, S, P);
-			terrain_buffer->data[node_index].triangles[1].circumradius2 = find_circum_radius_squared(R, S, P);
+			terrain_buffer->data[node_index].set_circumcircle(0, find_circum_center(P, Q, R), find_circum_radius_squared(P, Q, R));
+			terrain_buffer->data[node_index].set_circumcircle(1, find_circum_center(R, S, P), find_circum_radius_squared(R, S, P));
 
 			terrain_buffer->data[node_index].triangle_connections[0 + 0] = INVALID;
 			terrain_buffer->data[node_index].triangle_connections[0 + 1] = INVALID;
@@ -1809,6 +2225,8 @@ namespace cputri
 		//memoryBarrierBuffer();
 
 		// Generate static positions
+		float grid_x[GRID_SIDE * GRID_SIDE];
+		float grid_z[GRID_SIDE * GRID_SIDE];
 		uint i = gl_GlobalInvocationID.x;
 		while (i < GRID_SIDE * GRID_SIDE)
 		{
@@ -1820,12 +2238,25 @@ namespace cputri
 			else if ((i % GRID_SIDE) / float(GRID_SIDE - 1) > 0.99f)
 				x = max.x;
 
-			terrain_buffer->data[node_index].new_points[i] = vec4(x, -terrain(vec2(x, z)) - 0.5, z, curvature(vec3(x, 0.0f, z)));
-			terrain_buffer->data[node_index].new_points_triangles[i] = 0;
+			grid_x[i] = x;
+			grid_z[i] = z;
 
 			i += WORK_GROUP_SIZE;
 		}
 
+		// Heights and curvatures of all grid points at once
+		float grid_heights[GRID_SIDE * GRID_SIDE];
+		float grid_curvatures[GRID_SIDE * GRID_SIDE];
+		evaluate_terrain(grid_x, grid_z, GRID_SIDE * GRID_SIDE, grid_heights);
+		reset_error_cache(node_index);
+		rebuild_border_grid(node_index);
+		find_curvatures(grid_x, grid_z, GRID_SIDE * GRID_SIDE, grid_curvatures);
+
+		for (i = 0; i < GRID_SIDE * GRID_SIDE; ++i)
+		{
+			terrain_buffer->data[node_index].new_points[i] = vec4(grid_x[i], -grid_heights[i] - 0.5, grid_z[i], grid_curvatures[i]);
+		}
+
 		//barrier();
 		//memoryBarrierBuffer();
 
@@ -1853,7 +2284,7 @@ namespace cputri
 				// Check if valid node
 				if (nx >= 0 && nx < nodes_per_side && ny >= 0 && ny < nodes_per_side)
 				{
-					const uint neighbour_index = terrain_buffer->quadtree_index_map[ny * nodes_per_side + nx];
+					const uint neighbour_index = terrain_buffer->quadtree_index_map[get_map_index(nx, ny)];
 					if (neighbour_index == INVALID || terrain_buffer->data[neighbour_index].instance_count != 1 || (x == 0 && y == 0))
 						continue;
 
@@ -1862,28 +2293,28 @@ namespace cputri
 					for (uint tt = 0; tt < triangle_count; ++tt)
 					{
 						const uint triangle_index = terrain_buffer->data[neighbour_index].border_triangle_indices[tt];
-						const vec4 p0 = terrain_buffer->data[neighbour_index].positions[terrain_buffer->data[neighbour_index].indices[triangle_index * 3 + 0]];
+						const vec4 p0 = terrain_buffer->data[neighbour_index].get_position(terrain_buffer->data[neighbour_index].indices[triangle_index * 3 + 0]);
 						// Check if the point/triangle could actually be relevant
 						if (p0.x >= adjusted_min.x && p0.x <= adjusted_max.x
 							&& p0.z >= adjusted_min.y && p0.z <= adjusted_max.y)
 						{
-							const vec4 p1 = terrain_buffer->data[neighbour_index].positions[terrain_buffer->data[neighbour_index].indices[triangle_index * 3 + 1]];
-							const vec4 p2 = terrain_buffer->data[neighbour_index].positions[terrain_buffer->data[neighbour_index].indices[triangle_index * 3 + 2]];
+							const vec4 p1 = terrain_buffer->data[neighbour_index].get_position(terrain_buffer->data[neighbour_index].indices[triangle_index * 3 + 1]);
+							const vec4 p2 = terrain_buffer->data[neighbour_index].get_position(terrain_buffer->data[neighbour_index].indices[triangle_index * 3 + 2]);
 							// Find the side(s) that actually faces the border (and therefore has an INVALID connection)
 							if (terrain_buffer->data[neighbour_index].triangle_connections[triangle_index * 3 + 0] == INVALID - 4 + y * 3 + x)
 							{
-								add_border_point(node_index, neighbour_index, p0);
-								add_border_point(node_index, neighbour_index, p1);
+								add_border_point(node_index, p0);
+								add_border_point(node_index, p1);
 							}
 							if (terrain_buffer->data[neighbour_index].triangle_connections[triangle_index * 3 + 1] == INVALID - 4 + y * 3 + x)
 							{
-								add_border_point(node_index, neighbour_index, p1);
-								add_border_point(node_index, neighbour_index, p2);
+								add_border_point(node_index, p1);
+								add_border_point(node_index, p2);
 							}
 							if (terrain_buffer->data[neighbour_index].triangle_connections[triangle_index * 3 + 2] == INVALID - 4 + y * 3 + x)
 							{
-								add_border_point(node_index, neighbour_index, p2);
-								add_border_point(node_index, neighbour_index, p0);
+								add_border_point(node_index, p2);
+								add_border_point(node_index, p0);
 							}
 						}
 					}
@@ -1892,30 +2323,30 @@ namespace cputri
 		}
 
 		// Triangulation
-		generate_triangulate_shader(node_index);
+		generate_triangulate_shader(ctx, node_index);
 
 		// Find out and mark which triangles are part of the outer triangles/supertriangles
-		const vec4 start_positions[4] = { terrain_buffer->data[node_index].positions[0], 
-																			terrain_buffer->data[node_index].positions[1], 
-																			terrain_buffer->data[node_index].positions[2], 
-																			terrain_buffer->data[node_index].positions[3] };
+		const vec4 start_positions[4] = { terrain_buffer->data[node_index].get_position(0), 
+																			terrain_buffer->data[node_index].get_position(1), 
+																			terrain_buffer->data[node_index].get_position(2), 
+																			terrain_buffer->data[node_index].get_position(3) };
 		uint triangle_count = terrain_buffer->data[node_index].index_count / 3;
-		s_triangles_removed = 0;
+		ctx.s_triangles_removed = 0;
 		for (uint tt = 0; tt < triangle_count; ++tt)
 		{
 			// Check each of the three points that make up each triangle
 			bool found = false;
 			for (uint pp = 0; pp < 3 && !found; ++pp)
 			{
-				const vec4 test_point = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[tt * 3 + pp]];
+				const vec4 test_point = terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[tt * 3 + pp]);
 				// Check against all four supertriangle corners
 				for (uint sp = 0; sp < 4; ++sp)
 				{
 					if (test_point == start_positions[sp])
 					{
-						uint tr = atomicAdd(s_triangles_removed, 1);
+						uint tr = atomicAdd(ctx.s_triangles_removed, 1);
 						// Mark the triangle to be removed later
-						s_triangles_to_remove[tr] = tt;
+						ctx.s_triangles_to_remove[tr] = tt;
 						found = true;
 						break;
 					}
@@ -1924,7 +2355,7 @@ namespace cputri
 		}
 
 		// Remove the marked triangles
-		g_remove_marked_triangles(node_index);
+		g_remove_marked_triangles(ctx, node_index);
 
 		// Restore borders
 		triangle_count = terrain_buffer->data[node_index].index_count / 3; 
@@ -1962,23 +2393,23 @@ namespace cputri
 			g_seen_triangles[g_seen_triangle_count++] = terrain_buffer->data[node_index].border_triangle_indices[tt];
 			g_triangles_to_test[g_test_count++] = terrain_buffer->data[node_index].border_triangle_indices[tt];
 		}
-		s_triangles_removed = 0;
+		ctx.s_triangles_removed = 0;
 		while (g_test_count != 0)
 		{
 			const uint test_triangle = g_triangles_to_test[--g_test_count];
 			int found_sides = 0;
 			bool found_matching_edge = false;
 			uint ss;
-			const vec4 sides[3] = { terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + 0]],
-															terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + 1]],
-															terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + 2]] };
+			const vec4 sides[3] = { terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + 0]),
+															terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + 1]),
+															terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + 2]) };
 			const vec3 test_middle = (sides[0] + sides[1] + sides[2]) / 3.f;
 			// For each side of the triangle
 			for (ss = 0; ss < 3 && found_sides != 2; ++ss)
 			{
 				bool found = false;
-				vec4 e1p1 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + ss]];
-				vec4 e1p2 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + (ss + 1) % 3]];
+				vec4 e1p1 = terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + ss]);
+				vec4 e1p2 = terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + (ss + 1) % 3]);
 				// Check each neighbour node
 				for (int y = -1; y <= 1 && !found; ++y)
 				{
@@ -1989,7 +2420,7 @@ namespace cputri
 						// Check if valid node
 						if (nx >= 0 && nx < nodes_per_side && ny >= 0 && ny < nodes_per_side)
 						{
-							const uint neighbour_index = terrain_buffer->quadtree_index_map[ny * nodes_per_side + nx];
+							const uint neighbour_index = terrain_buffer->quadtree_index_map[get_map_index(nx, ny)];
 							if (neighbour_index == INVALID || terrain_buffer->data[neighbour_index].instance_count != 1 || (x == 0 && y == 0))
 								continue;
 
@@ -1998,13 +2429,13 @@ namespace cputri
 							for (uint tt = 0; tt < triangle_count && !found; ++tt)
 							{
 								const uint border_triangle_index = terrain_buffer->data[neighbour_index].border_triangle_indices[tt];
-								const vec4 e2p0 = terrain_buffer->data[neighbour_index].positions[terrain_buffer->data[neighbour_index].indices[border_triangle_index * 3 + 0]];
+								const vec4 e2p0 = terrain_buffer->data[neighbour_index].get_position(terrain_buffer->data[neighbour_index].indices[border_triangle_index * 3 + 0]);
 								// Check if the point could actually be relevant
 								if (e2p0.x >= adjusted_min.x && e2p0.x <= adjusted_max.x
 									&& e2p0.z >= adjusted_min.y && e2p0.z <= adjusted_max.y)
 								{
-									const vec4 e2p1 = terrain_buffer->data[neighbour_index].positions[terrain_buffer->data[neighbour_index].indices[border_triangle_index * 3 + 1]];
-									const vec4 e2p2 = terrain_buffer->data[neighbour_index].positions[terrain_buffer->data[neighbour_index].indices[border_triangle_index * 3 + 2]];
+									const vec4 e2p1 = terrain_buffer->data[neighbour_index].get_position(terrain_buffer->data[neighbour_index].indices[border_triangle_index * 3 + 1]);
+									const vec4 e2p2 = terrain_buffer->data[neighbour_index].get_position(terrain_buffer->data[neighbour_index].indices[border_triangle_index * 3 + 2]);
 									const vec4 neighbour_middle = (e2p0 + e2p1 + e2p2) / 3.f;
 									// 
 									if (is_same_edge(e1p1, e1p2, test_middle, e2p0, e2p1, neighbour_middle, neighbour_index, border_triangle_index * 3 + 0, found_matching_edge)
@@ -2042,8 +2473,8 @@ namespace cputri
 			bool statically_inserted = false;
 			for (ss = 0; ss < 3; ++ss)
 			{
-				vec4 p0 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + ss]];
-				vec4 p1 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[test_triangle * 3 + (ss + 1) % 3]];
+				vec4 p0 = terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + ss]);
+				vec4 p1 = terrain_buffer->data[node_index].get_position(terrain_buffer->data[node_index].indices[test_triangle * 3 + (ss + 1) % 3]);
 				vec3 mid = (p0 + p1) / 2.f;
 				if (abs(mid.x - node_min.x) < 0.01f)  // Left
 				{
@@ -2073,7 +2504,7 @@ namespace cputri
 			// Otherwise 
 			if (!statically_inserted && found_sides == 0)
 			{
-				s_triangles_to_remove[s_triangles_removed++] = test_triangle;
+				ctx.s_triangles_to_remove[ctx.s_triangles_removed++] = test_triangle;
 				for (ss = 0; ss < 3; ++ss)
 				{
 					const uint connection_index = terrain_buffer->data[node_index].triangle_connections[test_triangle * 3 + ss];
@@ -2102,12 +2533,13 @@ namespace cputri
 		}
 
 		// Remove the marked triangles
-		g_remove_marked_triangles2(node_index);
+		g_remove_marked_triangles2(ctx, node_index);
 
 		// Restore borders
 		triangle_count = terrain_buffer->data[node_index].index_count / 3;
 		terrain_buffer->data[node_index].border_count = 0;
-		for (uint tt = 0; tt < triangle_count; ++tt)
+		reserve_node(node_index, 0, 0, triangle_count);
+		for (uint tt = 0; tt < triangle_count && terrain_buffer->data[node_index].border_count < terrain_buffer->data[node_index].border_capacity; ++tt)
 		{
 			for (uint ss = 0; ss < 3; ++ss)
 			{
@@ -2118,30 +2550,111 @@ namespace cputri
 				}
 			}
 		}
+
+		rebuild_border_grid(node_index);
+	}
+
+	void Terrain::find_curvatures(const float* x, const float* z, uint count, float* results) const
+	{
+		if (derivative_mode == DERIVATIVE_MODE::ANALYTIC)
+		{
+			analytic_curvatures(x, z, count, results);
+		}
+		else
+		{
+			curvatures(x, z, count, results);
+		}
+	}
+
+	void Terrain::rebuild_border_grid(uint node_index)
+	{
+		const vec2 node_min = terrain_buffer->data[node_index].min;
+		const vec2 node_max = terrain_buffer->data[node_index].max;
+		const float side = node_max.x - node_min.x;
+
+		// Points looked up in a node come from it or its neighbours' adjusted areas
+		BorderGrid& grid = border_grids[node_index];
+		grid.reset(node_min - vec2(side) * ADJUST_PERCENTAGE, node_max + vec2(side) * ADJUST_PERCENTAGE);
+
+		for (uint tt = 0; tt < terrain_buffer->data[node_index].border_count; ++tt)
+		{
+			const uint triangle = terrain_buffer->data[node_index].border_triangle_indices[tt];
+			grid.insert(triangle, terrain_buffer->data[node_index].get_circumcentre(triangle), terrain_buffer->data[node_index].get_circumradius2(triangle));
+		}
 	}
 #pragma endregion
 
 #pragma region TRIANGLE_PROCESS
-	const uint max_new_normal_points = TRIANGULATE_MAX_NEW_POINTS / WORK_GROUP_SIZE;
-	static /*shared*/ std::array<uint, WORK_GROUP_SIZE> s_counts;
-	static /*shared*/ uint s_total;
+	// Finds the potential new point of a triangle from its corners and their clip space positions.
+	// Returns false if no corner is visible
+	bool make_refine_candidate(uint triangle, vec4 v0, vec4 v1, vec4 v2, vec4 c0, vec4 c1, vec4 c2, float area_multiplier, RefineCandidate& candidate)
+	{
+		// Check if any vertex is visible (shitty clipping)
+		if (!clip(c0) && !clip(c1) && !clip(c2))
+			return false;
+
+		// Calculate screen space area
+
+		c0 /= c0.w;
+		c1 /= c1.w;
+		c2 /= c2.w;
+
+		// a, b, c is triangle side lengths
+		float a = distance(vec2(c0.x, c0.y), vec2(c1.x, c1.y));
+		float b = distance(vec2(c0.x, c0.y), vec2(c2.x, c2.y));
+		float c = distance(vec2(c1.x, c1.y), vec2(c2.x, c2.y));
+
+		// s is semiperimeter
+		float s = (a + b + c) * 0.5f;
+
+		float area = pow(s * (s - a) * (s - b) * (s - c), area_multiplier);
+
+		glm::vec3 mid = (glm::vec3(v0) + glm::vec3(v1)+ glm::vec3(v2)) / 3.0f;
+		float curv0 = v0.w;		// Curvature is stored in w coordinate
+		float curv1 = v1.w;
+		float curv2 = v2.w;
+
+		float inv_total_curv = 1.0f / (curv0 + curv1 + curv2);
+
+		// Create linear combination of corners based on curvature
+		glm::vec3 curv_point = (curv0 * inv_total_curv * glm::vec3(v0)) + (curv1 * inv_total_curv * glm::vec3(v1)) + (curv2 * inv_total_curv * glm::vec3(v2));
+
+		// Linearly interpolate between triangle middle and curv_point
+		glm::vec3 new_pos = mix(mid, curv_point, 0.5);
+
+		candidate = RefineCandidate{ triangle, area, new_pos, curv_point };
+		return true;
+	}
 
-	void triangle_process_shader(mat4 vp, vec4 camera_position, vec2 screen_size, float threshold, float area_multiplier, float curvature_multiplier, uint node_index)
+	// Screen space error of a candidate whose new point is at height terrain_y
+	float candidate_error(const mat4& vp, const RefineCandidate& candidate, float terrain_y, float curvature_multiplier)
 	{
-		if (refine_node != -1 && refine_node != node_index)
-			return;
+		const glm::vec3 new_pos = candidate.new_pos;
+
+		// Transform terrain_y and curv_point to clip space
+		glm::vec4 clip_terrain_y = vp * glm::vec4(new_pos.x, terrain_y, new_pos.z, 1.0);
+		glm::vec4 clip_curv_point = vp * glm::vec4(candidate.curv_point, 1.0);
+		clip_terrain_y /= clip_terrain_y.w;
+		clip_curv_point /= clip_curv_point.w;
+
+		// Screen space distance between current triangle point and new point
+		float screen_space_dist = pow(distance(glm::vec2(clip_terrain_y.x, clip_terrain_y.y), glm::vec2(clip_curv_point.x, clip_curv_point.y)), curvature_multiplier);
+
+		return screen_space_dist * candidate.area;
+	}
 
-		if (terrain_buffer->data[node_index].new_points_count != 0)  // TODO: Remove when moving to GPU
+	void Terrain::add_process_node(uint node_index)
+	{
+		if (refine_node != -1 && (uint)refine_node != node_index)
 			return;
 
 		const vec2 node_min = terrain_buffer->data[node_index].min;
-		const vec2 node_max = terrain_buffer->data[node_index].max;
-		const float side = node_max.x - node_min.x;
+		const float side = terrain_buffer->data[node_index].max.x - node_min.x;
 
 		const int cx = int((node_min.x - terrain_buffer->quadtree_min.x + 1) / side);  // current node x
 		const int cy = int((node_min.y - terrain_buffer->quadtree_min.y + 1) / side);  // current node z/y
 
-		const uint nodes_per_side = 1 << quadtree_levels;
+		const int nodes_per_side = 1 << quadtree_levels;
 
 		// Check self and neighbour nodes
 		for (int y = -1; y <= 1; ++y)
@@ -2150,207 +2663,598 @@ namespace cputri
 			{
 				const int nx = cx + x;
 				const int ny = cy + y;
-				if (nx >= 0 && nx < nodes_per_side && ny >= 0 && ny < nodes_per_side)
+				if (nx < 0 || nx >= nodes_per_side || ny < 0 || ny >= nodes_per_side || quadtree.node_index_to_buffer_index[get_map_index(nx, ny)] == INVALID)
+					return;
+			}
+		}
+
+		// The points it has left are inserted first, and take from the same refine_point_budget
+		const uint new_points_count = terrain_buffer->data[node_index].new_points_count;
+		if (new_points_count != 0)  // TODO: Remove when moving to GPU
+		{
+			processing->pending_insertions += std::min((uint)std::max(vertices_per_refine, 1), new_points_count);
+			return;
+		}
+
+		if (processing->nodes.size() == processing->node_count)
+			processing->nodes.emplace_back();
+
+		processing->nodes[processing->node_count++].node_index = node_index;
+	}
+
+	void Terrain::add_triangle_ranges(uint process_node_index)
+	{
+		ProcessNode& process_node = processing->nodes[process_node_index];
+		process_node.first_range = processing->range_count;
+
+		// At least one range, so every node processed gets its scan
+		const uint triangle_count = terrain_buffer->data[process_node.node_index].index_count / 3;
+		process_node.range_count = std::max(1u, (triangle_count + TRIANGLE_PROCESS_RANGE_SIZE - 1) / TRIANGLE_PROCESS_RANGE_SIZE);
+
+		if (processing->ranges.size() < processing->range_count + process_node.range_count)
+			processing->ranges.resize(processing->range_count + process_node.range_count);
+
+		for (uint rr = 0; rr < process_node.range_count; ++rr)
+		{
+			TriangleRange& range = processing->ranges[processing->range_count + rr];
+			range.node = process_node_index;
+			range.first_triangle = rr * TRIANGLE_PROCESS_RANGE_SIZE;
+			range.end_triangle = std::min(triangle_count, (rr + 1) * TRIANGLE_PROCESS_RANGE_SIZE);
+		}
+
+		processing->range_count += process_node.range_count;
+	}
+
+	void Terrain::triangle_process_shader(TriangulationContext& ctx, float threshold, TriangleRange& range)
+	{
+		const uint node_index = processing->nodes[range.node].node_index;
+		const TerrainData& node = terrain_buffer->data[node_index];
+
+		ErrorCache& cache = error_caches[node_index];
+		const mat4& vp = cache.vp;
+		const std::vector<vec4>& clip_positions = cache.clip_positions;
+
+		uint new_point_count = 0;
+
+		uint64_t cached_errors = 0;
+		uint64_t measured_errors = 0;
+
+		// The triangles are tested in batches. The errors that are dirty are measured first, with the heights of
+		// their new points evaluated at once, then the triangles get new points in triangle order
+		for (uint first = range.first_triangle; first < range.end_triangle && new_point_count < max_new_normal_points; first += REFINE_BATCH_SIZE)
+		{
+			const uint end = std::min(first + REFINE_BATCH_SIZE, range.end_triangle);
+
+			ctx.refine_candidates.clear();
+			for (uint t = first; t < end; ++t)
+			{
+				const uint i0 = node.indices[t * 3];
+				const uint i1 = node.indices[t * 3 + 1];
+				const uint i2 = node.indices[t * 3 + 2];
+
+				TriangleError& error = cache.triangles[t];
+				if (error.corners[0] == i0 && error.corners[1] == i1 && error.corners[2] == i2)
+				{
+					++cached_errors;
+					continue;
+				}
+
+				++measured_errors;
+				error.corners[0] = i0;
+				error.corners[1] = i1;
+				error.corners[2] = i2;
+				error.error = -std::numeric_limits<float>::infinity();
+
+				RefineCandidate candidate;
+				if (make_refine_candidate(t, node.get_position(i0), node.get_position(i1), node.get_position(i2),
+					clip_positions[i0], clip_positions[i1], clip_positions[i2], cache.area_multiplier, candidate))
+				{
+					ctx.refine_candidates.push_back(candidate);
+				}
+			}
+
+			// Y position of every potential new point
+			const uint candidate_count = (uint)ctx.refine_candidates.size();
+			for (uint cc = 0; cc < candidate_count; ++cc)
+			{
+				ctx.candidate_x[cc] = ctx.refine_candidates[cc].new_pos.x;
+				ctx.candidate_z[cc] = ctx.refine_candidates[cc].new_pos.z;
+			}
+			evaluate_terrain(ctx.candidate_x.data(), ctx.candidate_z.data(), candidate_count, ctx.candidate_heights.data());
+
+			for (uint cc = 0; cc < candidate_count; ++cc)
+			{
+				const RefineCandidate& candidate = ctx.refine_candidates[cc];
+				const float terrain_y = -ctx.candidate_heights[cc] - 0.5f;
+
+				TriangleError& error = cache.triangles[candidate.triangle];
+				error.error = candidate_error(vp, candidate, terrain_y, cache.curvature_multiplier);
+				error.new_point = glm::vec3(candidate.new_pos.x, terrain_y, candidate.new_pos.z);
+			}
+
+			// A new point should be added, its curvature is found once all points are known
+			for (uint t = first; t < end && new_point_count < max_new_normal_points; ++t)
+			{
+				const TriangleError& error = cache.triangles[t];
+				if (error.error >= threshold)
+				{
+					range.new_points[new_point_count] = glm::vec4(error.new_point, 0.0f);
+					range.triangle_indices[new_point_count] = t;
+					++new_point_count;
+				}
+			}
+		}
+
+		range.point_count = new_point_count;
+
+		ctx.statistics.error_cache_hits += cached_errors;
+		ctx.statistics.error_cache_misses += measured_errors;
+	}
+
+	void Terrain::spend_point_budget()
+	{
+		std::vector<BudgetPoint>& heap = processing->budget_heap;
+		heap.clear();
+
+		// triangulate() inserts vertices_per_refine points per node, so only the ones with the largest errors compete
+		const uint node_points = (uint)std::max(vertices_per_refine, 1);
+		const auto larger_error = [](const BudgetPoint& a, const BudgetPoint& b) { return b < a; };
+
+		for (uint nn = 0; nn < processing->node_count; ++nn)
+		{
+			const ProcessNode& process_node = processing->nodes[nn];
+			const ErrorCache& cache = error_caches[process_node.node_index];
+			const size_t first = heap.size();
+
+			for (uint rr = process_node.first_range; rr < process_node.first_range + process_node.range_count; ++rr)
+			{
+				const TriangleRange& range = processing->ranges[rr];
+				for (uint pp = 0; pp < range.point_count; ++pp)
+				{
+					heap.push_back(BudgetPoint{ cache.triangles[range.triangle_indices[pp]].error, rr, pp });
+				}
+			}
+
+			if (heap.size() - first > node_points)
+			{
+				std::nth_element(heap.begin() + first, heap.begin() + first + node_points, heap.end(), larger_error);
+				heap.resize(first + node_points);
+			}
+		}
+
+		// Nodes keep all their points when the budget covers what they insert next
+		const size_t offered = heap.size();
+		const size_t budget = refine_point_budget - std::min(processing->pending_insertions, refine_point_budget);
+		if (offered <= budget)
+			return;
+
+		// The points taken from the heap end up after the ones left in it, which are dropped. Then every node gets
+		// no more points than it inserts next, and is processed again on the next call
+		const size_t taken = budget;
+		std::make_heap(heap.begin(), heap.end());
+		for (size_t bb = 0; bb < taken; ++bb)
+		{
+			std::pop_heap(heap.begin(), heap.end() - bb);
+		}
+
+		// The points that are kept keep their order in their ranges, the others are found again by later calls
+		std::sort(heap.end() - taken, heap.end(), [](const BudgetPoint& a, const BudgetPoint& b)
+		{
+			return a.range < b.range || (a.range == b.range && a.point < b.point);
+		});
+
+		size_t next = offered - taken;
+		for (uint rr = 0; rr < processing->range_count; ++rr)
+		{
+			TriangleRange& range = processing->ranges[rr];
+
+			uint kept = 0;
+			for (; next < offered && heap[next].range == rr; ++next)
+			{
+				range.new_points[kept] = range.new_points[heap[next].point];
+				range.triangle_indices[kept] = range.triangle_indices[heap[next].point];
+				++kept;
+			}
+			range.point_count = kept;
+		}
+
+		caller_context().statistics.points_over_budget += offered - taken;
+	}
+
+	void Terrain::reset_error_cache(uint node_index)
+	{
+		error_caches[node_index].valid = false;
+		error_caches[node_index].new_views = 0;
+	}
+
+	void Terrain::write_range_points(TriangleRange& range)
+	{
+		const uint node_index = processing->nodes[range.node].node_index;
+		TerrainData& node = terrain_buffer->data[node_index];
+
+		// Only the points that fit in the node
+		const uint count = range.offset < node.new_points_count ? std::min(range.kept_count, node.new_points_count - range.offset) : 0;
+
+		// Curvature of the new points, found together
+		std::array<float, max_new_normal_points + 1> new_x{};
+		std::array<float, max_new_normal_points + 1> new_z{};
+		std::array<float, max_new_normal_points + 1> new_curvatures;
+		for (uint nn = 0; nn < count; ++nn)
+		{
+			new_x[nn] = range.new_points[nn].x;
+			new_z[nn] = range.new_points[nn].z;
+		}
+
+		find_curvatures(new_x.data(), new_z.data(), count, new_curvatures.data());
+
+		for (uint nn = 0; nn < count; ++nn)
+		{
+			node.new_points[range.offset + nn] = vec4(vec3(range.new_points[nn]), new_curvatures[nn]);
+		}
+	}
+#pragma endregion
+
+#pragma region DECIMATE
+	void Terrain::decimate_node(TriangulationContext& ctx, uint node_index, float threshold)
+	{
+		TerrainData& node = terrain_buffer->data[node_index];
+		ErrorCache& cache = error_caches[node_index];
+
+		// Under the threshold new points are found at, so removed vertices are not put back as soon as the view changes
+		const float limit = threshold * decimation_hysteresis;
+		uint removed = 0;
+
+		ctx.vertex_triangles.assign(node.vertex_count, INVALID);
+		for (uint ii = 0; ii < node.index_count; ++ii)
+		{
+			ctx.vertex_triangles[node.indices[ii]] = ii / 3;
+		}
+
+		for (uint v = 0; v < node.vertex_count; ++v)
+		{
+			if (ctx.vertex_triangles[v] == INVALID || !find_vertex_star(ctx, node_index, v, ctx.vertex_triangles[v]))
+				continue;
+
+			const VertexStar& star = ctx.star;
+
+			// The errors of the new triangles are measured like in triangle_process_shader
+			RefineCandidate candidates[DECIMATE_MAX_STAR_TRIANGLES - 2];
+			float candidate_x[DECIMATE_MAX_STAR_TRIANGLES - 2];
+			float candidate_z[DECIMATE_MAX_STAR_TRIANGLES - 2];
+			float candidate_heights[DECIMATE_MAX_STAR_TRIANGLES - 2];
+			uint candidate_count = 0;
+			for (uint tt = 0; tt < star.triangle_count - 2; ++tt)
+			{
+				const uint i0 = star.corners[star.new_triangles[tt][0]];
+				const uint i1 = star.corners[star.new_triangles[tt][1]];
+				const uint i2 = star.corners[star.new_triangles[tt][2]];
+
+				RefineCandidate& candidate = candidates[candidate_count];
+				if (make_refine_candidate(tt, node.get_position(i0), node.get_position(i1), node.get_position(i2),
+					cache.clip_positions[i0], cache.clip_positions[i1], cache.clip_positions[i2], cache.area_multiplier, candidate))
 				{
-					const uint neighbour_index = quadtree.node_index_to_buffer_index[ny * nodes_per_side + nx];
-					if (neighbour_index == INVALID)
+					candidate_x[candidate_count] = candidate.new_pos.x;
+					candidate_z[candidate_count] = candidate.new_pos.z;
+					++candidate_count;
+				}
+			}
+
+			evaluate_terrain(candidate_x, candidate_z, candidate_count, candidate_heights);
+
+			bool needed = false;
+			for (uint cc = 0; cc < candidate_count && !needed; ++cc)
+			{
+				needed = !(candidate_error(cache.vp, candidates[cc], -candidate_heights[cc] - 0.5f, cache.curvature_multiplier) < limit);
+			}
+
+			if (!needed)
+			{
+				remove_vertex(ctx, node_index, v);
+				++removed;
+			}
+		}
+
+		if (removed == 0)
+			return;
+
+		// The vertices that are left move down over the slots of the removed ones, keeping their order, so new points
+		// reuse the slots. vertex_triangles becomes the new index of each vertex
+		uint kept = 0;
+		for (uint v = 0; v < node.vertex_count; ++v)
+		{
+			if (ctx.vertex_triangles[v] == INVALID)
+				continue;
+
+			node.set_position(kept, node.get_position(v));
+			cache.clip_positions[kept] = cache.clip_positions[v];
+			ctx.vertex_triangles[v] = kept++;
+		}
+
+		for (uint ii = 0; ii < node.index_count; ++ii)
+		{
+			node.indices[ii] = ctx.vertex_triangles[node.indices[ii]];
+		}
+
+		// Only called for a new view, so the node has no errors whose corners would need the new indices
+		node.vertex_count = kept;
+		cache.clip_positions.resize(kept);
+	}
+
+	bool Terrain::find_vertex_star(TriangulationContext& ctx, uint node_index, uint vertex, uint triangle)
+	{
+		const TerrainData& node = terrain_buffer->data[node_index];
+		VertexStar& star = ctx.star;
+
+		star.triangle_count = 0;
+		if (triangle >= node.index_count / 3)
+			return false;
+
+		// Walk around the vertex, going over the edge from it to the next corner of each triangle
+		uint current = triangle;
+		do
+		{
+			uint side = 0;
+			while (side < 3 && node.indices[current * 3 + side] != vertex)
+			{
+				++side;
+			}
+
+			if (side == 3 || star.triangle_count == DECIMATE_MAX_STAR_TRIANGLES)
+				return false;
+
+			const uint next = node.triangle_connections[current * 3 + side];
+			const uint outer = node.triangle_connections[current * 3 + (side + 1) % 3];
+			if (next >= INVALID - 9 || outer >= INVALID - 9)
+				return false;
+
+			const uint ii = star.triangle_count++;
+			star.triangles[ii] = current;
+			star.corners[ii] = node.indices[current * 3 + (side + 2) % 3];
+			star.outer[ii] = outer;
+			star.outer_sides[ii] = INVALID;
+			for (uint ss = 0; ss < 3; ++ss)
+			{
+				// Triangles along the border keep their neighbours, large triangles there would make border
+				// triangles with large circumcircles, which every insertion near the border has to test
+				if (node.triangle_connections[outer * 3 + ss] >= INVALID - 9)
+					return false;
+
+				if (node.triangle_connections[outer * 3 + ss] == current)
+					star.outer_sides[ii] = ss;
+			}
+			if (star.outer_sides[ii] == INVALID)
+				return false;
+
+			current = next;
+		} while (current != triangle);
+
+		const uint count = star.triangle_count;
+		if (count < 3)
+			return false;
+
+		// The polygon has to be simple and closed off from the star
+		for (uint ii = 0; ii < count; ++ii)
+		{
+			for (uint jj = 0; jj < count; ++jj)
+			{
+				if ((jj != ii && star.corners[ii] == star.corners[jj]) || star.outer[ii] == star.triangles[jj])
+					return false;
+			}
+		}
+
+		dvec2 points[DECIMATE_MAX_STAR_TRIANGLES];
+		for (uint ii = 0; ii < count; ++ii)
+		{
+			const vec4 p = node.get_position(star.corners[ii]);
+			points[ii] = dvec2(p.x, p.z);
+		}
+
+		// The polygon goes around against the winding of the node's triangles
+		const vec4 centre = node.get_position(vertex);
+		const double winding = orient2d(dvec2(centre.x, centre.z), points[1], points[0], &ctx.statistics.exact_predicates);
+		if (winding == 0.0)
+			return false;
+
+		// Cut off ears whose circumcircle has no corner inside, they are triangles of the Delaunay triangulation
+		uint remaining[DECIMATE_MAX_STAR_TRIANGLES];
+		uint remaining_count = count;
+		for (uint ii = 0; ii < count; ++ii)
+		{
+			remaining[ii] = ii;
+		}
+
+		uint new_count = 0;
+		while (remaining_count > 2)
+		{
+			bool cut = false;
+			for (uint rr = 0; rr < remaining_count && !cut; ++rr)
+			{
+				const uint a = remaining[rr];
+				const uint b = remaining[(rr + 1) % remaining_count];
+				const uint c = remaining[(rr + 2) % remaining_count];
+
+				const double turn = orient2d(points[a], points[b], points[c], &ctx.statistics.exact_predicates);
+				if (winding > 0.0 ? turn >= 0.0 : turn <= 0.0)
+					continue;
+
+				bool empty = true;
+				for (uint dd = 0; dd < count && empty && remaining_count > 3; ++dd)
+				{
+					if (dd != a && dd != b && dd != c)
 					{
-						return;
+						const double side = incircle(points[a], points[b], points[c], points[dd], &ctx.statistics.exact_predicates);
+						empty = turn > 0.0 ? side <= 0.0 : side >= 0.0;
 					}
 				}
-				else
+				if (!empty)
+					continue;
+
+				star.new_triangles[new_count][0] = a;
+				star.new_triangles[new_count][1] = c;
+				star.new_triangles[new_count][2] = b;
+				++new_count;
+
+				for (uint ii = (rr + 1) % remaining_count; ii + 1 < remaining_count; ++ii)
 				{
-					return;
+					remaining[ii] = remaining[ii + 1];
 				}
+				--remaining_count;
+				cut = true;
 			}
+
+			if (!cut)
+				return false;
 		}
 
-		//terrain_buffer->data[node_index].new_points_count = 0;
-		std::array<vec4, max_new_normal_points + 1> new_points;
-		std::array<uint, max_new_normal_points + 1> triangle_indices;
+		// Like find_cavity, triangles whose middle is outside the node would belong to a neighbour
+		for (uint tt = 0; tt < new_count; ++tt)
+		{
+			const dvec2 mid = (points[star.new_triangles[tt][0]] + points[star.new_triangles[tt][1]] + points[star.new_triangles[tt][2]]) / 3.0;
+			if (mid.x > node.max.x || mid.x < node.min.x || mid.y > node.max.y || mid.y < node.min.y)
+				return false;
+		}
 
-		const uint thid = gl_GlobalInvocationID.x;
+		return true;
+	}
 
-		const uint index_count = terrain_buffer->data[node_index].index_count;
+	void Terrain::remove_vertex(TriangulationContext& ctx, uint node_index, uint vertex)
+	{
+		TerrainData& node = terrain_buffer->data[node_index];
+		const VertexStar& star = ctx.star;
+		const uint count = star.triangle_count;
 
-		uint new_point_count = 0;
+		// The new triangles take the lowest slots, so the two slots that are freed are the ones closest to the end
+		uint slots[DECIMATE_MAX_STAR_TRIANGLES];
+		std::copy(star.triangles, star.triangles + count, slots);
+		std::sort(slots, slots + count);
 
-		// For every triangle
-		for (uint i = thid * 3; i + 3 <= index_count && new_point_count < max_new_normal_points; i += WORK_GROUP_SIZE * 3)
+		for (uint tt = 0; tt < count - 2; ++tt)
 		{
-			// Get vertices
-			vec4 v0 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[i]];
-			vec4 v1 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[i + 1]];
-			vec4 v2 = terrain_buffer->data[node_index].positions[terrain_buffer->data[node_index].indices[i + 2]];
+			const uint triangle = slots[tt];
 
-			// Get clipspace coordinates
-			vec4 c0 = vp * glm::vec4(glm::vec3(v0), 1.0f);
-			vec4 c1 = vp * glm::vec4(glm::vec3(v1), 1.0f);
-			vec4 c2 = vp * glm::vec4(glm::vec3(v2), 1.0f);
-
-			// Check if any vertex is visible (shitty clipping)
-			if (clip(c0) || clip(c1) || clip(c2))
+			for (uint ii = 0; ii < 3; ++ii)
 			{
-				// Calculate screen space area
-
-				c0 /= c0.w;
-				c1 /= c1.w;
-				c2 /= c2.w;
+				node.indices[triangle * 3 + ii] = star.corners[star.new_triangles[tt][ii]];
+				ctx.vertex_triangles[node.indices[triangle * 3 + ii]] = triangle;
+			}
 
-				// a, b, c is triangle side lengths
-				float a = distance(vec2(c0.x, c0.y), vec2(c1.x, c1.y));
-				float b = distance(vec2(c0.x, c0.y), vec2(c2.x, c2.y));
-				float c = distance(vec2(c1.x, c1.y), vec2(c2.x, c2.y));
+			const vec3 P = vec3(node.get_position(node.indices[triangle * 3 + 0]));
+			const vec3 Q = vec3(node.get_position(node.indices[triangle * 3 + 1]));
+			const vec3 R = vec3(node.get_position(node.indices[triangle * 3 + 2]));
 
-				// s is semiperimeter
-				float s = (a + b + c) * 0.5f;
+			// Set circumcircles for the new triangle
+			float a = distance(vec2(P.x, P.z), vec2(Q.x, Q.z));
+			float b = distance(vec2(P.x, P.z), vec2(R.x, R.z));
+			float c = distance(vec2(R.x, R.z), vec2(Q.x, Q.z));
 
-				float area = pow(s * (s - a) * (s - b) * (s - c), area_multiplier);
+			node.set_circumcircle(triangle, find_circum_center(vec2(P.x, P.z), vec2(Q.x, Q.z), vec2(R.x, R.z)), find_circum_radius_squared(a, b, c));
+		}
 
-				glm::vec3 mid = (glm::vec3(v0) + glm::vec3(v1)+ glm::vec3(v2)) / 3.0f;
-				float curv0 = v0.w;		// Curvature is stored in w coordinate
-				float curv1 = v1.w;
-				float curv2 = v2.w;
+		// Connection ss is the edge from corner ss to corner ss + 1. Edges that are not shared by two new triangles
+		// are polygon edges, which go the other way around in the new triangles
+		for (uint tt = 0; tt < count - 2; ++tt)
+		{
+			const uint triangle = slots[tt];
 
-				float inv_total_curv = 1.0f / (curv0 + curv1 + curv2);
+			for (uint ss = 0; ss < 3; ++ss)
+			{
+				const uint from = star.new_triangles[tt][ss];
+				const uint to = star.new_triangles[tt][(ss + 1) % 3];
 
-				// Create linear combination of corners based on curvature
-				glm::vec3 curv_point = (curv0 * inv_total_curv * glm::vec3(v0)) + (curv1 * inv_total_curv * glm::vec3(v1)) + (curv2 * inv_total_curv * glm::vec3(v2));
+				uint connection = INVALID;
+				for (uint other = 0; other < count - 2 && connection == INVALID; ++other)
+				{
+					for (uint os = 0; os < 3; ++os)
+					{
+						if (other != tt && star.new_triangles[other][os] == to && star.new_triangles[other][(os + 1) % 3] == from)
+						{
+							connection = slots[other];
+							break;
+						}
+					}
+				}
 
-				// Linearly interpolate between triangle middle and curv_point
-				glm::vec3 new_pos = mix(mid, curv_point, 0.5);
+				if (connection == INVALID)
+				{
+					connection = star.outer[to];
+					node.triangle_connections[star.outer[to] * 3 + star.outer_sides[to]] = triangle;
+				}
 
-				// Y position of potential new point
-				float terrain_y = -terrain(glm::vec2(new_pos.x, new_pos.z)) - 0.5f;
+				node.triangle_connections[triangle * 3 + ss] = connection;
+			}
+		}
 
-				// Transform terrain_y and curv_point to clip space
-				glm::vec4 clip_terrain_y = vp * glm::vec4(new_pos.x, terrain_y, new_pos.z, 1.0);
-				glm::vec4 clip_curv_point = vp * glm::vec4(curv_point, 1.0);
-				clip_terrain_y /= clip_terrain_y.w;
-				clip_curv_point /= clip_curv_point.w;
+		ctx.vertex_triangles[vertex] = INVALID;
 
-				// Screen space distance between current triangle point and new point
-				float screen_space_dist = pow(distance(glm::vec2(clip_terrain_y.x, clip_terrain_y.y), glm::vec2(clip_curv_point.x, clip_curv_point.y)), curvature_multiplier);
+		remove_triangle_slot(node_index, slots[count - 1]);
+		remove_triangle_slot(node_index, slots[count - 2]);
 
-				// A new point should be added
-				if (screen_space_dist * area >= threshold)
+		// The triangle moved into a freed slot is found there from now on
+		for (uint ss = 0; ss < 2; ++ss)
+		{
+			const uint triangle = slots[count - 1 - ss];
+			if (triangle < node.index_count / 3)
+			{
+				for (uint ii = 0; ii < 3; ++ii)
 				{
-					const glm::vec4 point = glm::vec4(new_pos.x, terrain_y, new_pos.z, curvature(vec3(new_pos.x, terrain_y, new_pos.z)));
-					new_points[new_point_count] = point;
-					triangle_indices[new_point_count] = i / 3;
-					++new_point_count;
+					ctx.vertex_triangles[node.indices[triangle * 3 + ii]] = triangle;
 				}
 			}
 		}
 
+		++ctx.statistics.vertices_removed;
+	}
 
+	void Terrain::remove_triangle_slot(uint node_index, uint triangle)
+	{
+		TerrainData& node = terrain_buffer->data[node_index];
+		const uint last_triangle = node.index_count / 3 - 1;
 
-
-		////// PREFIX SUM
-
-		const uint n = WORK_GROUP_SIZE;
-
-		// Load into shared memory
-		s_counts[thid] = new_point_count;
-
-		//barrier();
-		//memoryBarrierShared();
-
-		if (thid == 0)
-			s_total = s_counts[n - 1];
-
-		//barrier();
-		//memoryBarrierShared();
-
-		int offset = 1;
-		for (uint d = n >> 1; d > 0; d >>= 1) // Build sum in place up the tree
+		if (triangle < last_triangle)
 		{
-			//barrier();
-			//memoryBarrierShared();
-			if (thid < d)
+			for (uint ii = 0; ii < 3; ++ii)
 			{
-				uint ai = offset * (2 * thid + 1) - 1;
-				uint bi = offset * (2 * thid + 2) - 1;
-				s_counts[bi] += s_counts[ai];
+				replace_connection_index(node_index, node.triangle_connections[last_triangle * 3 + ii], last_triangle, triangle);
 			}
-			offset *= 2;
-		}
-		if (thid == 0) { s_counts[n - 1] = 0; } // Clear the last element
-		for (int d = 1; d < n; d *= 2) // Traverse down tree & build scan
-		{
-			offset >>= 1;
-			//barrier();
-			//memoryBarrierShared();
-			if (static_cast<int>(thid) < d)
-			{
-				uint ai = offset * (2 * thid + 1) - 1;
-				uint bi = offset * (2 * thid + 2) - 1;
 
-				uint t = s_counts[ai];
-				s_counts[ai] = s_counts[bi];
-				s_counts[bi] += t;
+			// Fix border indices
+			for (uint ss = 0; ss < 3; ++ss)
+			{
+				if (node.triangle_connections[last_triangle * 3 + ss] >= INVALID - 9)
+				{
+					for (uint tt = 0; tt < node.border_count; ++tt)
+					{
+						if (node.border_triangle_indices[tt] == last_triangle)
+						{
+							node.border_triangle_indices[tt] = triangle;
+							border_grids[node_index].rename(last_triangle, triangle);
+						}
+					}
+					break;
+				}
 			}
-		}
-		//barrier();
-		//memoryBarrierShared();
-
-		uint prev_count = terrain_buffer->data[node_index].new_points_count;
-
-
-		//barrier();
-		//memoryBarrierShared();
-		//memoryBarrierBuffer();
 
-		// Make sure the total is saved as well
-		if (thid == 0)
-		{
-			s_total += s_counts[n - 1];
-			terrain_buffer->data[node_index].new_points_count += s_total;
-			terrain_buffer->data[node_index].new_points_count = std::min(terrain_buffer->data[node_index].new_points_count, num_new_points);
+			for (uint ii = 0; ii < 3; ++ii)
+			{
+				node.indices[triangle * 3 + ii] = node.indices[last_triangle * 3 + ii];
+				node.triangle_connections[triangle * 3 + ii] = node.triangle_connections[last_triangle * 3 + ii];
+			}
+			node.set_circumcircle(triangle, node.get_circumcentre(last_triangle), node.get_circumradius2(last_triangle));
+			border_grids[node_index].update(triangle, node.get_circumcentre(triangle), node.get_circumradius2(triangle));
 		}
 
-		// Write points to output storage buffer
-		const uint base_offset = prev_count + s_counts[thid];
-		for (uint i = 0; i < new_point_count && base_offset + i < num_new_points; ++i)
-		{
-			terrain_buffer->data[node_index].new_points[base_offset + i] = new_points[i];
-			terrain_buffer->data[node_index].new_points_triangles[base_offset + i] = triangle_indices[i];
-		}
+		node.index_count -= 3;
 	}
 #pragma endregion
 
 #pragma region TRIANGULATE
 
-	struct BorderEdge
-	{
-		vec4 p1;
-		vec4 p2;
-		uint p1_index;
-		uint p2_index;
-		uint node_index; // Local node format
-		uint connection;
-		uint old_triangle_index;
-		uint future_index;
-		uint pad[2];
-	};
-	/*shared*/ std::array<BorderEdge, max_border_edges * 3> s_edges;
-	/*shared*/ std::array<uint, max_triangles_to_remove> s_owning_node;
-
-	// Convert local node format to global
-	uint ltg[9];
-
-	uint seen_triangle_owners[TEST_TRIANGLE_BUFFER_SIZE]; // Local node format
-	uint test_triangle_owners[TEST_TRIANGLE_BUFFER_SIZE]; // Local node format
-
-	uint new_triangle_indices[9 * NUM_NEW_TRIANGLE_INDICES];
-	uint new_triangle_index_count[9];
-
 #define EPSILON 1.0f - 0.0001f
 #define SELF_INDEX 4
 
 	const float INVALID_HEIGHT = 10000.0f;
 
-	void replace_connection_index(uint node_index, uint triangle_to_check, uint index_to_replace, uint new_value)
+	void Terrain::replace_connection_index(uint node_index, uint triangle_to_check, uint index_to_replace, uint new_value)
 	{
 		if (triangle_to_check <= INVALID - 9)
 		{
@@ -2366,13 +3270,13 @@ namespace cputri
 		}
 	}
 
-	void remove_old_triangles()
+	void Terrain::remove_old_triangles(TriangulationContext& ctx)
 	{
 		// Remove old triangles
-		for (int j = int(s_triangles_removed) - 1; j >= 0; --j)
+		for (int j = int(ctx.s_triangles_removed) - 1; j >= 0; --j)
 		{
-			const uint index = s_triangles_to_remove[j];
-			const uint global_node_index = ltg[s_owning_node[j]];
+			const uint index = ctx.s_triangles_to_remove[j];
+			const uint global_node_index = ctx.ltg[ctx.s_owning_node[j]];
 
 			const uint last_triangle = terrain_buffer->data[global_node_index].index_count / 3 - 1;
 
@@ -2395,10 +3299,12 @@ namespace cputri
 							terrain_buffer->data[global_node_index].border_triangle_indices[tt] = terrain_buffer->data[global_node_index].border_triangle_indices[count - 1];
 							--terrain_buffer->data[global_node_index].border_count;
 							--count;
+							border_grids[global_node_index].erase(index);
 						}
 						if (terrain_buffer->data[global_node_index].border_triangle_indices[tt] == last_triangle)
 						{
 							terrain_buffer->data[global_node_index].border_triangle_indices[tt] = index;
+							border_grids[global_node_index].rename(last_triangle, index);
 						}
 					}
 					break;
@@ -2411,81 +3317,54 @@ namespace cputri
 				terrain_buffer->data[global_node_index].indices[index * 3 + 0] = terrain_buffer->data[global_node_index].indices[last_triangle * 3 + 0];
 				terrain_buffer->data[global_node_index].indices[index * 3 + 1] = terrain_buffer->data[global_node_index].indices[last_triangle * 3 + 1];
 				terrain_buffer->data[global_node_index].indices[index * 3 + 2] = terrain_buffer->data[global_node_index].indices[last_triangle * 3 + 2];
-				terrain_buffer->data[global_node_index].triangles[index].circumcentre = terrain_buffer->data[global_node_index].triangles[last_triangle].circumcentre;
-				terrain_buffer->data[global_node_index].triangles[index].circumradius2 = terrain_buffer->data[global_node_index].triangles[last_triangle].circumradius2;
+				terrain_buffer->data[global_node_index].set_circumcircle(index, terrain_buffer->data[global_node_index].get_circumcentre(last_triangle), terrain_buffer->data[global_node_index].get_circumradius2(last_triangle));
+				border_grids[global_node_index].update(index, terrain_buffer->data[global_node_index].get_circumcentre(index), terrain_buffer->data[global_node_index].get_circumradius2(index));
 				terrain_buffer->data[global_node_index].triangle_connections[index * 3 + 0] = terrain_buffer->data[global_node_index].triangle_connections[last_triangle * 3 + 0];
 				terrain_buffer->data[global_node_index].triangle_connections[index * 3 + 1] = terrain_buffer->data[global_node_index].triangle_connections[last_triangle * 3 + 1];
 				terrain_buffer->data[global_node_index].triangle_connections[index * 3 + 2] = terrain_buffer->data[global_node_index].triangle_connections[last_triangle * 3 + 2];
 
-				for (uint tt = 0; tt < new_triangle_index_count[s_owning_node[j]]; ++tt)
+				for (uint tt = 0; tt < ctx.new_triangle_index_count[ctx.s_owning_node[j]]; ++tt)
 				{
-					const uint triangle_index = new_triangle_indices[s_owning_node[j] * NUM_NEW_TRIANGLE_INDICES + tt];
+					const uint triangle_index = ctx.new_triangle_indices[ctx.s_owning_node[j] * NUM_NEW_TRIANGLE_INDICES + tt];
 					if (triangle_index == last_triangle)
-						new_triangle_indices[s_owning_node[j] * NUM_NEW_TRIANGLE_INDICES + tt] = index;
+						ctx.new_triangle_indices[ctx.s_owning_node[j] * NUM_NEW_TRIANGLE_INDICES + tt] = index;
 				}
-			}
-
-			terrain_buffer->data[global_node_index].index_count -= 3;
 
-			// Update the rest of the new points' triangle index after updating triangles in node
-			for (uint ii = 0; ii < terrain_buffer->data[global_node_index].new_points_count; ++ii)
-			{
-				if (terrain_buffer->data[global_node_index].new_points_triangles[ii] == index)
-				{
-					// Look through all newly added triangles only
-					for (uint tt = 0; tt < new_triangle_index_count[s_owning_node[j]]; ++tt)
-					{
-						const uint triangle_index = new_triangle_indices[s_owning_node[j] * NUM_NEW_TRIANGLE_INDICES + tt];
-						const vec4 new_point = terrain_buffer->data[global_node_index].new_points[ii];
-						const vec2 circumcentre = terrain_buffer->data[global_node_index].triangles[triangle_index].circumcentre;
-						const float circumradius2 = terrain_buffer->data[global_node_index].triangles[triangle_index].circumradius2;
-
-						const float dx = new_point.x - circumcentre.x;
-						const float dy = new_point.z - circumcentre.y;
-
-						// Find the first triangle whose cc contains the point
-						if (dx * dx + dy * dy < circumradius2)
-						{
-							terrain_buffer->data[global_node_index].new_points_triangles[ii] = triangle_index;
-							break;
-						}
-					}
-				}
-				else if (terrain_buffer->data[global_node_index].new_points_triangles[ii] == last_triangle)
+				// If new triangles were moved to a neighbour, the node has fewer new triangles than removed ones,
+				// so the last triangle can be one still to be removed
+				for (int jj = 0; jj < j; ++jj)
 				{
-					terrain_buffer->data[global_node_index].new_points_triangles[ii] = index;
+					if (ctx.s_owning_node[jj] == ctx.s_owning_node[j] && ctx.s_triangles_to_remove[jj] == last_triangle)
+						ctx.s_triangles_to_remove[jj] = index;
 				}
 			}
+
+			terrain_buffer->data[global_node_index].index_count -= 3;
 		}
 	}
 
-	void add_connection(uint local_node_index, uint connection_index)
+	void add_connection(TriangulationContext& ctx, uint local_node_index, uint connection_index)
 	{
 		// Check if it has already been seen
-		for (uint ii = 0; ii < seen_triangle_count; ++ii)
+		for (uint ii = 0; ii < ctx.seen_triangle_count; ++ii)
 		{
-			if (local_node_index == seen_triangle_owners[ii] && connection_index == seen_triangles[ii])
+			if (local_node_index == ctx.seen_triangle_owners[ii] && connection_index == ctx.seen_triangles[ii])
 			{
 				return;
 			}
 		}
 
-		seen_triangles[seen_triangle_count] = connection_index;
-		seen_triangle_owners[seen_triangle_count] = local_node_index;
-		++seen_triangle_count;
-		triangles_to_test[test_count] = connection_index;
-		test_triangle_owners[test_count] = local_node_index;
-		++test_count;
+		ctx.seen_triangles[ctx.seen_triangle_count] = connection_index;
+		ctx.seen_triangle_owners[ctx.seen_triangle_count] = local_node_index;
+		++ctx.seen_triangle_count;
+		ctx.triangles_to_test[ctx.test_count] = connection_index;
+		ctx.test_triangle_owners[ctx.test_count] = local_node_index;
+		++ctx.test_count;
 	}
 
 
-	void triangulate_shader(const uint node_index)
+	void Terrain::find_neighbours(TriangulationContext& ctx, const uint node_index)
 	{
-		if (refine_node != -1 && refine_node != node_index)
-			return;
-
-		const uint thid = gl_GlobalInvocationID.x;
-
 		const vec2 node_min = terrain_buffer->data[node_index].min;
 		const vec2 node_max = terrain_buffer->data[node_index].max;
 		const float side = node_max.x - node_min.x;
@@ -2495,8 +3374,6 @@ namespace cputri
 		const int cx = int((node_min.x - terrain_buffer->quadtree_min.x + 1) / side);  // current node x
 		const int cy = int((node_min.y - terrain_buffer->quadtree_min.y + 1) / side);  // current node z/y
 
-		uint nodes_new_points_count[9];
-
 		for (int y = -1; y <= 1; ++y)
 		{
 			for (int x = -1; x <= 1; ++x)
@@ -2505,188 +3382,191 @@ namespace cputri
 				const int ny = cy + y;
 				if (nx >= 0 && nx < nodes_per_side && ny >= 0 && ny < nodes_per_side)
 				{
-					ltg[(y + 1) * 3 + x + 1] = terrain_buffer->quadtree_index_map[ny * nodes_per_side + nx];
+					ctx.ltg[(y + 1) * 3 + x + 1] = terrain_buffer->quadtree_index_map[get_map_index(nx, ny)];
 				}
 				else
 				{
-					ltg[(y + 1) * 3 + x + 1] = INVALID;
+					ctx.ltg[(y + 1) * 3 + x + 1] = INVALID;
 				}
 			}
 		}
+	}
 
-		// Set shared variables
-		if (thid == 0)
-		{
-			s_triangles_removed = 0;
-		}
+	bool Terrain::add_cavity_triangle(TriangulationContext& ctx, const uint local_owner_index, const uint triangle_index)
+	{
+		const uint global_owner_index = ctx.ltg[local_owner_index];
+
+		// Add triangle edges to edge buffer
+		const uint index0 = terrain_buffer->data[global_owner_index].indices[triangle_index * 3 + 0];
+		const uint index1 = terrain_buffer->data[global_owner_index].indices[triangle_index * 3 + 1];
+		const uint index2 = terrain_buffer->data[global_owner_index].indices[triangle_index * 3 + 2];
+		const vec4 p0 = terrain_buffer->data[global_owner_index].get_position(index0);
+		const vec4 p1 = terrain_buffer->data[global_owner_index].get_position(index1);
+		const vec4 p2 = terrain_buffer->data[global_owner_index].get_position(index2);
+
+		// Store edges to be removed
+		uint tr = atomicAdd(ctx.s_triangles_removed, 1);
+		if (tr >= max_triangles_to_remove || tr >= max_border_edges)
+			return false;
+
+		uint ec = tr * 3;
+		// Edge 0
+		bool biggest_point = p0.y < p1.y;
+		ctx.s_edges[ec + 0].p1 = biggest_point ? p0 : p1;
+		ctx.s_edges[ec + 0].p2 = !biggest_point ? p0 : p1;
+		ctx.s_edges[ec + 0].p1_index = biggest_point ? index0 : index1;
+		ctx.s_edges[ec + 0].p2_index = !biggest_point ? index0 : index1;
+		ctx.s_edges[ec + 0].node_index = local_owner_index;
+		ctx.s_edges[ec + 0].connection = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + 0];
+		ctx.s_edges[ec + 0].old_triangle_index = triangle_index;
+		// Edge 1
+		biggest_point = p1.y < p2.y;
+		ctx.s_edges[ec + 1].p1 = biggest_point ? p1 : p2;
+		ctx.s_edges[ec + 1].p2 = !biggest_point ? p1 : p2;
+		ctx.s_edges[ec + 1].p1_index = biggest_point ? index1 : index2;
+		ctx.s_edges[ec + 1].p2_index = !biggest_point ? index1 : index2;
+		ctx.s_edges[ec + 1].node_index = local_owner_index;
+		ctx.s_edges[ec + 1].connection = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + 1];
+		ctx.s_edges[ec + 1].old_triangle_index = triangle_index;
+		// Edge 2
+		biggest_point = p2.y < p0.y;
+		ctx.s_edges[ec + 2].p1 = biggest_point ? p2 : p0;
+		ctx.s_edges[ec + 2].p2 = !biggest_point ? p2 : p0;
+		ctx.s_edges[ec + 2].p1_index = biggest_point ? index2 : index0;
+		ctx.s_edges[ec + 2].p2_index = !biggest_point ? index2 : index0;
+		ctx.s_edges[ec + 2].node_index = local_owner_index;
+		ctx.s_edges[ec + 2].connection = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + 2];
+		ctx.s_edges[ec + 2].old_triangle_index = triangle_index;
+
+		// Mark the triangle to be removed later
+		ctx.s_triangles_to_remove[tr] = triangle_index;
+		ctx.s_owning_node[tr] = local_owner_index;
+
+		return true;
+	}
 
-		// barrier();
-		// memoryBarrierShared();
+	bool Terrain::insert_point(TriangulationContext& ctx, const uint node_index, const uint n)
+	{
+		const vec2 node_min = terrain_buffer->data[node_index].min;
+		const vec2 node_max = terrain_buffer->data[node_index].max;
+		const float side = node_max.x - node_min.x;
 
-		const uint new_points_count = terrain_buffer->data[node_index].new_points_count;
-		
-		uint counter = 0;
-		for (int n = (int)new_points_count - 1; n >= 0 && counter < (uint)vertices_per_refine; --n, ++counter)
-		//for (uint n = 0; n < new_points_count && n < TERRAIN_GENERATE_NUM_VERTICES; ++n)
-		{
-			const vec4 current_point = terrain_buffer->data[node_index].new_points[n];
+		const vec4 current_point = terrain_buffer->data[node_index].new_points[n];
 
-			// Reset
-			for (uint ii = 0; ii < 9; ++ii)
+		ctx.seen_triangle_count = 1;
+		ctx.test_count = 1;
+		bool checked_borders = false;
+
+		uint start_index = locate_point(terrain_buffer->data[node_index], border_grids[node_index], vec2(current_point.x, current_point.z));
+		if (start_index == INVALID || !circumcircle_contains(terrain_buffer->data[node_index], start_index, current_point, ctx.statistics))
+		{
+			// The point is in a triangle that was moved to a neighbour, or on the edge of its triangle
+			const std::vector<uint>& candidates = border_grids[node_index].get_candidates(vec2(current_point.x, current_point.z));
+			if (ctx.border_hits.size() < candidates.size())
+				ctx.border_hits.resize(candidates.size());
+			const uint hit_count = find_containing_circumcircles(terrain_buffer->data[node_index].get_circumcircles(),
+				candidates.data(),
+				(uint)candidates.size(),
+				vec2(current_point.x, current_point.z),
+				ctx.border_hits.data());
+			if (hit_count == 0)
 			{
-				nodes_new_points_count[ii] = 0;
-				new_triangle_index_count[ii] = 0;
+				++ctx.statistics.insertions_discarded;
+				return true;
 			}
 
-			seen_triangle_count = 1;
-			test_count = 1;
-			bool checked_borders = false;
+			start_index = ctx.border_hits[0];
+		}
 
-			const uint start_index = terrain_buffer->data[node_index].new_points_triangles[n];
-			seen_triangles[0] = start_index;
-			seen_triangle_owners[0] = SELF_INDEX;
-			triangles_to_test[0] = start_index;
-			test_triangle_owners[0] = SELF_INDEX;
+		ctx.seen_triangles[0] = start_index;
+		ctx.seen_triangle_owners[0] = SELF_INDEX;
+		ctx.triangles_to_test[0] = start_index;
+		ctx.test_triangle_owners[0] = SELF_INDEX;
 
-			bool finish = false;
-			while (test_count != 0 && !finish)
-			{
-				const uint triangle_index = triangles_to_test[--test_count];
-				const uint local_owner_index = test_triangle_owners[test_count];
-				const uint global_owner_index = ltg[local_owner_index];
-				const vec2 circumcentre = terrain_buffer->data[global_owner_index].triangles[triangle_index].circumcentre;
-				const float circumradius2 = terrain_buffer->data[global_owner_index].triangles[triangle_index].circumradius2;
+		bool finish = false;
+		while (ctx.test_count != 0 && !finish)
+		{
+			const uint triangle_index = ctx.triangles_to_test[--ctx.test_count];
+			const uint local_owner_index = ctx.test_triangle_owners[ctx.test_count];
+			const uint global_owner_index = ctx.ltg[local_owner_index];
 
-				const float dx = current_point.x - circumcentre.x;
-				const float dy = current_point.z - circumcentre.y;
+			if (circumcircle_contains(terrain_buffer->data[global_owner_index], triangle_index, current_point, ctx.statistics))
+			{
+				if (!add_cavity_triangle(ctx, local_owner_index, triangle_index))
+				{
+					finish = true;
+					break;
+				}
 
-				if (dx * dx + dy * dy < circumradius2)
+				// Add neighbour triangles to be tested
+				for (uint ss = 0; ss < 3 && !finish; ++ss)
 				{
-					// Add triangle edges to edge buffer
-					const uint index0 = terrain_buffer->data[global_owner_index].indices[triangle_index * 3 + 0];
-					const uint index1 = terrain_buffer->data[global_owner_index].indices[triangle_index * 3 + 1];
-					const uint index2 = terrain_buffer->data[global_owner_index].indices[triangle_index * 3 + 2];
-					const vec4 p0 = terrain_buffer->data[global_owner_index].positions[index0];
-					const vec4 p1 = terrain_buffer->data[global_owner_index].positions[index1];
-					const vec4 p2 = terrain_buffer->data[global_owner_index].positions[index2];
+					const uint index = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + ss];
 
-					// Store edges to be removed
-					uint tr = atomicAdd(s_triangles_removed, 1);
-					if (tr >= max_triangles_to_remove || tr >= max_border_edges)
+					if (index <= INVALID - 9)
 					{
-						finish = true;
-						break;
-					}
-
-					uint ec = tr * 3;
-					// Edge 0
-					bool biggest_point = p0.y < p1.y;
-					s_edges[ec + 0].p1 = biggest_point ? p0 : p1;
-					s_edges[ec + 0].p2 = !biggest_point ? p0 : p1;
-					s_edges[ec + 0].p1_index = biggest_point ? index0 : index1;
-					s_edges[ec + 0].p2_index = !biggest_point ? index0 : index1;
-					s_edges[ec + 0].node_index = local_owner_index;
-					s_edges[ec + 0].connection = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + 0];
-					s_edges[ec + 0].old_triangle_index = triangle_index;
-					// Edge 1
-					biggest_point = p1.y < p2.y;
-					s_edges[ec + 1].p1 = biggest_point ? p1 : p2;
-					s_edges[ec + 1].p2 = !biggest_point ? p1 : p2;
-					s_edges[ec + 1].p1_index = biggest_point ? index1 : index2;
-					s_edges[ec + 1].p2_index = !biggest_point ? index1 : index2;
-					s_edges[ec + 1].node_index = local_owner_index;
-					s_edges[ec + 1].connection = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + 1];
-					s_edges[ec + 1].old_triangle_index = triangle_index;
-					// Edge 2
-					biggest_point = p2.y < p0.y;
-					s_edges[ec + 2].p1 = biggest_point ? p2 : p0;
-					s_edges[ec + 2].p2 = !biggest_point ? p2 : p0;
-					s_edges[ec + 2].p1_index = biggest_point ? index2 : index0;
-					s_edges[ec + 2].p2_index = !biggest_point ? index2 : index0;
-					s_edges[ec + 2].node_index = local_owner_index;
-					s_edges[ec + 2].connection = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + 2];
-					s_edges[ec + 2].old_triangle_index = triangle_index;
-
-					// Mark the triangle to be removed later
-					s_triangles_to_remove[tr] = triangle_index;
-					s_owning_node[tr] = local_owner_index;
+						if (ctx.seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || ctx.test_count >= TEST_TRIANGLE_BUFFER_SIZE)
+						{
+							finish = true;
+							break;
+						}
 
-					// Add neighbour triangles to be tested
-					for (uint ss = 0; ss < 3 && !finish; ++ss)
+						add_connection(ctx, local_owner_index, index);
+					}
+					else if (!checked_borders)
 					{
-						const uint index = terrain_buffer->data[global_owner_index].triangle_connections[triangle_index * 3 + ss];
-
-						if (index <= INVALID - 9)
+						checked_borders = true;
+						// Check the internal border triangles listed in the grid cell of the point
+						uint node = ctx.ltg[SELF_INDEX];
+						const std::vector<uint>& candidates = border_grids[node].get_candidates(vec2(current_point.x, current_point.z));
+						if (ctx.border_hits.size() < candidates.size())
+							ctx.border_hits.resize(candidates.size());
+						const uint hit_count = find_containing_circumcircles(terrain_buffer->data[node].get_circumcircles(),
+							candidates.data(),
+							(uint)candidates.size(),
+							vec2(current_point.x, current_point.z),
+							ctx.border_hits.data());
+						for (uint hh = 0; hh < hit_count; ++hh)
 						{
-							if (seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || test_count >= TEST_TRIANGLE_BUFFER_SIZE)
+							if (ctx.seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || ctx.test_count >= TEST_TRIANGLE_BUFFER_SIZE)
 							{
 								finish = true;
 								break;
 							}
 
-							add_connection(local_owner_index, index);
+							add_connection(ctx, SELF_INDEX, ctx.border_hits[hh]);
 						}
-						else if (!checked_borders)
-						{
-							checked_borders = true;
-							// Check the internal border triangles
-							uint node = ltg[SELF_INDEX];
-							const uint triangle_count = terrain_buffer->data[node].border_count;
-							for (uint tt = 0; tt < triangle_count; ++tt)
-							{
-								const uint border_triangle = terrain_buffer->data[node].border_triangle_indices[tt];
-								const vec2 cc = terrain_buffer->data[node].triangles[border_triangle].circumcentre;
-								const float cr2 = terrain_buffer->data[node].triangles[border_triangle].circumradius2;
-
-								const float ddx = current_point.x - cc.x;
-								const float ddy = current_point.z - cc.y;
-
-								if (ddx * ddx + ddy * ddy < cr2)
-								{
-									if (seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || test_count >= TEST_TRIANGLE_BUFFER_SIZE)
-									{
-										finish = true;
-										break;
-									}
-
-									add_connection(SELF_INDEX, border_triangle);
-								}
-							}
 
-							// Check neighbour nodes
-							for (uint nn = 0; nn < 9 && !finish; ++nn)
+						// Check neighbour nodes
+						for (uint nn = 0; nn < 9 && !finish; ++nn)
+						{
+							if (nn != SELF_INDEX)
 							{
-								if (nn != SELF_INDEX)
+								const vec2 adjusted_max = node_max + vec2(side) * ADJUST_PERCENTAGE;
+								const vec2 adjusted_min = node_min - vec2(side) * ADJUST_PERCENTAGE;
+								if (current_point.x >= adjusted_min.x && current_point.x <= adjusted_max.x
+									&& current_point.z >= adjusted_min.y && current_point.z <= adjusted_max.y)
 								{
-									const vec2 adjusted_max = node_max + vec2(side) * ADJUST_PERCENTAGE;
-									const vec2 adjusted_min = node_min - vec2(side) * ADJUST_PERCENTAGE;
-									if (current_point.x >= adjusted_min.x && current_point.x <= adjusted_max.x
-										&& current_point.z >= adjusted_min.y && current_point.z <= adjusted_max.y)
+									const uint node = ctx.ltg[nn];
+									if (node != INVALID)
 									{
-										const uint node = ltg[nn];
-										if (node != INVALID)
+										const std::vector<uint>& candidates = border_grids[node].get_candidates(vec2(current_point.x, current_point.z));
+										if (ctx.border_hits.size() < candidates.size())
+											ctx.border_hits.resize(candidates.size());
+										const uint hit_count = find_containing_circumcircles(terrain_buffer->data[node].get_circumcircles(),
+											candidates.data(),
+											(uint)candidates.size(),
+											vec2(current_point.x, current_point.z),
+											ctx.border_hits.data());
+										for (uint hh = 0; hh < hit_count; ++hh)
 										{
-											const uint triangle_count = terrain_buffer->data[node].border_count;
-											for (uint tt = 0; tt < triangle_count; ++tt)
+											if (ctx.seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || ctx.test_count >= TEST_TRIANGLE_BUFFER_SIZE)
 											{
-												const uint border_triangle = terrain_buffer->data[node].border_triangle_indices[tt];
-												const vec2 cc = terrain_buffer->data[node].triangles[border_triangle].circumcentre;
-												const float cr2 = terrain_buffer->data[node].triangles[border_triangle].circumradius2;
-
-												const float ddx = current_point.x - cc.x;
-												const float ddy = current_point.z - cc.y;
-
-												if (ddx * ddx + ddy * ddy < cr2)
-												{
-													if (seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || test_count >= TEST_TRIANGLE_BUFFER_SIZE)
-													{
-														finish = true;
-														break;
-													}
-
-													add_connection(nn, border_triangle);
-												}
+												finish = true;
+												break;
 											}
+
+											add_connection(ctx, nn, ctx.border_hits[hh]);
 										}
 									}
 								}
@@ -2695,502 +3575,782 @@ namespace cputri
 					}
 				}
 			}
+		}
 
-			if (finish)
+		if (finish)
+		{
+			ctx.s_triangles_removed = 0;
+			++ctx.statistics.insertions_discarded;
+			return true;
+		}
+
+		return fill_cavity(ctx, node_index, current_point);
+	}
+
+	bool Terrain::fill_cavity(TriangulationContext& ctx, const uint node_index, const vec4 current_point)
+	{
+		const uint thid = gl_GlobalInvocationID.x;
+
+		const vec2 node_min = terrain_buffer->data[node_index].min;
+		const vec2 node_max = terrain_buffer->data[node_index].max;
+
+		uint nodes_new_points_count[9];
+		for (uint ii = 0; ii < 9; ++ii)
+		{
+			nodes_new_points_count[ii] = 0;
+			ctx.new_triangle_index_count[ii] = 0;
+		}
+
+		//barrier();
+		//memoryBarrierShared();
+
+		// Delete all doubly specified edges from edge buffer (this leaves the edges of the enclosing polygon only)
+		const uint edge_count = ctx.s_triangles_removed * 3;
+		count_cavity_edges(ctx.cavity_edges, ctx.s_edges.data(), edge_count);
+		for (uint i = thid; i < edge_count; i += WORK_GROUP_SIZE)
+		{
+			if (is_shared_edge(ctx.cavity_edges, i))
+				ctx.s_edges[i].p1.y = INVALID_HEIGHT;
+		}
+
+		//barrier();
+		//memoryBarrierShared();
+
+		// Count the number of new triangles to create
+		if (thid == 0)
+		{
+			ctx.s_new_triangle_count = 0;
+
+			for (uint j = 0; j < edge_count && j < max_triangles_to_remove * 3; ++j)
 			{
-				s_triangles_removed = 0;
-				continue;
+				if (ctx.s_edges[j].p1.y != INVALID_HEIGHT)
+				{
+					ctx.s_valid_indices[ctx.s_new_triangle_count++] = j;
+					nodes_new_points_count[ctx.s_edges[j].node_index]++;
+				}
 			}
+		}
 
-			//barrier();
-			//memoryBarrierShared();
+		// The cavity has to be a disc, which has two more edges than triangles and every corner on exactly two edges.
+		// Border triangles found through the grids can make it discs touching at a corner, and filling that in
+		// would connect new triangles that share no edge
+		bool is_disc = ctx.s_new_triangle_count == ctx.s_triangles_removed + 2;
+		for (uint edge = 0; edge < ctx.s_new_triangle_count && is_disc; ++edge)
+		{
+			const BorderEdge& current = ctx.s_edges[ctx.s_valid_indices[edge]];
+			uint p1_edges = 0;
+			uint p2_edges = 0;
+			for (uint other = 0; other < ctx.s_new_triangle_count; ++other)
+			{
+				const BorderEdge& test = ctx.s_edges[ctx.s_valid_indices[other]];
+				p1_edges += (test.p1 == current.p1 || test.p2 == current.p1) ? 1 : 0;
+				p2_edges += (test.p1 == current.p2 || test.p2 == current.p2) ? 1 : 0;
+			}
+			is_disc = p1_edges == 2 && p2_edges == 2;
+		}
 
-			// Delete all doubly specified edges from edge buffer (this leaves the edges of the enclosing polygon only)
-			const uint edge_count = s_triangles_removed * 3;
-			uint i = thid;
-			while (i < edge_count)
+		if (!is_disc)
+		{
+			ctx.s_triangles_removed = 0;
+			++ctx.statistics.insertions_discarded;
+			return true;
+		}
+
+		//barrier();
+		//memoryBarrierShared();
+
+		if (thid == 0)
+		{
+			struct moved_point
+			{
+				vec4 point;
+				uint index;			// Index of point in new node
+				uint node_index;	// Local index of node that the point was placed in
+			};
+
+			const uint MAX_MOVED_POINTS = 10;
+
+			// Array of points moved into other nodes
+			std::array<moved_point, MAX_MOVED_POINTS> moved_points;
+			uint moved_points_count = 0;
+
+			std::array<uint, 9> participating_nodes;
+			uint participation_count = 0;
+
+			// True if this point should be skipped due to an array being full
+			bool skip = false;
+
+			for (uint edge = 0; edge < ctx.s_new_triangle_count; ++edge)
 			{
+				// Calculate participating nodes
 				bool found = false;
-				for (uint j = 0; j < edge_count; ++j)
+				for (uint jj = 0; jj < participation_count; ++jj)
 				{
-					if (i != j &&
-						s_edges[i].p1 == s_edges[j].p1 &&
-						s_edges[i].p2 == s_edges[j].p2)
+					if (ctx.s_edges[ctx.s_valid_indices[edge]].node_index == participating_nodes[jj])
 					{
-						// Mark as invalid
-						s_edges[j].p1.y = INVALID_HEIGHT;
 						found = true;
+						break;
 					}
 				}
-				if (found)
-					s_edges[i].p1.y = INVALID_HEIGHT;
-				i += WORK_GROUP_SIZE;
-			}
+				if (!found)
+				{
+					participating_nodes[participation_count] = ctx.s_edges[ctx.s_valid_indices[edge]].node_index;
 
-			//barrier();
-			//memoryBarrierShared();
+					++participation_count;
+				}
+			}
 
-			// Count the number of new triangles to create
-			if (thid == 0)
+			// Any node may get all the new triangles, with two moved vertices and a new border triangle on either side of
+			// the border for each, so every node needs room for that
+			for (uint pp = 0; pp < 9; ++pp)
 			{
-				s_new_triangle_count = 0;
-
-				for (uint j = 0; j < edge_count && j < max_triangles_to_remove * 3; ++j)
+				if (ctx.ltg[pp] != INVALID)
 				{
-					if (s_edges[j].p1.y != INVALID_HEIGHT)
+					const TerrainData& node = terrain_buffer->data[ctx.ltg[pp]];
+					if (!reserve_node(ctx.ltg[pp],
+						node.index_count / 3 + ctx.s_new_triangle_count,
+						node.vertex_count + ctx.s_new_triangle_count * 2 + 1,
+						node.border_count + ctx.s_new_triangle_count * 2))
 					{
-						s_valid_indices[s_new_triangle_count++] = j;
-						nodes_new_points_count[s_edges[j].node_index]++;
+						skip = true;
+						break;
 					}
 				}
 			}
 
-			//barrier();
-			//memoryBarrierShared();
+			if (skip)
+			{
+				++ctx.statistics.insertions_discarded;
+				return false;
+			}
 
-			if (thid == 0)
+			// Move triangles to correct node
+			for (uint edge = 0; edge < ctx.s_new_triangle_count; ++edge)
 			{
-				struct moved_point
-				{
-					vec4 point;
-					uint index;			// Index of point in new node
-					uint node_index;	// Local index of node that the point was placed in
-				};
+				uint i = ctx.s_valid_indices[edge];
+				vec3 p0 = vec3(ctx.s_edges[i].p1);
+				vec3 p1 = vec3(ctx.s_edges[i].p2);
+				vec3 p2 = vec3(current_point);
+
+				// Check if triangle is in another node
+				const vec3 triangle_mid = (vec3(p0) + vec3(p1) + vec3(p2)) / 3.0f;
 
-				const uint MAX_MOVED_POINTS = 10;
+				bool move_triangle = false;
 
-				// Array of points moved into other nodes
-				std::array<moved_point, MAX_MOVED_POINTS> moved_points;
-				uint moved_points_count = 0;
+				uint x_index = 1;
+				uint y_index = 1;
 
-				std::array<uint, 9> participating_nodes;
-				uint participation_count = 0;
+				if (triangle_mid.x > node_max.x)
+					x_index = 2;
+				else if (triangle_mid.x < node_min.x)
+					x_index = 0;
+				if (triangle_mid.z > node_max.y)
+					y_index = 2;
+				else if (triangle_mid.z < node_min.y)
+					y_index = 0;
 
-				// True if this point should be skipped due to an array being full
-				bool skip = false;
+				uint local_node_index = y_index * 3 + x_index;
 
-				for (uint edge = 0; edge < s_new_triangle_count; ++edge)
+				if (local_node_index != ctx.s_edges[i].node_index && ctx.ltg[local_node_index] != INVALID &&
+					moved_points_count < MAX_MOVED_POINTS - 2)
 				{
-					// Calculate participating nodes
+					move_triangle = true;
+
 					bool found = false;
+					// Add target node to participating nodes if required
 					for (uint jj = 0; jj < participation_count; ++jj)
 					{
-						if (s_edges[s_valid_indices[edge]].node_index == participating_nodes[jj])
-						{
+						if (participating_nodes[jj] == local_node_index)
 							found = true;
-							break;
-						}
-					}
-					if (!found)
-					{
-						participating_nodes[participation_count] = s_edges[s_valid_indices[edge]].node_index;
-
-						++participation_count;
 					}
-				}
 
-				for (uint pp = 0; pp < 9; ++pp)
-				{
-					if (ltg[pp] != INVALID)
+					if (!found)
 					{
-						int offset = 0;
-						if (pp == 4)
-							offset = 500;
-
-						if (terrain_buffer->data[ltg[pp]].index_count + s_new_triangle_count * 3 >= num_indices - offset ||
-							terrain_buffer->data[ltg[pp]].vertex_count + s_new_triangle_count * 2 >= num_vertices - offset ||
-							terrain_buffer->data[ltg[pp]].border_count + s_new_triangle_count >= max_border_triangle_count - offset)
-						{
-							skip = true;
-							break;
-						}
+						participating_nodes[participation_count] = local_node_index;
+
+						++participation_count;
 					}
 				}
 
-				if (skip)
-					break;
+				uint old_old_triangle_index = INVALID;
+				uint old_node_index = INVALID;
 
-				// Move triangles to correct node
-				for (uint edge = 0; edge < s_new_triangle_count; ++edge)
+				if (move_triangle)
 				{
-					uint i = s_valid_indices[edge];
-					vec3 p0 = vec3(s_edges[i].p1);
-					vec3 p1 = vec3(s_edges[i].p2);
-					vec3 p2 = vec3(current_point);
-
-					// Check if triangle is in another node
-					const vec3 triangle_mid = (vec3(p0) + vec3(p1) + vec3(p2)) / 3.0f;
+					old_old_triangle_index = ctx.s_edges[i].old_triangle_index;
+					old_node_index = ctx.s_edges[i].node_index;
 
-					bool move_triangle = false;
-
-					uint x_index = 1;
-					uint y_index = 1;
+					ctx.s_edges[i].old_triangle_index = INVALID;
+					ctx.s_edges[i].node_index = local_node_index;
+				}
 
-					if (triangle_mid.x > node_max.x)
-						x_index = 2;
-					else if (triangle_mid.x < node_min.x)
-						x_index = 0;
-					if (triangle_mid.z > node_max.y)
-						y_index = 2;
-					else if (triangle_mid.z < node_min.y)
-						y_index = 0;
+				ctx.s_edges[i].future_index = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].index_count / 3;
+				terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].index_count += 3;
 
-					uint local_node_index = y_index * 3 + x_index;
+				if (move_triangle)
+				{
+					bool is_border = false;
 
-					if (local_node_index != s_edges[i].node_index && ltg[local_node_index] != INVALID &&
-						moved_points_count < MAX_MOVED_POINTS - 2)
+					if (ctx.s_edges[i].connection <= INVALID - 9)
 					{
-						move_triangle = true;
-
-						bool found = false;
-						// Add target node to participating nodes if required
-						for (uint jj = 0; jj < participation_count; ++jj)
+						// Check if old neighbour is a border triangle
+						for (uint border = 0; border < 3; ++border)
 						{
-							if (participating_nodes[jj] == local_node_index)
-								found = true;
+							if (terrain_buffer->data[ctx.ltg[old_node_index]].triangle_connections[ctx.s_edges[i].connection * 3 + border] >= INVALID - 9)
+							{
+								is_border = true;
+								break;
+							}
 						}
 
-						if (!found)
+						// Make old neighbour triangle a border triangle if it is not already
+						if (!is_border)
 						{
-							participating_nodes[participation_count] = local_node_index;
-
-							++participation_count;
+							terrain_buffer->data[ctx.ltg[old_node_index]].border_triangle_indices[terrain_buffer->data[ctx.ltg[old_node_index]].border_count] = ctx.s_edges[i].connection;
+							++terrain_buffer->data[ctx.ltg[old_node_index]].border_count;
+							border_grids[ctx.ltg[old_node_index]].insert(ctx.s_edges[i].connection,
+								terrain_buffer->data[ctx.ltg[old_node_index]].get_circumcentre(ctx.s_edges[i].connection),
+								terrain_buffer->data[ctx.ltg[old_node_index]].get_circumradius2(ctx.s_edges[i].connection));
 						}
 					}
 
-					uint old_old_triangle_index = INVALID;
-					uint old_node_index = INVALID;
-
-					if (move_triangle)
-					{
-						old_old_triangle_index = s_edges[i].old_triangle_index;
-						old_node_index = s_edges[i].node_index;
+					// Remove connection from old neighbour
+					replace_connection_index(ctx.ltg[old_node_index], ctx.s_edges[i].connection, old_old_triangle_index, INVALID - (4 + (int)ctx.s_edges[i].node_index - (int)old_node_index));
 
-						s_edges[i].old_triangle_index = INVALID;
-						s_edges[i].node_index = local_node_index;
-					}
+					const uint border_count = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_count;
 
-					s_edges[i].future_index = terrain_buffer->data[ltg[s_edges[i].node_index]].index_count / 3;
-					terrain_buffer->data[ltg[s_edges[i].node_index]].index_count += 3;
+					bool connected = false;
 
-					if (move_triangle)
+					// Loop through border triangles of target node to find connection
+					for (uint border_tri = 0; border_tri < border_count; ++border_tri)
 					{
-						bool is_border = false;
-
-						if (s_edges[i].connection <= INVALID - 9)
-						{
-							// Check if old neighbour is a border triangle
-							for (uint border = 0; border < 3; ++border)
-							{
-								if (terrain_buffer->data[ltg[old_node_index]].triangle_connections[s_edges[i].connection * 3 + border] >= INVALID - 9)
-								{
-									is_border = true;
-									break;
-								}
-							}
+						const uint border_index = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_triangle_indices[border_tri];
 
-							// Make old neighbour triangle a border triangle if it is not already
-							if (!is_border)
-							{
-								terrain_buffer->data[ltg[old_node_index]].border_triangle_indices[terrain_buffer->data[ltg[old_node_index]].border_count] = s_edges[i].connection;
-								++terrain_buffer->data[ltg[old_node_index]].border_count;
-							}
-						}
-
-						// Remove connection from old neighbour
-						replace_connection_index(ltg[old_node_index], s_edges[i].connection, old_old_triangle_index, INVALID - (4 + (int)s_edges[i].node_index - (int)old_node_index));
+						uint inds[3];
+						inds[0] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[border_index * 3 + 0];
+						inds[1] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[border_index * 3 + 1];
+						inds[2] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[border_index * 3 + 2];
 
-						const uint border_count = terrain_buffer->data[ltg[s_edges[i].node_index]].border_count;
+						vec3 p[3];
+						p[0] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].get_position(inds[0]);
+						p[1] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].get_position(inds[1]);
+						p[2] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].get_position(inds[2]);
 
-						bool connected = false;
-
-						// Loop through border triangles of target node to find connection
-						for (uint border_tri = 0; border_tri < border_count; ++border_tri)
+						// For every edge in border triangle
+						for (uint bb = 0; bb < 3; ++bb)
 						{
-							const uint border_index = terrain_buffer->data[ltg[s_edges[i].node_index]].border_triangle_indices[border_tri];
-
-							uint inds[3];
-							inds[0] = terrain_buffer->data[ltg[s_edges[i].node_index]].indices[border_index * 3 + 0];
-							inds[1] = terrain_buffer->data[ltg[s_edges[i].node_index]].indices[border_index * 3 + 1];
-							inds[2] = terrain_buffer->data[ltg[s_edges[i].node_index]].indices[border_index * 3 + 2];
-
-							vec3 p[3];
-							p[0] = terrain_buffer->data[ltg[s_edges[i].node_index]].positions[inds[0]];
-							p[1] = terrain_buffer->data[ltg[s_edges[i].node_index]].positions[inds[1]];
-							p[2] = terrain_buffer->data[ltg[s_edges[i].node_index]].positions[inds[2]];
-
-							// For every edge in border triangle
-							for (uint bb = 0; bb < 3; ++bb)
+							if ((p[bb] == vec3(ctx.s_edges[i].p1) && p[(bb + 1) % 3] == vec3(ctx.s_edges[i].p2)) ||
+								(p[bb] == vec3(ctx.s_edges[i].p2) && p[(bb + 1) % 3] == vec3(ctx.s_edges[i].p1)))
 							{
-								if (p[bb] == vec3(s_edges[i].p1) && p[(bb + 1) % 3] == vec3(s_edges[i].p2) || 
-									p[bb] == vec3(s_edges[i].p2) && p[(bb + 1) % 3] == vec3(s_edges[i].p1))
-								{
-									// Set connection
-									s_edges[i].connection = border_index;
-									terrain_buffer->data[ltg[s_edges[i].node_index]].triangle_connections[border_index * 3 + bb] = s_edges[i].future_index;
-
-									// Set indices
-									if (p[bb] == vec3(s_edges[i].p1))
-									{
-										s_edges[i].p1_index = inds[bb];
-										s_edges[i].p2_index = inds[(bb + 1) % 3];
-									}
-									else
-									{
-										s_edges[i].p2_index = inds[bb];
-										s_edges[i].p1_index = inds[(bb + 1) % 3];
-									}
+								// Set connection
+								ctx.s_edges[i].connection = border_index;
+								terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].triangle_connections[border_index * 3 + bb] = ctx.s_edges[i].future_index;
 
-									// Check if neighbour triangle is still a border triangle
-									bool border_triangle = false;
-									for (uint cc = 0; cc < 3; ++cc)
-									{
-										if (terrain_buffer->data[ltg[s_edges[i].node_index]].triangle_connections[border_index * 3 + cc] >= INVALID - 9)
-										{
-											border_triangle = true;
-											break;
-										}
-									}
+								// Set indices
+								if (p[bb] == vec3(ctx.s_edges[i].p1))
+								{
+									ctx.s_edges[i].p1_index = inds[bb];
+									ctx.s_edges[i].p2_index = inds[(bb + 1) % 3];
+								}
+								else
+								{
+									ctx.s_edges[i].p2_index = inds[bb];
+									ctx.s_edges[i].p1_index = inds[(bb + 1) % 3];
+								}
 
-									// If neighbour is not a border triangle anymore, remove it from border triangle list
-									if (!border_triangle)
+								// Check if neighbour triangle is still a border triangle
+								bool border_triangle = false;
+								for (uint cc = 0; cc < 3; ++cc)
+								{
+									if (terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].triangle_connections[border_index * 3 + cc] >= INVALID - 9)
 									{
-										terrain_buffer->data[ltg[s_edges[i].node_index]].border_triangle_indices[border_tri] =
-											terrain_buffer->data[ltg[s_edges[i].node_index]].border_triangle_indices[terrain_buffer->data[ltg[s_edges[i].node_index]].border_count - 1];
-										--terrain_buffer->data[ltg[s_edges[i].node_index]].border_count;
+										border_triangle = true;
+										break;
 									}
+								}
 
-									connected = true;
-									break;
+								// If neighbour is not a border triangle anymore, remove it from border triangle list
+								if (!border_triangle)
+								{
+									terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_triangle_indices[border_tri] =
+										terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_triangle_indices[terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_count - 1];
+									--terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_count;
+									border_grids[ctx.ltg[ctx.s_edges[i].node_index]].erase(border_index);
 								}
+
+								connected = true;
+								break;
 							}
 						}
+					}
 
-						// If the triangle did not connect to an existing border triangle, points need to be transferred to the target node
-						if (!connected)
-						{
-							bool p1_found = false;
-							bool p2_found = false;
+					// If the triangle did not connect to an existing border triangle, points need to be transferred to the target node
+					if (!connected)
+					{
+						bool p1_found = false;
+						bool p2_found = false;
 
-							s_edges[i].connection = INVALID - (4 + (int)old_node_index - (int)s_edges[i].node_index);
+						ctx.s_edges[i].connection = INVALID - (4 + (int)old_node_index - (int)ctx.s_edges[i].node_index);
 
-							// Check moved_points for a match, use that index if found
-							for (uint mp = 0; mp < moved_points_count && (!p1_found || !p2_found); ++mp)
+						// Check moved_points for a match, use that index if found. Only points moved into the same node,
+						// a large cavity can move a point into several nodes and the index is the one it got there
+						for (uint mp = 0; mp < moved_points_count && (!p1_found || !p2_found); ++mp)
+						{
+							if (moved_points[mp].node_index != ctx.s_edges[i].node_index)
+								continue;
+
+							if (!p1_found && ctx.s_edges[i].p1 == moved_points[mp].point)
 							{
-								if (!p1_found && s_edges[i].p1 == moved_points[mp].point)
-								{
-									p1_found = true;
-									s_edges[i].p1_index = moved_points[mp].index;
-								}
-								else if (!p2_found && s_edges[i].p2 == moved_points[mp].point)
-								{
-									p2_found = true;
-									s_edges[i].p2_index = moved_points[mp].index;
-								}
+								p1_found = true;
+								ctx.s_edges[i].p1_index = moved_points[mp].index;
+							}
+							else if (!p2_found && ctx.s_edges[i].p2 == moved_points[mp].point)
+							{
+								p2_found = true;
+								ctx.s_edges[i].p2_index = moved_points[mp].index;
 							}
+						}
 
-							if (!p1_found || !p2_found)
+						if (!p1_found || !p2_found)
+						{
+							// For every border triangle, set indices of points already within the node
+							for (uint border_tri = 0; border_tri < border_count && (!p1_found || !p2_found); ++border_tri)
 							{
-								// For every border triangle, set indices of points already within the node
-								for (uint border_tri = 0; border_tri < border_count && (!p1_found || !p2_found); ++border_tri)
-								{
-									const uint border_index = terrain_buffer->data[ltg[s_edges[i].node_index]].border_triangle_indices[border_tri];
+								const uint border_index = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_triangle_indices[border_tri];
 
-									uint inds[3];
-									inds[0] = terrain_buffer->data[ltg[s_edges[i].node_index]].indices[border_index * 3 + 0];
-									inds[1] = terrain_buffer->data[ltg[s_edges[i].node_index]].indices[border_index * 3 + 1];
-									inds[2] = terrain_buffer->data[ltg[s_edges[i].node_index]].indices[border_index * 3 + 2];
+								uint inds[3];
+								inds[0] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[border_index * 3 + 0];
+								inds[1] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[border_index * 3 + 1];
+								inds[2] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[border_index * 3 + 2];
 
-									// Vertices of border triangle
-									vec4 p[3];
-									p[0] = terrain_buffer->data[ltg[s_edges[i].node_index]].positions[inds[0]];
-									p[1] = terrain_buffer->data[ltg[s_edges[i].node_index]].positions[inds[1]];
-									p[2] = terrain_buffer->data[ltg[s_edges[i].node_index]].positions[inds[2]];
+								// Vertices of border triangle
+								vec4 p[3];
+								p[0] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].get_position(inds[0]);
+								p[1] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].get_position(inds[1]);
+								p[2] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].get_position(inds[2]);
 
-									for (uint bb = 0; bb < 3 && (!p1_found || !p2_found); ++bb)
+								for (uint bb = 0; bb < 3 && (!p1_found || !p2_found); ++bb)
+								{
+									if (!p1_found && p[bb] == ctx.s_edges[i].p1)
 									{
-										if (!p1_found && p[bb] == s_edges[i].p1)
-										{
-											p1_found = true;
-											
-											s_edges[i].p1_index = inds[bb];
-										}
-										else if (!p2_found && p[bb] == s_edges[i].p2)
-										{
-											p2_found = true;
-											
-											s_edges[i].p2_index = inds[bb];
-										}
+										p1_found = true;
+										
+										ctx.s_edges[i].p1_index = inds[bb];
+									}
+									else if (!p2_found && p[bb] == ctx.s_edges[i].p2)
+									{
+										p2_found = true;
+										
+										ctx.s_edges[i].p2_index = inds[bb];
 									}
 								}
+							}
 
-								// If the points are not within the node, add them
-								if (!p1_found)
-								{
-									moved_points[moved_points_count].node_index = s_edges[i].node_index;
-									moved_points[moved_points_count].point = s_edges[i].p1;
-									moved_points[moved_points_count].index = terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count;
+							// If the points are not within the node, add them
+							if (!p1_found)
+							{
+								moved_points[moved_points_count].node_index = ctx.s_edges[i].node_index;
+								moved_points[moved_points_count].point = ctx.s_edges[i].p1;
+								moved_points[moved_points_count].index = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count;
 
-									s_edges[i].p1_index = moved_points[moved_points_count].index;
+								ctx.s_edges[i].p1_index = moved_points[moved_points_count].index;
 
-									terrain_buffer->data[ltg[s_edges[i].node_index]].positions[terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count] = s_edges[i].p1;
+								terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].set_position(terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count, ctx.s_edges[i].p1);
 
-									++terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count;
-									++moved_points_count;
-								}
-								if (!p2_found)
-								{
-									moved_points[moved_points_count].node_index = s_edges[i].node_index;
-									moved_points[moved_points_count].point = s_edges[i].p2;
-									moved_points[moved_points_count].index = terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count;
+								++terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count;
+								++moved_points_count;
+							}
+							if (!p2_found)
+							{
+								moved_points[moved_points_count].node_index = ctx.s_edges[i].node_index;
+								moved_points[moved_points_count].point = ctx.s_edges[i].p2;
+								moved_points[moved_points_count].index = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count;
 
-									s_edges[i].p2_index = moved_points[moved_points_count].index;
+								ctx.s_edges[i].p2_index = moved_points[moved_points_count].index;
 
-									terrain_buffer->data[ltg[s_edges[i].node_index]].positions[terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count] = s_edges[i].p2;
+								terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].set_position(terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count, ctx.s_edges[i].p2);
 
-									++terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count;
-									++moved_points_count;
-								}
+								++terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count;
+								++moved_points_count;
 							}
 						}
 					}
 				}
+			}
 
 
-				// Add to the triangle list all triangles formed between the point and the edges of the enclosing polygon
-				for (uint ii = 0; ii < s_new_triangle_count; ++ii)
+			// Add to the triangle list all triangles formed between the point and the edges of the enclosing polygon
+			for (uint ii = 0; ii < ctx.s_new_triangle_count; ++ii)
+			{
+				uint i = ctx.s_valid_indices[ii];
+				vec3 P = vec3(ctx.s_edges[i].p1);
+				vec3 Q = vec3(ctx.s_edges[i].p2);
+				vec3 R = vec3(current_point);
+
+				//vec2 PQ = normalize(vec2(Q.x, Q.z) - vec2(P.x, P.z));
+				//vec2 PR = normalize(vec2(R.x, R.z) - vec2(P.x, P.z));
+				//vec2 RQ = normalize(vec2(Q.x, Q.z) - vec2(R.x, R.z));
+
+				//float d1 = abs(dot(PQ, PR));
+				//float d2 = abs(dot(PR, RQ));
+				//float d3 = abs(dot(RQ, PQ));
+
+				// Skip this triangle because it is too narrow (should only happen at borders)
+				//if (d1 > EPSILON || d2 > EPSILON || d3 > EPSILON)
+				//{
+				//	continue;
+				//}
+
+				// Make sure winding order is correct
+				const vec3 nor = cross(R - P, Q - P);
+				if (nor.y > 0)
 				{
-					uint i = s_valid_indices[ii];
-					vec3 P = vec3(s_edges[i].p1);
-					vec3 Q = vec3(s_edges[i].p2);
-					vec3 R = vec3(current_point);
-
-					//vec2 PQ = normalize(vec2(Q.x, Q.z) - vec2(P.x, P.z));
-					//vec2 PR = normalize(vec2(R.x, R.z) - vec2(P.x, P.z));
-					//vec2 RQ = normalize(vec2(Q.x, Q.z) - vec2(R.x, R.z));
+					vec4 temp = ctx.s_edges[i].p1;
+					ctx.s_edges[i].p1 = ctx.s_edges[i].p2;
+					ctx.s_edges[i].p2 = temp;
+					uint temp2 = ctx.s_edges[i].p1_index;
+					ctx.s_edges[i].p1_index = ctx.s_edges[i].p2_index;
+					ctx.s_edges[i].p2_index = temp2;
+				}
 
-					//float d1 = abs(dot(PQ, PR));
-					//float d2 = abs(dot(PR, RQ));
-					//float d3 = abs(dot(RQ, PQ));
+				// Set indices for the new triangle
+				const uint index = ctx.s_edges[i].future_index * 3;
+				terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[index + 0] = ctx.s_edges[i].p1_index;
+				terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[index + 1] = ctx.s_edges[i].p2_index;
+				terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].indices[index + 2] = terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].vertex_count;
+
+				const uint triangle_count = ctx.s_edges[i].future_index;
+				ctx.new_triangle_indices[ctx.s_edges[i].node_index * NUM_NEW_TRIANGLE_INDICES + ctx.new_triangle_index_count[ctx.s_edges[i].node_index]] = triangle_count;
+				++ctx.new_triangle_index_count[ctx.s_edges[i].node_index];
+
+				// Set circumcircles for the new triangle
+				float a = distance(vec2(P.x, P.z), vec2(Q.x, Q.z));
+				float b = distance(vec2(P.x, P.z), vec2(R.x, R.z));
+				float c = distance(vec2(R.x, R.z), vec2(Q.x, Q.z));
+				
+				const vec2 cc_center = find_circum_center(vec2(P.x, P.z), vec2(Q.x, Q.z), vec2(R.x, R.z));
+				const float cc_radius2 = find_circum_radius_squared(a, b, c);
+
+				terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].set_circumcircle(triangle_count, cc_center, cc_radius2);
+				border_grids[ctx.ltg[ctx.s_edges[i].node_index]].update(triangle_count, cc_center, cc_radius2);
+
+				// Connections
+				terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].triangle_connections[index + 0] = ctx.s_edges[i].connection;
+				const vec4 edges[2] = { ctx.s_edges[i].p1, ctx.s_edges[i].p2 };
+				bool already_added = false;
+				if (ctx.s_edges[i].connection >= INVALID - 9)
+				{
+					already_added = true;
+					terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_triangle_indices[terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_count] = ctx.s_edges[i].future_index;
+					++terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_count;
+					border_grids[ctx.ltg[ctx.s_edges[i].node_index]].insert(ctx.s_edges[i].future_index, cc_center, cc_radius2);
+				}
 
-					// Skip this triangle because it is too narrow (should only happen at borders)
-					//if (d1 > EPSILON || d2 > EPSILON || d3 > EPSILON)
-					//{
-					//	continue;
-					//}
+				for (uint ss = 0; ss < 2; ++ss)  // The two other sides
+				{
+					bool is_border = false;
+					// Search through all other new triangles that have been added to find possible neighbours/connections
+					for (uint ee = 0; ee < ctx.s_new_triangle_count; ++ee)
+					{
+						uint test_index = ctx.s_valid_indices[ee];
+						if (test_index == i)
+							continue;
+						// Check each pair of points in the triangle if they match
+						if (edges[ss] == ctx.s_edges[test_index].p1 || edges[ss] == ctx.s_edges[test_index].p2)
+						{
+							if (ctx.s_edges[i].node_index == ctx.s_edges[test_index].node_index)
+								terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].triangle_connections[index + 2 - ss] = ctx.s_edges[test_index].future_index;
+							else
+							{
+								terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].triangle_connections[index + 2 - ss] = INVALID - (4 + (int)ctx.s_edges[test_index].node_index - (int)ctx.s_edges[i].node_index);
+								is_border = true;
+							}
+							break;
+						}
+					}
 
-					// Make sure winding order is correct
-					const vec3 nor = cross(R - P, Q - P);
-					if (nor.y > 0)
+					if (is_border && !already_added)
 					{
-						vec4 temp = s_edges[i].p1;
-						s_edges[i].p1 = s_edges[i].p2;
-						s_edges[i].p2 = temp;
-						uint temp2 = s_edges[i].p1_index;
-						s_edges[i].p1_index = s_edges[i].p2_index;
-						s_edges[i].p2_index = temp2;
+						already_added = true;
+						terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_triangle_indices[terrain_buffer->data[ctx.ltg[ctx.s_edges[i].node_index]].border_count++] = ctx.s_edges[i].future_index;
+						border_grids[ctx.ltg[ctx.s_edges[i].node_index]].insert(ctx.s_edges[i].future_index, cc_center, cc_radius2);
 					}
+				}
 
-					// Set indices for the new triangle
-					const uint index = s_edges[i].future_index * 3;
-					terrain_buffer->data[ltg[s_edges[i].node_index]].indices[index + 0] = s_edges[i].p1_index;
-					terrain_buffer->data[ltg[s_edges[i].node_index]].indices[index + 1] = s_edges[i].p2_index;
-					terrain_buffer->data[ltg[s_edges[i].node_index]].indices[index + 2] = terrain_buffer->data[ltg[s_edges[i].node_index]].vertex_count;
+				if (ctx.s_edges[i].old_triangle_index != INVALID)
+					replace_connection_index(ctx.ltg[ctx.s_edges[i].node_index], ctx.s_edges[i].connection, ctx.s_edges[i].old_triangle_index, ctx.s_edges[i].future_index);
+			}
 
-					const uint triangle_count = s_edges[i].future_index;
-					new_triangle_indices[s_edges[i].node_index * NUM_NEW_TRIANGLE_INDICES + new_triangle_index_count[s_edges[i].node_index]] = triangle_count;
-					++new_triangle_index_count[s_edges[i].node_index];
+			const uint cavity_triangles = ctx.s_triangles_removed;
+			remove_old_triangles(ctx);
 
-					// Set circumcircles for the new triangle
-					float a = distance(vec2(P.x, P.z), vec2(Q.x, Q.z));
-					float b = distance(vec2(P.x, P.z), vec2(R.x, R.z));
-					float c = distance(vec2(R.x, R.z), vec2(Q.x, Q.z));
-					
-					const vec2 cc_center = find_circum_center(vec2(P.x, P.z), vec2(Q.x, Q.z), vec2(R.x, R.z));
-					const float cc_radius2 = find_circum_radius_squared(a, b, c);
-					const float cc_radius = sqrt(cc_radius2);
+			// Insert new point
+			for (uint jj = 0; jj < participation_count; ++jj)
+			{
+				terrain_buffer->data[ctx.ltg[participating_nodes[jj]]].set_position(terrain_buffer->data[ctx.ltg[participating_nodes[jj]]].vertex_count, current_point);
+				++terrain_buffer->data[ctx.ltg[participating_nodes[jj]]].vertex_count;
+			}
 
-					terrain_buffer->data[ltg[s_edges[i].node_index]].triangles[triangle_count].circumcentre = cc_center;
-					terrain_buffer->data[ltg[s_edges[i].node_index]].triangles[triangle_count].circumradius2 = cc_radius2;
+			++ctx.statistics.points_inserted;
+			ctx.statistics.triangles_created += ctx.s_new_triangle_count;
+			ctx.statistics.cavity_triangles += cavity_triangles;
+			ctx.statistics.largest_cavity = std::max(ctx.statistics.largest_cavity, (uint64_t)cavity_triangles);
 
-					// Connections
-					terrain_buffer->data[ltg[s_edges[i].node_index]].triangle_connections[index + 0] = s_edges[i].connection;
-					const vec4 edges[2] = { s_edges[i].p1, s_edges[i].p2 };
-					bool already_added = false;
-					if (s_edges[i].connection >= INVALID - 9 && terrain_buffer->data[ltg[s_edges[i].node_index]].border_count < MAX_BORDER_TRIANGLE_COUNT)
-					{
-						already_added = true;
-						terrain_buffer->data[ltg[s_edges[i].node_index]].border_triangle_indices[terrain_buffer->data[ltg[s_edges[i].node_index]].border_count] = s_edges[i].future_index;
-						++terrain_buffer->data[ltg[s_edges[i].node_index]].border_count;
-					}
+			ctx.s_triangles_removed = 0;
+		}
 
-					for (uint ss = 0; ss < 2; ++ss)  // The two other sides
-					{
-						bool is_border = false;
-						bool found = false;
-						// Search through all other new triangles that have been added to find possible neighbours/connections
-						for (uint ee = 0; ee < s_new_triangle_count; ++ee)
-						{
-							uint test_index = s_valid_indices[ee];
-							if (test_index == i)
-								continue;
-							// Check each pair of points in the triangle if they match
-							if (edges[ss] == s_edges[test_index].p1 || edges[ss] == s_edges[test_index].p2)
-							{
-								found = true;
-								if (s_edges[i].node_index == s_edges[test_index].node_index)
-									terrain_buffer->data[ltg[s_edges[i].node_index]].triangle_connections[index + 2 - ss] = s_edges[test_index].future_index;
-								else
-								{
-									terrain_buffer->data[ltg[s_edges[i].node_index]].triangle_connections[index + 2 - ss] = INVALID - (4 + (int)s_edges[test_index].node_index - (int)s_edges[i].node_index);
-									is_border = true;
-								}
-								break;
-							}
-						}
+		//barrier();
+		//memoryBarrierShared();
+		//memoryBarrierBuffer();
 
-						if (!found)
-						{
-							int a = 234234;
-						}
+		return true;
+	}
 
-						if (is_border && !already_added && terrain_buffer->data[ltg[s_edges[i].node_index]].border_count < MAX_BORDER_TRIANGLE_COUNT)
-						{
-							already_added = true;
-							terrain_buffer->data[ltg[s_edges[i].node_index]].border_triangle_indices[terrain_buffer->data[ltg[s_edges[i].node_index]].border_count++] = s_edges[i].future_index;
-						}
-					}
+	void Terrain::triangulate_shader(TriangulationContext& ctx, const uint node_index)
+	{
+		if (refine_node != -1 && (uint)refine_node != node_index)
+			return;
 
-					if (s_edges[i].old_triangle_index != INVALID)
-						replace_connection_index(ltg[s_edges[i].node_index], s_edges[i].connection, s_edges[i].old_triangle_index, s_edges[i].future_index);
-				}
+		const uint thid = gl_GlobalInvocationID.x;
 
-				remove_old_triangles();
+		find_neighbours(ctx, node_index);
 
-				// Insert new point
-				for (uint jj = 0; jj < participation_count; ++jj)
-				{
-					terrain_buffer->data[ltg[participating_nodes[jj]]].positions[terrain_buffer->data[ltg[participating_nodes[jj]]].vertex_count] = current_point;
-					++terrain_buffer->data[ltg[participating_nodes[jj]]].vertex_count;
-				}
+		// Set shared variables
+		if (thid == 0)
+		{
+			ctx.s_triangles_removed = 0;
+		}
+
+		// barrier();
+		// memoryBarrierShared();
 
-				s_triangles_removed = 0;
+		const uint new_points_count = terrain_buffer->data[node_index].new_points_count;
+		
+		uint counter = 0;
+		bool out_of_time = false;
+		for (int n = (int)new_points_count - 1; n >= 0 && counter < (uint)vertices_per_refine; --n, ++counter)
+		//for (uint n = 0; n < new_points_count && n < TERRAIN_GENERATE_NUM_VERTICES; ++n)
+		{
+			// The points that are left stay for the next call
+			if ((counter != 0 || !first_colour_class) && out_of_refine_time(ctx))
+			{
+				out_of_time = true;
+				break;
 			}
 
-			//barrier();
-			//memoryBarrierShared();
-			//memoryBarrierBuffer();
+			const auto insertion_start = refine_time_budget > 0.0f ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+			if (!insert_point(ctx, node_index, n))
+				break;
+
+			if (refine_time_budget > 0.0f)
+				ctx.insertion_time += (std::chrono::steady_clock::now() - insertion_start - ctx.insertion_time) / 8;
 		}
 
 		//if (thid == 0)
 		//{
 			//terrain_buffer->data[node_index].vertex_count = s_vertex_count;
 			//terrain_buffer->data[node_index].index_count = s_index_count;
+		if (out_of_time)
+		{
+			terrain_buffer->data[node_index].new_points_count -= counter;
+			ctx.out_of_time = true;
+		}
+		else
+		{
 			terrain_buffer->data[node_index].new_points_count -= std::min((uint)vertices_per_refine, new_points_count);
+		}
 		//}
 
 		//terrain_buffer->data[node_index].new_points_count = 0;
 	}
 
+	void Terrain::find_cavity(TriangulationContext& ctx, const uint node_index, const uint n, BatchCavity& cavity)
+	{
+		const TerrainData& node = terrain_buffer->data[node_index];
+
+		cavity.batchable = false;
+		cavity.triangle_count = 0;
+		cavity.tested_count = 0;
+
+		const vec4 current_point = node.new_points[n];
+		const uint start_index = locate_point(node, border_grids[node_index], vec2(current_point.x, current_point.z));
+		if (start_index == INVALID || !circumcircle_contains(node, start_index, current_point, ctx.statistics))
+			return;
+
+		// The same search as insert_point, so the triangles come in the same order and fill_cavity makes the same
+		// new triangles from them
+		ctx.seen_triangle_count = 1;
+		ctx.test_count = 1;
+		ctx.seen_triangles[0] = start_index;
+		ctx.seen_triangle_owners[0] = SELF_INDEX;
+		ctx.triangles_to_test[0] = start_index;
+		ctx.test_triangle_owners[0] = SELF_INDEX;
+
+		while (ctx.test_count != 0)
+		{
+			const uint triangle = ctx.triangles_to_test[--ctx.test_count];
+			if (!circumcircle_contains(node, triangle, current_point, ctx.statistics))
+				continue;
+
+			if (cavity.triangle_count >= MAX_BATCH_CAVITY_TRIANGLES)
+				return;
+			cavity.triangles[cavity.triangle_count++] = triangle;
+
+			for (uint ss = 0; ss < 3; ++ss)
+			{
+				// Cavities reaching a node border also search the neighbour nodes
+				const uint neighbour = node.triangle_connections[triangle * 3 + ss];
+				if (neighbour >= INVALID - 9)
+					return;
+
+				if (ctx.seen_triangle_count >= TEST_TRIANGLE_BUFFER_SIZE || ctx.test_count >= TEST_TRIANGLE_BUFFER_SIZE)
+					return;
+
+				add_connection(ctx, SELF_INDEX, neighbour);
+			}
+		}
+
+		// insert_point moves triangles whose middle is outside the node to the neighbour node
+		uint edge_count = 0;
+		for (uint tt = 0; tt < cavity.triangle_count; ++tt)
+		{
+			const uint triangle = cavity.triangles[tt];
+			for (uint ss = 0; ss < 3; ++ss)
+			{
+				const uint neighbour = node.triangle_connections[triangle * 3 + ss];
+				if (std::find(cavity.triangles.begin(), cavity.triangles.begin() + cavity.triangle_count, neighbour) != cavity.triangles.begin() + cavity.triangle_count)
+					continue;
+
+				const vec3 p1 = vec3(node.get_position(node.indices[triangle * 3 + ss]));
+				const vec3 p2 = vec3(node.get_position(node.indices[triangle * 3 + (ss + 1) % 3]));
+				const vec3 triangle_mid = (p1 + p2 + vec3(current_point)) / 3.0f;
+				if (triangle_mid.x > node.max.x || triangle_mid.x < node.min.x || triangle_mid.z > node.max.y || triangle_mid.z < node.min.y)
+					return;
+
+				++edge_count;
+			}
+		}
+
+		// The cavity of a point inside it is a disc, which has two more edges than triangles. Then the new triangles
+		// take the slots of the removed ones and two more at the end, and no other triangle of the node moves
+		if (edge_count != cavity.triangle_count + 2)
+			return;
+
+		cavity.tested_count = ctx.seen_triangle_count;
+		std::copy(ctx.seen_triangles, ctx.seen_triangles + ctx.seen_triangle_count, cavity.tested.begin());
+		cavity.batchable = true;
+	}
+
+	void Terrain::triangulate_batched(const uint node_index)
+	{
+		if (refine_node != -1 && (uint)refine_node != node_index)
+			return;
+
+		TriangulationContext& ctx = caller_context();
+		find_neighbours(ctx, node_index);
+		ctx.s_triangles_removed = 0;
+
+		TerrainData& node = terrain_buffer->data[node_index];
+
+		const uint new_points_count = node.new_points_count;
+		const uint point_count = std::min((uint)vertices_per_refine, new_points_count);
+
+		batch->points.clear();
+		for (uint pp = 0; pp < point_count; ++pp)
+		{
+			batch->points.push_back(new_points_count - 1 - pp);
+		}
+
+		bool full = false;
+		while (!batch->points.empty() && !full)
+		{
+			// Every remaining point looks for its cavity in the same mesh
+			batch->cavities.resize(batch->points.size());
+			thread_pool->parallel_for((uint)batch->points.size(), [&](uint task, uint thread)
+			{
+				find_cavity(contexts[thread], node_index, batch->points[task], batch->cavities[task]);
+			});
+
+			++batch->round;
+			batch->accepted.clear();
+			batch->retry.clear();
+			batch->serial.clear();
+
+			if (batch->claims.size() < node.triangle_capacity)
+				batch->claims.resize(node.triangle_capacity, 0);
+
+			// Accept cavities in insertion order until one tested a triangle that an accepted one tested. The others
+			// only change their own triangles and add two at the end, so the cavities found before any was filled in
+			// are still the ones insert_point would find. The points that have to go through insert_point come next,
+			// and the points after them wait for the next round
+			for (uint pp = 0; pp < (uint)batch->points.size(); ++pp)
+			{
+				const BatchCavity& cavity = batch->cavities[pp];
+
+				if (!batch->retry.empty())
+				{
+					batch->retry.push_back(pp);
+					continue;
+				}
+
+				if (!cavity.batchable)
+				{
+					batch->serial.push_back(pp);
+					continue;
+				}
+
+				bool overlaps = !batch->serial.empty();
+				for (uint tt = 0; tt < cavity.tested_count && !overlaps; ++tt)
+				{
+					overlaps = batch->claims[cavity.tested[tt]] == batch->round;
+				}
+
+				if (overlaps)
+				{
+					batch->retry.push_back(pp);
+					continue;
+				}
+
+				batch->accepted.push_back(pp);
+				for (uint tt = 0; tt < cavity.tested_count; ++tt)
+				{
+					batch->claims[cavity.tested[tt]] = batch->round;
+				}
+			}
+
+			// Filled in one at a time like insert_point does, so the node gets the same triangles in the same slots
+			for (uint pp : batch->accepted)
+			{
+				const BatchCavity& cavity = batch->cavities[pp];
+				for (uint tt = 0; tt < cavity.triangle_count; ++tt)
+				{
+					add_cavity_triangle(ctx, SELF_INDEX, cavity.triangles[tt]);
+				}
+
+				if (!fill_cavity(ctx, node_index, node.new_points[batch->points[pp]]))
+				{
+					full = true;
+					break;
+				}
+			}
+
+			for (uint ss = 0; ss < (uint)batch->serial.size() && !full; ++ss)
+			{
+				full = !insert_point(ctx, node_index, batch->points[batch->serial[ss]]);
+			}
+
+			// The points that waited look for their cavity again in the changed mesh
+			uint retry_count = 0;
+			for (uint pp : batch->retry)
+			{
+				batch->points[retry_count++] = batch->points[pp];
+			}
+			batch->points.resize(retry_count);
+		}
+
+		node.new_points_count -= point_count;
+	}
+
 #pragma endregion
 }
@@ -1,59 +1,396 @@
 #pragma once
 
-#include "graphics/debug_drawer.hpp"
-#include "tfile.hpp"
-#include "camera.hpp"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
 
+#include "math/geometry.hpp"
+#include "slot_allocator.hpp"
+
+class ThreadPool;
+
+// CPU version of the terrain generation, triangle processing and triangulation shaders.
+// Has no window or Vulkan dependencies, drawing and ImGui controls live in cpu_triangulate_debug.hpp
 namespace cputri
 {
-	void setup(TFile& tfile);
+	struct TerrainBuffer;
+	struct TriangulationContext;
+	struct BatchCavity;
+	struct InsertionBatch;
+	struct TriangleProcessing;
+	struct ErrorCache;
+	struct TriangleRange;
+	class BorderGrid;
+	class MeshArena;
+	class NodeCache;
+	class TileCache;
+	struct Tile;
+
+	// Counters gathered by the triangulator since the last reset_statistics()
+	struct Statistics
+	{
+		// Number of points inserted by refinement
+		uint64_t points_inserted;
+
+		// Number of triangles created by refinement
+		uint64_t triangles_created;
+
+		// Number of insertions thrown away because a scratch buffer or node array was full
+		uint64_t insertions_discarded;
+
+		// Number of triangles removed by the inserted points, divide by points_inserted for the mean cavity size
+		uint64_t cavity_triangles;
+
+		// Most triangles removed by one inserted point
+		uint64_t largest_cavity;
+
+		// Number of orientation and in-circle tests that were too close to call in doubles and needed exact arithmetic
+		uint64_t exact_predicates;
+
+		// Number of nodes entering the quadtree that were put back from the node cache, and that had to be generated
+		uint64_t node_cache_hits;
+		uint64_t node_cache_misses;
+
+		// Number of nodes entering the quadtree that were read from the tile cache
+		uint64_t tiles_loaded;
+
+		// Number of triangles tested by process_triangles() whose error was still cached, and that had to be measured
+		uint64_t error_cache_hits;
+		uint64_t error_cache_misses;
+
+		// Number of new points that nodes could have inserted, but that were left for a later call by refine_point_budget
+		uint64_t points_over_budget;
+
+		// Number of calls to triangulate() that left points for the next call because refine_time_budget was used up
+		uint64_t refine_time_exhausted;
+
+		// Number of vertices removed by decimation
+		uint64_t vertices_removed;
+	};
+
+	// How curvatures and normals are found from the terrain function
+	enum class DERIVATIVE_MODE {
+		FILTERED,	// Curvature filtered from 25 heights, normals from three heights like the terrain shader
+		ANALYTIC	// Curvature and normals from the derivatives of the noise, see terrain_with_derivatives
+	};
+
+	// Curvature of the terrain at each of the count positions (x[i], z[i]), found by filtering the heights around
+	// them the way DERIVATIVE_MODE::FILTERED does
+	void curvatures(const float* x, const float* z, uint32_t count, float* results);
+
+	// Same as curvatures(), but from the second derivatives the way DERIVATIVE_MODE::ANALYTIC does. The two only
+	// agree approximately, benchmark/curvature_check.cpp measures how well
+	void analytic_curvatures(const float* x, const float* z, uint32_t count, float* results);
+
+	struct GenerateInfo
+	{
+		glm::vec2 min;
+		glm::vec2 max;
+		uint32_t index;
+	};
+
+	struct Quadtree {
+		// Number and array of indices to nodes that needs to generate terrain
+		uint32_t num_generate_nodes;
+		GenerateInfo* generate_nodes;
+
+		// Number and array of indices to nodes that needs to draw terrain
+		uint32_t num_draw_nodes;
+		uint32_t* draw_nodes;
+
+		float total_side_length;
+
+		// Max number of active nodes
+		uint64_t max_nodes;
+
+		// Nodes of the terrain buffer that are in use
+		SlotAllocator node_slots;
+
+		// Buffer index of each node, or INVALID. The node x nodes from the left and y from the top is at
+		// Terrain::get_map_index(x, y), which wraps around from map_origin so shifting the quadtree only
+		// clears the row or column that comes in instead of moving every entry
+		uint32_t* node_index_to_buffer_index;
+		glm::uvec2 map_origin;
+
+		glm::vec2* quadtree_minmax;
+
+		glm::vec2 node_size;
+
+		const float quadtree_shift_distance = 100.0f;
+	};
+
+	// A CPU terrain with its own quadtree, node buffer and threads.
+	// Several can exist at once, nothing writable is shared between them
+	class Terrain
+	{
+	public:
+		// Starts thread_count threads for triangulation, or one per hardware thread if 0
+		Terrain(uint32_t thread_count = 0);
+		~Terrain();
+
+		Terrain(const Terrain&) = delete;
+		Terrain& operator=(const Terrain&) = delete;
+
+		// Number of threads used by triangulate(), including the calling thread
+		uint32_t get_thread_count() const;
+
+		// For a node at the given position, return its index into m_buffer
+		uint32_t get_offset(uint32_t node_x, uint32_t node_z);
+
+		// Shifts the quadtree if required
+		void shift_quadtree(glm::vec3 camera_pos);
+
+		// Index into quadtree.node_index_to_buffer_index of the node at x, y in the quadtree
+		uint32_t get_map_index(uint32_t x, uint32_t y) const;
+
+		void triangulate();
+
+		void clear_terrain();
+
+		void process_triangles(const glm::mat4& vp, float em_threshold, float area_multiplier, float curvature_multiplier);
+
+		// Gathers visible nodes and generates terrain for new ones. Returns true if any node was generated
+		bool intersect(Frustum& frustum, glm::vec3 camera_pos);
+
+		void intersect(Frustum& frustum, AabbXZ aabb, uint32_t level, uint32_t x, uint32_t y);
+
+		// Returns the number of triangles in all active nodes
+		uint64_t get_triangle_count();
+
+		// True if the node is in the quadtree, false if it is free or in the node cache
+		bool is_node_active(uint32_t node_index) const;
+
+		// Checks that every index of the nodes in the quadtree is under the node's vertex count, that neighbouring
+		// triangles point at each other over the same edge and that border triangles are in range. If not, returns
+		// false and describes the first problem in error. Goes over every triangle, so it is only for tests
+		bool check_mesh(std::string& error) const;
+
+		Statistics get_statistics() const;
+
+		void reset_statistics();
+
+		// Bytes the arrays of all nodes may take together. Refinement that needs more is discarded like it
+		// was when nodes had fixed size arrays
+		void set_memory_budget(uint64_t bytes);
+
+		// Normal of the detailed terrain at position, with y up as in the terrain shader. step is the distance to
+		// the heights the shader finds it from, which the analytic derivative mode does not need
+		glm::vec3 get_normal(glm::vec2 position, float step) const;
+
+		// Bytes taken by the arrays of all nodes
+		uint64_t get_memory_used() const;
+
+		// Bytes the arrays of all nodes are carved from, the used bytes and the free space between them
+		uint64_t get_memory_reserved() const;
+
+		// Number of nodes that left the quadtree to keep, so they do not have to be generated and refined again if
+		// the camera comes back. At most TERRAIN_NODE_CACHE_SIZE. Cached nodes count towards the memory budget,
+		// but are dropped, least recently used first, when a new node does not fit
+		void set_node_cache_size(uint32_t count);
+		uint32_t get_node_cache_size() const;
+
+		// Writes the nodes that leave the quadtree, and the nodes in it on clear_terrain() and destruction, to tiles in
+		// directory, and reads nodes entering the quadtree from their tile instead of generating them.
+		// Tiles are keyed by the node size and the error parameters given here, which should be the ones passed to
+		// process_triangles(). directory has to exist, an empty one turns the tile cache off
+		void set_tile_cache(const std::string& directory, float em_threshold, float area_multiplier, float curvature_multiplier);
+
+		// Max number of new points each node inserts per call to triangulate()
+		int vertices_per_refine = 1;
+
+		// If not 0, triangulate() stops inserting points when the next insertion, timed by the ones before it, would
+		// take it over this many milliseconds. The points that are left are inserted by the next calls, starting from
+		// the colour class it stopped in. Each call inserts at least one point per node of the first colour class
+		float refine_time_budget = 0.0f;
+
+		// If not 0, the next triangulate() inserts at most this many new points over all nodes. Points left from
+		// earlier calls count first. If the rest goes over, each processed node offers the vertices_per_refine
+		// points with the largest errors, process_triangles() keeps the ones with the largest errors over all
+		// nodes, and the others are found again by later calls
+		uint32_t refine_point_budget = 0;
+
+		// If not -1, only this node is processed and triangulated
+		int refine_node = -1;
+
+		// If true, colour classes with fewer nodes than threads find the cavities of each node's points in rounds
+		// spread over all threads, instead of one node per thread. The mesh is the same either way
+		bool batched_insertion = false;
+
+		// Curvatures of new points and get_normal() use derivatives found this way
+		DERIVATIVE_MODE derivative_mode = DERIVATIVE_MODE::FILTERED;
+
+		// If true, process_triangles() keeps the screen space error of each triangle and only measures the triangles
+		// created since the last call. All of them are measured again once an element of vp is more than
+		// error_cache_tolerance away from the one they were measured with, or another error parameter changed.
+		// Until then a node is refined as seen from the view it was last measured from
+		bool error_cache = true;
+		float error_cache_tolerance = 0.0f;
+
+		// If true, process_triangles() removes the vertices of a node whose triangles would all have errors under
+		// decimation_hysteresis * em_threshold without them, on every decimation_interval:th time it measures the node's
+		// errors from a new view. Nodes take turns, so a moving camera decimates a share of them each frame.
+		// Vertices whose triangles or their neighbours touch the node's border are kept
+		bool decimation = false;
+		float decimation_hysteresis = 0.5f;
+		uint32_t decimation_interval = 8;
+
+		// If true, new points found by process_triangles() are inserted in spatially coherent rounds, see InsertionOrder.
+		// Otherwise they are inserted in the reverse order of their triangles
+		bool spatial_insertion_order = true;
+
+		Quadtree quadtree;
+		TerrainBuffer* terrain_buffer;
+
+	private:
+		// Scratch memory of the thread calling the public functions
+		TriangulationContext& caller_context();
+
+		bool is_internal(uint32_t node_index, uint32_t connection_index);
+		void g_remove_old_triangles(TriangulationContext& ctx, uint32_t node_index);
+		void generate_triangulate_shader(TriangulationContext& ctx, uint32_t node_index);
+		void add_border_point(uint32_t self_node_index, glm::vec4 point);
+		void g_remove_marked_triangles(TriangulationContext& ctx, uint32_t node_index);
+		void g_remove_marked_triangles2(TriangulationContext& ctx, uint32_t node_index);
+		bool is_same_edge(glm::vec4 e1p1, glm::vec4 e1p2, glm::vec3 test_middle, glm::vec4 e2p1, glm::vec4 e2p2, glm::vec3 neighbour_middle,
+			uint32_t neighbour_node_index, uint32_t neighbour_border_index, bool& found_matching_edge);
+		void generate_shader(TriangulationContext& ctx, uint32_t node_index, glm::vec2 min, glm::vec2 max);
+
+		// Adds the node to processing, if it can get new points
+		void add_process_node(uint32_t node_index);
+
+		// Adds the ranges of the triangles of processing->nodes[process_node_index] to processing
+		void add_triangle_ranges(uint32_t process_node_index);
+
+		// Finds the new points of the triangles of range, up to max_new_normal_points, measuring the errors that are
+		// not in the node's ErrorCache
+		void triangle_process_shader(TriangulationContext& ctx, float threshold, TriangleRange& range);
+
+		// True if an insertion taking as long as the recent ones of ctx would end after triangulate() used up refine_time_budget
+		bool out_of_refine_time(const TriangulationContext& ctx) const;
+
+		// If the processed nodes would insert more points next than refine_point_budget has left, keeps the ones
+		// with the largest errors and drops the others
+		void spend_point_budget();
+
+		// Removes the vertices of a node that are not needed from the view of its ErrorCache, see decimation, and
+		// compacts the ones that are left. Only for a view the node has no errors for yet
+		void decimate_node(TriangulationContext& ctx, uint32_t node_index, float threshold);
+
+		// Fills ctx.star with the triangles around vertex, found from one of them, and the triangulation that replaces
+		// them. Returns false if the vertex has to stay because its triangles or their neighbours reach the node border,
+		// because the triangles are too many, or because the new triangles would not all belong to the node
+		bool find_vertex_star(TriangulationContext& ctx, uint32_t node_index, uint32_t vertex, uint32_t triangle);
+
+		// Replaces the triangles of ctx.star with its new triangles. The vertex keeps its slot, unused,
+		// until decimate_node compacts the vertices
+		void remove_vertex(TriangulationContext& ctx, uint32_t node_index, uint32_t vertex);
+
+		// Moves the last triangle of a node into the slot of triangle, which nothing may point to any more
+		void remove_triangle_slot(uint32_t node_index, uint32_t triangle);
+
+		// Forgets the errors cached for a node, for when it is generated or loaded
+		void reset_error_cache(uint32_t node_index);
+
+		// Writes the new points of range the node takes to its new_points, with their curvature
+		void write_range_points(TriangleRange& range);
+
+		void replace_connection_index(uint32_t node_index, uint32_t triangle_to_check, uint32_t index_to_replace, uint32_t new_value);
+		void remove_old_triangles(TriangulationContext& ctx);
+
+		// Fills ctx.ltg with the buffer indices of the node and its neighbours
+		void find_neighbours(TriangulationContext& ctx, uint32_t node_index);
+
+		// Inserts new point n of the node. Returns false if a node was too full, which ends the refinement of the node
+		bool insert_point(TriangulationContext& ctx, uint32_t node_index, uint32_t n);
+
+		// Adds a triangle of the node at local_owner_index in ctx.ltg to the cavity in ctx. Returns false if the
+		// cavity has too many triangles
+		bool add_cavity_triangle(TriangulationContext& ctx, uint32_t local_owner_index, uint32_t triangle_index);
+
+		// Replaces the cavity in ctx with triangles fanning out from point, the rest of insert_point
+		bool fill_cavity(TriangulationContext& ctx, uint32_t node_index, glm::vec4 point);
+
+		void triangulate_shader(TriangulationContext& ctx, uint32_t node_index);
+
+		// Finds the cavity of new point n the way insert_point would, without changing the node
+		void find_cavity(TriangulationContext& ctx, uint32_t node_index, uint32_t n, BatchCavity& cavity);
+
+		// Does the same as triangulate_shader and makes the same mesh, but finds the cavities of the points in parallel
+		// on thread_pool and fills in the ones that do not overlap without searching for them again
+		void triangulate_batched(uint32_t node_index);
+
+		// Relists every border triangle of a node in its grid
+		void rebuild_border_grid(uint32_t node_index);
+
+		// Curvature at each of the count positions (x[i], z[i]), the way derivative_mode asks for
+		void find_curvatures(const float* x, const float* z, uint32_t count, float* results) const;
+
+		// Makes sure the arrays of a node have room for the given number of triangles, vertices and border triangles,
+		// at least doubling those that are too small. Returns false and leaves the node as it is if that would
+		// go over the memory budget
+		bool reserve_node(uint32_t node_index, uint32_t triangle_count, uint32_t vertex_count, uint32_t border_count);
+
+		// Same as reserve_node for the new points of a node
+		bool reserve_new_points(uint32_t node_index, uint32_t count);
+
+		// Gives the arrays of a node back to the arena, for when the node leaves the quadtree
+		void release_node(uint32_t node_index);
 
-	void destroy();
+		// Releases the arrays and the slot of a node
+		void free_node(uint32_t node_index);
 
-	void run(DebugDrawer& dd, Camera& main_camera, Camera& current_camera, Window& window, bool show_imgui);
+		// Position of the quadtree node at x, y in whole node sizes from the origin
+		glm::ivec2 get_node_position(uint32_t x, uint32_t y) const;
 
-	// Finds a free chunk in m_buffer and returns it index, or INVALID if none was found
-	uint32_t find_chunk();
+		// Fills serials with the serials of the eight neighbours of the node at position, in the quadtree or in the node cache
+		void get_neighbour_serials(glm::ivec2 position, uint64_t* serials) const;
 
-	// For a node at the given position, return its index into m_buffer
-	uint32_t get_offset(uint32_t node_x, uint32_t node_z);
+		// Moves the quadtree one node along x (axis 0) or z (axis 1), in the positive direction if direction is 1
+		// and the negative if it is -1
+		void shift_quadtree(uint32_t axis, int direction);
 
-	// Get offset for indices for index i in m_buffer
-	uint64_t get_index_offset_of_node(uint32_t i);
+		// Moves the quadtree node at x, y into the node cache, which might free the least recently cached node
+		void cache_node(uint32_t x, uint32_t y);
 
-	// Get offset for indices for index i in m_buffer
-	uint64_t get_vertex_offset_of_node(uint32_t i);
+		// Writes every node in the quadtree to the tile cache, if there is one
+		void save_tiles();
 
-	// Get offset for indices for index i in m_buffer
-	uint64_t get_offset_of_node(uint32_t i);
+		// Fills a node reserved for the tile last read into tile
+		void load_tile(uint32_t node_index, glm::vec2 min, glm::vec2 max);
 
-	// Shifts the quadtree if required
-	void shift_quadtree(glm::vec3 camera_pos);
+		// Holds the arrays of every node in terrain_buffer
+		MeshArena* mesh_arena;
 
-	void generate_shader(uint32_t node_index, glm::vec2 min, glm::vec2 max);
-	void triangle_process_shader(glm::mat4 vp,
-		glm::vec4 camera_position,
-		glm::vec2 screen_size,
-		float threshold,
-		float area_multiplier,
-		float curvature_multiplier,
-		uint32_t node_index);
+		NodeCache* node_cache;
 
-	void triangulate();
+		// Every generated node gets a new serial, so a cached node can tell if a neighbour was generated while it was away
+		uint64_t* node_serials;
+		uint64_t next_node_serial = 1;
 
-	void triangulate_shader(uint32_t node_index);
+		// Refined nodes on disk, or nullptr. tile holds the last tile read
+		TileCache* tile_cache;
+		Tile* tile;
 
-	void replace_connection_index(uint32_t node_index, uint32_t triangle_to_check, uint32_t index_to_replace, uint32_t new_value);
+		ThreadPool* thread_pool;
 
-	void clear_terrain();
+		// One per thread of thread_pool, indexed by the thread index handed out by parallel_for
+		TriangulationContext* contexts;
 
-	void process_triangles(Camera& camera, Window& window, float em_threshold, float area_multiplier, float curvature_multiplier);
+		InsertionBatch* batch;
 
-	void draw_terrain(Frustum& frustum, DebugDrawer& dd, Camera& camera, Window& window);
+		// When the current call to triangulate() has to stop, and the colour class the next call starts from.
+		// Only nodes of the first colour class of a call insert a point after the deadline
+		std::chrono::steady_clock::time_point refine_deadline;
+		uint32_t next_colour_class = 0;
+		bool first_colour_class;
 
-	void intersect(Frustum& frustum, DebugDrawer& dd, glm::vec3 camera_pos);
+		TriangleProcessing* processing;
 
-	void intersect(Frustum& frustum, DebugDrawer& dd, AabbXZ aabb, uint32_t level, uint32_t x, uint32_t y);
+		// Border triangles of each chunk of terrain_buffer by circumcircle, kept in step with border_triangle_indices
+		BorderGrid* border_grids;
 
-	int intersect_triangle(glm::vec3 r_o, glm::vec3 r_d, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, float* t);
-}
\ No newline at end of file
+		// Errors of the triangles of each chunk of terrain_buffer, see error_cache
+		ErrorCache* error_caches;
+	};
+}
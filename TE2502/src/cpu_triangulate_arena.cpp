@@ -0,0 +1,189 @@
+#include "cpu_triangulate_arena.hpp"
+
+#include <algorithm>
+#include <new>
+
+namespace cputri
+{
+	namespace
+	{
+		// Chunks are aligned to their size, so the buddy of a block is found from its offset in the chunk
+		const std::align_val_t chunk_alignment = std::align_val_t(MeshArena::chunk_size);
+
+		// Block sizes from min_block_size up to chunk_size, larger blocks are not kept on free lists
+		const uint32_t size_class_count = 64 - 8;
+	}
+
+	MeshArena::MeshArena(uint64_t budget)
+		: m_budget(budget), m_free_blocks(size_class_count)
+	{
+	}
+
+	MeshArena::~MeshArena()
+	{
+		for (char* chunk : m_chunks)
+		{
+			::operator delete(chunk, chunk_alignment);
+		}
+	}
+
+	void* MeshArena::allocate(uint64_t size)
+	{
+		const uint64_t block_size = get_block_size(size);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_used + block_size > m_budget)
+			return nullptr;
+
+		if (block_size > chunk_size)
+		{
+			char* block = allocate_chunk(block_size);
+			m_used += block_size;
+			return block;
+		}
+
+		// The smallest free block that fits, or a new chunk
+		uint64_t found_size = block_size;
+		while (found_size <= chunk_size && m_free_blocks[get_size_class(found_size)].empty())
+		{
+			found_size *= 2;
+		}
+
+		char* block;
+		if (found_size > chunk_size)
+		{
+			found_size = chunk_size;
+			block = allocate_chunk(chunk_size);
+		}
+		else
+		{
+			std::set<char*>& free_blocks = m_free_blocks[get_size_class(found_size)];
+			block = *free_blocks.begin();
+			free_blocks.erase(free_blocks.begin());
+		}
+
+		// The upper halves of a larger block are left free
+		while (found_size > block_size)
+		{
+			found_size /= 2;
+			m_free_blocks[get_size_class(found_size)].insert(block + found_size);
+		}
+
+		m_used += block_size;
+		return block;
+	}
+
+	void MeshArena::release(void* block, uint64_t size)
+	{
+		if (!block)
+			return;
+
+		uint64_t block_size = get_block_size(size);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_used -= block_size;
+
+		if (block_size > chunk_size)
+		{
+			free_chunk((char*)block, block_size);
+			return;
+		}
+
+		char* merged = (char*)block;
+		while (block_size < chunk_size)
+		{
+			const uintptr_t chunk_offset = (uintptr_t)merged & (chunk_size - 1);
+			char* buddy = merged - chunk_offset + (chunk_offset ^ block_size);
+
+			std::set<char*>& free_blocks = m_free_blocks[get_size_class(block_size)];
+			const auto it = free_blocks.find(buddy);
+			if (it == free_blocks.end())
+				break;
+
+			free_blocks.erase(it);
+			merged = std::min(merged, buddy);
+			block_size *= 2;
+		}
+
+		if (block_size == chunk_size)
+			free_chunk(merged, chunk_size);
+		else
+			m_free_blocks[get_size_class(block_size)].insert(merged);
+	}
+
+	uint64_t MeshArena::get_block_size(uint64_t size)
+	{
+		uint64_t block_size = min_block_size;
+		while (block_size < size)
+		{
+			block_size *= 2;
+		}
+
+		return block_size;
+	}
+
+	uint64_t MeshArena::get_used() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_used;
+	}
+
+	uint64_t MeshArena::get_reserved() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_reserved;
+	}
+
+	uint64_t MeshArena::get_budget() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_budget;
+	}
+
+	void MeshArena::set_budget(uint64_t budget)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_budget = budget;
+	}
+
+	uint32_t MeshArena::get_size_class(uint64_t size)
+	{
+		uint32_t size_class = 0;
+		while ((min_block_size << size_class) < size)
+		{
+			++size_class;
+		}
+
+		return size_class;
+	}
+
+	char* MeshArena::allocate_chunk(uint64_t size)
+	{
+		if (size == chunk_size && m_spare_chunk)
+		{
+			char* chunk = m_spare_chunk;
+			m_spare_chunk = nullptr;
+			return chunk;
+		}
+
+		char* chunk = (char*)::operator new(size, chunk_alignment);
+		m_chunks.push_back(chunk);
+		m_reserved += size;
+		return chunk;
+	}
+
+	void MeshArena::free_chunk(char* chunk, uint64_t size)
+	{
+		if (size == chunk_size && !m_spare_chunk)
+		{
+			m_spare_chunk = chunk;
+			return;
+		}
+
+		m_chunks.erase(std::find(m_chunks.begin(), m_chunks.end(), chunk));
+		m_reserved -= size;
+		::operator delete(chunk, chunk_alignment);
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace cputri
+{
+	// Shared memory for the variable sized arrays of all nodes of a Terrain. Blocks are powers of two from
+	// min_block_size bytes, split from chunks of chunk_size bytes and kept on one free list per size after they are
+	// released, so nodes can grow and shrink without fragmenting the heap. A released block is merged with its free
+	// buddy, the other half of the block they were split from, and chunks that are free again go back to the heap.
+	// Blocks larger than a chunk get memory of their own. The bytes in blocks handed out never go over the budget
+	class MeshArena
+	{
+	public:
+		static const uint64_t min_block_size = 256;
+		static const uint64_t chunk_size = 1 << 20;
+
+		MeshArena(uint64_t budget);
+		~MeshArena();
+
+		MeshArena(const MeshArena&) = delete;
+		MeshArena& operator=(const MeshArena&) = delete;
+
+		// Returns a block of at least size bytes aligned to 64 bytes, or nullptr if it would take the bytes
+		// in use over the budget. Thread safe
+		void* allocate(uint64_t size);
+
+		// Gives back a block returned by allocate for the same size. Thread safe
+		void release(void* block, uint64_t size);
+
+		// Size of the block allocate returns for size bytes
+		static uint64_t get_block_size(uint64_t size);
+
+		// Bytes in blocks handed out and not released
+		uint64_t get_used() const;
+
+		// Bytes taken from the heap, the used bytes, the free blocks of chunks that are partly used and the spare chunk
+		uint64_t get_reserved() const;
+
+		uint64_t get_budget() const;
+
+		// Blocks already handed out are kept even if they go over a lower budget
+		void set_budget(uint64_t budget);
+
+	private:
+		// Index of the free list of blocks of size bytes, which must be a block size
+		static uint32_t get_size_class(uint64_t size);
+
+		// Takes size bytes from the heap, aligned to chunk_size
+		char* allocate_chunk(uint64_t size);
+		void free_chunk(char* chunk, uint64_t size);
+
+		mutable std::mutex m_mutex;
+
+		uint64_t m_budget;
+		uint64_t m_used = 0;
+		uint64_t m_reserved = 0;
+
+		// Ordered by address, so blocks are taken from the start of the chunks and the chunks at the end empty first
+		std::vector<std::set<char*>> m_free_blocks;
+
+		// Every chunk and large block taken from the heap and not given back
+		std::vector<char*> m_chunks;
+
+		// One chunk that became free is kept for the next one needed, so a node that grows and shrinks around
+		// a chunk boundary does not take it from the heap and give it back over and over
+		char* m_spare_chunk = nullptr;
+	};
+}
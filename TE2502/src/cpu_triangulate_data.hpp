@@ -0,0 +1,475 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpu_triangulate.hpp"
+#include "cpu_triangulate_arena.hpp"
+#include "cpu_triangulate_grid.hpp"
+#include "cpu_triangulate_node_cache.hpp"
+#include "cpu_triangulate_order.hpp"
+#include "cpu_triangulate_simd.hpp"
+#include "cpu_triangulate_tile_cache.hpp"
+
+// Buffer layout and scratch memory of the CPU triangulator. Mirrors terrain_buffer.include so the kernels
+// in cpu_triangulate.cpp can be written like the compute shaders, except that the arrays of a node are allocated
+// from a MeshArena and grow on demand instead of having a fixed size. Only included by cputri sources,
+// since the defines clash with the ones in quadtree.hpp.
+
+namespace cputri
+{
+	typedef uint32_t uint;
+
+	#define TERRAIN_GENERATE_TOTAL_SIDE_LENGTH 1000
+	// Nodes in the quadtree plus the most nodes the node cache can hold
+	#define TERRAIN_GENERATE_NUM_NODES ((1 << QUADTREE_LEVELS) * (1 << QUADTREE_LEVELS) + TERRAIN_NODE_CACHE_SIZE)
+	#define TERRAIN_NODE_CACHE_SIZE 8
+	#define TERRAIN_GENERATE_GRID_SIDE 3
+	#define TRIANGULATE_MAX_NEW_POINTS 1024
+	#define QUADTREE_LEVELS 2
+	#define ADJUST_PERCENTAGE 0.35f
+
+	// Capacity of the arrays of a newly generated node, they double whenever they run out
+	#define NODE_INITIAL_TRIANGLE_CAPACITY 64
+	#define NODE_INITIAL_VERTEX_CAPACITY 32
+	#define NODE_INITIAL_BORDER_CAPACITY 32
+	#define NODE_INITIAL_NEW_POINTS_CAPACITY 16
+
+	// Default bytes the arrays of all nodes may take together
+	#define TERRAIN_MEMORY_BUDGET (16ull << 20)
+
+	#define WORK_GROUP_SIZE 1
+
+	// If 1, vertex positions and circumcircles are stored as one array per component
+	// instead of as vec4s and Triangles, so loops over them read contiguous floats
+	#define TERRAIN_SOA_LAYOUT 0
+
+	struct Triangle
+	{
+		glm::vec2 circumcentre;
+		float circumradius2;
+		uint pad;
+	};
+
+	// Array of a node in a block of the MeshArena, indexed like the fixed size arrays of the shaders.
+	// Only valid until the node's capacity changes
+	template<typename T>
+	struct NodeArray
+	{
+		T* elements = nullptr;
+
+		T& operator[](uint i) { return elements[i]; }
+		const T& operator[](uint i) const { return elements[i]; }
+
+		T* data() { return elements; }
+		const T* data() const { return elements; }
+	};
+
+	struct TerrainData
+	{
+		uint index_count;
+		uint instance_count;
+		uint first_index;
+		int  vertex_offset;
+		uint first_instance;
+
+		// struct BufferNodeHeader {
+		uint vertex_count;
+		uint new_points_count;
+		uint pad;
+
+		glm::vec2 min;
+		glm::vec2 max;
+
+		uint border_count;
+		NodeArray<uint> border_triangle_indices;
+		// }
+
+		// Number of triangles, vertices, border triangles and new points the arrays have room for,
+		// see Terrain::reserve_node and Terrain::reserve_new_points
+		uint triangle_capacity;
+		uint vertex_capacity;
+		uint border_capacity;
+		uint new_points_capacity;
+
+		// The arrays sized by each capacity share one block, see Terrain::reserve_node
+		NodeArray<uint> indices;
+#if TERRAIN_SOA_LAYOUT
+		NodeArray<float> position_x;
+		NodeArray<float> position_y;
+		NodeArray<float> position_z;
+		NodeArray<float> curvature;
+		NodeArray<float> circumcentre_x;
+		NodeArray<float> circumcentre_y;
+		NodeArray<float> circumradius2;
+#else
+		NodeArray<glm::vec4> positions;
+		NodeArray<Triangle> triangles;
+#endif
+		NodeArray<uint> triangle_connections;
+		NodeArray<glm::vec4> new_points;
+
+		// Position of vertex i, with curvature in w
+		glm::vec4 get_position(uint i) const
+		{
+#if TERRAIN_SOA_LAYOUT
+			return glm::vec4(position_x[i], position_y[i], position_z[i], curvature[i]);
+#else
+			return positions[i];
+#endif
+		}
+
+		void set_position(uint i, glm::vec4 position)
+		{
+#if TERRAIN_SOA_LAYOUT
+			position_x[i] = position.x;
+			position_y[i] = position.y;
+			position_z[i] = position.z;
+			curvature[i] = position.w;
+#else
+			positions[i] = position;
+#endif
+		}
+
+		glm::vec2 get_circumcentre(uint triangle) const
+		{
+#if TERRAIN_SOA_LAYOUT
+			return glm::vec2(circumcentre_x[triangle], circumcentre_y[triangle]);
+#else
+			return triangles[triangle].circumcentre;
+#endif
+		}
+
+		float get_circumradius2(uint triangle) const
+		{
+#if TERRAIN_SOA_LAYOUT
+			return circumradius2[triangle];
+#else
+			return triangles[triangle].circumradius2;
+#endif
+		}
+
+		// Circumcircles in the form taken by the batch kernels
+		CircumcircleArrays get_circumcircles() const
+		{
+#if TERRAIN_SOA_LAYOUT
+			return CircumcircleArrays{ circumcentre_x.data(), circumcentre_y.data(), circumradius2.data(), 1 };
+#else
+			return CircumcircleArrays{ &triangles[0].circumcentre.x, &triangles[0].circumcentre.y, &triangles[0].circumradius2, sizeof(Triangle) / sizeof(float) };
+#endif
+		}
+
+		void set_circumcircle(uint triangle, glm::vec2 circumcentre, float radius2)
+		{
+#if TERRAIN_SOA_LAYOUT
+			circumcentre_x[triangle] = circumcentre.x;
+			circumcentre_y[triangle] = circumcentre.y;
+			circumradius2[triangle] = radius2;
+#else
+			triangles[triangle].circumcentre = circumcentre;
+			triangles[triangle].circumradius2 = radius2;
+#endif
+		}
+	};
+
+	const uint quadtree_data_size = (1 << QUADTREE_LEVELS) * (1 << QUADTREE_LEVELS) + 4;
+	const uint pad_size = 16 - (quadtree_data_size % 16);
+
+	struct TerrainBuffer
+	{
+		std::array<uint, (1 << QUADTREE_LEVELS) * (1 << QUADTREE_LEVELS)> quadtree_index_map;
+		glm::vec2 quadtree_min;
+		glm::vec2 quadtree_max;
+		std::array<uint, pad_size> pad;
+		std::array<TerrainData, TERRAIN_GENERATE_NUM_NODES> data;
+	};
+
+
+	const uint INVALID = ~0u;
+
+	const uint num_nodes = TERRAIN_GENERATE_NUM_NODES;
+	const uint num_new_points = TRIANGULATE_MAX_NEW_POINTS;
+	const uint max_new_normal_points = TRIANGULATE_MAX_NEW_POINTS / WORK_GROUP_SIZE;
+	const uint quadtree_levels = QUADTREE_LEVELS;
+
+	struct GenerateEdge
+	{
+		glm::vec4 p1;
+		glm::vec4 p2;
+		uint p1_index;
+		uint p2_index;
+		uint connection;
+		uint old_triangle_index;
+		uint future_index;
+		uint pad[3];
+	};
+
+	struct BorderEdge
+	{
+		glm::vec4 p1;
+		glm::vec4 p2;
+		uint p1_index;
+		uint p2_index;
+		uint node_index; // Local node format
+		uint connection;
+		uint old_triangle_index;
+		uint future_index;
+		uint pad[2];
+	};
+
+	const uint max_border_edges = 100;
+	const uint max_triangles_to_remove = 100;
+
+	// Triangles whose new points have their heights evaluated together in triangle processing
+	#define REFINE_BATCH_SIZE 256
+
+	// Triangles per task of Terrain::process_triangles, larger nodes are split so several threads test their triangles
+	#define TRIANGLE_PROCESS_RANGE_SIZE 4096
+
+	// Walks locate_point tries from triangles spread over the node, after the walk from the newest triangle
+	#define LOCATE_EXTRA_WALKS 4
+
+	#define NUM_NEW_TRIANGLE_INDICES 30
+	#define TEST_TRIANGLE_BUFFER_SIZE 50
+
+	// Hash table over the edges of the triangles removed for one point, keyed by the edge's end points.
+	// An edge found twice lies inside the cavity, the others make up its boundary
+	struct CavityEdgeTable
+	{
+		// Power of two, at least twice the number of edges
+		static const uint size = 1024;
+
+		// Slot of every edge looked up since the last count
+		uint edge_slots[max_border_edges * 3];
+
+		// First edge stored in a slot and how many edges have the same end points
+		uint slot_edges[size];
+		uint slot_counts[size];
+
+		// A slot is only in use if its stamp matches stamp, so the table never has to be cleared
+		uint slot_stamps[size] = {};
+		uint stamp = 0;
+	};
+
+	// Triangle that gets a new point if the screen space error at the point is large enough, see Terrain::triangle_process_shader
+	struct RefineCandidate
+	{
+		uint triangle;
+		float area;
+		glm::vec3 new_pos;
+		glm::vec3 curv_point;
+	};
+
+	// Most triangles around a vertex that decimation removes
+	#define DECIMATE_MAX_STAR_TRIANGLES 16
+
+	// Triangles around a vertex, and the Delaunay triangulation of the polygon they make up that replaces them
+	// if the vertex is removed, see Terrain::find_vertex_star
+	struct VertexStar
+	{
+		// Triangles in order around the vertex. Triangle i has the polygon edge from corners[i] to corners[i + 1]
+		uint triangle_count;
+		uint triangles[DECIMATE_MAX_STAR_TRIANGLES];
+		uint corners[DECIMATE_MAX_STAR_TRIANGLES];
+
+		// Triangle on the other side of each polygon edge, and which of its connections points back
+		uint outer[DECIMATE_MAX_STAR_TRIANGLES];
+		uint outer_sides[DECIMATE_MAX_STAR_TRIANGLES];
+
+		// triangle_count - 2 triangles as indices into corners, wound like the node's triangles
+		uint new_triangles[DECIMATE_MAX_STAR_TRIANGLES - 2][3];
+	};
+
+	// Scratch memory of one thread running the kernels, stands in for the shaders' shared memory.
+	// Every thread of a Terrain has its own, so nodes can be processed at the same time
+	struct TriangulationContext
+	{
+		// Generation and triangulation
+		std::array<GenerateEdge, max_border_edges * 3> s_generate_edges;
+		std::array<uint, max_triangles_to_remove> s_triangles_to_remove;
+		uint s_triangles_removed;
+		uint s_new_triangle_count;
+		uint s_valid_indices[max_triangles_to_remove];
+
+		uint g_new_triangle_indices[NUM_NEW_TRIANGLE_INDICES];
+		uint g_new_triangle_index_count;
+
+		uint seen_triangles[TEST_TRIANGLE_BUFFER_SIZE];
+		uint seen_triangle_count;
+		uint triangles_to_test[TEST_TRIANGLE_BUFFER_SIZE];
+		uint test_count;
+
+		// Triangulation across node borders
+		std::array<BorderEdge, max_border_edges * 3> s_edges;
+		std::array<uint, max_triangles_to_remove> s_owning_node;
+
+		// Convert local node format to global
+		uint ltg[9];
+
+		uint seen_triangle_owners[TEST_TRIANGLE_BUFFER_SIZE]; // Local node format
+		uint test_triangle_owners[TEST_TRIANGLE_BUFFER_SIZE]; // Local node format
+
+		uint new_triangle_indices[9 * NUM_NEW_TRIANGLE_INDICES];
+		uint new_triangle_index_count[9];
+
+		// Finds the shared edges of a cavity
+		CavityEdgeTable cavity_edges;
+
+		// Border triangles whose circumcircle contains the point being inserted, sized to the candidates tested
+		std::vector<uint> border_hits;
+
+		// Triangle processing, triangles that might get a new point and the positions of their new points to evaluate in one batch
+		std::vector<RefineCandidate> refine_candidates;
+		std::array<float, REFINE_BATCH_SIZE> candidate_x;
+		std::array<float, REFINE_BATCH_SIZE> candidate_z;
+		std::array<float, REFINE_BATCH_SIZE> candidate_heights;
+		InsertionOrder insertion_order;
+
+		// Decimation, a triangle of each vertex of the node, or INVALID if the vertex was removed. Then the index each
+		// vertex is moved to
+		std::vector<uint> vertex_triangles;
+		VertexStar star;
+
+		// Set when a node of the current colour class stopped at Terrain::refine_time_budget with points left
+		bool out_of_time;
+
+		// Moving average of the time insert_point took, while there is a refine_time_budget
+		std::chrono::steady_clock::duration insertion_time{};
+
+		// Counters added up by Terrain::get_statistics()
+		Statistics statistics;
+	};
+
+	#define MAX_BATCH_CAVITY_TRIANGLES 32
+
+	// Bowyer-Watson cavity of a new point, found without changing the node
+	struct BatchCavity
+	{
+		// False if the point has to go through Terrain::insert_point instead. That is the case if the point is not in
+		// its start triangle, or if the cavity reaches a node border, would move triangles to a neighbour or is too large
+		bool batchable;
+
+		// Triangles whose circumcircle contains the point, in the order Terrain::insert_point finds them
+		uint triangle_count;
+		std::array<uint, MAX_BATCH_CAVITY_TRIANGLES> triangles;
+
+		// The triangles and their neighbours, every triangle the search tested
+		uint tested_count;
+		std::array<uint, TEST_TRIANGLE_BUFFER_SIZE> tested;
+	};
+
+	// Scratch memory of Terrain::triangulate_batched
+	struct InsertionBatch
+	{
+		// New points of the node not inserted yet, in the order triangulate_shader would insert them
+		std::vector<uint> points;
+		std::vector<BatchCavity> cavities;
+
+		// Index into points of the points whose cavity is filled in without searching for it again this round
+		std::vector<uint> accepted;
+
+		// The first point whose cavity overlapped an accepted one or came after a serial point, and the points after
+		// it. They are tried again next round
+		std::vector<uint> retry;
+
+		// Points after the accepted ones that are inserted one at a time with Terrain::insert_point
+		std::vector<uint> serial;
+
+		// Round in which each triangle slot was last tested by an accepted cavity, sized to the node's triangle capacity
+		std::vector<uint> claims;
+
+		uint round;
+	};
+
+	// Node tested by Terrain::process_triangles
+	struct ProcessNode
+	{
+		uint node_index;
+
+		// Its ranges in TriangleProcessing::ranges
+		uint first_range;
+		uint range_count;
+	};
+
+	// Triangles [first_triangle, end_triangle) of a node, tested by one task of Terrain::process_triangles,
+	// and the new points found in them in triangle order
+	struct TriangleRange
+	{
+		uint node;  // Index into TriangleProcessing::nodes
+		uint first_triangle;
+		uint end_triangle;
+
+		uint point_count;
+		std::array<glm::vec4, max_new_normal_points + 1> new_points;
+		std::array<uint, max_new_normal_points + 1> triangle_indices;
+
+		// Where the points go in the node's new_points, and how many of them the node takes
+		uint offset;
+		uint kept_count;
+	};
+
+	// New point competing for Terrain::refine_point_budget
+	struct BudgetPoint
+	{
+		float error;
+
+		// Index into TriangleProcessing::ranges, and into the points of the range
+		uint range;
+		uint point;
+
+		// Max-heap order
+		bool operator<(const BudgetPoint& other) const { return error < other.error; }
+	};
+
+	// Scratch memory of Terrain::process_triangles
+	struct TriangleProcessing
+	{
+		std::vector<ProcessNode> nodes;
+		uint node_count;
+
+		std::vector<TriangleRange> ranges;
+		uint range_count;
+
+		// Points that the nodes left out for having points from earlier calls insert next, see Terrain::add_process_node
+		uint pending_insertions;
+
+		std::vector<BudgetPoint> budget_heap;
+	};
+
+	// Screen space error of a triangle slot, and the potential new point it was measured at
+	struct TriangleError
+	{
+		// Corners of the triangle the error is for. A triangle created in the slot, or moved into it, has other
+		// corners, so its error is dirty until it is measured again. A new slot is dirty
+		uint corners[3] = { INVALID, INVALID, INVALID };
+
+		// Negative infinity if the triangle was not visible
+		float error = 0.0f;
+
+		glm::vec3 new_point = glm::vec3(0.0f);
+	};
+
+	// Errors of the triangles of one node, reused by Terrain::process_triangles for as long as the view stays within
+	// error_cache_tolerance of the one they were measured with. Vertices never move, so neither do their errors
+	struct ErrorCache
+	{
+		// Nothing is cached until the node is processed the first time after it is generated or loaded
+		bool valid = false;
+
+		// View the errors were measured with
+		glm::mat4 vp;
+		float area_multiplier;
+		float curvature_multiplier;
+
+		// Views the errors were measured from since the node was generated or loaded, counts when to decimate it
+		uint new_views = 0;
+
+		// Clip space position of each vertex with vp
+		std::vector<glm::vec4> clip_positions;
+
+		// Indexed by triangle slot
+		std::vector<TriangleError> triangles;
+	};
+}
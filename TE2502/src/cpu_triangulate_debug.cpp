@@ -0,0 +1,297 @@
+#include "cpu_triangulate_debug.hpp"
+#include "cpu_triangulate.hpp"
+#include "cpu_triangulate_data.hpp"
+
+#include "imgui/imgui.h"
+#include <GLFW/glfw3.h>
+
+namespace cputri
+{
+	using namespace glm;
+
+	int max_points_per_refine = 9999999;
+	int vistris_start = 0;
+	int vistris_end = 99999999;
+	bool show_cc = false;
+	bool show = false;
+
+	int temp = 0;
+	int show_connections = -1;
+	int sideshow_bob = 0;
+
+	void run(Terrain& terrain, DebugDrawer& dd, Camera& main_camera, Camera& current_camera, Window& window, bool show_imgui)
+	{
+		Frustum fr = main_camera.get_frustum();
+		const bool do_triangulation = terrain.intersect(fr, main_camera.get_pos());
+
+		cputri::draw_terrain(terrain, fr, dd, current_camera, window);
+
+		static float threshold = 0.0f;
+		static float area_mult = 1.0f;
+		static float curv_mult = 1.0f;
+
+		if (show_imgui)
+		{
+			ImGui::Begin("Lol");
+			ImGui::SliderInt("Index", &temp, -1, 15);
+			ImGui::SliderInt("Vertices per refine", &terrain.vertices_per_refine, 1, 10);
+			ImGui::SliderInt("Show Connections", &show_connections, -1, 200);
+			ImGui::SliderInt("Refine Node", &terrain.refine_node, -1, TERRAIN_GENERATE_NUM_NODES - 1);
+			ImGui::SliderInt("Sideshow", &sideshow_bob, -1, 8);
+
+			ImGui::End();
+
+			ImGui::Begin("cputri");
+			if (ImGui::Button("Refine"))
+			{
+				terrain.process_triangles(main_camera.get_vp(), threshold, area_mult, curv_mult);
+				terrain.triangulate();
+			}
+			else if (do_triangulation)
+			{
+				terrain.triangulate();
+			}
+			if (ImGui::Button("Clear Terrain"))
+			{
+				terrain.clear_terrain();
+			}
+
+			ImGui::DragFloat("Area mult", &area_mult, 0.01f, 0.0f, 50.0f);
+			ImGui::DragFloat("Curv mult", &curv_mult, 0.01f, 0.0f, 50.0f);
+			ImGui::DragFloat("Threshold", &threshold, 0.01f, 0.0f, 50.0f);
+
+			ImGui::Checkbox("Show", &show);
+			ImGui::Checkbox("Show CC", &show_cc);
+
+			ImGui::DragInt("Max Points", &max_points_per_refine);
+			ImGui::DragInt("Vistris Start", &vistris_start, 0.1f);
+			ImGui::DragInt("Vistris End", &vistris_end, 0.1f);
+			ImGui::End();
+		}
+	}
+
+	const float EPSILON = 1e-5f;
+	int intersect_triangle(glm::vec3 r_o, glm::vec3 r_d, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, float * t)
+	{
+		vec3 edge1, edge2, tvec, pvec, qvec;
+		float det, inv_det, u, v;
+
+		//find vecotrs fo two edges sharing vert0
+		edge1 = p1 - p0;
+		edge2 = p2 - p0;
+
+		//begin calculationg determinant
+		pvec = cross(r_d, edge2);
+
+		//if determinant is near zero, ray lies in plane of triangle
+		det = dot(edge1, pvec);
+
+		if (det > -EPSILON && det < EPSILON)
+			return 0;
+		inv_det = 1.0f / det;
+
+		//calculate distance from vert0 to ray origin
+		tvec = r_o - p0;
+
+		u = dot(tvec, pvec) * inv_det;
+		if (u < 0.0f || u > 1.0f)
+			return 0;
+
+		//prepare to test V parameter
+		qvec = cross(tvec, edge1);
+
+		//calculate V parameter and test bounds
+		v = dot(r_d, qvec) * inv_det;
+		if (v < 0.0f || u + v > 1.0f)
+			return 0;
+
+		//calculate t, ray intersection triangle
+		*t = dot(edge2, qvec) * inv_det;
+
+		return 1;
+	}
+
+	void draw_terrain(Terrain& terrain, Frustum& frustum, DebugDrawer& dd, Camera& camera, Window& window)
+	{
+		const Quadtree& quadtree = terrain.quadtree;
+		const TerrainBuffer* terrain_buffer = terrain.terrain_buffer;
+
+		static vec3 ori;
+		static vec3 dir;
+		if (show)
+		{
+			for (size_t ii = 0; ii < num_nodes; ii++)
+			{
+				if (terrain.is_node_active((uint32_t)ii) && (ii == temp || temp == -1))
+				{
+					int hovered_triangle = -1;
+					const float height = -100.0f;
+
+
+					// If C is pressed, do ray-triangle intersection and show connection of hovered triangle
+					if (glfwGetKey(window.get_glfw_window(), GLFW_KEY_C) == GLFW_PRESS
+						&& !ImGui::GetIO().WantCaptureMouse)
+					{
+						vec3 ray_o = camera.get_pos();
+						vec3 ray_dir;
+
+						ori = ray_o;
+						
+
+						vec2 mouse_pos;
+						// Get mouse pos
+						const bool focused = glfwGetWindowAttrib(window.get_glfw_window(), GLFW_FOCUSED) != 0;
+						if (focused)
+						{
+							double mouse_x, mouse_y;
+							glfwGetCursorPos(window.get_glfw_window(), &mouse_x, &mouse_y);
+							mouse_pos = vec2((float)mouse_x, (float)mouse_y);
+						}
+
+						int w, h;
+						glfwGetWindowSize(window.get_glfw_window(), &w, &h);
+						vec2 window_size = vec2(w, h);
+						const float deg_to_rad = 3.1415f / 180.0f;
+						const float fov = camera.get_fov();	// In degrees
+						float px = 2.0f * (mouse_pos.x + 0.5f - window_size.x / 2) / window_size.x * tan(fov / 2.0f * deg_to_rad);
+						float py = 2.0f * (mouse_pos.y + 0.5f - window_size.y / 2) / window_size.y * tan(fov / 2.0f * deg_to_rad) * window_size.y / window_size.x;
+						ray_dir = vec3(px, py, 1);
+						ray_dir = normalize(vec3(inverse(camera.get_view()) * vec4(normalize(ray_dir), 0.0f)));
+
+						dir = ray_dir;
+
+						float d = 9999999999.0f;
+						float max_d = 9999999999.0f;
+
+						// Perform ray-triangle intersection
+						for (uint ind = 0; ind < terrain_buffer->data[ii].index_count; ind += 3)
+						{
+							vec3 p0 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 0])) + vec3(0.0f, height, 0.0f);
+							vec3 p1 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 1])) + vec3(0.0f, height, 0.0f);
+							vec3 p2 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 2])) + vec3(0.0f, height, 0.0f);
+
+							if (intersect_triangle(ray_o, ray_dir, p0, p1, p2, &d) && d < max_d && d >= 0.0f)
+							{
+								hovered_triangle = ind / 3;
+							}
+						}
+					}
+
+					for (uint ind = vistris_start * 3; ind < terrain_buffer->data[ii].index_count && ind < (uint)vistris_end * 3; ind += 3)
+					{
+						vec3 p0 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 0])) + vec3(0.0f, height, 0.0f);
+						vec3 p1 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 1])) + vec3(0.0f, height, 0.0f);
+						vec3 p2 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 2])) + vec3(0.0f, height, 0.0f);
+
+						vec3 mid = (p0 + p1 + p2) / 3.0f;
+
+						dd.draw_line(p0, p1, { 1, 0, 0 });
+						dd.draw_line(p1, p2, { 1, 0, 0 });
+						dd.draw_line(p2, p0, { 1, 0, 0 });
+
+						//dd.draw_line(mid, p0, { 0, 1, 0 });
+						//dd.draw_line(mid, p1, { 0, 1, 0 });
+						//dd.draw_line(mid, p2, { 0, 1, 0 });
+
+						if (show_cc || hovered_triangle == ind / 3)
+						{
+							const uint tri_index = ind / 3;
+							const uint steps = 20;
+							const float angle = 3.14159265f * 2.0f / steps;
+							for (uint jj = 0; jj < steps + 1; ++jj)
+							{
+								float cc_radius = sqrt(terrain_buffer->data[ii].get_circumradius2(tri_index));
+								vec3 cc_mid = { terrain_buffer->data[ii].get_circumcentre(tri_index).x, mid.y, terrain_buffer->data[ii].get_circumcentre(tri_index).y };
+
+								dd.draw_line(cc_mid + vec3(sinf(angle * jj) * cc_radius, 0.0f, cosf(angle * jj) * cc_radius),
+									cc_mid + vec3(sinf(angle * (jj + 1)) * cc_radius, 0.0f, cosf(angle * (jj + 1)) * cc_radius),
+									{ 0, 0, 1 });
+							}
+						}
+
+						if (show_connections == ind / 3 || hovered_triangle == ind / 3)
+						{
+							glm::vec3 h = { 0, -20, 0 };
+
+							dd.draw_line(p0 + h, p1 + h, { 1, 0, 0 });
+							dd.draw_line(p1 + h, p2 + h, { 0, 1, 0 });
+							dd.draw_line(p2 + h, p0 + h, { 0, 0, 1 });
+
+							glm::vec3 n0 = mid + h;
+							glm::vec3 n1 = mid + h;
+							glm::vec3 n2 = mid + h;
+
+							if (terrain_buffer->data[ii].triangle_connections[ind + 0] < INVALID - 10)
+							{
+								uint neighbour_ind = terrain_buffer->data[ii].triangle_connections[ind + 0];
+								n0 = (terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 0]) + 
+									  terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 1]) + 
+									  terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 2])) / 3.0f;
+								n0 += glm::vec3(0, height, 0) + h;
+							}
+							if (terrain_buffer->data[ii].triangle_connections[ind + 1] < INVALID - 10)
+							{
+								uint neighbour_ind = terrain_buffer->data[ii].triangle_connections[ind + 1];
+								n1 = (terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 0]) +
+									terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 1]) +
+									terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 2])) / 3.0f;
+								n1 += glm::vec3(0, height, 0) + h;
+							}
+							if (terrain_buffer->data[ii].triangle_connections[ind + 2] < INVALID - 10)
+							{
+								uint neighbour_ind = terrain_buffer->data[ii].triangle_connections[ind + 2];
+								n2 = (terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 0]) +
+									terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 1]) +
+									terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[neighbour_ind * 3 + 2])) / 3.0f;
+								n2 += glm::vec3(0, height, 0) + h;
+							}
+
+
+							dd.draw_line(mid + h, n0, { 1, 0, 0 });
+							dd.draw_line(mid + h, n1, { 0, 1, 0 });
+							dd.draw_line(mid + h, n2, { 0, 0, 1 });
+						}
+					}
+					//for (int tt = 0; tt < terrain_buffer->data[ii].vertex_count; ++tt)
+					//{
+					//	vec3 p = terrain_buffer->data[ii].positions[tt] + vec4(0, -100, 0, 0);
+					//	dd.draw_line(p, p + vec3(0, -50, 0), vec3(1, 0, 1));
+					//}
+
+					//vec2 min = terrain_buffer->data[ii].min;
+					//vec2 max = terrain_buffer->data[ii].max;
+					//dd.draw_line({ min.x - terrain_buffer->data[ii].border_max[3], -150, min.y }, { min.x - terrain_buffer->data[ii].border_max[3], -150, max.y }, { 1, 1, 1 });
+					//dd.draw_line({ max.x + terrain_buffer->data[ii].border_max[1], -150, min.y }, { max.x + terrain_buffer->data[ii].border_max[1], -150, max.y }, { 1, 1, 1 });
+					//dd.draw_line({ min.x, -150, max.y + terrain_buffer->data[ii].border_max[0] }, { max.x, -150, max.y + terrain_buffer->data[ii].border_max[0] }, { 1, 1, 1 });
+					//dd.draw_line({ min.x, -150, min.y - terrain_buffer->data[ii].border_max[2] }, { max.x, -150, min.y - terrain_buffer->data[ii].border_max[2] }, { 1, 1, 1 });
+
+					for (uint bt = 0; bt < terrain_buffer->data[ii].border_count; ++bt)
+					{
+						const float height = -102.0f;
+						uint ind = terrain_buffer->data[ii].border_triangle_indices[bt] * 3;
+						vec3 p0 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 0])) + vec3(0.0f, height, 0.0f);
+						vec3 p1 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 1])) + vec3(0.0f, height, 0.0f);
+						vec3 p2 = vec3(terrain_buffer->data[ii].get_position(terrain_buffer->data[ii].indices[ind + 2])) + vec3(0.0f, height, 0.0f);
+
+						if (sideshow_bob != -1 && terrain_buffer->data[ii].triangle_connections[ind + 0] == INVALID - sideshow_bob)
+						{
+							dd.draw_line(p0 - vec3{0, 2, 0}, p1 - vec3{0, 2, 0}, { 0.0f, 1.0f, 0.0f });
+						}
+						if (sideshow_bob != -1 && terrain_buffer->data[ii].triangle_connections[ind + 1] == INVALID - sideshow_bob)
+						{
+							dd.draw_line(p1 - vec3{ 0, 2, 0 }, p2 - vec3{ 0, 2, 0 }, { 0.0f, 1.0f, 0.0f });
+						}
+						if (sideshow_bob != -1 && terrain_buffer->data[ii].triangle_connections[ind + 2] == INVALID - sideshow_bob)
+						{
+							dd.draw_line(p2 - vec3{ 0, 2, 0 }, p0 - vec3{ 0, 2, 0 }, { 0.0f, 1.0f, 0.0f });
+						}
+
+						dd.draw_line(p0, p1, { 0, 0, 1 });
+						dd.draw_line(p1, p2, { 0, 0, 1 });
+						dd.draw_line(p2, p0, { 0, 0, 1 });
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "graphics/debug_drawer.hpp"
+#include "graphics/window.hpp"
+#include "camera.hpp"
+#include "cpu_triangulate.hpp"
+
+// ImGui controls and debug drawing for the CPU triangulator
+namespace cputri
+{
+	void run(Terrain& terrain, DebugDrawer& dd, Camera& main_camera, Camera& current_camera, Window& window, bool show_imgui);
+
+	void draw_terrain(Terrain& terrain, Frustum& frustum, DebugDrawer& dd, Camera& camera, Window& window);
+
+	int intersect_triangle(glm::vec3 r_o, glm::vec3 r_d, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, float* t);
+}
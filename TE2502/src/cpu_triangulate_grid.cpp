@@ -0,0 +1,147 @@
+#include "cpu_triangulate_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cputri
+{
+	void BorderGrid::reset(glm::vec2 min, glm::vec2 max)
+	{
+		m_min = min;
+		m_inverse_cell_size = glm::vec2(float(side)) / (max - min);
+
+		for (std::vector<uint32_t>& cell : m_cells)
+		{
+			cell.clear();
+		}
+
+		for (CellRect& rect : m_rects)
+		{
+			rect.entries = 0;
+		}
+	}
+
+	void BorderGrid::insert(uint32_t triangle, glm::vec2 circumcentre, float circumradius2)
+	{
+		CellRect& rect = get_entry(triangle);
+		if (rect.entries++ > 0)
+			return;
+
+		rect = get_rect(circumcentre, circumradius2);
+		rect.entries = 1;
+		add_to_cells(rect, triangle);
+	}
+
+	void BorderGrid::update(uint32_t triangle, glm::vec2 circumcentre, float circumradius2)
+	{
+		if (triangle >= m_rects.size() || m_rects[triangle].entries == 0)
+			return;
+
+		CellRect& old_rect = m_rects[triangle];
+		CellRect rect = get_rect(circumcentre, circumradius2);
+		if (rect.min_x == old_rect.min_x && rect.min_y == old_rect.min_y && rect.max_x == old_rect.max_x && rect.max_y == old_rect.max_y)
+			return;
+
+		remove_from_cells(old_rect, triangle);
+		rect.entries = old_rect.entries;
+		old_rect = rect;
+		add_to_cells(rect, triangle);
+	}
+
+	void BorderGrid::erase(uint32_t triangle)
+	{
+		if (triangle >= m_rects.size() || m_rects[triangle].entries == 0)
+			return;
+
+		if (--m_rects[triangle].entries == 0)
+			remove_from_cells(m_rects[triangle], triangle);
+	}
+
+	void BorderGrid::rename(uint32_t old_triangle, uint32_t new_triangle)
+	{
+		if (old_triangle == new_triangle || old_triangle >= m_rects.size() || m_rects[old_triangle].entries == 0)
+			return;
+
+		CellRect& new_rect = get_entry(new_triangle);
+		CellRect& old_rect = m_rects[old_triangle];
+
+		if (new_rect.entries++ == 0)
+		{
+			new_rect = old_rect;
+			new_rect.entries = 1;
+			add_to_cells(new_rect, new_triangle);
+		}
+
+		if (--old_rect.entries == 0)
+			remove_from_cells(old_rect, old_triangle);
+	}
+
+	const std::vector<uint32_t>& BorderGrid::get_candidates(glm::vec2 point) const
+	{
+		const uint32_t x = get_cell(point.x, m_min.x, m_inverse_cell_size.x);
+		const uint32_t y = get_cell(point.y, m_min.y, m_inverse_cell_size.y);
+
+		return m_cells[y * side + x];
+	}
+
+	BorderGrid::CellRect& BorderGrid::get_entry(uint32_t triangle)
+	{
+		if (triangle >= m_rects.size())
+			m_rects.resize(triangle + 1, CellRect{ 0, 0, 0, 0, 0 });
+
+		return m_rects[triangle];
+	}
+
+	uint32_t BorderGrid::get_cell(float v, float min, float inverse_size) const
+	{
+		const float cell = (v - min) * inverse_size;
+		if (!(cell > 0.0f))
+			return 0;
+		if (cell >= float(side))
+			return side - 1;
+
+		return uint32_t(cell);
+	}
+
+	BorderGrid::CellRect BorderGrid::get_rect(glm::vec2 circumcentre, float circumradius2) const
+	{
+		const float radius = std::sqrt(circumradius2);
+
+		CellRect rect;
+		rect.min_x = (uint8_t)get_cell(circumcentre.x - radius, m_min.x, m_inverse_cell_size.x);
+		rect.min_y = (uint8_t)get_cell(circumcentre.y - radius, m_min.y, m_inverse_cell_size.y);
+		rect.max_x = (uint8_t)get_cell(circumcentre.x + radius, m_min.x, m_inverse_cell_size.x);
+		rect.max_y = (uint8_t)get_cell(circumcentre.y + radius, m_min.y, m_inverse_cell_size.y);
+		rect.entries = 0;
+
+		return rect;
+	}
+
+	void BorderGrid::add_to_cells(const CellRect& rect, uint32_t triangle)
+	{
+		for (uint32_t y = rect.min_y; y <= rect.max_y; ++y)
+		{
+			for (uint32_t x = rect.min_x; x <= rect.max_x; ++x)
+			{
+				m_cells[y * side + x].push_back(triangle);
+			}
+		}
+	}
+
+	void BorderGrid::remove_from_cells(const CellRect& rect, uint32_t triangle)
+	{
+		for (uint32_t y = rect.min_y; y <= rect.max_y; ++y)
+		{
+			for (uint32_t x = rect.min_x; x <= rect.max_x; ++x)
+			{
+				std::vector<uint32_t>& cell = m_cells[y * side + x];
+				const auto it = std::find(cell.begin(), cell.end(), triangle);
+				if (it != cell.end())
+				{
+					*it = cell.back();
+					cell.pop_back();
+				}
+			}
+		}
+	}
+}
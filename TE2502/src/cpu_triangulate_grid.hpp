@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace cputri
+{
+	// Uniform grid over the circumcircle bounding boxes of a node's border triangles.
+	// Every triangle is listed in each cell its bounding box overlaps, so the border triangles
+	// whose circumcircle may contain a point are the ones listed in the point's cell.
+	// Mirrors border_triangle_indices entry for entry: a triangle added twice has to be erased twice
+	class BorderGrid
+	{
+	public:
+		// Cells per axis
+		static const uint32_t side = 16;
+
+		// Empties the grid and covers [min, max]. Points and circles outside are clamped to the edge cells
+		void reset(glm::vec2 min, glm::vec2 max);
+
+		// Adds an entry for triangle. A triangle with entries is listed in the cells its circumcircle overlaps
+		void insert(uint32_t triangle, glm::vec2 circumcentre, float circumradius2);
+
+		// Moves a listed triangle to the cells of its new circumcircle. Does nothing if the triangle is not listed
+		void update(uint32_t triangle, glm::vec2 circumcentre, float circumradius2);
+
+		// Removes an entry for triangle, if it has one
+		void erase(uint32_t triangle);
+
+		// Turns an entry for old_triangle into one for new_triangle, for when a triangle is moved to another index.
+		// new_triangle is listed where old_triangle was until update() is called for it
+		void rename(uint32_t old_triangle, uint32_t new_triangle);
+
+		// Returns the border triangles listed in the cell of point
+		const std::vector<uint32_t>& get_candidates(glm::vec2 point) const;
+
+	private:
+		struct CellRect
+		{
+			uint8_t min_x;
+			uint8_t min_y;
+			uint8_t max_x;
+			uint8_t max_y;
+
+			// Number of times the triangle is in border_triangle_indices
+			uint16_t entries;
+		};
+
+		CellRect& get_entry(uint32_t triangle);
+		uint32_t get_cell(float v, float min, float inverse_size) const;
+		CellRect get_rect(glm::vec2 circumcentre, float circumradius2) const;
+		void add_to_cells(const CellRect& rect, uint32_t triangle);
+		void remove_from_cells(const CellRect& rect, uint32_t triangle);
+
+		glm::vec2 m_min;
+		glm::vec2 m_inverse_cell_size;
+
+		std::vector<uint32_t> m_cells[side * side];
+
+		// Cells covered by each triangle index, grows to the highest index inserted
+		std::vector<CellRect> m_rects;
+	};
+}
@@ -0,0 +1,100 @@
+#include "cpu_triangulate_node_cache.hpp"
+
+namespace cputri
+{
+	uint32_t NodeCache::get_capacity() const
+	{
+		return m_capacity;
+	}
+
+	void NodeCache::set_capacity(uint32_t capacity)
+	{
+		m_capacity = capacity;
+	}
+
+	uint32_t NodeCache::get_count() const
+	{
+		return (uint32_t)m_entries.size();
+	}
+
+	uint32_t NodeCache::insert(glm::ivec2 position, uint32_t slot, const NeighbourSerials& neighbours)
+	{
+		if (m_capacity == 0)
+			return slot;
+
+		const uint64_t key = get_key(position);
+
+		// A node is only cached again after it was taken out, but drop an old copy just in case
+		uint32_t freed = INVALID;
+		auto found = m_lookup.find(key);
+		if (found != m_lookup.end())
+		{
+			freed = found->second->slot;
+			m_entries.erase(found->second);
+			m_lookup.erase(found);
+		}
+		else if (m_entries.size() >= m_capacity)
+		{
+			freed = pop_oldest();
+		}
+
+		m_entries.push_front(Entry{ key, slot, neighbours });
+		m_lookup[key] = m_entries.begin();
+
+		return freed;
+	}
+
+	uint32_t NodeCache::find(glm::ivec2 position) const
+	{
+		auto found = m_lookup.find(get_key(position));
+		return found != m_lookup.end() ? found->second->slot : INVALID;
+	}
+
+	uint32_t NodeCache::take(glm::ivec2 position, const NeighbourSerials& neighbours, uint32_t& stale_slot)
+	{
+		stale_slot = INVALID;
+
+		auto found = m_lookup.find(get_key(position));
+		if (found == m_lookup.end())
+			return INVALID;
+
+		const Entry entry = *found->second;
+		m_entries.erase(found->second);
+		m_lookup.erase(found);
+
+		for (uint32_t nn = 0; nn < entry.neighbours.size(); ++nn)
+		{
+			if (neighbours[nn] != 0 && neighbours[nn] != entry.neighbours[nn])
+			{
+				stale_slot = entry.slot;
+				return INVALID;
+			}
+		}
+
+		return entry.slot;
+	}
+
+	uint32_t NodeCache::pop_oldest()
+	{
+		if (m_entries.empty())
+			return INVALID;
+
+		const Entry& oldest = m_entries.back();
+		const uint32_t slot = oldest.slot;
+		m_lookup.erase(oldest.key);
+		m_entries.pop_back();
+
+		return slot;
+	}
+
+	void NodeCache::clear()
+	{
+		m_entries.clear();
+		m_lookup.clear();
+	}
+
+	uint64_t NodeCache::get_key(glm::ivec2 position)
+	{
+		return ((uint64_t)(uint32_t)position.x << 32) | (uint32_t)position.y;
+	}
+}
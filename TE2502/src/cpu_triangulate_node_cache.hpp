@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+namespace cputri
+{
+	// Nodes that shift_quadtree moved out of the quadtree, kept with their slot and mesh so they can be put back
+	// if the camera returns, keyed by the node's position in whole node sizes from the origin.
+	// A node only fits back if none of its neighbours were generated while it was away, since a new neighbour
+	// has its own vertices along the shared border. Neighbours are told apart by the serial each generated node gets
+	class NodeCache
+	{
+	public:
+		static const uint32_t INVALID = ~0u;
+
+		// Serials of the eight neighbours of a node, in the order of the local node indices without the node itself.
+		// 0 where there is no neighbour
+		typedef std::array<uint64_t, 8> NeighbourSerials;
+
+		// Most nodes the cache holds
+		uint32_t get_capacity() const;
+
+		// Call pop_oldest() until get_count() is at most the new capacity
+		void set_capacity(uint32_t capacity);
+
+		uint32_t get_count() const;
+
+		// Adds a node that left the quadtree. Returns a slot that has to be freed: the least recently cached node's
+		// if the cache was full, slot itself if the capacity is 0, or INVALID
+		uint32_t insert(glm::ivec2 position, uint32_t slot, const NeighbourSerials& neighbours);
+
+		// Slot of the node cached at position, or INVALID
+		uint32_t find(glm::ivec2 position) const;
+
+		// Removes the node cached at position and returns its slot if it still fits its neighbours, or INVALID.
+		// A cached node that no longer fits is removed as well and its slot is returned in stale_slot, else INVALID
+		uint32_t take(glm::ivec2 position, const NeighbourSerials& neighbours, uint32_t& stale_slot);
+
+		// Removes the least recently cached node and returns its slot, or INVALID if the cache is empty
+		uint32_t pop_oldest();
+
+		// Removes every node without freeing anything
+		void clear();
+
+	private:
+		struct Entry
+		{
+			uint64_t key;
+			uint32_t slot;
+			NeighbourSerials neighbours;
+		};
+
+		static uint64_t get_key(glm::ivec2 position);
+
+		uint32_t m_capacity = 0;
+
+		// Most recently cached first
+		std::list<Entry> m_entries;
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> m_lookup;
+	};
+}
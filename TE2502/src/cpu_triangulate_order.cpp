@@ -0,0 +1,85 @@
+#include "cpu_triangulate_order.hpp"
+
+#include <algorithm>
+
+namespace cputri
+{
+	void InsertionOrder::sort(glm::vec4* points, uint32_t count, glm::vec2 min, glm::vec2 max)
+	{
+		if (count < 2)
+			return;
+
+		// Rounds of fewer than about 8 points do not spread out over the node
+		uint32_t round_count = 1;
+		while ((8u << round_count) <= count)
+		{
+			++round_count;
+		}
+
+		const glm::vec2 scale = glm::vec2(65535.0f) / glm::max(max - min, glm::vec2(1e-6f));
+
+		m_keys.resize(count);
+		for (uint32_t pp = 0; pp < count; ++pp)
+		{
+			const glm::vec2 cell = glm::clamp((glm::vec2(points[pp].x, points[pp].z) - min) * scale, glm::vec2(0.0f), glm::vec2(65535.0f));
+			const uint64_t curve = hilbert_index((uint32_t)cell.x, (uint32_t)cell.y);
+			m_keys[pp] = ((uint64_t)get_round(pp, round_count) << 56) | (curve << 24) | pp;
+		}
+
+		std::sort(m_keys.begin(), m_keys.end());
+
+		m_points.assign(points, points + count);
+		for (uint32_t kk = 0; kk < count; ++kk)
+		{
+			const uint32_t pp = (uint32_t)(m_keys[kk] & 0xFFFFFF);
+			points[count - 1 - kk] = m_points[pp];
+		}
+	}
+
+	uint32_t InsertionOrder::hilbert_index(uint32_t x, uint32_t y)
+	{
+		const uint32_t n = 1u << 16;
+
+		uint32_t d = 0;
+		for (uint32_t s = n / 2; s > 0; s /= 2)
+		{
+			const uint32_t rx = (x & s) > 0 ? 1 : 0;
+			const uint32_t ry = (y & s) > 0 ? 1 : 0;
+			d += s * s * ((3 * rx) ^ ry);
+
+			// Rotate the quadrant so the curve continues where the last one ended
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = n - 1 - x;
+					y = n - 1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+
+		return d;
+	}
+
+	uint32_t InsertionOrder::get_round(uint32_t index, uint32_t round_count)
+	{
+		// Integer hash so rounds do not follow the order the points were found in
+		uint32_t h = index + 0x9E3779B9u;
+		h ^= h >> 16;
+		h *= 0x85EBCA6Bu;
+		h ^= h >> 13;
+		h *= 0xC2B2AE35u;
+		h ^= h >> 16;
+
+		// Each trailing zero bit halves the chance, so every round is about half the size of the next
+		uint32_t rounds_before_last = 0;
+		while (rounds_before_last + 1 < round_count && (h & 1) == 0)
+		{
+			h >>= 1;
+			++rounds_before_last;
+		}
+
+		return round_count - 1 - rounds_before_last;
+	}
+}
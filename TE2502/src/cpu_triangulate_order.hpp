@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace cputri
+{
+	// Orders the new points of a node so that points inserted one after another are close to each other.
+	// Points are split into biased randomised insertion rounds (BRIO), where each round has about twice as many
+	// points as the one before and every point ends up in the last round with probability 1/2. Within a round,
+	// points are inserted along a Hilbert curve over the node
+	class InsertionOrder
+	{
+	public:
+		// Reorders points. triangulate_shader inserts new points from the back, so the first point to insert
+		// is put last. The order only depends on the points' positions and indices
+		void sort(glm::vec4* points, uint32_t count, glm::vec2 min, glm::vec2 max);
+
+	private:
+		// Index along a Hilbert curve through a grid of 2^16 by 2^16 cells
+		static uint32_t hilbert_index(uint32_t x, uint32_t y);
+
+		// Insertion round of point index out of round_count, 0 is inserted first
+		static uint32_t get_round(uint32_t index, uint32_t round_count);
+
+		// Round, curve index and point index packed so that sorting them gives the insertion order
+		std::vector<uint64_t> m_keys;
+
+		std::vector<glm::vec4> m_points;
+	};
+}
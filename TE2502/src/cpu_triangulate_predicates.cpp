@@ -0,0 +1,221 @@
+#include "cpu_triangulate_predicates.hpp"
+
+#include <cmath>
+#include <vector>
+
+namespace cputri
+{
+	namespace
+	{
+		// Sum of non-overlapping doubles, least significant first, with no zero components
+		typedef std::vector<double> Expansion;
+
+		// Half an ulp of 1.0
+		const double epsilon = 1.1102230246251565e-16;
+
+		// Error bounds of the double evaluations, from Shewchuk's "Adaptive Precision Floating-Point Arithmetic
+		// and Fast Robust Geometric Predicates"
+		const double orient_error_bound = (3.0 + 16.0 * epsilon) * epsilon;
+		const double incircle_error_bound = (10.0 + 96.0 * epsilon) * epsilon;
+
+		// x + y == a + b exactly
+		void two_sum(double a, double b, double& x, double& y)
+		{
+			x = a + b;
+			const double b_virtual = x - a;
+			const double a_virtual = x - b_virtual;
+			y = (a - a_virtual) + (b - b_virtual);
+		}
+
+		// Same as two_sum if |a| >= |b|
+		void fast_two_sum(double a, double b, double& x, double& y)
+		{
+			x = a + b;
+			y = b - (x - a);
+		}
+
+		// x + y == a * b exactly
+		void two_product(double a, double b, double& x, double& y)
+		{
+			x = a * b;
+			y = std::fma(a, b, -x);
+		}
+
+		Expansion from_difference(double a, double b)
+		{
+			double x, y;
+			two_sum(a, -b, x, y);
+
+			Expansion e;
+			if (y != 0.0)
+				e.push_back(y);
+			if (x != 0.0)
+				e.push_back(x);
+			return e;
+		}
+
+		// e + b
+		Expansion grow(const Expansion& e, double b)
+		{
+			Expansion h;
+			h.reserve(e.size() + 1);
+
+			double q = b;
+			for (double component : e)
+			{
+				double sum, error;
+				two_sum(q, component, sum, error);
+				if (error != 0.0)
+					h.push_back(error);
+				q = sum;
+			}
+			if (q != 0.0)
+				h.push_back(q);
+			return h;
+		}
+
+		Expansion add(const Expansion& e, const Expansion& f)
+		{
+			Expansion h = e;
+			for (double component : f)
+			{
+				h = grow(h, component);
+			}
+			return h;
+		}
+
+		// e * b
+		Expansion scale(const Expansion& e, double b)
+		{
+			Expansion h;
+			if (e.empty() || b == 0.0)
+				return h;
+			h.reserve(e.size() * 2);
+
+			double q, error;
+			two_product(e[0], b, q, error);
+			if (error != 0.0)
+				h.push_back(error);
+
+			for (size_t i = 1; i < e.size(); ++i)
+			{
+				double product, product_error, sum;
+				two_product(e[i], b, product, product_error);
+
+				two_sum(q, product_error, sum, error);
+				if (error != 0.0)
+					h.push_back(error);
+
+				fast_two_sum(product, sum, q, error);
+				if (error != 0.0)
+					h.push_back(error);
+			}
+			if (q != 0.0)
+				h.push_back(q);
+			return h;
+		}
+
+		Expansion multiply(const Expansion& e, const Expansion& f)
+		{
+			Expansion h;
+			for (double component : f)
+			{
+				h = add(h, scale(e, component));
+			}
+			return h;
+		}
+
+		Expansion negate(Expansion e)
+		{
+			for (double& component : e)
+			{
+				component = -component;
+			}
+			return e;
+		}
+
+		// The most significant component has the sign of the whole expansion
+		double most_significant(const Expansion& e)
+		{
+			return e.empty() ? 0.0 : e.back();
+		}
+
+		double orient2d_exact(glm::dvec2 a, glm::dvec2 b, glm::dvec2 c)
+		{
+			const Expansion acx = from_difference(a.x, c.x);
+			const Expansion acy = from_difference(a.y, c.y);
+			const Expansion bcx = from_difference(b.x, c.x);
+			const Expansion bcy = from_difference(b.y, c.y);
+
+			return most_significant(add(multiply(acx, bcy), negate(multiply(acy, bcx))));
+		}
+
+		double incircle_exact(glm::dvec2 a, glm::dvec2 b, glm::dvec2 c, glm::dvec2 d)
+		{
+			const Expansion adx = from_difference(a.x, d.x);
+			const Expansion ady = from_difference(a.y, d.y);
+			const Expansion bdx = from_difference(b.x, d.x);
+			const Expansion bdy = from_difference(b.y, d.y);
+			const Expansion cdx = from_difference(c.x, d.x);
+			const Expansion cdy = from_difference(c.y, d.y);
+
+			const Expansion alift = add(multiply(adx, adx), multiply(ady, ady));
+			const Expansion blift = add(multiply(bdx, bdx), multiply(bdy, bdy));
+			const Expansion clift = add(multiply(cdx, cdx), multiply(cdy, cdy));
+
+			const Expansion bc = add(multiply(bdx, cdy), negate(multiply(cdx, bdy)));
+			const Expansion ca = add(multiply(cdx, ady), negate(multiply(adx, cdy)));
+			const Expansion ab = add(multiply(adx, bdy), negate(multiply(bdx, ady)));
+
+			return most_significant(add(add(multiply(alift, bc), multiply(blift, ca)), multiply(clift, ab)));
+		}
+	}
+
+	double orient2d(glm::dvec2 a, glm::dvec2 b, glm::dvec2 c, uint64_t* exact_count)
+	{
+		const double left = (a.x - c.x) * (b.y - c.y);
+		const double right = (a.y - c.y) * (b.x - c.x);
+		const double det = left - right;
+
+		if (std::abs(det) >= orient_error_bound * (std::abs(left) + std::abs(right)) && det != 0.0)
+			return det;
+
+		if (exact_count)
+			++*exact_count;
+		return orient2d_exact(a, b, c);
+	}
+
+	double incircle(glm::dvec2 a, glm::dvec2 b, glm::dvec2 c, glm::dvec2 d, uint64_t* exact_count)
+	{
+		const double adx = a.x - d.x;
+		const double ady = a.y - d.y;
+		const double bdx = b.x - d.x;
+		const double bdy = b.y - d.y;
+		const double cdx = c.x - d.x;
+		const double cdy = c.y - d.y;
+
+		const double bdxcdy = bdx * cdy;
+		const double cdxbdy = cdx * bdy;
+		const double alift = adx * adx + ady * ady;
+
+		const double cdxady = cdx * ady;
+		const double adxcdy = adx * cdy;
+		const double blift = bdx * bdx + bdy * bdy;
+
+		const double adxbdy = adx * bdy;
+		const double bdxady = bdx * ady;
+		const double clift = cdx * cdx + cdy * cdy;
+
+		const double det = alift * (bdxcdy - cdxbdy) + blift * (cdxady - adxcdy) + clift * (adxbdy - bdxady);
+		const double permanent = (std::abs(bdxcdy) + std::abs(cdxbdy)) * alift
+			+ (std::abs(cdxady) + std::abs(adxcdy)) * blift
+			+ (std::abs(adxbdy) + std::abs(bdxady)) * clift;
+
+		if (std::abs(det) > incircle_error_bound * permanent)
+			return det;
+
+		if (exact_count)
+			++*exact_count;
+		return incircle_exact(a, b, c, d);
+	}
+}
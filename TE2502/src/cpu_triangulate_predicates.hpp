@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Orientation and in-circle tests in the style of Shewchuk's adaptive predicates. They are evaluated in doubles first and
+// only fall back to exact expansion arithmetic if the result is too close to 0 to trust, so their sign is always right
+namespace cputri
+{
+	// Positive if a, b and c are counterclockwise, negative if clockwise and 0 if they are on a line.
+	// exact_count is incremented if the exact fallback was needed
+	double orient2d(glm::dvec2 a, glm::dvec2 b, glm::dvec2 c, uint64_t* exact_count = nullptr);
+
+	// Positive if d is inside the circle through a, b and c when they are counterclockwise, negative if it is outside
+	// and 0 if it is on the circle. The sign is flipped if a, b and c are clockwise.
+	// exact_count is incremented if the exact fallback was needed
+	double incircle(glm::dvec2 a, glm::dvec2 b, glm::dvec2 c, glm::dvec2 d, uint64_t* exact_count = nullptr);
+}
@@ -0,0 +1,644 @@
+#include "cpu_triangulate_simd.hpp"
+
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPUTRI_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions marked for it, MSVC allows them anywhere
+#if defined(CPUTRI_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace cputri
+{
+	uint32_t find_containing_circumcircles_scalar(const CircumcircleArrays& circles, const uint32_t* triangles, uint32_t count, glm::vec2 point, uint32_t* hits)
+	{
+		uint32_t hit_count = 0;
+
+		for (uint32_t tt = 0; tt < count; ++tt)
+		{
+			const uint32_t offset = triangles[tt] * circles.stride;
+
+			const float ddx = point.x - circles.x[offset];
+			const float ddy = point.y - circles.y[offset];
+
+			if (ddx * ddx + ddy * ddy < circles.radius2[offset])
+			{
+				hits[hit_count++] = triangles[tt];
+			}
+		}
+
+		return hit_count;
+	}
+
+	// Terrain height kernels. Every operation is done in the same order as in terrain() and terrain2(),
+	// without fused multiply-adds, so each lane gives exactly the scalar result
+
+	const float hash_scale = 0.1031f;
+
+	// Columns of rotate2D in the terrain shaders
+	const float rotate_xx = 1.3623f;
+	const float rotate_xy = 1.7531f;
+	const float rotate_yx = -1.7131f;
+	const float rotate_yy = 1.4623f;
+
+	float hash12_scalar(float px, float py)
+	{
+		float p3x = px * hash_scale;
+		float p3y = py * hash_scale;
+		p3x -= std::floor(p3x);
+		p3y -= std::floor(p3y);
+		float p3z = p3x;
+
+		const float d = p3x * (p3y + 19.19f) + p3y * (p3z + 19.19f) + p3z * (p3x + 19.19f);
+		p3x += d;
+		p3y += d;
+		p3z += d;
+
+		// Positive, so this is the same as modff
+		const float h = (p3x + p3y) * p3z;
+		return h - std::floor(h);
+	}
+
+	float noise_scalar(float x, float y)
+	{
+		const float px = std::floor(x);
+		const float py = std::floor(y);
+		float fx = x - px;
+		float fy = y - py;
+		fx = fx * fx * (3.0f - 2.0f * fx);
+		fy = fy * fy * (3.0f - 2.0f * fy);
+
+		const float bottom = hash12_scalar(px, py) * (1.0f - fx) + hash12_scalar(px + 1.0f, py) * fx;
+		const float top = hash12_scalar(px, py + 1.0f) * (1.0f - fx) + hash12_scalar(px + 1.0f, py + 1.0f) * fx;
+		return bottom * (1.0f - fy) + top * fy;
+	}
+
+	template<int DETAIL_OCTAVES>
+	float terrain_scalar(float x, float z)
+	{
+		float px = x * 0.05f;
+		float py = z * 0.05f;
+
+		float w = noise_scalar(px * 0.25f, py * 0.25f) * 0.75f + 0.15f;
+		w = 66.0f * w * w;
+
+		float f = 0.0f;
+		for (int ii = 0; ii < 5; ++ii)
+		{
+			f += w * noise_scalar(px, py);
+			w = -w * 0.4f;
+
+			const float rx = rotate_xx * px + rotate_yx * py;
+			py = rotate_xy * px + rotate_yy * py;
+			px = rx;
+		}
+
+		const float ff = noise_scalar(px * 0.002f, py * 0.002f);
+		f += std::pow(std::abs(ff), 5.0f) * 275.0f - 5.0f;
+
+		for (int ii = 0; ii < DETAIL_OCTAVES; ++ii)
+		{
+			f += w * noise_scalar(px, py);
+			w = -w * 0.4f;
+
+			const float rx = rotate_xx * px + rotate_yx * py;
+			py = rotate_xy * px + rotate_yy * py;
+			px = rx;
+		}
+
+		return f;
+	}
+
+	template<int DETAIL_OCTAVES>
+	void evaluate_terrain_scalar(const float* x, const float* z, uint32_t count, float* heights)
+	{
+		for (uint32_t ii = 0; ii < count; ++ii)
+		{
+			heights[ii] = terrain_scalar<DETAIL_OCTAVES>(x[ii], z[ii]);
+		}
+	}
+
+	// Value noise and its derivatives. Smoothstep interpolation makes the gradient continuous but not the second
+	// derivatives, which jump across the edges of the hash cells
+	struct NoiseDerivatives
+	{
+		float value;
+		glm::vec2 gradient;
+		glm::mat2 hessian;
+	};
+
+	NoiseDerivatives noise_derivatives(float x, float y)
+	{
+		const float px = std::floor(x);
+		const float py = std::floor(y);
+		const float tx = x - px;
+		const float ty = y - py;
+		const float fx = tx * tx * (3.0f - 2.0f * tx);
+		const float fy = ty * ty * (3.0f - 2.0f * ty);
+
+		const float a = hash12_scalar(px, py);
+		const float b = hash12_scalar(px + 1.0f, py);
+		const float c = hash12_scalar(px, py + 1.0f);
+		const float d = hash12_scalar(px + 1.0f, py + 1.0f);
+
+		// Value the same way as noise_scalar
+		NoiseDerivatives result;
+		const float bottom = a * (1.0f - fx) + b * fx;
+		const float top = c * (1.0f - fx) + d * fx;
+		result.value = bottom * (1.0f - fy) + top * fy;
+
+		// value = a + (b - a) * fx + (c - a) * fy + k * fx * fy
+		const float k = a - b - c + d;
+		const float along_x = (b - a) + k * fy;
+		const float along_y = (c - a) + k * fx;
+		const float dfx = 6.0f * tx * (1.0f - tx);
+		const float dfy = 6.0f * ty * (1.0f - ty);
+
+		result.gradient = glm::vec2(dfx * along_x, dfy * along_y);
+
+		const float dxy = k * dfx * dfy;
+		result.hessian = glm::mat2((6.0f - 12.0f * tx) * along_x, dxy, dxy, (6.0f - 12.0f * ty) * along_y);
+
+		return result;
+	}
+
+	// Noise at p = transform * (x, z), with the derivatives along x and z. The second derivatives are those of the
+	// noise blurred by a Gaussian of width smoothing, approximated by damping them as much as the Gaussian damps
+	// the noise's main frequency, about one feature per two hash cells
+	NoiseDerivatives transformed_noise(glm::vec2 p, const glm::mat2& transform, float smoothing)
+	{
+		NoiseDerivatives result = noise_derivatives(p.x, p.y);
+		result.gradient = glm::transpose(transform) * result.gradient;
+		result.hessian = glm::transpose(transform) * result.hessian * transform;
+
+		// The octaves scale and rotate, so the scale is the same along both axes
+		const float frequency = 0.5f * std::sqrt(std::abs(glm::determinant(transform)));
+		result.hessian *= std::exp(-2.0f * 9.8696044f * smoothing * smoothing * frequency * frequency);
+
+		return result;
+	}
+
+	// Sum of octaves weighted by 1, -0.4, 0.16, ..., with its derivatives. Advances p and transform like the octave
+	// loops of terrain_scalar
+	struct OctaveSum
+	{
+		float weight = 1.0f;
+		float value = 0.0f;
+		glm::vec2 gradient = glm::vec2(0.0f);
+		glm::mat2 hessian = glm::mat2(0.0f);
+
+		void add(float& f, float& w, float& px, float& py, glm::mat2& transform, float smoothing)
+		{
+			const NoiseDerivatives octave = transformed_noise(glm::vec2(px, py), transform, smoothing);
+
+			// Height the same way as terrain_scalar
+			f += w * octave.value;
+			w = -w * 0.4f;
+
+			value += weight * octave.value;
+			gradient += weight * octave.gradient;
+			hessian += weight * octave.hessian;
+			weight *= -0.4f;
+
+			const float rx = rotate_xx * px + rotate_yx * py;
+			py = rotate_xy * px + rotate_yy * py;
+			px = rx;
+			transform = glm::mat2(rotate_xx, rotate_xy, rotate_yx, rotate_yy) * transform;
+		}
+	};
+
+	template<int DETAIL_OCTAVES>
+	TerrainDerivatives terrain_with_derivatives(float x, float z, float smoothing)
+	{
+		float px = x * 0.05f;
+		float py = z * 0.05f;
+
+		// Maps (x, z) to (px, py)
+		glm::mat2 transform(0.05f);
+
+		// Weight of the first octave, w = 66 * q^2
+		const NoiseDerivatives base = transformed_noise(glm::vec2(px * 0.25f, py * 0.25f), transform * 0.25f, smoothing);
+		float w = base.value * 0.75f + 0.15f;
+		const float q = w;
+		w = 66.0f * w * w;
+
+		const float w0 = w;
+		const glm::vec2 w_gradient = 132.0f * q * 0.75f * base.gradient;
+		const glm::mat2 w_hessian = 132.0f * 0.75f * 0.75f * glm::outerProduct(base.gradient, base.gradient) + 132.0f * q * 0.75f * base.hessian;
+
+		float f = 0.0f;
+		OctaveSum octaves;
+		for (int ii = 0; ii < 5; ++ii)
+		{
+			octaves.add(f, w, px, py, transform, smoothing);
+		}
+
+		// Mountains, 275 * ff^5 - 5. Noise is never negative
+		const NoiseDerivatives mountains = transformed_noise(glm::vec2(px * 0.002f, py * 0.002f), transform * 0.002f, smoothing);
+		const float ff = mountains.value;
+		f += std::pow(std::abs(ff), 5.0f) * 275.0f - 5.0f;
+
+		for (int ii = 0; ii < DETAIL_OCTAVES; ++ii)
+		{
+			octaves.add(f, w, px, py, transform, smoothing);
+		}
+
+		// f = w0 * octaves + mountains
+		const float ff3 = ff * ff * ff;
+		const glm::vec2 mountains_gradient = 275.0f * 5.0f * ff3 * ff * mountains.gradient;
+		const glm::mat2 mountains_hessian = 275.0f * 20.0f * ff3 * glm::outerProduct(mountains.gradient, mountains.gradient) + 275.0f * 5.0f * ff3 * ff * mountains.hessian;
+
+		const glm::vec2 gradient = octaves.value * w_gradient + w0 * octaves.gradient + mountains_gradient;
+		const glm::mat2 hessian = octaves.value * w_hessian
+			+ glm::outerProduct(w_gradient, octaves.gradient) + glm::outerProduct(octaves.gradient, w_gradient)
+			+ w0 * octaves.hessian + mountains_hessian;
+
+		TerrainDerivatives result;
+		result.height = f;
+		result.gradient = gradient;
+		result.hessian = glm::vec3(hessian[0][0], hessian[0][1], hessian[1][1]);
+		return result;
+	}
+
+	template TerrainDerivatives terrain_with_derivatives<0>(float x, float z, float smoothing);
+	template TerrainDerivatives terrain_with_derivatives<6>(float x, float z, float smoothing);
+
+#ifdef CPUTRI_X86
+	uint32_t find_containing_circumcircles_sse2(const CircumcircleArrays& circles, const uint32_t* triangles, uint32_t count, glm::vec2 point, uint32_t* hits)
+	{
+		const __m128 px = _mm_set1_ps(point.x);
+		const __m128 py = _mm_set1_ps(point.y);
+
+		uint32_t hit_count = 0;
+		uint32_t tt = 0;
+
+		for (; tt + 4 <= count; tt += 4)
+		{
+			const uint32_t o0 = triangles[tt + 0] * circles.stride;
+			const uint32_t o1 = triangles[tt + 1] * circles.stride;
+			const uint32_t o2 = triangles[tt + 2] * circles.stride;
+			const uint32_t o3 = triangles[tt + 3] * circles.stride;
+
+			// SSE2 has no gather, so the lanes are loaded one by one
+			const __m128 cx = _mm_setr_ps(circles.x[o0], circles.x[o1], circles.x[o2], circles.x[o3]);
+			const __m128 cy = _mm_setr_ps(circles.y[o0], circles.y[o1], circles.y[o2], circles.y[o3]);
+			const __m128 cr2 = _mm_setr_ps(circles.radius2[o0], circles.radius2[o1], circles.radius2[o2], circles.radius2[o3]);
+
+			const __m128 ddx = _mm_sub_ps(px, cx);
+			const __m128 ddy = _mm_sub_ps(py, cy);
+			const __m128 dist2 = _mm_add_ps(_mm_mul_ps(ddx, ddx), _mm_mul_ps(ddy, ddy));
+
+			uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(dist2, cr2));
+			for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1)
+			{
+				if (mask & 1)
+					hits[hit_count++] = triangles[tt + lane];
+			}
+		}
+
+		return hit_count + find_containing_circumcircles_scalar(circles, triangles + tt, count - tt, point, hits + hit_count);
+	}
+
+	TARGET_AVX2 uint32_t find_containing_circumcircles_avx2(const CircumcircleArrays& circles, const uint32_t* triangles, uint32_t count, glm::vec2 point, uint32_t* hits)
+	{
+		const __m256 px = _mm256_set1_ps(point.x);
+		const __m256 py = _mm256_set1_ps(point.y);
+		const __m256i stride = _mm256_set1_epi32((int)circles.stride);
+
+		uint32_t hit_count = 0;
+		uint32_t tt = 0;
+
+		for (; tt + 8 <= count; tt += 8)
+		{
+			const __m256i offsets = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(triangles + tt)), stride);
+
+			const __m256 cx = _mm256_i32gather_ps(circles.x, offsets, 4);
+			const __m256 cy = _mm256_i32gather_ps(circles.y, offsets, 4);
+			const __m256 cr2 = _mm256_i32gather_ps(circles.radius2, offsets, 4);
+
+			// Multiply and add separately so the result matches the scalar test exactly
+			const __m256 ddx = _mm256_sub_ps(px, cx);
+			const __m256 ddy = _mm256_sub_ps(py, cy);
+			const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(ddx, ddx), _mm256_mul_ps(ddy, ddy));
+
+			uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(dist2, cr2, _CMP_LT_OQ));
+			for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1)
+			{
+				if (mask & 1)
+					hits[hit_count++] = triangles[tt + lane];
+			}
+		}
+
+		// Leave the upper halves clean, the SSE code after this function stalls on them otherwise
+		_mm256_zeroupper();
+
+		return hit_count + find_containing_circumcircles_scalar(circles, triangles + tt, count - tt, point, hits + hit_count);
+	}
+
+	__m128 floor_sse2(__m128 v)
+	{
+		// SSE2 has no rounding instruction, so truncate and step down where that rounded up
+		const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+		const __m128 floored = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, v), _mm_set1_ps(1.0f)));
+
+		// From 2^23 up every float is whole already, and might not fit in an int
+		const __m128 whole = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), v), _mm_set1_ps(8388608.0f));
+		return _mm_or_ps(_mm_and_ps(whole, v), _mm_andnot_ps(whole, floored));
+	}
+
+	__m128 fract_sse2(__m128 v)
+	{
+		return _mm_sub_ps(v, floor_sse2(v));
+	}
+
+	__m128 hash12_sse2(__m128 px, __m128 py)
+	{
+		const __m128 scale = _mm_set1_ps(hash_scale);
+		const __m128 offset = _mm_set1_ps(19.19f);
+
+		__m128 p3x = fract_sse2(_mm_mul_ps(px, scale));
+		__m128 p3y = fract_sse2(_mm_mul_ps(py, scale));
+		__m128 p3z = p3x;
+
+		const __m128 d = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(p3x, _mm_add_ps(p3y, offset)),
+			_mm_mul_ps(p3y, _mm_add_ps(p3z, offset))),
+			_mm_mul_ps(p3z, _mm_add_ps(p3x, offset)));
+		p3x = _mm_add_ps(p3x, d);
+		p3y = _mm_add_ps(p3y, d);
+		p3z = _mm_add_ps(p3z, d);
+
+		return fract_sse2(_mm_mul_ps(_mm_add_ps(p3x, p3y), p3z));
+	}
+
+	__m128 noise_sse2(__m128 x, __m128 y)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 three = _mm_set1_ps(3.0f);
+
+		const __m128 px = floor_sse2(x);
+		const __m128 py = floor_sse2(y);
+		__m128 fx = _mm_sub_ps(x, px);
+		__m128 fy = _mm_sub_ps(y, py);
+		fx = _mm_mul_ps(_mm_mul_ps(fx, fx), _mm_sub_ps(three, _mm_mul_ps(two, fx)));
+		fy = _mm_mul_ps(_mm_mul_ps(fy, fy), _mm_sub_ps(three, _mm_mul_ps(two, fy)));
+
+		const __m128 px1 = _mm_add_ps(px, one);
+		const __m128 py1 = _mm_add_ps(py, one);
+		const __m128 ifx = _mm_sub_ps(one, fx);
+
+		const __m128 bottom = _mm_add_ps(_mm_mul_ps(hash12_sse2(px, py), ifx), _mm_mul_ps(hash12_sse2(px1, py), fx));
+		const __m128 top = _mm_add_ps(_mm_mul_ps(hash12_sse2(px, py1), ifx), _mm_mul_ps(hash12_sse2(px1, py1), fx));
+		return _mm_add_ps(_mm_mul_ps(bottom, _mm_sub_ps(one, fy)), _mm_mul_ps(top, fy));
+	}
+
+	// One octave of the terrain, then rotates the position for the next
+	void octave_sse2(__m128& f, __m128& w, __m128& px, __m128& py)
+	{
+		f = _mm_add_ps(f, _mm_mul_ps(w, noise_sse2(px, py)));
+		w = _mm_mul_ps(_mm_xor_ps(w, _mm_set1_ps(-0.0f)), _mm_set1_ps(0.4f));
+
+		const __m128 rx = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotate_xx), px), _mm_mul_ps(_mm_set1_ps(rotate_yx), py));
+		py = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotate_xy), px), _mm_mul_ps(_mm_set1_ps(rotate_yy), py));
+		px = rx;
+	}
+
+	template<int DETAIL_OCTAVES>
+	void evaluate_terrain_sse2(const float* x, const float* z, uint32_t count, float* heights)
+	{
+		uint32_t ii = 0;
+		for (; ii + 4 <= count; ii += 4)
+		{
+			__m128 px = _mm_mul_ps(_mm_loadu_ps(x + ii), _mm_set1_ps(0.05f));
+			__m128 py = _mm_mul_ps(_mm_loadu_ps(z + ii), _mm_set1_ps(0.05f));
+
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			__m128 w = _mm_add_ps(_mm_mul_ps(noise_sse2(_mm_mul_ps(px, quarter), _mm_mul_ps(py, quarter)), _mm_set1_ps(0.75f)), _mm_set1_ps(0.15f));
+			w = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(66.0f), w), w);
+
+			__m128 f = _mm_setzero_ps();
+			for (int oo = 0; oo < 5; ++oo)
+			{
+				octave_sse2(f, w, px, py);
+			}
+
+			// pow has no SIMD version that rounds the same, and it is only needed once per position
+			const __m128 scale = _mm_set1_ps(0.002f);
+			float ff[4];
+			_mm_storeu_ps(ff, noise_sse2(_mm_mul_ps(px, scale), _mm_mul_ps(py, scale)));
+			for (int ll = 0; ll < 4; ++ll)
+			{
+				ff[ll] = std::pow(std::abs(ff[ll]), 5.0f);
+			}
+			f = _mm_add_ps(f, _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(ff), _mm_set1_ps(275.0f)), _mm_set1_ps(5.0f)));
+
+			for (int oo = 0; oo < DETAIL_OCTAVES; ++oo)
+			{
+				octave_sse2(f, w, px, py);
+			}
+
+			_mm_storeu_ps(heights + ii, f);
+		}
+
+		evaluate_terrain_scalar<DETAIL_OCTAVES>(x + ii, z + ii, count - ii, heights + ii);
+	}
+
+	TARGET_AVX2 __m256 hash12_avx2(__m256 px, __m256 py)
+	{
+		const __m256 scale = _mm256_set1_ps(hash_scale);
+		const __m256 offset = _mm256_set1_ps(19.19f);
+
+		__m256 p3x = _mm256_mul_ps(px, scale);
+		__m256 p3y = _mm256_mul_ps(py, scale);
+		p3x = _mm256_sub_ps(p3x, _mm256_floor_ps(p3x));
+		p3y = _mm256_sub_ps(p3y, _mm256_floor_ps(p3y));
+		__m256 p3z = p3x;
+
+		const __m256 d = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(p3x, _mm256_add_ps(p3y, offset)),
+			_mm256_mul_ps(p3y, _mm256_add_ps(p3z, offset))),
+			_mm256_mul_ps(p3z, _mm256_add_ps(p3x, offset)));
+		p3x = _mm256_add_ps(p3x, d);
+		p3y = _mm256_add_ps(p3y, d);
+		p3z = _mm256_add_ps(p3z, d);
+
+		const __m256 h = _mm256_mul_ps(_mm256_add_ps(p3x, p3y), p3z);
+		return _mm256_sub_ps(h, _mm256_floor_ps(h));
+	}
+
+	TARGET_AVX2 __m256 noise_avx2(__m256 x, __m256 y)
+	{
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 two = _mm256_set1_ps(2.0f);
+		const __m256 three = _mm256_set1_ps(3.0f);
+
+		const __m256 px = _mm256_floor_ps(x);
+		const __m256 py = _mm256_floor_ps(y);
+		__m256 fx = _mm256_sub_ps(x, px);
+		__m256 fy = _mm256_sub_ps(y, py);
+		fx = _mm256_mul_ps(_mm256_mul_ps(fx, fx), _mm256_sub_ps(three, _mm256_mul_ps(two, fx)));
+		fy = _mm256_mul_ps(_mm256_mul_ps(fy, fy), _mm256_sub_ps(three, _mm256_mul_ps(two, fy)));
+
+		const __m256 px1 = _mm256_add_ps(px, one);
+		const __m256 py1 = _mm256_add_ps(py, one);
+		const __m256 ifx = _mm256_sub_ps(one, fx);
+
+		const __m256 bottom = _mm256_add_ps(_mm256_mul_ps(hash12_avx2(px, py), ifx), _mm256_mul_ps(hash12_avx2(px1, py), fx));
+		const __m256 top = _mm256_add_ps(_mm256_mul_ps(hash12_avx2(px, py1), ifx), _mm256_mul_ps(hash12_avx2(px1, py1), fx));
+		return _mm256_add_ps(_mm256_mul_ps(bottom, _mm256_sub_ps(one, fy)), _mm256_mul_ps(top, fy));
+	}
+
+	TARGET_AVX2 void octave_avx2(__m256& f, __m256& w, __m256& px, __m256& py)
+	{
+		f = _mm256_add_ps(f, _mm256_mul_ps(w, noise_avx2(px, py)));
+		w = _mm256_mul_ps(_mm256_xor_ps(w, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(0.4f));
+
+		const __m256 rx = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(rotate_xx), px), _mm256_mul_ps(_mm256_set1_ps(rotate_yx), py));
+		py = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(rotate_xy), px), _mm256_mul_ps(_mm256_set1_ps(rotate_yy), py));
+		px = rx;
+	}
+
+	template<int DETAIL_OCTAVES>
+	TARGET_AVX2 void evaluate_terrain_avx2(const float* x, const float* z, uint32_t count, float* heights)
+	{
+		uint32_t ii = 0;
+		for (; ii + 8 <= count; ii += 8)
+		{
+			__m256 px = _mm256_mul_ps(_mm256_loadu_ps(x + ii), _mm256_set1_ps(0.05f));
+			__m256 py = _mm256_mul_ps(_mm256_loadu_ps(z + ii), _mm256_set1_ps(0.05f));
+
+			const __m256 quarter = _mm256_set1_ps(0.25f);
+			__m256 w = _mm256_add_ps(_mm256_mul_ps(noise_avx2(_mm256_mul_ps(px, quarter), _mm256_mul_ps(py, quarter)), _mm256_set1_ps(0.75f)), _mm256_set1_ps(0.15f));
+			w = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(66.0f), w), w);
+
+			__m256 f = _mm256_setzero_ps();
+			for (int oo = 0; oo < 5; ++oo)
+			{
+				octave_avx2(f, w, px, py);
+			}
+
+			const __m256 scale = _mm256_set1_ps(0.002f);
+			float ff[8];
+			_mm256_storeu_ps(ff, noise_avx2(_mm256_mul_ps(px, scale), _mm256_mul_ps(py, scale)));
+			for (int ll = 0; ll < 8; ++ll)
+			{
+				ff[ll] = std::pow(std::abs(ff[ll]), 5.0f);
+			}
+			f = _mm256_add_ps(f, _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(ff), _mm256_set1_ps(275.0f)), _mm256_set1_ps(5.0f)));
+
+			for (int oo = 0; oo < DETAIL_OCTAVES; ++oo)
+			{
+				octave_avx2(f, w, px, py);
+			}
+
+			_mm256_storeu_ps(heights + ii, f);
+		}
+
+		_mm256_zeroupper();
+
+		evaluate_terrain_scalar<DETAIL_OCTAVES>(x + ii, z + ii, count - ii, heights + ii);
+	}
+#endif
+
+	SIMD_LEVEL detect_simd_level()
+	{
+#ifdef CPUTRI_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		const int max_leaf = info[0];
+
+		__cpuid(info, 1);
+		const bool sse2 = (info[3] & (1 << 26)) != 0;
+		const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+
+		bool avx2 = false;
+		if (max_leaf >= 7 && os_saves_ymm)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		// May run during static initialization, before the compiler runtime has read the CPU features
+		__builtin_cpu_init();
+		const bool sse2 = __builtin_cpu_supports("sse2");
+		const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+		if (avx2)
+			return SIMD_LEVEL::AVX2;
+		if (sse2)
+			return SIMD_LEVEL::SSE2;
+#endif
+		return SIMD_LEVEL::SCALAR;
+	}
+
+	const char* get_simd_level_name(SIMD_LEVEL level)
+	{
+		switch (level)
+		{
+		case SIMD_LEVEL::AVX2:
+			return "avx2";
+		case SIMD_LEVEL::SSE2:
+			return "sse2";
+		default:
+			return "scalar";
+		}
+	}
+
+	CircumcircleKernel get_circumcircle_kernel(SIMD_LEVEL level)
+	{
+#ifdef CPUTRI_X86
+		if (level == SIMD_LEVEL::AVX2)
+			return find_containing_circumcircles_avx2;
+		if (level == SIMD_LEVEL::SSE2)
+			return find_containing_circumcircles_sse2;
+#endif
+		return find_containing_circumcircles_scalar;
+	}
+
+	// Picked once, the CPU does not change while running
+	const CircumcircleKernel circumcircle_kernel = get_circumcircle_kernel(detect_simd_level());
+
+	uint32_t find_containing_circumcircles(const CircumcircleArrays& circles, const uint32_t* triangles, uint32_t count, glm::vec2 point, uint32_t* hits)
+	{
+		return circumcircle_kernel(circles, triangles, count, point, hits);
+	}
+
+	template<int DETAIL_OCTAVES>
+	HeightKernel get_height_kernel(SIMD_LEVEL level)
+	{
+#ifdef CPUTRI_X86
+		if (level == SIMD_LEVEL::AVX2)
+			return evaluate_terrain_avx2<DETAIL_OCTAVES>;
+		if (level == SIMD_LEVEL::SSE2)
+			return evaluate_terrain_sse2<DETAIL_OCTAVES>;
+#endif
+		return evaluate_terrain_scalar<DETAIL_OCTAVES>;
+	}
+
+	template HeightKernel get_height_kernel<0>(SIMD_LEVEL level);
+	template HeightKernel get_height_kernel<6>(SIMD_LEVEL level);
+
+	const HeightKernel terrain_kernel = get_height_kernel<0>(detect_simd_level());
+	const HeightKernel terrain2_kernel = get_height_kernel<6>(detect_simd_level());
+
+	void evaluate_terrain(const float* x, const float* z, uint32_t count, float* heights)
+	{
+		terrain_kernel(x, z, count, heights);
+	}
+
+	void evaluate_terrain2(const float* x, const float* z, uint32_t count, float* heights)
+	{
+		terrain2_kernel(x, z, count, heights);
+	}
+}
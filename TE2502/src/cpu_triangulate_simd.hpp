@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Batch kernels for the CPU triangulator. The widest version the CPU supports is picked at startup
+namespace cputri
+{
+	enum class SIMD_LEVEL {
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	// Circumcircles of a node's triangles. Component c of triangle t is c[t * stride]
+	struct CircumcircleArrays
+	{
+		const float* x;
+		const float* y;
+		const float* radius2;
+		uint32_t stride;
+	};
+
+	// Writes the triangles of triangles[0, count) whose circumcircle contains point to hits, in the same order.
+	// Returns the number of triangles written
+	typedef uint32_t (*CircumcircleKernel)(const CircumcircleArrays& circles, const uint32_t* triangles, uint32_t count, glm::vec2 point, uint32_t* hits);
+
+	// Widest level supported by the CPU and the OS
+	SIMD_LEVEL detect_simd_level();
+
+	const char* get_simd_level_name(SIMD_LEVEL level);
+
+	// Returns the kernel for the given level, or the scalar one if the level is not compiled in
+	CircumcircleKernel get_circumcircle_kernel(SIMD_LEVEL level);
+
+	// Same as get_circumcircle_kernel(detect_simd_level())(...)
+	uint32_t find_containing_circumcircles(const CircumcircleArrays& circles, const uint32_t* triangles, uint32_t count, glm::vec2 point, uint32_t* hits);
+
+	// Writes the terrain height at each of the positions (x[i], z[i]), i in [0, count), to heights.
+	// Gives the same floats as evaluating terrain() in cpu_triangulate.cpp one position at a time
+	typedef void (*HeightKernel)(const float* x, const float* z, uint32_t count, float* heights);
+
+	// Returns the height kernel for the given level, or the scalar one if the level is not compiled in.
+	// DETAIL_OCTAVES is the number of octaves added after the mountains, 0 for terrain() and 6 for terrain2().
+	// Only instantiated for those two
+	template<int DETAIL_OCTAVES>
+	HeightKernel get_height_kernel(SIMD_LEVEL level);
+
+	// Same as get_height_kernel<0>(detect_simd_level())(...)
+	void evaluate_terrain(const float* x, const float* z, uint32_t count, float* heights);
+
+	// Same as get_height_kernel<6>(detect_simd_level())(...)
+	void evaluate_terrain2(const float* x, const float* z, uint32_t count, float* heights);
+
+	// Height of the terrain at a position with its derivatives along x and z
+	struct TerrainDerivatives
+	{
+		float height;
+		glm::vec2 gradient;
+		glm::vec3 hessian;  // d2/dx2, d2/dxdz and d2/dz2
+	};
+
+	// Height the same as the height kernels give, with the derivatives of the smoothstep value noise found in closed
+	// form in the same pass instead of from more heights. DETAIL_OCTAVES as in get_height_kernel. Scalar only.
+	// If smoothing is not 0, the second derivatives are approximately those of the terrain blurred by a Gaussian
+	// of that width, which damps the octaves finer than it
+	template<int DETAIL_OCTAVES>
+	TerrainDerivatives terrain_with_derivatives(float x, float z, float smoothing);
+}
@@ -0,0 +1,180 @@
+#include "cpu_triangulate_tile_cache.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+
+#include "cpu_triangulate_data.hpp"
+
+namespace cputri
+{
+	// Start of every tile file, the version changes whenever the layout of the file does.
+	// Tiles are the raw arrays of the machine that wrote them. The magic reads differently with the other byte
+	// order and header_size differs if the compiler lays the header out differently, so such tiles are not read
+	struct TileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t parameters;
+		uint64_t serial;
+		NodeCache::NeighbourSerials neighbours;
+
+		uint32_t index_count;
+		uint32_t vertex_count;
+		uint32_t border_count;
+		uint32_t header_size;
+	};
+
+	const uint32_t tile_magic = 0x4c495454;  // "TTIL"
+	const uint32_t tile_version = 2;
+
+	// Bytes the arrays after the header take for the counts in it
+	uint64_t get_array_size(const TileHeader& header)
+	{
+		const uint64_t index_count = header.index_count;
+		return index_count * sizeof(uint32_t) + (uint64_t)header.vertex_count * sizeof(glm::vec4) + index_count / 3 * sizeof(glm::vec3)
+			+ index_count * sizeof(uint32_t) + (uint64_t)header.border_count * sizeof(uint32_t);
+	}
+
+	template<typename T>
+	void write_array(std::ofstream& file, const std::vector<T>& elements)
+	{
+		file.write((const char*)elements.data(), elements.size() * sizeof(T));
+	}
+
+	template<typename T>
+	void read_array(std::ifstream& file, std::vector<T>& elements, uint32_t count)
+	{
+		elements.resize(count);
+		file.read((char*)elements.data(), count * sizeof(T));
+	}
+
+	// True if every index, connection and border entry of the tile points into its own arrays, so a stale or
+	// corrupt tile that passed the header test cannot send the kernels out of bounds
+	bool is_consistent(const Tile& tile)
+	{
+		if (tile.indices.size() % 3 != 0)
+			return false;
+
+		const uint32_t triangle_count = tile.get_triangle_count();
+		const uint32_t vertex_count = (uint32_t)tile.positions.size();
+
+		for (const uint32_t index : tile.indices)
+		{
+			if (index >= vertex_count)
+				return false;
+		}
+
+		// Connections of 10 values below INVALID and up point to neighbour nodes
+		for (const uint32_t connection : tile.triangle_connections)
+		{
+			if (connection >= triangle_count && connection < INVALID - 9)
+				return false;
+		}
+
+		for (const uint32_t triangle : tile.border_triangle_indices)
+		{
+			if (triangle >= triangle_count)
+				return false;
+		}
+
+		return true;
+	}
+
+	TileCache::TileCache(const std::string& directory, uint64_t parameters)
+		: m_directory(directory), m_parameters(parameters)
+	{
+	}
+
+	bool TileCache::save(glm::ivec2 position, uint64_t serial, const NodeCache::NeighbourSerials& neighbours, const TerrainData& node) const
+	{
+		const uint32_t triangle_count = node.index_count / 3;
+
+		Tile tile;
+		tile.indices.assign(node.indices.data(), node.indices.data() + node.index_count);
+		tile.triangle_connections.assign(node.triangle_connections.data(), node.triangle_connections.data() + node.index_count);
+		tile.border_triangle_indices.assign(node.border_triangle_indices.data(), node.border_triangle_indices.data() + node.border_count);
+
+		// Written as vec4s and vec3s whatever the layout of the node, so tiles work with both
+		tile.positions.resize(node.vertex_count);
+		for (uint32_t vv = 0; vv < node.vertex_count; ++vv)
+		{
+			tile.positions[vv] = node.get_position(vv);
+		}
+
+		tile.circumcircles.resize(triangle_count);
+		for (uint32_t tt = 0; tt < triangle_count; ++tt)
+		{
+			tile.circumcircles[tt] = glm::vec3(node.get_circumcentre(tt), node.get_circumradius2(tt));
+		}
+
+		TileHeader header{};
+		header.magic = tile_magic;
+		header.version = tile_version;
+		header.parameters = m_parameters;
+		header.serial = serial;
+		header.neighbours = neighbours;
+		header.index_count = node.index_count;
+		header.vertex_count = node.vertex_count;
+		header.border_count = node.border_count;
+		header.header_size = sizeof(header);
+
+		std::ofstream file(get_path(position), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		file.write((const char*)&header, sizeof(header));
+		write_array(file, tile.indices);
+		write_array(file, tile.positions);
+		write_array(file, tile.circumcircles);
+		write_array(file, tile.triangle_connections);
+		write_array(file, tile.border_triangle_indices);
+
+		return file.good();
+	}
+
+	bool TileCache::load(glm::ivec2 position, const NodeCache::NeighbourSerials& neighbours, uint64_t max_bytes, Tile& tile) const
+	{
+		std::ifstream file(get_path(position), std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+
+		const uint64_t file_size = (uint64_t)file.tellg();
+		file.seekg(0);
+
+		TileHeader header;
+		if (file_size < sizeof(header) || !file.read((char*)&header, sizeof(header)) || header.magic != tile_magic || header.version != tile_version
+			|| header.header_size != sizeof(header) || header.parameters != m_parameters || header.index_count % 3 != 0
+			|| header.border_count > header.index_count / 3)
+			return false;
+
+		// The counts are checked before anything is allocated for them, a tile cut short or with corrupt counts
+		// must not ask for more memory than the file holds or the node could ever be given
+		const uint64_t array_size = get_array_size(header);
+		if (array_size != file_size - sizeof(header) || array_size > max_bytes)
+			return false;
+
+		// Same test as NodeCache::take
+		for (uint32_t nn = 0; nn < neighbours.size(); ++nn)
+		{
+			if (neighbours[nn] != 0 && neighbours[nn] != header.neighbours[nn])
+				return false;
+		}
+
+		tile.serial = header.serial;
+		read_array(file, tile.indices, header.index_count);
+		read_array(file, tile.positions, header.vertex_count);
+		read_array(file, tile.circumcircles, header.index_count / 3);
+		read_array(file, tile.triangle_connections, header.index_count);
+		read_array(file, tile.border_triangle_indices, header.border_count);
+
+		return file.good() && is_consistent(tile);
+	}
+
+	std::string TileCache::get_path(glm::ivec2 position) const
+	{
+		char name[96];
+		snprintf(name, sizeof(name), "/tile_%d_%d_%016" PRIx64 ".bin", position.x, position.y, m_parameters);
+		return m_directory + name;
+	}
+}
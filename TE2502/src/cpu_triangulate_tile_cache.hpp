@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpu_triangulate_node_cache.hpp"
+
+namespace cputri
+{
+	struct TerrainData;
+
+	// Triangles, vertices and border triangles of a node read from a tile file
+	struct Tile
+	{
+		// Serial the node had when it was written, it keeps it when it is read
+		uint64_t serial;
+
+		std::vector<uint32_t> indices;
+		std::vector<glm::vec4> positions;
+		std::vector<glm::vec3> circumcircles;  // Centre in x and y, squared radius in z
+		std::vector<uint32_t> triangle_connections;
+		std::vector<uint32_t> border_triangle_indices;
+
+		uint32_t get_triangle_count() const { return (uint32_t)indices.size() / 3; }
+	};
+
+	// Refined nodes on disk, one file per node named after its position in whole node sizes from the origin
+	// and a key of the parameters it was refined with, so a run over known terrain can read nodes instead of
+	// generating and refining them again.
+	// Like in the NodeCache, a tile is only read if the neighbours it was written next to are still there or gone,
+	// which needs serials that are unique across runs, see Terrain::set_tile_cache
+	class TileCache
+	{
+	public:
+		// directory has to exist
+		TileCache(const std::string& directory, uint64_t parameters);
+
+		// Writes the mesh of a node, replacing an older tile at the same position. Returns false if the file
+		// could not be written
+		bool save(glm::ivec2 position, uint64_t serial, const NodeCache::NeighbourSerials& neighbours, const TerrainData& node) const;
+
+		// Reads the tile at position into tile. Returns false if there is none, it is from another version or
+		// machine, does not fit the serials of the current neighbours, 0 where there is no neighbour, has counts
+		// that do not match the size of the file or whose arrays would take more than max_bytes, or has indices,
+		// connections or border triangles that point outside its arrays
+		bool load(glm::ivec2 position, const NodeCache::NeighbourSerials& neighbours, uint64_t max_bytes, Tile& tile) const;
+
+	private:
+		std::string get_path(glm::ivec2 position) const;
+
+		std::string m_directory;
+		uint64_t m_parameters;
+	};
+}
@@ -44,11 +44,11 @@ Quadtree::Quadtree(
 {
 	assert(levels > 0);
 
-	m_buffer_index_filled = new bool[max_nodes];
-	memset(m_buffer_index_filled, 0, max_nodes * sizeof(bool));
+	m_node_slots = SlotAllocator((uint32_t)max_nodes);
 
 	m_num_generate_nodes = 0;
 	m_generate_nodes = new GenerateInfo[max_nodes];
+	m_generate_slots.resize(max_nodes);
 
 	m_num_draw_nodes = 0;
 	m_draw_nodes = new uint32_t[max_nodes];
@@ -276,7 +276,7 @@ void Quadtree::shift_quadtree(glm::vec3 camera_pos)
 					{
 						if (x == 0 && m_node_index_to_buffer_index[index] != INVALID)
 						{
-							m_buffer_index_filled[m_node_index_to_buffer_index[index]] = false;
+							m_node_slots.release(m_node_index_to_buffer_index[index]);
 						}
 
 						m_node_index_to_buffer_index[index] = m_node_index_to_buffer_index[index + 1];
@@ -305,7 +305,7 @@ void Quadtree::shift_quadtree(glm::vec3 camera_pos)
 					{
 						if (x == nodes_per_side - 1 && m_node_index_to_buffer_index[index] != INVALID)
 						{
-							m_buffer_index_filled[m_node_index_to_buffer_index[index]] = false;
+							m_node_slots.release(m_node_index_to_buffer_index[index]);
 						}
 
 						m_node_index_to_buffer_index[index] = m_node_index_to_buffer_index[index - 1];
@@ -334,7 +334,7 @@ void Quadtree::shift_quadtree(glm::vec3 camera_pos)
 					{
 						if (y == 0 && m_node_index_to_buffer_index[index] != INVALID)
 						{
-							m_buffer_index_filled[m_node_index_to_buffer_index[index]] = false;
+							m_node_slots.release(m_node_index_to_buffer_index[index]);
 						}
 
 						m_node_index_to_buffer_index[index] = m_node_index_to_buffer_index[index + nodes_per_side];
@@ -363,7 +363,7 @@ void Quadtree::shift_quadtree(glm::vec3 camera_pos)
 					{
 						if (y == nodes_per_side - 1 && m_node_index_to_buffer_index[index] != INVALID)
 						{
-							m_buffer_index_filled[m_node_index_to_buffer_index[index]] = false;
+							m_node_slots.release(m_node_index_to_buffer_index[index]);
 						}
 
 						m_node_index_to_buffer_index[index] = m_node_index_to_buffer_index[index - nodes_per_side];
@@ -604,7 +604,7 @@ void Quadtree::draw_error_metric(
 void Quadtree::clear_terrain()
 {
 	memset(m_node_index_to_buffer_index, INVALID, (1 << m_levels) * (1 << m_levels) * sizeof(uint32_t));
-	memset(m_buffer_index_filled, 0, m_max_nodes * sizeof(bool));
+	m_node_slots.clear();
 }
 
 void Quadtree::create_pipelines(Window& window)
@@ -685,9 +685,12 @@ void Quadtree::generate()
 	m_descriptor_set.bind();
 	m_triangulation_queue.cmd_bind_descriptor_set_compute(m_generation_pipeline_layout.get_pipeline_layout(), 0, m_descriptor_set.get_descriptor_set());
 
+	// Chunks for every node of the frame at once, nodes after the last free chunk are not generated
+	const uint32_t acquired_count = m_node_slots.acquire(m_num_generate_nodes, m_generate_slots.data());
+
 	for (uint32_t i = 0; i < m_num_generate_nodes; i++)
 	{
-		uint32_t new_index = find_chunk();
+		uint32_t new_index = i < acquired_count ? m_generate_slots[i] : INVALID;
 		if (new_index != INVALID)
 		{
 			m_push_data.node_index = new_index;
@@ -696,7 +699,6 @@ void Quadtree::generate()
 
 			m_generate_nodes[i].buffer_index = new_index;
 
-			m_buffer_index_filled[new_index] = true;
 			m_node_index_to_buffer_index[m_generate_nodes[i].quadtree_index] = new_index;
 
 			m_triangulation_queue.cmd_push_constants(
@@ -710,6 +712,7 @@ void Quadtree::generate()
 		else
 		{
 			// No space left. Ignore
+			m_generate_nodes[i].buffer_index = INVALID;
 		}
 	}
 
@@ -802,8 +805,7 @@ void Quadtree::move_from(Quadtree&& other)
 	m_node_index_to_buffer_index = other.m_node_index_to_buffer_index;
 	other.m_node_index_to_buffer_index = nullptr;
 
-	m_buffer_index_filled = other.m_buffer_index_filled;
-	other.m_buffer_index_filled = nullptr;
+	m_node_slots = std::move(other.m_node_slots);
 
 	m_em_memory = std::move(other.m_em_memory);
 	m_em_image = std::move(other.m_em_image);
@@ -827,6 +829,7 @@ void Quadtree::move_from(Quadtree&& other)
 	m_num_generate_nodes = other.m_num_generate_nodes;
 	m_generate_nodes = other.m_generate_nodes;
 	other.m_generate_nodes = nullptr;
+	m_generate_slots = std::move(other.m_generate_slots);
 
 	m_num_draw_nodes = other.m_num_draw_nodes;
 
@@ -869,7 +872,6 @@ void Quadtree::destroy()
 	}
 
 	delete[] m_render_node_index_to_buffer_index;
-	delete[] m_buffer_index_filled;
 
 	delete[] m_generate_nodes;
 	delete[] m_draw_nodes;
@@ -929,17 +931,6 @@ void Quadtree::intersect(Frustum& frustum, DebugDrawer& dd, AabbXZ aabb, uint32_
 	}
 }
 
-uint32_t Quadtree::find_chunk()
-{
-	for (uint32_t i = 0; i < m_max_nodes; i++)
-	{
-		if (!m_buffer_index_filled[i])
-			return i;
-	}
-
-	return INVALID;
-}
-
 uint32_t Quadtree::get_offset(uint32_t node_x, uint32_t node_z)
 {
 	assert(node_x >= 0u && node_x < (1u << m_levels));
@@ -4,6 +4,7 @@
 
 #include "graphics/debug_drawer.hpp"
 #include "math/geometry.hpp"
+#include "slot_allocator.hpp"
 #include "graphics/gpu_memory.hpp"
 #include "graphics/gpu_buffer.hpp"
 #include "graphics/graphics_queue.hpp"
@@ -153,9 +154,6 @@ private:
 
 	void intersect(Frustum& frustum, DebugDrawer& dd, AabbXZ aabb, uint32_t level, uint32_t x, uint32_t y);
 
-	// Finds a free chunk in m_buffer and returns it index, or INVALID if none was found
-	uint32_t find_chunk();
-
 	// For a node at the given position, return its index into m_buffer
 	uint32_t get_offset(uint32_t node_x, uint32_t node_z);
 
@@ -261,8 +259,8 @@ private:
 	// If camera is closer than this distance to the edge of the quadtree, it will shift
 	float m_quadtree_shift_distance = 100.0f;
 
-	// For chunk i of m_buffer, m_buffer_index_filled[i] is true if that chunk is used by a node
-	bool* m_buffer_index_filled;
+	// Chunks of m_buffer that are used by a node
+	SlotAllocator m_node_slots;
 
 	static const uint32_t INVALID = ~0u;
 
@@ -278,6 +276,9 @@ private:
 	uint32_t m_num_generate_nodes;
 	GenerateInfo* m_generate_nodes;
 
+	// Chunks acquired for the generate nodes of a frame
+	std::vector<uint32_t> m_generate_slots;
+
 	// Number and array of indices to nodes that needs to draw terrain
 	uint32_t m_num_draw_nodes;
 	uint32_t* m_draw_nodes;
@@ -0,0 +1,109 @@
+#include "slot_allocator.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	// Index of the lowest set bit, bits must not be 0
+	uint32_t lowest_set_bit(uint64_t bits)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return index;
+#else
+		return (uint32_t)__builtin_ctzll(bits);
+#endif
+	}
+}
+
+SlotAllocator::SlotAllocator(uint32_t slot_count)
+	: m_slot_count(slot_count),
+	m_free_slots((slot_count + 63) / 64),
+	m_free_words((m_free_slots.size() + 63) / 64)
+{
+	clear();
+}
+
+uint32_t SlotAllocator::acquire()
+{
+	// There is one word of m_free_words per 4096 slots, so this rarely looks at more than one
+	for (uint32_t ss = 0; ss < m_free_words.size(); ++ss)
+	{
+		if (m_free_words[ss] == 0)
+			continue;
+
+		const uint32_t word = ss * 64 + lowest_set_bit(m_free_words[ss]);
+		const uint32_t slot = word * 64 + lowest_set_bit(m_free_slots[word]);
+
+		m_free_slots[word] &= m_free_slots[word] - 1;
+		if (m_free_slots[word] == 0)
+			m_free_words[ss] &= ~(1ull << (word % 64));
+
+		++m_used_count;
+		return slot;
+	}
+
+	return INVALID;
+}
+
+uint32_t SlotAllocator::acquire(uint32_t count, uint32_t* slots)
+{
+	uint32_t acquired = 0;
+	while (acquired < count)
+	{
+		const uint32_t slot = acquire();
+		if (slot == INVALID)
+			break;
+
+		slots[acquired++] = slot;
+	}
+
+	return acquired;
+}
+
+void SlotAllocator::release(uint32_t slot)
+{
+	if (slot >= m_slot_count || !is_used(slot))
+		return;
+
+	const uint32_t word = slot / 64;
+	m_free_slots[word] |= 1ull << (slot % 64);
+	m_free_words[word / 64] |= 1ull << (word % 64);
+
+	--m_used_count;
+}
+
+void SlotAllocator::clear()
+{
+	for (uint32_t word = 0; word < m_free_slots.size(); ++word)
+	{
+		const uint32_t slots_in_word = m_slot_count - word * 64;
+		m_free_slots[word] = slots_in_word >= 64 ? ~0ull : (1ull << slots_in_word) - 1;
+	}
+
+	for (uint32_t ss = 0; ss < m_free_words.size(); ++ss)
+	{
+		const uint32_t words_in_summary = (uint32_t)m_free_slots.size() - ss * 64;
+		m_free_words[ss] = words_in_summary >= 64 ? ~0ull : (1ull << words_in_summary) - 1;
+	}
+
+	m_used_count = 0;
+}
+
+bool SlotAllocator::is_used(uint32_t slot) const
+{
+	return slot < m_slot_count && (m_free_slots[slot / 64] & (1ull << (slot % 64))) == 0;
+}
+
+uint32_t SlotAllocator::get_slot_count() const
+{
+	return m_slot_count;
+}
+
+uint32_t SlotAllocator::get_used_count() const
+{
+	return m_used_count;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Hands out the slots [0, slot_count) of a fixed size buffer, lowest free slot first.
+// Free slots are bits in 64 bit words, with a second level of bits telling which words
+// have a free slot, so acquiring and releasing a slot does not scan the whole buffer
+class SlotAllocator
+{
+public:
+	static const uint32_t INVALID = ~0u;
+
+	SlotAllocator(uint32_t slot_count = 0);
+
+	// Marks the lowest free slot as used and returns it, or INVALID if every slot is used
+	uint32_t acquire();
+
+	// Acquires up to count slots into slots, lowest first, and returns how many were free
+	uint32_t acquire(uint32_t count, uint32_t* slots);
+
+	// Marks a slot returned by acquire as free again
+	void release(uint32_t slot);
+
+	// Marks every slot as free
+	void clear();
+
+	bool is_used(uint32_t slot) const;
+
+	uint32_t get_slot_count() const;
+	uint32_t get_used_count() const;
+
+private:
+	uint32_t m_slot_count;
+	uint32_t m_used_count;
+
+	// Bit i of word w is set if slot w * 64 + i is free
+	std::vector<uint64_t> m_free_slots;
+
+	// Bit i of word s is set if m_free_slots[s * 64 + i] has a free slot
+	std::vector<uint64_t> m_free_words;
+};
@@ -0,0 +1,159 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t thread_count)
+{
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	m_remaining = 0;
+
+	for (uint32_t i = 0; i < thread_count; i++)
+	{
+		m_queues.push_back(std::make_unique<TaskQueue>());
+	}
+
+	// The calling thread works as the last thread, so only thread_count - 1 are started
+	for (uint32_t i = 0; i < thread_count - 1; i++)
+	{
+		m_threads.emplace_back(&ThreadPool::worker, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_work_cv.notify_all();
+
+	for (auto& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::parallel_for(uint32_t task_count, const std::function<void(uint32_t, uint32_t)>& function)
+{
+	if (task_count == 0)
+		return;
+
+	const uint32_t thread_count = get_thread_count();
+	const uint32_t self_index = thread_count - 1;
+
+	// Run directly if there is nothing to share
+	if (task_count == 1 || thread_count == 1)
+	{
+		for (uint32_t i = 0; i < task_count; i++)
+		{
+			function(i, self_index);
+		}
+		return;
+	}
+
+	m_function = &function;
+	m_remaining = task_count;
+
+	// Deal out tasks round robin
+	for (uint32_t i = 0; i < thread_count; i++)
+	{
+		std::lock_guard<std::mutex> lock(m_queues[i]->mutex);
+		for (uint32_t task = i; task < task_count; task += thread_count)
+		{
+			m_queues[i]->tasks.push_back(task);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_generation++;
+	}
+	m_work_cv.notify_all();
+
+	// Help out until every queue is empty
+	while (run_task(self_index))
+	{
+	}
+
+	// Wait for tasks still running on other threads
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this]() { return m_remaining == 0; });
+
+	m_function = nullptr;
+}
+
+uint32_t ThreadPool::get_thread_count() const
+{
+	return (uint32_t)m_queues.size();
+}
+
+void ThreadPool::worker(uint32_t thread_index)
+{
+	uint64_t seen_generation = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [&]() { return m_quit || m_generation != seen_generation; });
+
+			if (m_quit)
+				return;
+
+			seen_generation = m_generation;
+		}
+
+		while (run_task(thread_index))
+		{
+		}
+	}
+}
+
+bool ThreadPool::run_task(uint32_t thread_index)
+{
+	const uint32_t thread_count = get_thread_count();
+
+	uint32_t task;
+	bool found = false;
+
+	// Take newest task from own queue
+	{
+		TaskQueue& queue = *m_queues[thread_index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// Steal oldest task from another queue
+	for (uint32_t i = 1; i < thread_count && !found; i++)
+	{
+		TaskQueue& queue = *m_queues[(thread_index + i) % thread_count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	(*m_function)(task, thread_index);
+
+	if (--m_remaining == 0)
+	{
+		// Lock so the notification can not slip in between the caller's check and wait
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_done_cv.notify_all();
+	}
+
+	return true;
+}
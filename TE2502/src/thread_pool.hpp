@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every thread has its own task queue and steals
+// from the other queues when its own runs out
+class ThreadPool
+{
+public:
+	// Creates a pool with thread_count threads, including the calling thread.
+	// If thread_count is 0, one thread per hardware thread is used
+	ThreadPool(uint32_t thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Runs function(task_index, thread_index) for every task index in [0, task_count) and returns
+	// when all of them have finished. The calling thread runs tasks as thread get_thread_count() - 1.
+	// Must not be called from inside a task
+	void parallel_for(uint32_t task_count, const std::function<void(uint32_t, uint32_t)>& function);
+
+	// Number of threads running tasks, including the calling thread
+	uint32_t get_thread_count() const;
+
+private:
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<uint32_t> tasks;
+	};
+
+	// Main loop of the worker threads
+	void worker(uint32_t thread_index);
+
+	// Runs one task from the thread's own queue, or steals one from another queue.
+	// Returns false if all queues were empty
+	bool run_task(uint32_t thread_index);
+
+	std::vector<std::thread> m_threads;
+
+	// One queue per thread, the last one belongs to the thread calling parallel_for
+	std::vector<std::unique_ptr<TaskQueue>> m_queues;
+
+	// Function of the current parallel_for call
+	const std::function<void(uint32_t, uint32_t)>* m_function = nullptr;
+
+	// Number of tasks of the current parallel_for call that have not finished yet
+	std::atomic<uint32_t> m_remaining;
+
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_done_cv;
+
+	// Incremented every time parallel_for hands out new tasks
+	uint64_t m_generation = 0;
+	bool m_quit = false;
+};